@@ -0,0 +1,114 @@
+#pragma once
+
+#include "Parser.h"
+
+// A visitor over Stmts, Exprs and Values that dispatches with a switch over
+// their kind tags, so visiting a node costs neither a virtual call nor RTTI.
+//
+//   class PrintCounter : public ASTVisitor<PrintCounter, int> {
+//   public:
+//     int visit_PrintStmt(PrintStmt *stmt) { return 1; }
+//   };
+//
+// Derived classes (CRTP) implement the visit_* functions of the nodes they care
+// about. The others fall back to the function of the parent class, e.g.
+// visit_DefVarStmt -> visit_DefStmt -> visit_Stmt, and visit_Stmt, visit_Expr
+// and visit_Value return RetTy(). The visitor does not walk into the children
+// of a node by itself.
+template <typename Derived, typename RetTy = void> class ASTVisitor {
+public:
+  RetTy visit(Stmt *stmt) {
+    switch (stmt->kind()) {
+    case Stmt::sk_compound:
+      return derived().visit_CompoundStmt(static_cast<CompoundStmt *>(stmt));
+    case Stmt::sk_return:
+      return derived().visit_ReturnStmt(static_cast<ReturnStmt *>(stmt));
+    case Stmt::sk_loop:
+      return derived().visit_LoopStmt(static_cast<LoopStmt *>(stmt));
+    case Stmt::sk_print:
+      return derived().visit_PrintStmt(static_cast<PrintStmt *>(stmt));
+    case Stmt::sk_def_var:
+      return derived().visit_DefVarStmt(static_cast<DefVarStmt *>(stmt));
+    case Stmt::sk_def_func:
+      return derived().visit_DefFuncStmt(static_cast<DefFuncStmt *>(stmt));
+    }
+    ERROR("ASTVisitor: unknown Stmt kind.");
+  }
+
+  RetTy visit(Expr *expr) {
+    switch (expr->kind()) {
+    case Expr::ek_call:
+      return derived().visit_CallExpr(static_cast<CallExpr *>(expr));
+    case Expr::ek_var:
+      return derived().visit_VarExpr(static_cast<VarExpr *>(expr));
+    case Expr::ek_binary_op:
+      return derived().visit_BinaryOpExpr(static_cast<BinaryOpExpr *>(expr));
+    case Expr::ek_value:
+      return derived().visit_ValueExpr(static_cast<ValueExpr *>(expr));
+    case Expr::ek_index:
+      return derived().visit_IndexExpr(static_cast<IndexExpr *>(expr));
+    case Expr::ek_transpose:
+      return derived().visit_TransposeExpr(static_cast<TransposeExpr *>(expr));
+    }
+    ERROR("ASTVisitor: unknown Expr kind.");
+  }
+
+  RetTy visit(Value *value) {
+    switch (value->kind()) {
+    case Value::vk_scala:
+      return derived().visit_ScalaValue(static_cast<ScalaValue *>(value));
+    case Value::vk_tensor:
+      return derived().visit_TensorValue(static_cast<TensorValue *>(value));
+    case Value::vk_packed:
+      return derived().visit_PackedTensorValue(
+          static_cast<PackedTensorValue *>(value));
+    }
+    ERROR("ASTVisitor: unknown Value kind.");
+  }
+
+  // Stmts
+  RetTy visit_Stmt(Stmt *) { return RetTy(); }
+  RetTy visit_CompoundStmt(CompoundStmt *stmt) {
+    return derived().visit_Stmt(stmt);
+  }
+  RetTy visit_ReturnStmt(ReturnStmt *stmt) {
+    return derived().visit_Stmt(stmt);
+  }
+  RetTy visit_LoopStmt(LoopStmt *stmt) { return derived().visit_Stmt(stmt); }
+  RetTy visit_PrintStmt(PrintStmt *stmt) { return derived().visit_Stmt(stmt); }
+  RetTy visit_DefStmt(DefStmt *stmt) { return derived().visit_Stmt(stmt); }
+  RetTy visit_DefVarStmt(DefVarStmt *stmt) {
+    return derived().visit_DefStmt(stmt);
+  }
+  RetTy visit_DefFuncStmt(DefFuncStmt *stmt) {
+    return derived().visit_DefStmt(stmt);
+  }
+
+  // Exprs
+  RetTy visit_Expr(Expr *) { return RetTy(); }
+  RetTy visit_CallExpr(CallExpr *expr) { return derived().visit_Expr(expr); }
+  RetTy visit_VarExpr(VarExpr *expr) { return derived().visit_Expr(expr); }
+  RetTy visit_BinaryOpExpr(BinaryOpExpr *expr) {
+    return derived().visit_Expr(expr);
+  }
+  RetTy visit_ValueExpr(ValueExpr *expr) { return derived().visit_Expr(expr); }
+  RetTy visit_IndexExpr(IndexExpr *expr) { return derived().visit_Expr(expr); }
+  RetTy visit_TransposeExpr(TransposeExpr *expr) {
+    return derived().visit_Expr(expr);
+  }
+
+  // Values
+  RetTy visit_Value(Value *) { return RetTy(); }
+  RetTy visit_ScalaValue(ScalaValue *value) {
+    return derived().visit_Value(value);
+  }
+  RetTy visit_TensorValue(TensorValue *value) {
+    return derived().visit_Value(value);
+  }
+  RetTy visit_PackedTensorValue(PackedTensorValue *value) {
+    return derived().visit_Value(value);
+  }
+
+private:
+  Derived &derived() { return *static_cast<Derived *>(this); }
+};
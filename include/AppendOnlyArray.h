@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+
+// An array that only grows at the back, for the process-wide tables that are
+// read far more often than they grow.
+//
+// The elements live in segments of doubling sizes and never move, so a thread
+// can read the element of an index it was given while another thread appends.
+// Appending must be serialized by the owner, e.g. with a mutex.
+template <typename T> class AppendOnlyArray {
+public:
+  AppendOnlyArray() {}
+  AppendOnlyArray(const AppendOnlyArray &) = delete;
+  AppendOnlyArray &operator=(const AppendOnlyArray &) = delete;
+  ~AppendOnlyArray() {
+    for (std::atomic<T *> &segment : segments)
+      delete[] segment.load(std::memory_order_relaxed);
+  }
+
+  size_t size() const { return _size.load(std::memory_order_acquire); }
+  const T &operator[](size_t i) const { return at(i); }
+  T &operator[](size_t i) { return at(i); }
+  // the index of the appended element
+  size_t push_back(const T &value) {
+    const size_t i = _size.load(std::memory_order_relaxed);
+    size_t segment, offset;
+    locate(i, segment, offset);
+    if (offset == 0)
+      segments[segment].store(new T[first_segment_size << segment],
+                              std::memory_order_release);
+    segments[segment].load(std::memory_order_relaxed)[offset] = value;
+    _size.store(i + 1, std::memory_order_release);
+    return i;
+  }
+
+private:
+  static constexpr size_t first_segment_size = 1024;
+  // first_segment_size * (2^num_of_segments - 1) elements at most, more than
+  // a 32-bit ID can tell apart
+  static constexpr size_t num_of_segments = 23;
+
+  // the segment k holds the indices [s * (2^k - 1), s * (2^(k+1) - 1)), where
+  // s is first_segment_size
+  static void locate(size_t i, size_t &segment, size_t &offset) {
+    segment = std::bit_width(i / first_segment_size + 1) - 1;
+    offset = i - first_segment_size * ((size_t(1) << segment) - 1);
+  }
+  T &at(size_t i) const {
+    size_t segment, offset;
+    locate(i, segment, offset);
+    return segments[segment].load(std::memory_order_acquire)[offset];
+  }
+
+  std::atomic<T *> segments[num_of_segments] = {};
+  std::atomic<size_t> _size{0};
+};
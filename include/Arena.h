@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+// Usage statistics of an Arena
+struct ArenaStats {
+  // the number of blocks got from the system
+  size_t num_of_blocks = 0;
+  // the total size of these blocks
+  size_t bytes_reserved = 0;
+  // the bytes handed out, alignment padding included
+  size_t bytes_allocated = 0;
+  // the number of objects created with Arena::make
+  size_t num_of_objects = 0;
+  // the number of objects whose destructors run when the arena dies
+  size_t num_of_finalizers = 0;
+  std::string str() const;
+};
+
+// A bump allocator owning the AST nodes, values and shapes of a translation
+// unit. Nothing is freed one by one: when the arena is destroyed, the
+// destructors of the objects that need one run in reverse creation order and
+// all blocks are released at once.
+class Arena {
+public:
+  static constexpr size_t default_block_size = 64 * 1024;
+
+  Arena(size_t block_size = default_block_size) : block_size(block_size) {}
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  ~Arena();
+
+  // ${size} bytes aligned to ${align}, which must be a power of two
+  void *allocate(size_t size, size_t align);
+
+  // Uninitialized storage for ${n} objects of type T
+  template <typename T> T *allocate_array(size_t n) {
+    static_assert(std::is_trivially_destructible_v<T>,
+                  "allocate_array does not run destructors");
+    return static_cast<T *>(allocate(sizeof(T) * n, alignof(T)));
+  }
+
+  // Construct a T inside the arena, it lives as long as the arena
+  template <typename T, typename... Args> T *make(Args &&...args) {
+    T *object = new (allocate(sizeof(T), alignof(T)))
+        T(std::forward<Args>(args)...);
+    _stats.num_of_objects++;
+    if constexpr (!std::is_trivially_destructible_v<T>) {
+      Finalizer *finalizer = static_cast<Finalizer *>(
+          allocate(sizeof(Finalizer), alignof(Finalizer)));
+      finalizer->destroy = [](void *object) { static_cast<T *>(object)->~T(); };
+      finalizer->object = object;
+      finalizer->next = finalizers;
+      finalizers = finalizer;
+      _stats.num_of_finalizers++;
+    }
+    return object;
+  }
+
+  const ArenaStats &stats() const { return _stats; }
+
+private:
+  // the header of every block, blocks form a singly linked list
+  struct alignas(std::max_align_t) Block {
+    Block *next;
+  };
+  struct Finalizer {
+    void (*destroy)(void *);
+    void *object;
+    Finalizer *next;
+  };
+  // get a new block with ${bytes} usable bytes, return the first of them
+  char *new_block(size_t bytes);
+
+  size_t block_size;
+  Block *blocks = nullptr;
+  // the free space of the current block is [cur, end)
+  char *cur = nullptr;
+  char *end = nullptr;
+  // the most recently created object comes first
+  Finalizer *finalizers = nullptr;
+  ArenaStats _stats;
+};
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Parser.h"
+#include "SymbolTable.h"
+#include "ThreadPool.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// The front end of one module of a batch
+struct ModuleResult {
+  std::string file_name;
+  // the first error of the module, empty if it compiled
+  std::string error;
+  // the owner of the AST
+  std::unique_ptr<Parser> parser;
+  // the AST, mapped from the .pieckc cache when it is valid (see
+  // Parser::parse_module)
+  FlatView ast;
+  bool ok() const { return error.empty(); }
+};
+
+// Compile many source files at once.
+//
+// Every module is parsed on the ThreadPool by a Parser of its own, and its
+// top-level definitions are put into the shared SymbolTable. Once all modules
+// are parsed, a name defined by several modules is an error in every module
+// but the first one, counting the modules of earlier batches first. A module
+// that fails does not stop the others.
+class BatchDriver {
+public:
+  BatchDriver(ThreadPool &pool, SymbolTable &symbols)
+      : pool(pool), symbols(symbols) {}
+  // the results of ${file_names}, in the same order
+  std::vector<ModuleResult>
+  compile(const std::vector<std::string> &file_names);
+
+private:
+  ThreadPool &pool;
+  SymbolTable &symbols;
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "Fusion.h"
+#include "Symbol.h"
+#include "Tensor.h"
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// The instructions of the VM (see VM.h). R[x] is the register x of the
+// current call, G[x] the global x, and bc the 32-bit operand (b << 16) | c.
+// Element-wise ops with the suffix _ss are specialized for two scalars; the
+// others work on registers of any kind.
+//
+//   op           operands
+//   load_scala   R[a] = Program::scalas[bc]
+//   load_tensor  R[a] = Program::tensors[bc], copied into a new buffer if
+//                flag is 1
+//   move         R[a] = R[b]
+//   get_global   R[a] = G[bc]
+//   set_global   G[bc] = R[a]
+//   add ... div  R[a] = R[b] op R[c]
+//   add_ss ...   R[a] = R[b] op R[c], both scalars
+//   matmul       R[a] = R[b] @ R[c]
+//   fused        R[a] = Program::fusions[bc] over its input registers
+//   index        R[a] = the view Program::indexings[bc] of its base register
+//   transpose    R[a] = the view R[b].T, R[b] itself if it is a scalar
+//   store        write R[b] into the elements R[a] refers to
+//   unique       R[a] = a copy of R[a] if it is a view or, unless flag is 1,
+//                if another register shares its elements, so writing
+//                through a reference to it changes no other value
+//   for_prep     start a loop over R[a], R[a + 1] is the state of the loop
+//   for_next     R[b] = the next sub-tensor of R[a]: a copy if flag is 0, a
+//                view if it is 1 (by reference) or 2, its element if it has
+//                rank 0 and flag is not 1; skip the next instruction, which
+//                jumps out of the loop, unless there is none left
+//   jump         go to the instruction bc of the function
+//   call         R[a] = Program::functions[b](R[c], R[c + 1], ...)
+//   ret          return R[a]
+//   ret_none     return none
+//   print        print R[a] and a new line
+#define PIECK_OPCODES(X)                                                       \
+  X(load_scala)                                                                \
+  X(load_tensor)                                                               \
+  X(move)                                                                      \
+  X(get_global)                                                                \
+  X(set_global)                                                                \
+  X(add)                                                                       \
+  X(sub)                                                                       \
+  X(mul)                                                                       \
+  X(div)                                                                       \
+  X(add_ss)                                                                    \
+  X(sub_ss)                                                                    \
+  X(mul_ss)                                                                    \
+  X(div_ss)                                                                    \
+  X(matmul)                                                                    \
+  X(fused)                                                                     \
+  X(index)                                                                     \
+  X(transpose)                                                                 \
+  X(store)                                                                     \
+  X(unique)                                                                    \
+  X(for_prep)                                                                  \
+  X(for_next)                                                                  \
+  X(jump)                                                                      \
+  X(call)                                                                      \
+  X(ret)                                                                       \
+  X(ret_none)                                                                  \
+  X(print)
+
+enum OpCode : uint8_t {
+#define PIECK_OPCODE_ENUM(NAME) op_##NAME,
+  PIECK_OPCODES(PIECK_OPCODE_ENUM)
+#undef PIECK_OPCODE_ENUM
+      num_of_opcodes
+};
+
+// the name of ${op}, such as "add_ss"
+const char *opcode_name(OpCode op);
+
+// An instruction is 8 bytes, so a cache line holds 8 of them
+struct Instruction {
+  OpCode op;
+  uint8_t flag = 0;
+  uint16_t a = 0, b = 0, c = 0;
+
+  uint32_t bc() const { return uint32_t(b) << 16 | c; }
+  void set_bc(uint32_t bc) {
+    b = bc >> 16;
+    c = bc & 0xFFFF;
+  }
+};
+static_assert(sizeof(Instruction) == 8);
+static_assert(std::is_trivially_copyable_v<Instruction>);
+
+struct Function {
+  Symbol name;
+  // the arguments are passed in the registers [0, num_of_params)
+  uint16_t num_of_params = 0;
+  uint32_t num_of_registers = 0;
+  std::vector<Instruction> code;
+};
+
+// A Fusion of element-wise ops and the registers its inputs are read from
+struct FusedExpr {
+  Fusion fusion;
+  std::vector<uint16_t> inputs;
+};
+
+// The subscripts of an IndexExpr and the registers of its base and bounds
+struct IndexedExpr {
+  struct Subscript {
+    // the registers of the index, or of the bounds of a range
+    uint16_t begin = 0, end = 0;
+    bool has_begin = false, has_end = false, is_range = false;
+  };
+  uint16_t base;
+  std::vector<Subscript> subscripts;
+};
+
+// A compiled program. It holds copies of the constants of the AST, so it
+// does not depend on the Parser that built the AST.
+struct Program {
+  // functions[0] is the top level of the module
+  std::vector<Function> functions;
+  std::vector<double> scalas;
+  std::vector<Tensor> tensors;
+  std::vector<FusedExpr> fusions;
+  std::vector<IndexedExpr> indexings;
+  // the top-level variables the functions read
+  std::vector<Symbol> globals;
+
+  // one instruction per line, such as "  3  add_ss 2 0 1"
+  std::string disassemble() const;
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Error.h"
+#include <type_traits>
+
+// LLVM-style casts over the kind-tagged AST. A class To can be the target of
+// a cast if it provides
+//   static bool classof(const Base *)
+// where Base is the root of its hierarchy (Stmt, Expr or Value). All checks
+// are integer comparisons of kind tags, no RTTI is involved.
+
+// From with the constness of To
+template <typename To, typename From>
+using cast_result_t =
+    std::conditional_t<std::is_const_v<From>, const To *, To *>;
+
+// ${value} is a To, ${value} must not be null
+template <typename To, typename From> bool isa(From *value) {
+  ASSERT(value, "isa<> used on a null pointer.");
+  if constexpr (std::is_base_of_v<To, std::remove_const_t<From>>)
+    return true;
+  else
+    return To::classof(value);
+}
+
+// ${value} as a To, ${value} must be a To
+template <typename To, typename From>
+cast_result_t<To, From> cast(From *value) {
+  ASSERT(isa<To>(value), "cast<> argument of incompatible type.");
+  return static_cast<cast_result_t<To, From>>(value);
+}
+
+// ${value} as a To, or null if ${value} is not a To
+template <typename To, typename From>
+cast_result_t<To, From> dyn_cast(From *value) {
+  return isa<To>(value) ? static_cast<cast_result_t<To, From>>(value)
+                        : nullptr;
+}
+
+// dyn_cast<> that also accepts a null ${value}
+template <typename To, typename From>
+cast_result_t<To, From> dyn_cast_or_null(From *value) {
+  return value ? dyn_cast<To>(value) : nullptr;
+}
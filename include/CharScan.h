@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+
+// Kernels that find the end of a run of characters of the same class, that is
+// the first position in [p, end) that does not belong to the run (or end).
+// The SIMD versions look at 16 (SSE2) or 32 (AVX2) characters at a time and
+// fall back to the scalar loop for the last few characters of the buffer.
+struct ScanKernels {
+  const char *name;
+  // ' ' \t \v \f \r, but not \n since the lexer counts lines
+  const char *(*skip_spaces)(const char *p, const char *end);
+  // [A-Za-z0-9], the tail of an identifier
+  const char *(*skip_alnum)(const char *p, const char *end);
+  // [0-9]
+  const char *(*skip_digits)(const char *p, const char *end);
+  // the first ${delimiter} or \n, which ends a string literal
+  const char *(*find_string_end)(const char *p, const char *end,
+                                 char delimiter);
+};
+
+// The fastest kernels supported by the running CPU, picked once at runtime
+const ScanKernels &scan_kernels();
+// All kernels supported by the running CPU, the scalar ones come first
+std::vector<const ScanKernels *> available_scan_kernels();
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+
+class Arena;
+class CompoundStmt;
+
+// Compile a module to native code through LLVM.
+//
+// The constant subtrees are folded (see ConstantFolding.h) and the shapes
+// of all values inferred before any code is generated (see
+// TypeInference.h), so a tensor is lowered to a pointer to its elements and
+// every loop over it has a known trip count. Functions are specialized for
+// the shapes of their arguments. A tree of element-wise ops is lowered to
+// one loop over the elements (see Fusion.h), which the LLVM vectorizer turns
+// into SIMD code; operands broadcast to its shape are read with a stride of
+// 0 along the dims they are stretched over, and views through their
+// strides. @ calls the MatMul engine, which reads a transposed matrix as it
+// is.
+//
+// Unlike the bytecode of the VM, variables hold copies: assigning a tensor
+// copies it into the buffer of the variable. Indexing, ranges and .T point
+// into the elements of their base, and only views that skip or permute
+// elements, such as columns, are gathered when a value is needed. The
+// variable of a loop by value points into the iterable when nothing can
+// write it meanwhile.
+//
+// The buffers of a function are planned by the MemoryPlanner, so buffers
+// whose lifetimes do not overlap share memory and element-wise ops write
+// over operands that die there. They are allocated once when the module
+// starts, except those of recursive functions, which are allocated when a
+// call starts and freed when it returns.
+//
+// The top level is compiled to void pieck_main(RuntimeContext *), see
+// Runtime.h.
+class Codegen {
+public:
+  enum OptLevel { O0, O2, O3 };
+
+  // Lower the module ${root} to LLVM IR, throw if it uses undefined names or
+  // values whose shapes are not known statically. ${arena} is the one ${root}
+  // lives in, the folded values are added to it.
+  Codegen(CompoundStmt *root, Arena &arena);
+  ~Codegen();
+
+  // run the standard LLVM pipeline of ${level} over the module
+  void optimize(OptLevel level);
+  // the module as LLVM IR text
+  std::string ir() const;
+  // the bytes of the buffers allocated when the module starts
+  int64_t buffer_bytes() const;
+  // Write the module as an object file for this machine to ${path}. Link it
+  // with the library to run it.
+  void emit_object(const std::string &path) const;
+  // Compile the module with the ORC JIT and run its top level. ${out}
+  // receives the output of print. Runtime errors are thrown as
+  // std::logic_error.
+  void run(std::ostream &out = std::cout) const;
+
+private:
+  struct Impl;
+  std::unique_ptr<Impl> impl;
+};
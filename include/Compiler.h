@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Bytecode.h"
+
+class Arena;
+class CompoundStmt;
+
+// Compile a module to the bytecode of the VM.
+//
+// Every function gets a fixed register per local variable and parameter,
+// and temporaries are reused from statement to statement. Functions are
+// defined at the top level and can be called before their definition. A
+// function reads the top-level variables it does not assign, which are kept
+// in globals; an assignment in a function makes the name local to it.
+//
+// Before a function is compiled, the kinds of its variables (scalar, tensor
+// of a rank, or unknown) are inferred from all their assignments, so the
+// arithmetic of scalar variables compiles to the _ss instructions. The
+// constant subtrees of the module are folded first (see ConstantFolding.h).
+class Compiler {
+public:
+  // The program of the module ${root}, throw if it uses undefined names.
+  // ${arena} is the one ${root} lives in, the folded values are added to it.
+  static Program compile(CompoundStmt *root, Arena &arena);
+};
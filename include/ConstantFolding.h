@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Parser.h"
+#include <cstdint>
+
+// Fold the constant subtrees of a module at compile time.
+//
+// A BinaryOpExpr, an IndexExpr or a TransposeExpr whose operands are all
+// literals is evaluated with the kernels of the runtime (see Kernels.h) and
+// replaced by a ValueExpr of its value: a ScalaValue, or a PackedTensorValue
+// whose Shape is already computed. Subtrees are folded bottom-up, so
+// [1, 2] * 2 + [3, 4] becomes a single literal, and the arithmetic is done
+// once instead of on every run.
+//
+// A subtree whose evaluation throws, such as the sum of tensors of different
+// shapes, is left as it is, so the error is still reported where shapes are
+// checked, and only if the code is reached.
+class ConstantFolding {
+public:
+  // Fold the constant subtrees of ${root} and of the functions it defines.
+  // The folded values are allocated in ${arena}, which must outlive the AST.
+  // Return the number of subtrees replaced.
+  static int32_t fold(CompoundStmt *root, Arena &arena);
+};
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "Shape.h"
+#include <cstdint>
+#include <span>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+class Arena;
+class CompoundStmt;
+
+// The kinds of the nodes of a FlatAST, one per concrete AST class. Tree and
+// packed tensors are both encoded as fk_tensor.
+enum FlatKind : uint8_t {
+  // Stmts
+  fk_compound,
+  fk_return,
+  fk_loop,
+  fk_print,
+  fk_def_var,
+  fk_def_func,
+  // Exprs
+  fk_call,
+  fk_var,
+  fk_binary_op,
+  fk_value,
+  fk_index,
+  fk_transpose,
+  // Values
+  fk_scala,
+  fk_tensor,
+};
+
+// A node of a FlatAST. Nodes refer to each other by their 32-bit indices in
+// FlatAST::nodes, and the children of a node are the contiguous range
+// [first, first + count) of FlatAST::children. What a, first and count mean
+// depends on the kind:
+//
+//   kind         a               children
+//   fk_compound  -               the stmts
+//   fk_return    -               [expr], or none without a value
+//   fk_loop      var             [iterable, the stmts of the body], op is 1
+//                                for a loop by reference
+//   fk_print     -               [expr]
+//   fk_def_var   name            [rhs]
+//   fk_def_func  name            [an fk_var per param, the compound body]
+//   fk_call      name            the args
+//   fk_var       name            -
+//   fk_binary_op -               [lhs, rhs], op is the BinaryOpExpr::OP
+//   fk_value     -               [the value]
+//   fk_index     the bit i is 1  [base, the begin and the end of every
+//                if subscript i  subscript], the index of an index is its
+//                is a range      begin, bounds left out are FlatNode::none
+//   fk_transpose -               [operand]
+//   fk_scala     -               none, the value is constants[first]
+//   fk_tensor    the first dim   none, the elements are constants[first, ...)
+//                                and the dims are dims[a, a + count)
+struct FlatNode {
+  // a child that is left out
+  static constexpr uint32_t none = UINT32_MAX;
+
+  FlatKind kind;
+  // the BinaryOpExpr::OP of fk_binary_op, by_reference of fk_loop
+  uint8_t op = 0;
+  // the Type of Exprs
+  int8_t type = 0;
+  // the index into FlatAST::scopes of Stmts
+  uint32_t scope = 0;
+  uint32_t a = 0;
+  uint32_t first = 0;
+  uint32_t count = 0;
+};
+static_assert(std::is_trivially_copyable_v<FlatNode>);
+
+// a string stored in FlatAST::strings
+struct FlatString {
+  uint32_t offset, length;
+};
+
+// a scope, the names of its levels are scope_names[first, first + count)
+struct FlatScope {
+  uint32_t first, count;
+};
+
+// A read-only view of the arrays of a FlatAST. The arrays may be owned by a
+// FlatAST or live in a mapped .pieckc file (see ModuleCache.h).
+struct FlatView {
+  std::span<const FlatNode> nodes;
+  std::span<const uint32_t> children;
+  std::span<const FlatString> names;
+  std::span<const char> strings;
+  std::span<const FlatScope> scopes;
+  std::span<const uint32_t> scope_names;
+  std::span<const double> constants;
+  std::span<const int32_t> dims;
+
+  const FlatNode &root() const { return nodes[0]; }
+  std::span<const uint32_t> children_of(const FlatNode &node) const {
+    return children.subspan(node.first, node.count);
+  }
+  // the name of fk_def_var, fk_def_func, fk_call and fk_var nodes, the var of
+  // fk_loop nodes
+  std::string_view name_of(const FlatNode &node) const {
+    return string(node.a);
+  }
+  std::string_view string(uint32_t id) const {
+    return std::string_view(strings.data() + names[id].offset,
+                            names[id].length);
+  }
+  // the elements of fk_scala and fk_tensor nodes
+  const double *data_of(const FlatNode &node) const {
+    return constants.data() + node.first;
+  }
+  // the shape of fk_scala and fk_tensor nodes
+  Shape shape_of(const FlatNode &node) const;
+};
+
+// An AST encoded as typed arrays of trivially copyable records instead of
+// pointer-linked objects. Nodes are stored in pre-order, so walking the tree
+// is a linear scan over ${nodes}, and the whole AST can be copied with a
+// memcpy per array and handed to other threads. The root is nodes[0].
+class FlatAST {
+public:
+  std::vector<FlatNode> nodes;
+  std::vector<uint32_t> children;
+  // names of variables, functions and scopes
+  std::vector<FlatString> names;
+  std::vector<char> strings;
+  std::vector<FlatScope> scopes;
+  std::vector<uint32_t> scope_names;
+  // the elements of scalars and tensors
+  std::vector<double> constants;
+  std::vector<int32_t> dims;
+
+  // Encode the AST under ${root}. Tree tensors are packed on the way.
+  static FlatAST flatten(CompoundStmt *root);
+  // Build the AST of ${ast} in ${arena}, the inverse of flatten. The tensors
+  // are packed ones whose elements are copied into ${arena}.
+  static CompoundStmt *expand(const FlatView &ast, Arena &arena);
+
+  // the view stays valid until the arrays are modified
+  FlatView view() const {
+    return FlatView{nodes,       children,    names,     strings,
+                    scopes,      scope_names, constants, dims};
+  }
+  const FlatNode &root() const { return nodes[0]; }
+  std::span<const uint32_t> children_of(const FlatNode &node) const {
+    return view().children_of(node);
+  }
+  std::string_view name_of(const FlatNode &node) const {
+    return view().name_of(node);
+  }
+  std::string_view string(uint32_t id) const { return view().string(id); }
+  const double *data_of(const FlatNode &node) const {
+    return view().data_of(node);
+  }
+  Shape shape_of(const FlatNode &node) const { return view().shape_of(node); }
+};
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Parser.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// An input of a fused expression when it runs: the elements of a tensor, or
+// a scalar if ${data} is nullptr
+struct FusedInput {
+  const double *data = nullptr;
+  double scala = 0;
+};
+
+// A tree of element-wise BinaryOpExprs (+ - * /) fused into one loop.
+//
+// Run naively, every op of a + b * c - d would write a temporary tensor as
+// large as its operands and read it back. A Fusion runs the whole tree over
+// blocks of block_size elements instead: the intermediate values of a block
+// stay in small tiles in L1, each input is read once and only the result is
+// written to memory.
+//
+// The tree is stored in postfix order. Its leaves, the operands that are not
+// element-wise ops, are the inputs; a variable used several times is one
+// input, and scalar literals are folded into the steps.
+class Fusion {
+public:
+  static constexpr int64_t block_size = 512;
+
+  struct Step {
+    enum Kind : uint8_t { sk_input, sk_constant, sk_op };
+    Kind kind;
+    // the BinaryOpExpr::OP of an op
+    uint8_t op = 0;
+    // the index of an input
+    uint16_t index = 0;
+    double constant_value = 0;
+  };
+
+  // the number of element-wise ops in the tree at the root of ${expr}
+  static int32_t num_of_ops(Expr *expr);
+  // The fusion of the tree at the root of ${root}. Its leaves are appended
+  // to ${inputs}, the first leaf first.
+  static Fusion of(BinaryOpExpr *root, std::vector<Expr *> &inputs);
+
+  // ${out}[0, ${n}) = the tree over ${inputs}, tensor inputs have ${n}
+  // elements. ${scratch} holds scratch_size() doubles.
+  void run(const FusedInput *inputs, double *out, int64_t n,
+           double *scratch) const;
+  // the tree over scalar inputs
+  double run(const FusedInput *inputs) const;
+  size_t scratch_size() const { return size_t(depth) * block_size; }
+  // such as ((in0 * in1) + 2)
+  std::string str() const;
+
+  std::vector<Step> steps;
+  uint16_t num_of_inputs = 0;
+  // the most values the evaluation holds at once
+  uint16_t depth = 0;
+};
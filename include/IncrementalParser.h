@@ -0,0 +1,61 @@
+#pragma once
+
+#include "Parser.h"
+#include "Segmenter.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// The replacement of the text [offset, offset + length) with ${text}
+struct TextEdit {
+  uint32_t offset, length;
+  std::string text;
+};
+
+// A source kept parsed across edits.
+//
+// The source is split into top-level statements (see Segmenter), and every
+// statement is parsed by a Parser of its own. After an edit, only the
+// statements overlapping an edited range are split, lexed and parsed again,
+// until the split meets an old statement boundary. The other statements keep
+// their Stmts, and so the shapes already inferred for their tensors. The
+// lexing and parsing done for an edit grows with the size of the statements
+// it touches, not with the size of the source.
+class IncrementalParser {
+public:
+  IncrementalParser(std::string file_name, std::string text);
+  IncrementalParser(const IncrementalParser &) = delete;
+  IncrementalParser &operator=(const IncrementalParser &) = delete;
+
+  // Apply ${edits}, whose ranges are in the current text and must not overlap.
+  // If the new text does not parse, the error is thrown and nothing changes.
+  void apply(std::vector<TextEdit> edits);
+  // the AST of the current text, valid until the next apply
+  CompoundStmt *ast() { return root.get(); }
+  const std::string &text() const { return _text; }
+  // the number of statements
+  size_t num_of_stmts() const { return segments.size(); }
+  // the number of statements parsed by the last apply
+  size_t num_of_reparsed() const { return reparsed; }
+
+private:
+  struct Segment {
+    SourceRange range;
+    // The owner of the Stmts of the statement. Its lexer is not used after
+    // parsing, so the text it was given may be gone.
+    std::unique_ptr<Parser> parser;
+    // the links of the Stmts in the chain of the AST
+    StmtChain *first, *last;
+  };
+  // parse the statement ${range} of ${text}
+  Segment parse_segment(const std::string &text, SourceRange range);
+
+  std::string file_name;
+  std::string _text;
+  std::vector<Segment> segments;
+  // the head of the chain of the AST, followed by the links of all segments
+  StmtChain head;
+  std::unique_ptr<CompoundStmt> root;
+  size_t reparsed = 0;
+};
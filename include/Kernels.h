@@ -0,0 +1,66 @@
+#pragma once
+
+#include "Parser.h"
+#include "Tensor.h"
+#include <cstdint>
+
+// The arithmetic of the runtime. The kernels on raw buffers work on
+// contiguous row-major elements; the Tensor functions check the shapes,
+// allocate the result and call them. Element-wise ops read strided and
+// broadcast operands in place. matmul reads transposed matrices in place
+// and packs the other strided operands first.
+
+// ${lhs} ${op} ${rhs} for an element-wise ${op}
+inline double apply(BinaryOpExpr::OP op, double lhs, double rhs) {
+  switch (op) {
+  case BinaryOpExpr::add:
+    return lhs + rhs;
+  case BinaryOpExpr::sub:
+    return lhs - rhs;
+  case BinaryOpExpr::mul:
+    return lhs * rhs;
+  case BinaryOpExpr::div:
+    return lhs / rhs;
+  case BinaryOpExpr::matmul:
+    break;
+  }
+  ERROR("apply: @ is not an element-wise operator.");
+}
+
+// the name of ${op} in the source, such as "+"
+const char *op_name(BinaryOpExpr::OP op);
+
+// The index ${value} into a dim of ${n}, throw if it is not an integer in
+// [0, ${n})
+int64_t index_of(double value, int64_t n);
+// the bound ${value} of a range along a dim of ${n}, an integer in [0, ${n}]
+int64_t bound_of(double value, int64_t n);
+// throw if the range [${begin}, ${end}) ends before it begins
+void check_range(int64_t begin, int64_t end);
+
+// ${out}[i] = ${lhs}[i] ${op} ${rhs}[i] for i < ${n}
+void elementwise(BinaryOpExpr::OP op, const double *lhs, const double *rhs,
+                 double *out, int64_t n);
+// ${out}[i] = ${lhs}[i] ${op} ${rhs} for i < ${n}
+void elementwise(BinaryOpExpr::OP op, const double *lhs, double rhs,
+                 double *out, int64_t n);
+// ${out}[i] = ${lhs} ${op} ${rhs}[i] for i < ${n}
+void elementwise(BinaryOpExpr::OP op, double lhs, const double *rhs,
+                 double *out, int64_t n);
+// the (${m}, ${n}) matrix ${c} = ${a} @ ${b}, where ${a} is (${m}, ${k}) and
+// ${b} is (${k}, ${n}), computed by MatMul. An operand is stored as the
+// row-major matrix whose transpose it is if it is ${a_transposed} or
+// ${b_transposed}.
+void matmul(const double *a, const double *b, double *c, int64_t m, int64_t n,
+            int64_t k, bool a_transposed, bool b_transposed);
+
+// ${lhs} ${op} ${rhs} element by element, the shapes are broadcast as in
+// NumPy (see Shape::broadcast) and no operand is copied to stretch it
+Tensor elementwise(BinaryOpExpr::OP op, const Tensor &lhs, const Tensor &rhs);
+// ${op} between every element of a tensor and a scalar
+Tensor elementwise(BinaryOpExpr::OP op, const Tensor &lhs, double rhs);
+Tensor elementwise(BinaryOpExpr::OP op, double lhs, const Tensor &rhs);
+// ${lhs} @ ${rhs} of vectors and matrices, as numpy.matmul: a vector on the
+// left is a row, a vector on the right is a column, and vector @ vector is
+// their dot product, a tensor of rank 0
+Tensor matmul(const Tensor &lhs, const Tensor &rhs);
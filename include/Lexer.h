@@ -1,9 +1,9 @@
 #pragma once
 
-#include <cctype>
+#include "CharScan.h"
+#include "SourceBuffer.h"
+#include <array>
 #include <cstddef>
-#include <fstream>
-#include <iostream>
 #include <stdint.h>
 #include <string>
 #include <string_view>
@@ -41,8 +41,9 @@ enum TokenKind : int {
   tk_identifier,
   tk_keyword,
   tk_number, // number
-  tk_string  // string, must be wrapped by " or '
+  tk_string, // string, must be wrapped by " or '
   // tk_comment,
+  tk_eof // no token is left
 };
 
 struct FileLocation {
@@ -52,157 +53,185 @@ struct FileLocation {
       : file_name(file_name), line(line), col(col) {}
 };
 
-struct TokenHandler;
+// The part [begin, end) of a source, which starts on the line ${line}
+// (1-based) of the source
+struct SourceRange {
+  uint32_t begin, end;
+  int32_t line;
+};
+
+// A token is a compact record, its text lives in the source buffer and can be
+// obtained with Lexer::text.
+struct Token {
+  TokenKind kind;
+  // the text of the token is [offset, offset + length) in the source buffer
+  uint32_t offset;
+  uint32_t length;
+  // the location of the first character
+  int32_t line, col;
+};
+
+// The scanner looks at every character once and decides what to do with it
+// by its class, which is a lookup in a 256-entry table.
+enum CharClass : uint8_t {
+  cc_unknown,   // cannot appear in the source
+  cc_space,     // ' ' \t \v \f \r
+  cc_newline,   // \n
+  cc_alpha,     // starts an identifier or a keyword
+  cc_digit,     // starts a number
+  cc_period,    // . starts a number or .T (transpose)
+  cc_quote,     // " and ' wrap a string
+  cc_arith,     // + - * / @, which can be followed by a single '='
+  cc_semicolon, // ; -> statement delimiter ;; -> function delimiter
+  cc_punct,     // & ~ : # , [ ] { } ( ) =
+};
+
+constexpr std::array<CharClass, 256> make_char_class_table() {
+  std::array<CharClass, 256> table{};
+  for (int c = 'a'; c <= 'z'; c++)
+    table[c] = cc_alpha;
+  for (int c = 'A'; c <= 'Z'; c++)
+    table[c] = cc_alpha;
+  for (int c = '0'; c <= '9'; c++)
+    table[c] = cc_digit;
+  for (unsigned char c : std::string_view(" \t\v\f\r"))
+    table[c] = cc_space;
+  table['\n'] = cc_newline;
+  table['.'] = cc_period;
+  table['"'] = table['\''] = cc_quote;
+  for (unsigned char c : std::string_view("+-*/@"))
+    table[c] = cc_arith;
+  table[';'] = cc_semicolon;
+  for (unsigned char c : std::string_view("&~:#,[]{}()="))
+    table[c] = cc_punct;
+  return table;
+}
+
+inline constexpr std::array<CharClass, 256> char_class_table =
+    make_char_class_table();
+
+constexpr CharClass char_class(char c) {
+  return char_class_table[static_cast<unsigned char>(c)];
+}
+
+// Keywords are recognized with a perfect hash over (first char, last char,
+// length). The hash is checked to be collision-free at compile time.
+inline constexpr std::string_view keywords[] = {"def", "print",  "for",
+                                                "in",  "return", "let"};
+constexpr size_t num_of_keywords = sizeof(keywords) / sizeof(keywords[0]);
+constexpr size_t keyword_table_size = 16;
+
+constexpr size_t keyword_hash(std::string_view word) {
+  return (static_cast<unsigned char>(word.front()) +
+          (static_cast<unsigned char>(word.back()) << 3) + word.size()) &
+         (keyword_table_size - 1);
+}
+
+// keyword_table[hash] is the index into keywords, or -1 for an empty slot
+constexpr std::array<int8_t, keyword_table_size> make_keyword_table() {
+  std::array<int8_t, keyword_table_size> table{};
+  for (auto &slot : table)
+    slot = -1;
+  for (size_t i = 0; i < num_of_keywords; i++) {
+    int8_t &slot = table[keyword_hash(keywords[i])];
+    // a collision makes the table non-constant and fails the compilation
+    if (slot != -1)
+      throw "keyword_hash is not a perfect hash";
+    slot = i;
+  }
+  return table;
+}
+
+inline constexpr std::array<int8_t, keyword_table_size> keyword_table =
+    make_keyword_table();
+
+constexpr bool is_keyword(std::string_view word) {
+  if (word.size() < 2 || word.size() > 6)
+    return false;
+  int8_t slot = keyword_table[keyword_hash(word)];
+  return slot != -1 && keywords[slot] == word;
+}
 
 class Lexer {
 public:
-  Lexer(FileLocation file_loc) : file_loc(file_loc) {
-    file.open(file_loc.file_name);
-    nextLine();
-  }
+  // The source file is mapped into memory as a whole, lines and tokens are
+  // views into the mapping.
+  Lexer(FileLocation file_loc)
+      : Lexer(file_loc, SourceBuffer(file_loc.file_name)) {}
+  // lex ${source}, ${file_loc} only names it in error messages
+  Lexer(FileLocation file_loc, SourceBuffer source);
+  // Lex the part ${range} of ${source} only. Tokens, lines and columns are
+  // located in the whole source, so are the errors.
+  Lexer(FileLocation file_loc, SourceBuffer source, SourceRange range);
+  // the location right after the current token
   FileLocation file_loc;
-  ~Lexer() { file.close(); }
 
   bool nextToken(); // get the next token
-
-  TokenKind get_kind() { return kind; }
-  std::string get_token() { return token_text; }
-  // report the error
+  // Scan the next token into ${token}. At the end of the source, ${token} is
+  // a tk_eof token and false is returned.
+  bool lex(Token &token);
+
+  TokenKind get_kind() { return current.kind; }
+  // The view stays valid as long as the lexer is alive
+  std::string_view get_token() { return text(current); }
+  std::string_view text(const Token &token) {
+    return std::string_view(source.data() + token.offset, token.length);
+  }
+  // the whole source being lexed
+  std::string_view source_text() const { return source.view(); }
+  // report the error at the current location
   void report(std::string error_msg);
-
-  friend class TokenHandler;
-  // keywords
-  friend class TokenHandler_def;
-  friend class TokenHandler_print;
-  friend class TokenHandler_for;
-  friend class TokenHandler_in;
-  friend class TokenHandler_return;
-  friend class TokenHandler_let;
-
-  friend class TokenHandler_identifier;
-  friend class TokenHandler_punctuation;
-  friend class TokenHandler_number;
-  friend class TokenHandler_string;
-  friend class TokenHandler_unknown;
+  // report the error at the first character of ${token}
+  void report(const Token &token, std::string error_msg);
 
 private:
-  // eat a number of characters
-  void eat_chars_in_the_current_line(int);
-  // get a number of unhandeled continuous characters
-  std::string_view get_chars_in_this_line(int);
-  // get the char on the positition the is ${dis} slots after the current slot
-  char get_char_in_this_line(int dis);
-  // a queue to get
-  // read the next line from the source file
-  void nextLine();
-  // the number of remaining characters
-  int num_of_unhandled_chars_this_line();
-  // Look n characters backward and check if the nth character is '\n'
-  bool is_end_of_line(int num);
-  // Look n characters backward and check if the nth character is ' '
-  bool is_space(int num);
+  // a new line starts at the offset ${begin}
+  void new_line(size_t begin);
+  // the line that contains the offset ${offset}
+  std::string_view line_at(size_t offset);
 
 private:
-  TokenKind kind;
-  // the real text for this token
-  std::string token_text;
-  // FileLocation file_loc;
-  // a buffer the temporarily store a line from the source file
-  std::string code_line;
-  int32_t code_line_length;
-  std::ifstream file;
-};
-
-struct TokenHandler {
-  TokenHandler(Lexer *lexer) { this->lexer = lexer; }
-  TokenHandler(Lexer *lexer, TokenHandler *next) {
-    this->lexer = lexer;
-    this->next = next;
-  }
-  virtual void handle(std::string &code_line) {
-    while (!lexer->is_end_of_line(0) &&
-           std::isspace(code_line[lexer->file_loc.col])) {
-      lexer->eat_chars_in_the_current_line(1);
-    }
-    if (lexer->is_end_of_line(0)) {
-      lexer->nextLine();
-    }
+  // the token got by nextToken
+  Token current;
+  // the whole source file
+  SourceBuffer source;
+  // runs of characters of the same class are skipped by these kernels
+  const ScanKernels &scan = scan_kernels();
+  // offset of the first unhandled character in ${source}
+  size_t pos = 0;
+  // lexing stops at this offset
+  size_t end;
+  // offset of the first character of the current line in ${source}
+  size_t line_begin = 0;
+};
+
+// A stream of tokens with a lookahead of up to ${lookahead} tokens.
+// Tokens are kept in a fixed ring buffer, so neither lexing nor looking ahead
+// allocates, and the memory stays the same no matter how large the file is.
+class TokenStream {
+public:
+  static constexpr size_t lookahead = 8;
+  static_assert((lookahead & (lookahead - 1)) == 0,
+                "lookahead must be a power of two");
+
+  TokenStream(Lexer &lexer) : lexer(lexer) {}
+
+  // the ${k}-th token that has not been consumed, peek(0) is the next one
+  const Token &peek(size_t k = 0);
+  // consume the next token
+  Token next();
+  // the next token is of kind ${kind} and has the text ${text}
+  bool next_is(TokenKind kind, std::string_view text);
+  std::string_view text(const Token &token) { return lexer.text(token); }
+  void report(const Token &token, std::string error_msg) {
+    lexer.report(token, std::move(error_msg));
   }
-  // pass the responsibility to the next handler
-  void pass();
-  TokenHandler *next = nullptr;
-  Lexer *lexer;
-};
 
-struct TokenHandler_def : TokenHandler {
-  TokenHandler_def(Lexer *lexer, TokenHandler *next)
-      : TokenHandler(lexer, next) {}
-  void handle(std::string &code_line) final;
-};
-
-struct TokenHandler_print : TokenHandler {
-  TokenHandler_print(Lexer *lexer, TokenHandler *next)
-      : TokenHandler(lexer, next) {}
-  void handle(std::string &code_line);
-};
-
-struct TokenHandler_for : TokenHandler {
-  TokenHandler_for(Lexer *lexer, TokenHandler *next)
-      : TokenHandler(lexer, next) {}
-  void handle(std::string &code_line);
-};
-
-struct TokenHandler_in : TokenHandler {
-  TokenHandler_in(Lexer *lexer, TokenHandler *next)
-      : TokenHandler(lexer, next) {}
-  void handle(std::string &code_line);
-};
-
-struct TokenHandler_return : TokenHandler {
-  TokenHandler_return(Lexer *lexer, TokenHandler *next)
-      : TokenHandler(lexer, next) {}
-  void handle(std::string &code_line);
-};
-
-struct TokenHandler_let : TokenHandler {
-  TokenHandler_let(Lexer *lexer, TokenHandler *next)
-      : TokenHandler(lexer, next) {}
-  void handle(std::string &code_line);
-};
-
-struct TokenHandler_identifier : TokenHandler {
-  TokenHandler_identifier(Lexer *lexer, TokenHandler *next)
-      : TokenHandler(lexer, next) {}
-  void handle(std::string &code_line);
-};
-
-struct TokenHandler_punctuation : TokenHandler {
-  TokenHandler_punctuation(Lexer *lexer, TokenHandler *next)
-      : TokenHandler(lexer, next) {}
-  void handle(std::string &code_line);
-};
-
-struct TokenHandler_number : TokenHandler {
-  TokenHandler_number(Lexer *lexer, TokenHandler *next)
-      : TokenHandler(lexer, next) {}
-  void handle(std::string &code_line);
-};
-
-struct TokenHandler_string : TokenHandler {
-  TokenHandler_string(Lexer *lexer, TokenHandler *next)
-      : TokenHandler(lexer, next) {}
-  void handle(std::string &code_line);
-};
-
-struct TokenHandler_unknown : TokenHandler {
-  TokenHandler_unknown(Lexer *lexer) : TokenHandler(lexer) {}
-  void handle(std::string &code_line);
-};
-
-struct ITokenHandler_Factory {
-  virtual TokenHandler *create(Lexer *lexer) = 0;
+private:
+  Lexer &lexer;
+  Token ring[lookahead];
+  // ring[head] is the next token
+  size_t head = 0;
+  // the number of lexed but unconsumed tokens
+  size_t count = 0;
 };
-
-struct Default_TokenHandler_Factory : ITokenHandler_Factory {
-  TokenHandler *create(Lexer *lexer) override;
-};
\ No newline at end of file
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "Shape.h"
+#include <cstdint>
+
+// The engine behind @.
+//
+// Products big enough to be compute bound run a cache-blocked GEMM: a
+// (kc, nc) block of the right operand is packed into panels of nr columns
+// that stay in L3/L2, a (mc, kc) block of the left operand into panels of mr
+// rows that stay in L2, and a micro-kernel keeps an (mr, nr) tile of the
+// result in vector registers while it streams through one panel of each.
+// The micro-kernel is the best the CPU supports, picked at runtime, so the
+// library itself needs no -mavx2.
+//
+// The plan of a product is picked from the shapes of the operands: vectors
+// and tiny matrices skip the packing, as it would cost more than the product.
+//
+// A matrix operand may be transposed, stored as the row-major matrix whose
+// transpose it is, which is how .T leaves it. The variant of the product
+// (NN, NT, TN or TT) picks the loop order of the small kernels and the
+// strides the packing reads, so a transposed operand is never copied first.
+class MatMul {
+public:
+  // the instruction sets there are micro-kernels for
+  enum ISA : uint8_t { isa_scalar, isa_sse2, isa_avx2 };
+  // how a product is computed
+  enum Method : uint8_t {
+    // vector @ vector
+    mm_dot,
+    // (m, k) @ vector, a dot product per row
+    mm_matvec,
+    // vector @ (k, n), the rows of the right operand are scaled and summed
+    mm_vecmat,
+    // small matrices, no packing
+    mm_direct,
+    mm_blocked,
+  };
+
+  // which operands are transposed, N for row-major and T for transposed,
+  // the left one first
+  enum Variant : uint8_t { mm_nn = 0, mm_nt = 1, mm_tn = 2, mm_tt = 3 };
+
+  // the product of a (m, k) and a (k, n) matrix, computed by ${method}
+  struct Plan {
+    int64_t m, n, k;
+    Method method;
+    // the shape of the result: the dims of vector operands are dropped, as
+    // in numpy.matmul
+    Shape shape;
+  };
+
+  // the plan of ${lhs} @ ${rhs}, throw if they are not vectors or matrices
+  // or their dims do not match
+  static Plan plan(const Shape &lhs, const Shape &rhs);
+  // the plan of a (m, k) @ (k, n) product of matrices
+  static Plan plan(int64_t m, int64_t n, int64_t k);
+
+  // ${c} = ${a} @ ${b} as planned, all row-major and contiguous
+  static void run(const Plan &plan, const double *a, const double *b,
+                  double *c) {
+    run(plan, mm_nn, a, b, c);
+  }
+  // ${c} = ${a} @ ${b} as planned, where the operands are laid out as
+  // ${variant} says and ${c} is row-major
+  static void run(const Plan &plan, Variant variant, const double *a,
+                  const double *b, double *c);
+  // the blocked product of ${variant} with the micro-kernel of ${isa},
+  // which must be supported
+  static void gemm(ISA isa, Variant variant, const double *a,
+                   const double *b, double *c, int64_t m, int64_t n,
+                   int64_t k);
+
+  static Variant variant(bool left_transposed, bool right_transposed);
+  static bool transposes_left(Variant variant) { return variant & mm_tn; }
+  static bool transposes_right(Variant variant) { return variant & mm_nt; }
+  // such as "NT"
+  static const char *name(Variant variant);
+
+  // the best instruction set of this CPU, detected once
+  static ISA best();
+  static bool supported(ISA isa);
+  static const char *name(ISA isa);
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Plan the tensor buffers of a function whose sizes are known statically.
+//
+// The code of the function reports its buffers and, in the order it runs,
+// the points where they are read and written, and the loops around them. A
+// buffer is live from its first event to its last one. A buffer written in a
+// loop before it is read there is not live across iterations, but one read
+// before it is written holds a value of the previous iteration and lives as
+// long as the loop.
+//
+// Buffers of the same size whose lifetimes do not overlap share one slot. An
+// in-place write may share the slot of a buffer read last at the same point,
+// which is how an element-wise op reuses an operand that dies there.
+class MemoryPlanner {
+public:
+  using BufferID = int32_t;
+
+  struct Plan {
+    // the slot of every buffer
+    std::vector<int32_t> slot_of;
+    // the number of elements of every slot
+    std::vector<int64_t> slot_sizes;
+    // the elements of all slots
+    int64_t num_of_elements() const;
+  };
+
+  // a new buffer of ${n} elements
+  BufferID add_buffer(int64_t n);
+  // Start the next point. Everything a point reads happens before what it
+  // writes.
+  void tick() { point++; }
+  // ${buffer} is read at the current point
+  void use(BufferID buffer) { add_event(buffer, false, false); }
+  // ${buffer} is written at the current point. If ${in_place}, every element
+  // is written after the elements of the same index are read, so it may
+  // share the slot of a buffer read last at this point.
+  void def(BufferID buffer, bool in_place) {
+    add_event(buffer, true, in_place);
+  }
+  // the body of a loop that runs ${trip_count} times starts
+  void enter_loop(int64_t trip_count);
+  void leave_loop();
+
+  Plan plan() const;
+
+private:
+  struct Event {
+    BufferID buffer;
+    // 2 * point for reads and for writes that are not in place, 2 * point +
+    // 1 for writes in place, so they come after the reads of their point
+    int64_t time;
+    bool def;
+    // the innermost loop around the event, -1 for none
+    int32_t loop;
+  };
+  struct Loop {
+    int64_t start, end = -1;
+    int64_t trip_count;
+    int32_t parent;
+  };
+  void add_event(BufferID buffer, bool def, bool in_place);
+
+  int64_t point = 0;
+  std::vector<int64_t> sizes;
+  std::vector<Event> events;
+  std::vector<Loop> loops;
+  // the loops entered and not left yet
+  std::vector<int32_t> open_loops;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "FlatAST.h"
+#include "SourceBuffer.h"
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// A .pieckc file: the FlatAST of a source file, written next to it and keyed
+// by the size and a content hash of the source.
+//
+// The file is a header followed by the arrays of the FlatAST, each starting
+// at a 64-byte aligned offset, in the byte order of the machine that wrote
+// it. Loading a cache maps the file and points a FlatView at the arrays, so
+// there is no deserialization pass: the tensor elements are read straight
+// from the page cache. Only the indices in the records are checked, so a
+// corrupted cache is rejected instead of read out of bounds.
+class ModuleCache {
+public:
+  static constexpr uint32_t version = 4;
+
+  // the cache of ${source_file}
+  static std::string path_of(const std::string &source_file) {
+    return source_file + "c";
+  }
+  // the content hash a cache is keyed by
+  static uint64_t hash(std::string_view source);
+  // Write ${ast}, the FlatAST of ${source}, to ${cache_file}. The file is
+  // replaced atomically, so concurrent readers never see a partial cache.
+  // Return false if it cannot be written.
+  static bool write(const std::string &cache_file, const FlatView &ast,
+                    std::string_view source);
+
+  ModuleCache() {}
+  // Map ${cache_file} if it is a valid cache of ${source} and its records
+  // form a well-formed FlatAST, otherwise return false and leave this cache
+  // unloaded
+  bool load(const std::string &cache_file, std::string_view source);
+  bool loaded() const { return file.is_mapped(); }
+  // the cached AST, it lives as long as this cache
+  const FlatView &ast() const { return view; }
+
+private:
+  SourceBuffer file;
+  FlatView view;
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "ASTVisitor.h"
+#include "Symbol.h"
+#include <unordered_set>
+#include <vector>
+
+// The names a function assigns, loop variables included, and the names it
+// reads. Functions defined inside are not walked into.
+class NameCollector : public ASTVisitor<NameCollector> {
+public:
+  std::vector<Symbol> assigned;
+  std::vector<Symbol> read;
+
+  void visit_CompoundStmt(CompoundStmt *stmt) { visit_chain(stmt->stmts()); }
+  void visit_ReturnStmt(ReturnStmt *stmt) {
+    if (stmt->expr)
+      visit(stmt->expr);
+  }
+  void visit_LoopStmt(LoopStmt *stmt) {
+    visit(stmt->iterable);
+    add(assigned, assigned_ids, stmt->var);
+    visit_chain(stmt->body);
+  }
+  void visit_PrintStmt(PrintStmt *stmt) { visit(stmt->expr); }
+  void visit_DefVarStmt(DefVarStmt *stmt) {
+    visit(stmt->rhs);
+    add(assigned, assigned_ids, stmt->identifier_name);
+  }
+  void visit_CallExpr(CallExpr *expr) {
+    for (int32_t i = 0; i < expr->num_of_args; i++)
+      visit(expr->args[i]);
+  }
+  void visit_VarExpr(VarExpr *expr) { add(read, read_ids, expr->var_name); }
+  void visit_BinaryOpExpr(BinaryOpExpr *expr) {
+    visit(expr->lhs);
+    visit(expr->rhs);
+  }
+  void visit_IndexExpr(IndexExpr *expr) {
+    visit(expr->base);
+    for (int32_t i = 0; i < expr->num_of_subscripts; i++) {
+      if (expr->subscripts[i].begin)
+        visit(expr->subscripts[i].begin);
+      if (expr->subscripts[i].end)
+        visit(expr->subscripts[i].end);
+    }
+  }
+
+  void visit_TransposeExpr(TransposeExpr *expr) { visit(expr->operand); }
+
+  bool assigns(Symbol name) const { return assigned_ids.count(name.id()); }
+
+private:
+  void visit_chain(StmtChain *chain) {
+    for (StmtChain *link = chain; link; link = link->next) {
+      if (link->stmt)
+        visit(link->stmt);
+    }
+  }
+  static void add(std::vector<Symbol> &names,
+                  std::unordered_set<SymbolID> &ids, Symbol name) {
+    if (ids.insert(name.id()).second)
+      names.push_back(name);
+  }
+  std::unordered_set<SymbolID> assigned_ids, read_ids;
+};
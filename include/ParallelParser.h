@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Parser.h"
+#include "Segmenter.h"
+#include "ThreadPool.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Parse the top-level statements of a source in parallel.
+//
+// A pre-scan (see Segmenter) splits the source into top-level statements,
+// which are grouped into chunks of about the same size. Each chunk is lexed
+// and parsed on ${pool} by a Parser of its own, and the Stmts of all chunks
+// are chained into one CompoundStmt in source order. Errors are located in
+// the whole source, and if several chunks fail, the first error in source
+// order is thrown, as the sequential Parser would.
+class ParallelParser {
+public:
+  static constexpr size_t default_min_chunk_size = 64 * 1024;
+
+  // map the file ${file_name}
+  ParallelParser(std::string file_name, ThreadPool &pool)
+      : ParallelParser(file_name, SourceBuffer(file_name), pool) {}
+  // parse ${source}, ${file_name} only names it in error messages
+  ParallelParser(std::string file_name, SourceBuffer source, ThreadPool &pool)
+      : file_name(std::move(file_name)), source(std::move(source)),
+        pool(pool) {}
+  ParallelParser(const ParallelParser &) = delete;
+  ParallelParser &operator=(const ParallelParser &) = delete;
+
+  // The AST of the source, it lives as long as this parser. Chunks are at
+  // least ${min_chunk_size} bytes, unless the source is smaller.
+  CompoundStmt *parse(size_t min_chunk_size = default_min_chunk_size);
+  // the number of chunks parsed by the last parse
+  size_t num_of_chunks() const { return chunks.size(); }
+
+private:
+  struct Chunk {
+    SourceRange range;
+    // the owner of the Stmts of the chunk
+    std::unique_ptr<Parser> parser;
+    // the links of the Stmts in the chain of the AST
+    StmtChain *first, *last;
+  };
+
+  std::string file_name;
+  SourceBuffer source;
+  ThreadPool &pool;
+  std::vector<Chunk> chunks;
+  // the head of the chain of the AST, followed by the links of all chunks
+  StmtChain head;
+  std::unique_ptr<CompoundStmt> root;
+};
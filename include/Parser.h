@@ -1,15 +1,17 @@
 #pragma once
 
+#include "Arena.h"
 #include "Error.h"
 #include "Lexer.h"
+#include "ModuleCache.h"
+#include "Scope.h"
+#include "Shape.h"
+#include "Symbol.h"
 #include <cstddef>
 #include <cstdint>
 #include <string>
 #include <unordered_map>
 #include <vector>
-#ifdef DEBUG
-#include <iostream>
-#endif
 
 class Expr;
 class Value;
@@ -24,30 +26,33 @@ enum Type {
   tyList = -4
 };
 
-class Scope {
+// Stmt, Expr and Value carry a kind tag, so telling nodes apart with
+// isa<>/dyn_cast<> (see Casting.h) or ASTVisitor is an integer check.
+class Stmt {
 public:
-  std::vector<std::string> scope_names;
-  void push(std::string scope_name) { scope_names.push_back(scope_name); }
-  void pop() { scope_names.pop_back(); }
-  bool operator<=(const Scope &other) {
-    if (scope_names.size() < other.scope_names.size())
-      return false;
-    for (int i = 0; i < other.scope_names.size(); i++) {
-      if (scope_names[i] != other.scope_names[i])
-        return false;
-    }
-    return true;
-  }
-};
+  enum StmtKind {
+    sk_compound,
+    sk_return,
+    sk_loop,
+    sk_print,
+    // DefStmts
+    sk_def_var,
+    sk_def_func,
+    sk_first_def = sk_def_var,
+    sk_last_def = sk_def_func
+  };
 
-class Stmt {
 protected:
-  Stmt(Scope scope) : scope(scope) {}
-  Stmt(){};
+  Stmt(StmtKind kind, Scope scope) : scope(scope), _kind(kind) {}
+  Stmt(StmtKind kind) : _kind(kind){};
   virtual ~Stmt() {}
 
 public:
   Scope scope;
+  StmtKind kind() const { return _kind; }
+
+private:
+  const StmtKind _kind;
 };
 
 class StmtChain {
@@ -57,7 +62,11 @@ public:
   Stmt *stmt = nullptr;
   StmtChain *header = this;
   StmtChain *next = nullptr;
-  StmtChain *add(Stmt *stmt);
+  // append ${stmt} after this link, the new link is allocated in ${arena}
+  StmtChain *add(Arena &arena, Stmt *stmt);
+  // Make ${head} the header of this link and of the links after it, so they
+  // can be spliced into the chain of ${head}. Return the last link.
+  StmtChain *rehead(StmtChain *head);
 };
 
 // a sequence of stmts in the same scope
@@ -66,7 +75,11 @@ private:
   StmtChain *chain;
 
 public:
-  CompoundStmt(Scope scope, StmtChain *chain) : Stmt(scope), chain(chain) {}
+  CompoundStmt(Scope scope, StmtChain *chain)
+      : Stmt(sk_compound, scope), chain(chain) {}
+  static bool classof(const Stmt *stmt) { return stmt->kind() == sk_compound; }
+  // the first link of the chain, to walk the stmts without moving the cursor
+  StmtChain *stmts() { return chain->header; }
   Stmt *header();
   Stmt *next();
   Stmt *cur();
@@ -76,176 +89,353 @@ public:
 
 class ReturnStmt : public Stmt {
 public:
+  // nullptr for a return without a value
   Expr *expr;
-  ReturnStmt(Scope scope, Expr *expr) : Stmt(scope), expr(expr){};
+  ReturnStmt(Scope scope, Expr *expr) : Stmt(sk_return, scope), expr(expr){};
+  static bool classof(const Stmt *stmt) { return stmt->kind() == sk_return; }
 };
 
+// for var in iterable: body
+// The loop runs once per sub-tensor of iterable along its first dim, or once
+// per element if iterable is a vector. With for &var, var refers to the
+// sub-tensor instead of holding a copy of it.
 class LoopStmt : public Stmt {
 public:
+  LoopStmt(Scope scope, Symbol var, Expr *iterable, StmtChain *body,
+           bool by_reference = false)
+      : Stmt(sk_loop, scope), var(var), by_reference(by_reference),
+        iterable(iterable), body(body) {}
+  LoopStmt(Scope scope, std::string_view var, Expr *iterable,
+           StmtChain *body, bool by_reference = false)
+      : LoopStmt(scope, Symbol(var), iterable, body, by_reference) {}
+  Symbol var;
+  bool by_reference;
+  Expr *iterable;
   StmtChain *body;
-  LoopStmt(Scope scope, StmtChain *body) : Stmt(scope), body(body){};
+  static bool classof(const Stmt *stmt) { return stmt->kind() == sk_loop; }
 };
 
 class PrintStmt : public Stmt {
 public:
   Expr *expr;
-  PrintStmt(Scope scope, Expr *expr) : Stmt(scope), expr(expr){};
+  PrintStmt(Scope scope, Expr *expr) : Stmt(sk_print, scope), expr(expr){};
+  static bool classof(const Stmt *stmt) { return stmt->kind() == sk_print; }
 };
 
 class DefStmt : public Stmt {
 protected:
-  DefStmt(Scope scope, const std::string &name)
-      : Stmt(scope), identifier_name(name) {}
+  DefStmt(StmtKind kind, Scope scope, Symbol name)
+      : Stmt(kind, scope), identifier_name(name) {}
 
 public:
-  std::string identifier_name;
+  Symbol identifier_name;
+  static bool classof(const Stmt *stmt) {
+    return stmt->kind() >= sk_first_def && stmt->kind() <= sk_last_def;
+  }
 };
 
 class DefVarStmt : public DefStmt {
 public:
-  DefVarStmt(Scope scope, const std::string &name, Expr *rhs)
-      : DefStmt(scope, name), rhs(rhs) {}
+  DefVarStmt(Scope scope, Symbol name, Expr *rhs)
+      : DefStmt(sk_def_var, scope, name), rhs(rhs) {}
+  DefVarStmt(Scope scope, std::string_view name, Expr *rhs)
+      : DefVarStmt(scope, Symbol(name), rhs) {}
   Expr *rhs;
+  static bool classof(const Stmt *stmt) { return stmt->kind() == sk_def_var; }
 };
 
 class DefFuncStmt : public DefStmt {
 public:
-  DefFuncStmt(Scope scope, const std::string &name, CompoundStmt *rhs)
-      : DefStmt(scope, name), rhs(rhs) {}
+  DefFuncStmt(Scope scope, Symbol name, CompoundStmt *rhs,
+              int32_t num_of_params = 0, Symbol *params = nullptr)
+      : DefStmt(sk_def_func, scope, name), rhs(rhs),
+        num_of_params(num_of_params), params(params) {}
+  DefFuncStmt(Scope scope, std::string_view name, CompoundStmt *rhs,
+              int32_t num_of_params = 0, Symbol *params = nullptr)
+      : DefFuncStmt(scope, Symbol(name), rhs, num_of_params, params) {}
   CompoundStmt *rhs;
+  int32_t num_of_params;
+  Symbol *params;
+  static bool classof(const Stmt *stmt) {
+    return stmt->kind() == sk_def_func;
+  }
 };
 
 // TODO: support parsing Let
 //  class LetStmt : public Stmt {
 //  };
 class Expr {
+public:
+  enum ExprKind {
+    ek_call,
+    ek_var,
+    ek_binary_op,
+    ek_value,
+    ek_index,
+    ek_transpose
+  };
+
 protected:
   Type ty = tyUnknown;
+  Expr(ExprKind kind, Type ty) : ty(ty), _kind(kind) {}
+  Expr(ExprKind kind) : _kind(kind) {}
 
 public:
-  Expr(Type ty) : ty(ty) {}
-  Expr() {}
   virtual ~Expr() {}
   Type type() { return this->ty; }
   void set_type(Type ty) { this->ty = ty; }
+  // The shape of the value, set by TypeInference if it is the same wherever
+  // the Expr is evaluated. Otherwise it is uninitialized.
+  const Shape &shape() const { return _shape; }
+  void set_shape(Shape shape) { _shape = shape; }
+  ExprKind kind() const { return _kind; }
+
+private:
+  Shape _shape;
+  const ExprKind _kind;
 };
 
 class CallExpr : public Expr {
 public:
-  CallExpr(std::string func_name) : func_name(func_name) {}
-  std::string func_name;
+  CallExpr(Symbol func_name, int32_t num_of_args = 0, Expr **args = nullptr)
+      : Expr(ek_call), func_name(func_name), num_of_args(num_of_args),
+        args(args) {}
+  CallExpr(std::string_view func_name, int32_t num_of_args = 0,
+           Expr **args = nullptr)
+      : CallExpr(Symbol(func_name), num_of_args, args) {}
+  Symbol func_name;
+  int32_t num_of_args;
+  Expr **args;
+  static bool classof(const Expr *expr) { return expr->kind() == ek_call; }
 };
 
 class VarExpr : public Expr {
 public:
-  VarExpr(std::string var_name) : var_name(var_name) {}
-  std::string var_name;
+  VarExpr(Symbol var_name) : Expr(ek_var), var_name(var_name) {}
+  VarExpr(std::string_view var_name) : VarExpr(Symbol(var_name)) {}
+  Symbol var_name;
+  static bool classof(const Expr *expr) { return expr->kind() == ek_var; }
 };
 
 class BinaryOpExpr : public Expr {
-protected:
+public:
   enum OP { add, sub, mul, div, matmul };
 
-public:
-  BinaryOpExpr(Expr *lhs, OP op, Expr *rhs) : lhs(lhs), op(op), rhs(rhs) {}
+  BinaryOpExpr(Expr *lhs, OP op, Expr *rhs)
+      : Expr(ek_binary_op), op(op), lhs(lhs), rhs(rhs) {}
   OP op;
   Expr *lhs, *rhs;
+  static bool classof(const Expr *expr) {
+    return expr->kind() == ek_binary_op;
+  }
 };
 
-// TODO: support UnaryOP
-//  class UnaryOpExpr : public Expr {
-//  };
-
-// Describe the shape of a tensor (a1,a2,...,an) or a scale ()
-struct Shape {
-  Shape() {}
-  // the length of the dims vector
-  int32_t dims_dim = -1;
-  // an int array representing the dims
-  // such as [1, 3, 2, 4]
-  int32_t *dims = nullptr;
-  Shape(int32_t dims_dim) : dims_dim(dims_dim) {}
-  Shape(int32_t dims_dim, int32_t dims[]) : dims_dim(dims_dim), dims(dims) {}
-  // The comparison here is very strict.
-  // Shape A == Shape B holds only when A's dims is exactly the same as B's
-  // Does not support broadcast rules to enable "interspecies communication"
-  // such as Scala + Vector
-  bool operator==(const Shape &other);
-  bool operator!=(const Shape &other) { return !operator==(other); }
-  bool unintialized() const { return dims_dim == -1; }
-#ifdef DEBUG
-  void print() {
-    ASSERT(!unintialized(), "Shape must be initialized before being printed.");
-    std::cout << "{";
-    for (int i = 0; i < dims_dim; i++) {
-      std::cout << dims[i];
-      if (i < dims_dim - 1)
-        std::cout << ", ";
+// base[subscripts], such as x[0], x[1~3] or x[~, 2]. The subscripts apply
+// to the first dims of base in order: an index drops its dim, a range
+// begin~end keeps the sub-tensors [begin, end) along it, from the first one
+// or up to the last one if begin or end is left out. The value is a view of
+// the elements of base, so a loop by reference over it writes into base.
+class IndexExpr : public Expr {
+public:
+  struct Subscript {
+    // the index, or the begin of a range, nullptr if it is left out
+    Expr *begin = nullptr;
+    // the end of a range, nullptr if it is left out
+    Expr *end = nullptr;
+    bool is_range = false;
+
+    static Subscript index(Expr *index) { return {index, nullptr, false}; }
+    static Subscript range(Expr *begin, Expr *end) {
+      return {begin, end, true};
     }
-    std::cout << "}";
+  };
+
+  IndexExpr(Expr *base, int32_t num_of_subscripts, Subscript *subscripts)
+      : Expr(ek_index), base(base), num_of_subscripts(num_of_subscripts),
+        subscripts(subscripts) {}
+  Expr *base;
+  int32_t num_of_subscripts;
+  Subscript *subscripts;
+  // the number of dims the subscripts drop
+  int32_t num_of_indices() const {
+    int32_t n = 0;
+    for (int32_t i = 0; i < num_of_subscripts; i++)
+      n += !subscripts[i].is_range;
+    return n;
   }
-#endif
+  static bool classof(const Expr *expr) { return expr->kind() == ek_index; }
+  // the Expr whose elements ${expr} is a view of, ${expr} itself if it is
+  // neither an IndexExpr nor a TransposeExpr
+  static Expr *root_of(Expr *expr);
 };
 
+// operand.T, the dims of operand in reverse order: a matrix is transposed
+// and a vector or a scalar is left as it is. Like an IndexExpr, the value is
+// a view of the elements of operand.
+class TransposeExpr : public Expr {
+public:
+  TransposeExpr(Expr *operand) : Expr(ek_transpose), operand(operand) {}
+  Expr *operand;
+  static bool classof(const Expr *expr) {
+    return expr->kind() == ek_transpose;
+  }
+};
+
+inline Expr *IndexExpr::root_of(Expr *expr) {
+  while (true) {
+    if (expr->kind() == ek_index)
+      expr = static_cast<IndexExpr *>(expr)->base;
+    else if (expr->kind() == ek_transpose)
+      expr = static_cast<TransposeExpr *>(expr)->operand;
+    else
+      return expr;
+  }
+}
+
+// TODO: support UnaryOP
+//  class UnaryOpExpr : public Expr {
+//  };
+
 class Value {
 public:
-  Value() {}
-  ~Value() {}
-  virtual bool is_scala() { return false; }
-  virtual bool is_tensor() { return false; }
-  virtual Shape shape() = 0;
+  enum ValueKind { vk_scala, vk_tensor, vk_packed };
+
+protected:
+  Value(ValueKind kind) : _kind(kind) {}
+
+public:
+  virtual ~Value() {}
+  ValueKind kind() const { return _kind; }
+  bool is_scala() const { return _kind == vk_scala; }
+  // a tensor in the tree form
+  bool is_tensor() const { return _kind == vk_tensor; }
+  bool is_packed() const { return _kind == vk_packed; }
+  // We delay the shape inference of tree tensors to when they are used.
+  // Therefore, the unused incorrect shapes will not trigger an error
+  // and should be removed in codegen.
+  const Shape &shape();
+  // the shape is already known
+  bool has_shape() const { return !_shape.unintialized(); }
 
 protected:
   Shape _shape;
+
+private:
+  const ValueKind _kind;
 };
 
 class ScalaValue : public Value {
 public:
-  ScalaValue(std::string val_str) {
+  ScalaValue(std::string val_str) : Value(vk_scala) {
     try {
       this->val = std::stod(val_str);
     } catch (...) {
       ERROR(val_str + " cannot be converted into a double value.");
     }
-    _shape.dims_dim = 0;
+    _shape = Shape::scala();
+  }
+  // a scalar computed at compile time, such as a folded constant
+  explicit ScalaValue(double val) : Value(vk_scala), val(val) {
+    _shape = Shape::scala();
   }
   double val;
-  bool is_scala() override { return true; }
-  Shape shape() override;
+  static bool classof(const Value *value) { return value->is_scala(); }
 };
 
 class TensorValue : public Value {
 public:
-  TensorValue(int32_t dim, Value *vals[]) : dim(dim), vals(vals) {}
+  TensorValue(int32_t dim, Value *vals[])
+      : Value(vk_tensor), dim(dim), vals(vals) {}
   // dim must be > 0
   int32_t dim;
   Value **vals;
-  bool is_tensor() override { return true; }
-  // We delay the shape inference of tensors to when they are used.
-  // Therefore, the unused incorrect shapes will not trigger an error
-  // and should be removed in codegen.
-  Shape shape() override;
+  static bool classof(const Value *value) { return value->is_tensor(); }
   void set_shape(Shape _shape) { this->_shape = _shape; }
 };
 
+// A tensor stored as one contiguous, 64-byte aligned buffer of doubles in
+// row-major order. Tensor literals are parsed straight into this form; the
+// tree form (TensorValue) is kept for building tensors by hand.
+class PackedTensorValue : public Value {
+public:
+  static constexpr size_t alignment = 64;
+  PackedTensorValue(Shape shape, double *data, int64_t *strides)
+      : Value(vk_packed), data(data), strides(strides) {
+    _shape = shape;
+  }
+  // the element at (i0, i1, ...) is data[i0 * strides[0] + i1 * strides[1] +
+  // ...]
+  double *data;
+  // the number of elements between two neighbours along each dim
+  int64_t *strides;
+  int64_t num_of_elements() { return _shape.num_of_elements(); }
+  static bool classof(const Value *value) { return value->is_packed(); }
+  // A packed tensor of ${dims_dim} ${dims} in ${arena}, the elements are left
+  // uninitialized
+  static PackedTensorValue *create(Arena &arena, int32_t dims_dim,
+                                   const int32_t *dims);
+  // Pack the elements of ${tree}, whose shape must be well-formed
+  static PackedTensorValue *pack(Arena &arena, TensorValue *tree);
+};
+
 class ValueExpr : public Expr {
 protected:
 public:
   Value *val;
-  ValueExpr(Value *val) : val(val) {}
+  ValueExpr(Value *val) : Expr(ek_value), val(val) {}
+  static bool classof(const Expr *expr) { return expr->kind() == ek_value; }
 };
 
+// A Parser is the owner of a translation unit: every Stmt, Expr, Value and
+// Shape it builds lives in its arena and is freed when the Parser dies.
 class Parser {
 private:
+  Arena arena;
   Lexer lexer;
+  TokenStream tokens;
   Scope scope;
   DefStmt *build_DefStmt();
-  DefVarStmt *build_DefVarStmt(std::string);
-  DefFuncStmt *build_DefFuncStmt(std::string);
-  Stmt *meet_keyword();
+  DefVarStmt *build_DefVarStmt(Symbol);
+  DefFuncStmt *build_DefFuncStmt(Symbol);
+  PackedTensorValue *build_TensorLiteral();
+  Stmt *meet_keyword(const Token &keyword);
+  // lex and parse the source, fold its constants
+  CompoundStmt *parse_source();
+  // the elements of the tensor literal being parsed, reused across literals
+  std::vector<double> literal_elements;
+  // the .pieckc cache of the source file, empty for in-memory sources
+  std::string cache_file;
+  ModuleCache cache;
+  // the FlatAST of the source when it is not cached
+  FlatAST flat;
 
 public:
-  Parser(std::string file_name) : lexer(FileLocation(file_name, 0, 0)) {}
-
+  Parser(std::string file_name)
+      : lexer(FileLocation(file_name, 0, 0)), tokens(lexer),
+        cache_file(ModuleCache::path_of(file_name)) {}
+  // parse ${source}, ${file_name} only names it in error messages
+  Parser(std::string file_name, SourceBuffer source)
+      : lexer(FileLocation(file_name, 0, 0), std::move(source)),
+        tokens(lexer) {}
+  // Parse the part ${range} of ${source}, such as a statement found by the
+  // Segmenter. Errors are located in the whole source. A statement needs far
+  // less memory than a file, so the arena starts with small blocks.
+  Parser(std::string file_name, SourceBuffer source, SourceRange range)
+      : arena(Arena::default_block_size / 64),
+        lexer(FileLocation(file_name, 0, 0), std::move(source), range),
+        tokens(lexer) {}
+
+  // The AST of the source. If the .pieckc cache next to the source file was
+  // written for the same source, the AST is built from it and the source is
+  // neither lexed nor parsed. Otherwise the cache is rewritten.
   Stmt *parse();
+  // The FlatAST of the source. If the .pieckc cache next to the source file
+  // was written for the same source, it is mapped and the source is neither
+  // lexed nor parsed. Otherwise the source is parsed and the cache rewritten.
+  // In-memory sources are never cached. The view lives as long as the Parser.
+  FlatView parse_module();
+  // the memory used by the AST of this translation unit
+  const ArenaStats &arena_stats() const { return arena.stats(); }
+  // the arena of the AST, for the backends to compile it (see Compiler.h)
+  Arena &ast_arena() { return arena; }
 };
\ No newline at end of file
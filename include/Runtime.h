@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+// The state of a run of the native code of a module (see Codegen.h). Every
+// generated function receives it and passes it on to the runtime functions
+// below.
+struct RuntimeContext {
+  static constexpr int64_t max_call_depth = 10000;
+
+  explicit RuntimeContext(std::ostream &out = std::cout) : out(&out) {}
+
+  // receives the output of print
+  std::ostream *out;
+  int64_t depth = 0;
+  // the error that stopped the run, empty if none. Generated code does not
+  // unwind: a function that fails records the error and returns, and its
+  // callers return as soon as they see it.
+  std::string error;
+};
+
+// The functions the generated code calls. Tensors are passed as pointers to
+// their contiguous row-major elements; the generated code knows their shapes.
+extern "C" {
+// a buffer of ${n} doubles, 64-byte aligned
+double *pieck_alloc(int64_t n);
+void pieck_free(double *data);
+void pieck_print_scala(RuntimeContext *ctx, double value);
+void pieck_print_tensor(RuntimeContext *ctx, const double *data, int32_t rank,
+                        const int32_t *dims);
+void pieck_print_none(RuntimeContext *ctx);
+// ${c} = ${a} @ ${b} for a (${m}, ${k}) and a (${k}, ${n}) matrix, an
+// operand is transposed if ${a_transposed} or ${b_transposed} is 1 (see
+// matmul in Kernels.h)
+void pieck_matmul(const double *a, const double *b, double *c, int64_t m,
+                  int64_t n, int64_t k, int32_t a_transposed,
+                  int32_t b_transposed);
+// the index ${value} into a dim of ${n}, or -1 after recording the error of
+// ${where} if it is not an integer in [0, ${n})
+int64_t pieck_index(RuntimeContext *ctx, const char *where, double value,
+                    int64_t n);
+// Enter a call of the function ${where}, return 0 if the calls are nested
+// too deeply
+int32_t pieck_enter(RuntimeContext *ctx, const char *where);
+void pieck_leave(RuntimeContext *ctx);
+// record the error ${message} of ${where}
+void pieck_fail(RuntimeContext *ctx, const char *where, const char *message);
+int32_t pieck_failed(RuntimeContext *ctx);
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "AppendOnlyArray.h"
+#include "Symbol.h"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// the canonical ID of a scope
+using ScopeID = uint32_t;
+
+// The pre-order and post-order numbers of the scopes of the ScopeTree at one
+// point in time. A scope contains another one iff its interval [pre, post]
+// encloses the other's.
+class ScopeIntervals {
+public:
+  // the number of scopes numbered
+  size_t size() const { return intervals.size(); }
+  // ${inner} is ${outer} or nested in it, both must be numbered
+  bool contains(ScopeID outer, ScopeID inner) const {
+    return intervals[outer].pre <= intervals[inner].pre &&
+           intervals[inner].post <= intervals[outer].post;
+  }
+
+private:
+  friend class ScopeTree;
+  struct Interval {
+    uint32_t pre, post;
+  };
+  std::vector<Interval> intervals;
+};
+
+// The process-wide tree of scopes. A scope is interned by its parent and its
+// name, so two scopes with the same path of names are the same scope, whatever
+// module or thread they were entered in. Adding scopes is thread-safe, and the
+// parent, name and depth of an ID are read without a lock.
+class ScopeTree {
+public:
+  // the outermost scope, it has no name
+  static constexpr ScopeID root = 0;
+  static constexpr ScopeID invalid_id = UINT32_MAX;
+
+  static ScopeTree &global();
+
+  // the scope ${name} nested in ${parent}
+  ScopeID child(ScopeID parent, Symbol name);
+  ScopeID parent(ScopeID scope) const { return nodes[scope].parent; }
+  Symbol name(ScopeID scope) const { return nodes[scope].name; }
+  // the number of scopes ${scope} is nested in
+  int32_t depth(ScopeID scope) const { return nodes[scope].depth; }
+  // the number of scopes
+  size_t size() const { return nodes.size(); }
+
+  // The intervals of all scopes so far. The tree is numbered again only if
+  // scopes were added since the last call, so a pass over a parsed program
+  // takes the intervals once and checks every containment with two integer
+  // comparisons.
+  std::shared_ptr<const ScopeIntervals> intervals();
+  // ${inner} is ${outer} or nested in it. Every thread keeps the intervals
+  // it took last and takes them again, under the lock, only if one of the
+  // scopes is newer, so checking the scopes of a parsed program takes no
+  // lock.
+  bool contains(ScopeID outer, ScopeID inner) {
+    thread_local std::shared_ptr<const ScopeIntervals> taken;
+    if (!taken || std::max(outer, inner) >= taken->size())
+      taken = intervals();
+    return taken->contains(outer, inner);
+  }
+
+private:
+  ScopeTree();
+  struct Node {
+    ScopeID parent;
+    Symbol name;
+    int32_t depth;
+    // the children form a list, only used to number the tree
+    ScopeID first_child, next_sibling;
+  };
+
+  std::mutex mutex;
+  AppendOnlyArray<Node> nodes;
+  // the child of (parent << 32 | name)
+  std::unordered_map<uint64_t, ScopeID> children;
+  std::shared_ptr<const ScopeIntervals> numbered;
+};
+
+// A scope, such as the one a Stmt is in. It is only the ID of a scope in the
+// ScopeTree, so copying and comparing scopes is cheap.
+class Scope {
+public:
+  Scope() {}
+  explicit Scope(ScopeID id) : _id(id) {}
+  // enter the scope ${scope_name} nested in this one
+  void push(std::string_view scope_name) {
+    _id = ScopeTree::global().child(_id, Symbol(scope_name));
+  }
+  // leave to the enclosing scope
+  void pop();
+  ScopeID id() const { return _id; }
+  // the names of the scopes from the outermost one to this one
+  std::vector<Symbol> names() const;
+
+  bool operator==(const Scope &other) const { return _id == other._id; }
+  bool operator!=(const Scope &other) const { return _id != other._id; }
+  // this scope is ${other} or nested in it
+  bool operator<=(const Scope &other) const {
+    return ScopeTree::global().contains(other._id, _id);
+  }
+
+private:
+  ScopeID _id = ScopeTree::root;
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Lexer.h"
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Split a source into its top-level statements without lexing it.
+//
+// A top-level statement ends at a ';' or a ';;'. The body of a function,
+// which starts with `def name (`, only ends at a ';;'. Strings are skipped,
+// so a ';' inside a string does not end a statement. The whitespaces in
+// front of a statement belong to it, and the blank tail of a source belongs
+// to no statement. Each statement can be lexed and parsed on its own, see
+// Parser(file_name, source, range).
+class Segmenter {
+public:
+  // split ${source} from the offset ${begin}, which is at the top level and
+  // on the line ${line}
+  Segmenter(std::string_view source, uint32_t begin = 0, int32_t line = 1)
+      : source(source), pos(begin), line(line) {}
+  // Scan the next statement into ${range}, false at the end of the source
+  bool next(SourceRange &range);
+  // all top-level statements of ${source}
+  static std::vector<SourceRange> split(std::string_view source);
+
+private:
+  // the statement at ${begin} is a function definition
+  bool starts_function(size_t begin) const;
+
+  std::string_view source;
+  size_t pos;
+  int32_t line;
+};
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "AppendOnlyArray.h"
+#include "Arena.h"
+#include "Error.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#ifdef DEBUG
+#include <iostream>
+#endif
+
+// the canonical ID of a shape
+using ShapeID = uint32_t;
+
+// Describe the shape of a tensor (a1,a2,...,an) or a scale ()
+//
+// Shapes are hash-consed by the ShapeTable: every distinct shape gets one
+// canonical ID, so comparing two shapes is a single integer comparison. The
+// dims of ranks up to max_inline_rank are copied into the Shape itself, the
+// dims of larger ranks live in the ShapeTable.
+class Shape {
+public:
+  static constexpr int32_t max_inline_rank = 6;
+  static constexpr ShapeID invalid_id = UINT32_MAX;
+
+  Shape() {}
+  // the shape of ${dims_dim} dims, such as [1, 3, 2, 4]
+  Shape(int32_t dims_dim, const int32_t dims[]);
+  // the shape () of scalars
+  static Shape scala();
+
+  // the length of the dims vector, -1 if uninitialized
+  int32_t dims_dim() const { return _dims_dim; }
+  const int32_t *dims() const {
+    return _dims_dim <= max_inline_rank ? inline_dims : table_dims;
+  }
+  int32_t operator[](int32_t i) const { return dims()[i]; }
+  ShapeID id() const { return _id; }
+  // the number of elements
+  int64_t num_of_elements() const;
+  // the shape (dim, a1, a2, ..., an), where this shape is (a1, a2, ..., an)
+  Shape prepend(int32_t dim) const;
+  // the shape (a2, ..., an), where this shape is (a1, a2, ..., an)
+  Shape drop_front() const;
+  // The shape of ${lhs} and ${rhs} broadcast together as in NumPy: the dims
+  // are matched from the last one, a missing dim counts as 1 and a dim of 1
+  // stretches to the other one, so (2, 3) and (3) give (2, 3). The shape is
+  // uninitialized if two matched dims differ and neither is 1.
+  static Shape broadcast(const Shape &lhs, const Shape &rhs);
+  // such as (2, 3), or () for scalars
+  std::string str() const;
+
+  // The comparison here is very strict.
+  // Shape A == Shape B holds only when A's dims is exactly the same as B's.
+  // Shapes that only agree by the broadcast rules, such as (2, 3) and (3),
+  // are different; see broadcast()
+  bool operator==(const Shape &other) const {
+    return _id == other._id && _id != invalid_id;
+  }
+  bool operator!=(const Shape &other) const { return !operator==(other); }
+  bool unintialized() const { return _dims_dim == -1; }
+#ifdef DEBUG
+  void print() const {
+    ASSERT(!unintialized(), "Shape must be initialized before being printed.");
+    std::cout << "{";
+    for (int i = 0; i < _dims_dim; i++) {
+      std::cout << dims()[i];
+      if (i < _dims_dim - 1)
+        std::cout << ", ";
+    }
+    std::cout << "}";
+  }
+#endif
+
+private:
+  int32_t _dims_dim = -1;
+  ShapeID _id = invalid_id;
+  union {
+    int32_t inline_dims[max_inline_rank] = {};
+    // owned by the ShapeTable
+    const int32_t *table_dims;
+  };
+};
+
+// The process-wide table of canonical shapes. It keeps a single copy of every
+// distinct shape, so the memory for shape metadata is bounded by the number of
+// distinct shapes rather than the number of tensors. Interning is thread-safe,
+// and a shape interned before is found without a lock, so the Shapes built on
+// every VM instruction do not contend; only a new shape takes the lock.
+class ShapeTable {
+public:
+  static ShapeTable &global();
+
+  // The canonical ID of the shape ${dims_dim} ${dims}. The copy of the dims
+  // kept in the table is stored into ${stored_dims}.
+  ShapeID intern(int32_t dims_dim, const int32_t dims[],
+                 const int32_t **stored_dims);
+  // the number of distinct shapes
+  size_t size() const { return entries.size(); }
+  // the memory used by the dims of all shapes
+  ArenaStats stats();
+
+private:
+  ShapeTable();
+  struct Entry {
+    uint64_t hash;
+    int32_t dims_dim;
+    const int32_t *dims;
+  };
+  // open addressing, slots hold IDs or Shape::invalid_id
+  struct Slots {
+    explicit Slots(size_t size);
+    std::unique_ptr<std::atomic<ShapeID>[]> ids;
+    size_t mask;
+  };
+  // The ID of the shape in ${slots}, Shape::invalid_id if it is not there.
+  // Set ${slot} to where the probe stopped.
+  ShapeID find(const Slots &slots, uint64_t hash, int32_t dims_dim,
+               const int32_t dims[], size_t &slot) const;
+  void grow();
+
+  // taken by the threads that add shapes
+  std::mutex mutex;
+  // entries[id] is the shape of the ID ${id}
+  AppendOnlyArray<Entry> entries;
+  // the slots read without the lock, a table replaced by a larger one is kept
+  // for the readers that may still probe it
+  std::atomic<const Slots *> slots;
+  std::vector<std::unique_ptr<Slots>> tables;
+  Arena dims_storage;
+};
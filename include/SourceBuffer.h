@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// The whole text of a source file, read-only.
+//
+// The file is mapped into memory once with mmap, so the Lexer can hand out
+// every line and every token as a std::string_view into the mapping instead
+// of copying characters around. Files that cannot be mapped (empty files,
+// pipes, ...) and sources that only live in memory fall back to an owned
+// std::string, or to text borrowed from the caller.
+class SourceBuffer {
+public:
+  SourceBuffer() {}
+  // map the file ${file_name} into memory
+  explicit SourceBuffer(const std::string &file_name);
+  // wrap a source that only lives in memory
+  static SourceBuffer from_string(std::string text);
+  // Refer to ${text} without copying it, ${text} must outlive the reads
+  // through this buffer
+  static SourceBuffer borrow(std::string_view text);
+
+  SourceBuffer(SourceBuffer &&other) noexcept;
+  SourceBuffer &operator=(SourceBuffer &&other) noexcept;
+  SourceBuffer(const SourceBuffer &) = delete;
+  SourceBuffer &operator=(const SourceBuffer &) = delete;
+  ~SourceBuffer();
+
+  const char *data() const { return _data; }
+  size_t size() const { return _size; }
+  std::string_view view() const { return std::string_view(_data, _size); }
+  // true if the text is backed by a memory mapping
+  bool is_mapped() const { return mapped; }
+
+private:
+  void release();
+
+  const char *_data = "";
+  size_t _size = 0;
+  bool mapped = false;
+  // the text belongs to someone else
+  bool borrowed = false;
+  // the storage of unmapped sources
+  std::string owned;
+};
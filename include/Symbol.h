@@ -0,0 +1,82 @@
+#pragma once
+
+#include "AppendOnlyArray.h"
+#include "Arena.h"
+#include <cstdint>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+// the canonical ID of a name
+using SymbolID = uint32_t;
+
+// A name of a variable, a function or a scope.
+//
+// Names are interned by the SymbolInterner: every distinct name gets one
+// 32-bit ID, so a Symbol is as small as an integer and comparing two names is
+// a single integer comparison.
+class Symbol {
+public:
+  static constexpr SymbolID invalid_id = UINT32_MAX;
+
+  Symbol() {}
+  explicit Symbol(std::string_view name);
+  static Symbol from_id(SymbolID id) {
+    Symbol symbol;
+    symbol._id = id;
+    return symbol;
+  }
+
+  SymbolID id() const { return _id; }
+  bool valid() const { return _id != invalid_id; }
+  // the name, it lives as long as the process
+  std::string_view str() const;
+
+  bool operator==(const Symbol &other) const { return _id == other._id; }
+  bool operator!=(const Symbol &other) const { return _id != other._id; }
+  bool operator==(std::string_view name) const {
+    return valid() && str() == name;
+  }
+  bool operator!=(std::string_view name) const { return !operator==(name); }
+
+private:
+  SymbolID _id = invalid_id;
+};
+
+// The process-wide table of names. Interning is thread-safe, and the name of
+// an ID is read without a lock.
+class SymbolInterner {
+public:
+  static SymbolInterner &global();
+
+  // the canonical ID of ${name}
+  SymbolID intern(std::string_view name);
+  std::string_view name(SymbolID id) const {
+    const Entry &entry = entries[id];
+    return std::string_view(entry.data, entry.length);
+  }
+  // the number of distinct names
+  size_t size() const { return entries.size(); }
+  // the memory used by the characters of all names
+  ArenaStats stats();
+
+private:
+  SymbolInterner() : slots(64, Symbol::invalid_id) {}
+  struct Entry {
+    uint64_t hash;
+    const char *data;
+    uint32_t length;
+  };
+  void grow();
+
+  std::mutex mutex;
+  // entries[id] is the name of the ID ${id}
+  AppendOnlyArray<Entry> entries;
+  // open addressing, slots hold IDs or Symbol::invalid_id
+  std::vector<SymbolID> slots;
+  Arena name_storage;
+};
+
+inline std::string_view Symbol::str() const {
+  return SymbolInterner::global().name(_id);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "FlatAST.h"
+#include "Symbol.h"
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The top-level definitions of the modules of a batch, shared by the threads
+// compiling them.
+//
+// The names are interned Symbols spread over shards, each guarded by a
+// reader-writer lock, so threads defining different names rarely wait for
+// each other. When several definitions of a name race, the one of the
+// smallest (module, node) wins, so the outcome does not depend on the order
+// the threads run in.
+class SymbolTable {
+public:
+  struct Definition {
+    // the number of the module, see add_modules
+    uint32_t module;
+    // the index of the definition in the FlatAST of the module
+    uint32_t node;
+    FlatKind kind;
+  };
+
+  // Number the modules of ${file_names} after the modules added before, return
+  // the number of the first one
+  uint32_t add_modules(const std::vector<std::string> &file_names);
+  // the file of the module ${module}
+  const std::string &file_of(uint32_t module) const;
+
+  // Define ${name} as ${definition}, return the winning definition so far
+  Definition define(Symbol name, Definition definition);
+  std::optional<Definition> lookup(Symbol name) const;
+  // the number of names
+  size_t size() const;
+
+private:
+  static constexpr size_t num_of_shards = 32;
+  struct Shard {
+    mutable std::shared_mutex mutex;
+    std::unordered_map<SymbolID, Definition> definitions;
+  };
+  Shard &shard_of(Symbol name) const {
+    return shards[name.id() % num_of_shards];
+  }
+
+  mutable std::array<Shard, num_of_shards> shards;
+  mutable std::mutex modules_mutex;
+  // the files of the modules, a deque so they stay where they are
+  std::deque<std::string> module_files;
+};
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "Shape.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+// A tensor of the runtime (see VM.h): a Shape and the elements, in a 64-byte
+// aligned buffer. The buffer is reference counted and may be shared: copying
+// a Tensor does not copy the elements, and a view of a sub-tensor, a range or
+// a column points into the buffer of its parent. A tensor of rank 0 is a view
+// of a single element.
+//
+// The element at (i0, i1, ...) is data()[i0 * stride(0) + i1 * stride(1) +
+// ...]. The elements of a tensor are in row-major order unless it is a view
+// that skips some of them, such as a column; only those views store their
+// strides.
+class Tensor {
+public:
+  static constexpr size_t alignment = 64;
+
+  Tensor() {}
+  // a tensor of ${shape} in a new buffer, the elements are left uninitialized
+  explicit Tensor(Shape shape);
+  // a tensor of ${shape} holding a copy of the elements at ${data}
+  static Tensor copy_of(Shape shape, const double *data);
+
+  const Shape &shape() const { return _shape; }
+  int32_t rank() const { return _shape.dims_dim(); }
+  int64_t num_of_elements() const { return _shape.num_of_elements(); }
+  double *data() const { return _data; }
+  // no tensor is held
+  bool empty() const { return _data == nullptr; }
+  // the elements are in row-major order, without gaps
+  bool is_contiguous() const { return !_strides; }
+  // the tensor refers to a part of the buffer of another one
+  bool is_view() const { return _view; }
+  // no other tensor shares the buffer
+  bool unique() const { return buffer.use_count() == 1; }
+  // the number of elements between two neighbours along ${dim}
+  int64_t stride(int32_t dim) const;
+
+  // A view of ${shape} starting ${offset} elements after the first element of
+  // this tensor, whose elements are in row-major order. The view must fit
+  // into the buffer.
+  Tensor view(Shape shape, int64_t offset) const {
+    Tensor tensor;
+    tensor.buffer = buffer;
+    tensor._data = _data + offset;
+    tensor._shape = shape;
+    tensor._view = true;
+    return tensor;
+  }
+  // this view moved by ${offset} elements, with the same shape and strides
+  Tensor shifted(int64_t offset) const {
+    Tensor tensor = *this;
+    tensor._data += offset;
+    tensor._view = true;
+    return tensor;
+  }
+  // the view of the ${index}th sub-tensor along ${dim}, which is dropped
+  Tensor select(int32_t dim, int64_t index) const;
+  // the view of the sub-tensors [${begin}, ${end}) along ${dim}
+  Tensor slice(int32_t dim, int64_t begin, int64_t end) const;
+  // The view of the tensor with its dims in reverse order, as .T: the
+  // element (i, j) of a transposed matrix is the element (j, i) of this one.
+  // Only the shape and the strides are permuted, no element moves.
+  Tensor transpose() const;
+  // the elements are those of the transpose of a row-major tensor, as
+  // transpose() lays out a contiguous one
+  bool is_transposed() const;
+  // The view of this tensor broadcast to ${shape} (see Shape::broadcast).
+  // The dims it stretches or prepends have a stride of 0, so every element
+  // along them is the same element of this tensor.
+  Tensor broadcast_to(const Shape &shape) const;
+  // the elements copied into a new buffer, in row-major order
+  Tensor clone() const;
+  // this tensor if it is contiguous, otherwise a contiguous copy of it
+  Tensor contiguous() const { return is_contiguous() ? *this : clone(); }
+  // Write the elements of ${value}, which has the same shape, into the
+  // elements of this tensor. They may overlap.
+  void assign(const Tensor &value) const;
+  // write ${value} into every element
+  void fill(double value) const;
+
+  // such as [[1, 2], [3, 4]], the element itself for rank 0
+  void print(std::ostream &out) const;
+
+  // the strides of the dims of ${shape} in row-major order
+  static std::vector<int64_t> row_major_strides(const Shape &shape);
+  // the strides of a tensor of ${shape} with ${strides} broadcast to ${to},
+  // 0 along the dims it stretches or prepends
+  static std::vector<int64_t>
+  broadcast_strides(const Shape &shape, const std::vector<int64_t> &strides,
+                    const Shape &to);
+  // ${strides} lay out ${shape} in row-major order, dims of one element
+  // aside
+  static bool is_row_major(const Shape &shape,
+                           const std::vector<int64_t> &strides);
+  // ${strides} lay out ${shape} as the transpose of a row-major tensor, in
+  // column-major order, dims of one element aside
+  static bool is_transposed(const Shape &shape,
+                            const std::vector<int64_t> &strides);
+
+private:
+  // a view of ${shape} at ${data} with the ${strides} of its dims
+  Tensor with_strides(double *data, Shape shape,
+                      const std::vector<int64_t> &strides) const;
+
+  std::shared_ptr<double> buffer;
+  double *_data = nullptr;
+  Shape _shape;
+  // the strides of the dims, null if the elements are in row-major order
+  std::shared_ptr<const int64_t[]> _strides;
+  bool _view = false;
+};
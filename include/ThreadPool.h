@@ -0,0 +1,56 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads with work stealing.
+//
+// Every worker has a deque of its own. Tasks pushed by a worker, such as the
+// helpers of a parallel_for nested in a task, go to the back of its deque and
+// are popped from there, so the worker keeps to the data it just touched.
+// Idle workers steal from the front of the deques of the others. Tasks pushed
+// from outside the pool are spread over the deques round-robin.
+class ThreadPool {
+public:
+  // ${num_of_threads} workers, one per core by default
+  explicit ThreadPool(size_t num_of_threads = default_num_of_threads());
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ~ThreadPool();
+
+  static size_t default_num_of_threads();
+  size_t size() const { return workers.size(); }
+
+  // Run ${task}(i) for every i in [0, n) and wait for all of them. The calling
+  // thread runs tasks too. If tasks throw, the exception of the smallest i is
+  // rethrown once all tasks are done.
+  void parallel_for(size_t n, const std::function<void(size_t)> &task);
+
+private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+  void push(std::function<void()> task);
+  // pop a task of the worker ${index}, or steal one from the others
+  bool take(size_t index, std::function<void()> &task);
+  void work(size_t index);
+
+  std::vector<std::thread> workers;
+  std::vector<std::unique_ptr<Queue>> queues;
+  // the deque of the next task pushed from outside the pool
+  std::atomic<size_t> next_queue{0};
+  // the number of tasks in all deques, idle workers sleep while it is 0
+  std::atomic<int64_t> pending{0};
+  std::mutex sleep_mutex;
+  std::condition_variable wake;
+  bool stopping = false;
+};
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "Parser.h"
+#include "Shape.h"
+#include "Symbol.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// The shape of a value known at compile time: not known yet, none (the value
+// of a function that returns nothing), or a Shape, () for scalars
+struct StaticShape {
+  enum Kind : uint8_t { ss_unknown, ss_none, ss_shape };
+  Kind kind = ss_unknown;
+  Shape shape;
+
+  static StaticShape none() {
+    StaticShape none;
+    none.kind = ss_none;
+    return none;
+  }
+  static StaticShape of(Shape shape) {
+    StaticShape of;
+    of.kind = ss_shape;
+    of.shape = shape;
+    return of;
+  }
+  bool known() const { return kind != ss_unknown; }
+  bool is_none() const { return kind == ss_none; }
+  bool is_scala() const { return kind == ss_shape && shape.dims_dim() == 0; }
+  bool operator==(const StaticShape &other) const {
+    return kind == other.kind && (kind != ss_shape || shape == other.shape);
+  }
+  bool operator!=(const StaticShape &other) const { return !(*this == other); }
+  // such as "a tensor of shape (2, 3)", for error messages
+  std::string describe() const;
+};
+
+// A function defined at the top level
+struct FunctionInfo {
+  DefFuncStmt *def;
+  // its params and the names it assigns
+  std::unordered_set<SymbolID> locals;
+  std::unordered_set<SymbolID> assigned;
+  bool returns_value;
+  int32_t num_of_specializations = 0;
+};
+
+// A function, or the top level, for the shapes of its params
+struct Specialization {
+  // the index of the function in TypeInference::functions, -1 for the top
+  // level
+  int32_t function;
+  // the index of the specialization in TypeInference::specs
+  size_t index;
+  std::vector<Shape> params;
+  // the shapes of the locals, unknown until an assignment is seen
+  std::unordered_map<SymbolID, StaticShape> shapes;
+  // the variables of loops by reference
+  std::unordered_set<SymbolID> references;
+  StaticShape result;
+  // the shape of every Expr of the body
+  std::unordered_map<Expr *, StaticShape> exprs;
+  // the index of the specialization every call of the body calls
+  std::unordered_map<CallExpr *, size_t> callees;
+  // whether a call of the specialization may call it again before it
+  // returns
+  bool recursive = false;
+};
+
+class ShapeInference;
+
+// Infer the types and shapes of a whole module before any of it runs.
+//
+// Functions are specialized for the shapes of the arguments they are called
+// with. The shapes of the variables, of what the functions return and of
+// every Expr are propagated through all specializations until nothing
+// changes, so shape errors, such as adding tensors whose shapes cannot be
+// broadcast (see Shape::broadcast) or changing the shape of a variable, are
+// thrown before the module runs.
+// Functions that are never called are not checked.
+//
+// Every Expr reached is annotated with its type, tyFloat64 or tyNone for the
+// calls of functions that return nothing, and with its shape if it has the
+// same shape in every specialization. The shapes of each specialization are
+// kept in TypeInference::specs, so a backend can allocate the output of
+// every Expr before it runs (see Codegen.h).
+class TypeInference {
+public:
+  static constexpr int32_t max_specializations = 64;
+
+  // Infer the module ${root}, throw if it uses undefined names or if the
+  // shapes of its values do not agree
+  explicit TypeInference(CompoundStmt *root);
+
+  bool top_level(const Specialization &spec) const {
+    return spec.function < 0;
+  }
+  // "the top level" or the name of the function
+  std::string name_of(const Specialization &spec) const;
+  CompoundStmt *body_of(const Specialization &spec) const {
+    return top_level(spec) ? root : functions[spec.function].def->rhs;
+  }
+  // the shape of ${expr} in ${spec}, unknown if it is never inferred
+  StaticShape shape_of(const Specialization &spec, Expr *expr) const;
+
+  CompoundStmt *root;
+  std::vector<FunctionInfo> functions;
+  std::unordered_map<SymbolID, int32_t> function_index;
+  // the names the top level assigns
+  std::unordered_set<SymbolID> top_assigned;
+  // the top-level variables read by functions
+  std::unordered_set<SymbolID> globals;
+  // The top level is specs[0]. A deque, so specializations are not moved
+  // when more are added.
+  std::deque<Specialization> specs;
+
+private:
+  friend class ShapeInference;
+
+  // the specialization of the function ${function} for ${params}, created
+  // if it is the first call with these shapes
+  Specialization &specialize(int32_t function,
+                             const std::vector<Shape> &params);
+  void find_recursion();
+  void annotate();
+
+  std::map<std::pair<int32_t, std::vector<ShapeID>>, size_t> spec_index;
+  // set when anything new is learned
+  bool changed = false;
+};
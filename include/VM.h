@@ -0,0 +1,79 @@
+#pragma once
+
+#include "Bytecode.h"
+#include "Tensor.h"
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// A register of the VM. Registers are typed: the kind says whether the value
+// is the double in ${scala} or the tensor in ${tensor}, so scalar arithmetic
+// never touches a tensor or allocates.
+struct Register {
+  enum Kind : uint8_t { rk_none, rk_scala, rk_tensor };
+  Kind kind = rk_none;
+  double scala = 0;
+  Tensor tensor;
+
+  void set_scala(double value) {
+    // let go of the buffer of the tensor held before
+    if (kind == rk_tensor)
+      tensor = Tensor();
+    kind = rk_scala;
+    scala = value;
+  }
+  void set_tensor(Tensor value) {
+    kind = rk_tensor;
+    tensor = std::move(value);
+  }
+  void clear() {
+    kind = rk_none;
+    tensor = Tensor();
+  }
+  // a scalar, or a view of a single element
+  bool is_number() const {
+    return kind == rk_scala || (kind == rk_tensor && tensor.rank() == 0);
+  }
+  double number() const { return kind == rk_scala ? scala : *tensor.data(); }
+  // such as "a tensor of shape (2, 3)", for error messages
+  std::string describe() const;
+  void print(std::ostream &out) const;
+};
+
+// Run the bytecode of a Program (see Compiler.h).
+//
+// The registers of all calls live in one stack: a call takes the registers
+// right after the ones of its caller, so calling a function allocates
+// nothing once the stack has grown. Instructions are dispatched with computed
+// gotos where the compiler supports them: every instruction ends with an
+// indirect jump of its own, which the branch predictor tells apart.
+class VM {
+public:
+  static constexpr size_t max_call_depth = 10000;
+
+  // ${out} receives the output of print
+  explicit VM(std::ostream &out = std::cout) : out(out) {}
+
+  // Run the top level of ${program} and return the value it returns, none if
+  // it returns nothing. Runtime errors are thrown as std::logic_error.
+  Register run(const Program &program);
+
+private:
+  // a call waiting for the function it called to return
+  struct Frame {
+    const Function *function;
+    // where to go on when the callee returns
+    const Instruction *ip;
+    size_t base;
+    // the register the value of the callee goes to
+    uint16_t dest;
+  };
+
+  std::ostream &out;
+  std::vector<Register> stack;
+  std::vector<Register> globals;
+  std::vector<Frame> frames;
+  // the tiles of fused instructions
+  std::vector<double> scratch;
+};
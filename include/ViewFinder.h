@@ -0,0 +1,127 @@
+#pragma once
+
+#include "ASTVisitor.h"
+#include "Casting.h"
+#include "Symbol.h"
+#include <unordered_map>
+#include <unordered_set>
+
+// What a part of a function reads, binds, loops over and calls
+class Summary : public ASTVisitor<Summary> {
+public:
+  // the number of reads and of bindings of every name
+  std::unordered_map<SymbolID, int32_t> reads, binds;
+  // the number of loops over every name, the name being the root of the
+  // iterable (see IndexExpr::root_of), and of those by reference
+  std::unordered_map<SymbolID, int32_t> loops_over, references_into;
+  // the variables of the loops by reference
+  std::unordered_set<SymbolID> references;
+  bool calls = false;
+
+  void visit_CompoundStmt(CompoundStmt *stmt) { visit_chain(stmt->stmts()); }
+  void visit_ReturnStmt(ReturnStmt *stmt) {
+    if (stmt->expr)
+      visit(stmt->expr);
+  }
+  void visit_LoopStmt(LoopStmt *stmt) {
+    visit(stmt->iterable);
+    if (VarExpr *root =
+            dyn_cast<VarExpr>(IndexExpr::root_of(stmt->iterable))) {
+      loops_over[root->var_name.id()]++;
+      if (stmt->by_reference)
+        references_into[root->var_name.id()]++;
+    }
+    binds[stmt->var.id()]++;
+    if (stmt->by_reference)
+      references.insert(stmt->var.id());
+    visit_chain(stmt->body);
+  }
+  void visit_PrintStmt(PrintStmt *stmt) { visit(stmt->expr); }
+  void visit_DefVarStmt(DefVarStmt *stmt) {
+    visit(stmt->rhs);
+    binds[stmt->identifier_name.id()]++;
+  }
+  void visit_CallExpr(CallExpr *expr) {
+    calls = true;
+    for (int32_t i = 0; i < expr->num_of_args; i++)
+      visit(expr->args[i]);
+  }
+  void visit_VarExpr(VarExpr *expr) { reads[expr->var_name.id()]++; }
+  void visit_BinaryOpExpr(BinaryOpExpr *expr) {
+    visit(expr->lhs);
+    visit(expr->rhs);
+  }
+  void visit_IndexExpr(IndexExpr *expr) {
+    visit(expr->base);
+    for (int32_t i = 0; i < expr->num_of_subscripts; i++) {
+      if (expr->subscripts[i].begin)
+        visit(expr->subscripts[i].begin);
+      if (expr->subscripts[i].end)
+        visit(expr->subscripts[i].end);
+    }
+  }
+  void visit_TransposeExpr(TransposeExpr *expr) { visit(expr->operand); }
+  void visit_chain(StmtChain *chain) {
+    for (StmtChain *link = chain; link; link = link->next) {
+      if (link->stmt)
+        visit(link->stmt);
+    }
+  }
+};
+
+// The loops by value whose variable may point into the iterable instead of
+// holding a copy of the sub-tensor, as nothing writes the elements while the
+// variable is read: the loop is the only place the variable is bound, the
+// variable is only read in the body, and the body calls no function and
+// assigns neither the variable the iterable is a view of nor a reference.
+// Codegen and the Compiler of the VM agree on them, so both backends give
+// the variable the same elements.
+class ViewFinder : public ASTVisitor<ViewFinder> {
+public:
+  // ${pinned} are the params and globals of the function, whose elements
+  // are shared with the caller or the functions
+  ViewFinder(CompoundStmt *body, const std::unordered_set<SymbolID> &pinned,
+             const std::unordered_set<SymbolID> &references)
+      : pinned(pinned), references(references) {
+    all.visit(body);
+    visit(body);
+  }
+
+  std::unordered_set<LoopStmt *> loops;
+
+  void visit_CompoundStmt(CompoundStmt *stmt) { visit_chain(stmt->stmts()); }
+  void visit_LoopStmt(LoopStmt *stmt) {
+    visit_chain(stmt->body);
+    const SymbolID var = stmt->var.id();
+    if (stmt->by_reference || pinned.count(var) || references.count(var) ||
+        all.binds[var] != 1)
+      return;
+    Summary body;
+    body.visit_chain(stmt->body);
+    if (body.calls || body.reads[var] != all.reads[var])
+      return;
+    // a reference points into the elements of an unknown variable
+    if (VarExpr *root =
+            dyn_cast<VarExpr>(IndexExpr::root_of(stmt->iterable))) {
+      const SymbolID name = root->var_name.id();
+      if (references.count(name) || body.binds[name])
+        return;
+    }
+    for (auto &[name, count] : body.binds) {
+      if (count && references.count(name))
+        return;
+    }
+    loops.insert(stmt);
+  }
+
+private:
+  void visit_chain(StmtChain *chain) {
+    for (StmtChain *link = chain; link; link = link->next) {
+      if (link->stmt)
+        visit(link->stmt);
+    }
+  }
+
+  const std::unordered_set<SymbolID> &pinned, &references;
+  Summary all;
+};
@@ -0,0 +1,60 @@
+#include "../include/Arena.h"
+#include "../include/Error.h"
+#include <cstdlib>
+
+std::string ArenaStats::str() const {
+  return "blocks: " + std::to_string(num_of_blocks) +
+         ", reserved: " + std::to_string(bytes_reserved) +
+         " bytes, allocated: " + std::to_string(bytes_allocated) +
+         " bytes, objects: " + std::to_string(num_of_objects) +
+         ", finalizers: " + std::to_string(num_of_finalizers);
+}
+
+Arena::~Arena() {
+  for (Finalizer *finalizer = finalizers; finalizer;
+       finalizer = finalizer->next) {
+    finalizer->destroy(finalizer->object);
+  }
+  while (blocks) {
+    Block *next = blocks->next;
+    std::free(blocks);
+    blocks = next;
+  }
+}
+
+static char *align_up(char *p, size_t align) {
+  uintptr_t address = reinterpret_cast<uintptr_t>(p);
+  return reinterpret_cast<char *>((address + align - 1) & ~(align - 1));
+}
+
+void *Arena::allocate(size_t size, size_t align) {
+  ASSERT(align && (align & (align - 1)) == 0,
+         "Arena: the alignment must be a power of two.");
+  // oversized requests get a block of their own, and the current block keeps
+  // serving the small ones
+  if (size + align > block_size / 2) {
+    char *p = align_up(new_block(size + align), align);
+    _stats.bytes_allocated += size;
+    return p;
+  }
+  char *p = align_up(cur, align);
+  if (!cur || p + size > end) {
+    cur = new_block(block_size);
+    end = cur + block_size;
+    p = align_up(cur, align);
+  }
+  _stats.bytes_allocated += p + size - cur;
+  cur = p + size;
+  return p;
+}
+
+char *Arena::new_block(size_t bytes) {
+  Block *block = static_cast<Block *>(std::malloc(sizeof(Block) + bytes));
+  if (!block)
+    throw std::bad_alloc();
+  block->next = blocks;
+  blocks = block;
+  _stats.num_of_blocks++;
+  _stats.bytes_reserved += sizeof(Block) + bytes;
+  return reinterpret_cast<char *>(block + 1);
+}
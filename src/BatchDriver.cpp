@@ -0,0 +1,45 @@
+#include "../include/BatchDriver.h"
+
+std::vector<ModuleResult>
+BatchDriver::compile(const std::vector<std::string> &file_names) {
+  std::vector<ModuleResult> results(file_names.size());
+  const uint32_t first_module = symbols.add_modules(file_names);
+  pool.parallel_for(file_names.size(), [&](size_t i) {
+    ModuleResult &result = results[i];
+    result.file_name = file_names[i];
+    try {
+      result.parser = std::make_unique<Parser>(result.file_name);
+      result.ast = result.parser->parse_module();
+    } catch (const std::logic_error &e) {
+      result.error = e.what();
+      return;
+    }
+    for (uint32_t node : result.ast.children_of(result.ast.root())) {
+      FlatKind kind = result.ast.nodes[node].kind;
+      if (kind == fk_def_var || kind == fk_def_func)
+        symbols.define(Symbol(result.ast.name_of(result.ast.nodes[node])),
+                       {uint32_t(first_module + i), node, kind});
+    }
+  });
+
+  // all definitions are in, the winners are final
+  pool.parallel_for(results.size(), [&](size_t i) {
+    ModuleResult &result = results[i];
+    if (!result.ok())
+      return;
+    for (uint32_t node : result.ast.children_of(result.ast.root())) {
+      const FlatNode &def = result.ast.nodes[node];
+      if (def.kind != fk_def_var && def.kind != fk_def_func)
+        continue;
+      std::string_view name = result.ast.name_of(def);
+      SymbolTable::Definition winner = *symbols.lookup(Symbol(name));
+      if (winner.module != first_module + i) {
+        result.error = "File: " + result.file_name + "\n" +
+                       std::string(name) + " is already defined in " +
+                       symbols.file_of(winner.module);
+        return;
+      }
+    }
+  });
+  return results;
+}
@@ -0,0 +1,183 @@
+#include "../include/CharScan.h"
+#include "../include/Lexer.h"
+
+#if defined(__SSE2__)
+#define PIECK_X86 1
+#include <immintrin.h>
+#endif
+
+// Scalar kernels, also used for the tails of the SIMD kernels
+
+static const char *skip_spaces_scalar(const char *p, const char *end) {
+  while (p < end && char_class(*p) == cc_space)
+    p++;
+  return p;
+}
+
+static const char *skip_alnum_scalar(const char *p, const char *end) {
+  while (p < end && (char_class(*p) == cc_alpha || char_class(*p) == cc_digit))
+    p++;
+  return p;
+}
+
+static const char *skip_digits_scalar(const char *p, const char *end) {
+  while (p < end && char_class(*p) == cc_digit)
+    p++;
+  return p;
+}
+
+static const char *find_string_end_scalar(const char *p, const char *end,
+                                          char delimiter) {
+  while (p < end && *p != delimiter && *p != '\n')
+    p++;
+  return p;
+}
+
+static const ScanKernels scalar_kernels = {
+    "scalar", skip_spaces_scalar, skip_alnum_scalar, skip_digits_scalar,
+    find_string_end_scalar};
+
+#ifdef PIECK_X86
+
+// The character classes below only contain ASCII characters, and bytes >= 0x80
+// are negative when compared as signed, so signed range checks are safe.
+
+// SSE2 is part of x86-64, so only AVX2 needs a target attribute.
+
+static inline __m128i in_range_sse2(__m128i x, char lo, char hi) {
+  return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(lo - 1)),
+                       _mm_cmplt_epi8(x, _mm_set1_epi8(hi + 1)));
+}
+
+static inline __m128i is_space_sse2(__m128i x) {
+  // \t \v \f \r are [9, 13] without \n
+  return _mm_or_si128(
+      _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+      _mm_andnot_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')),
+                       in_range_sse2(x, '\t', '\r')));
+}
+
+static inline __m128i is_digit_sse2(__m128i x) {
+  return in_range_sse2(x, '0', '9');
+}
+
+static inline __m128i is_alnum_sse2(__m128i x) {
+  // setting 0x20 maps 'A'-'Z' to 'a'-'z' and keeps the digits
+  __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+  return _mm_or_si128(in_range_sse2(lower, 'a', 'z'), is_digit_sse2(x));
+}
+
+// Run ${in_class} over 16 characters at a time until one of them is out of
+// the class.
+#define DEFINE_SSE2_SKIP(NAME, IN_CLASS, SCALAR)                               \
+  static const char *NAME(const char *p, const char *end) {                    \
+    while (end - p >= 16) {                                                    \
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));       \
+      unsigned mask = _mm_movemask_epi8(IN_CLASS(x)) ^ 0xFFFFu;                \
+      if (mask)                                                                \
+        return p + __builtin_ctz(mask);                                        \
+      p += 16;                                                                 \
+    }                                                                          \
+    return SCALAR(p, end);                                                     \
+  }
+
+DEFINE_SSE2_SKIP(skip_spaces_sse2, is_space_sse2, skip_spaces_scalar)
+DEFINE_SSE2_SKIP(skip_alnum_sse2, is_alnum_sse2, skip_alnum_scalar)
+DEFINE_SSE2_SKIP(skip_digits_sse2, is_digit_sse2, skip_digits_scalar)
+
+static const char *find_string_end_sse2(const char *p, const char *end,
+                                        char delimiter) {
+  const __m128i quote = _mm_set1_epi8(delimiter);
+  const __m128i newline = _mm_set1_epi8('\n');
+  while (end - p >= 16) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    unsigned mask = _mm_movemask_epi8(
+        _mm_or_si128(_mm_cmpeq_epi8(x, quote), _mm_cmpeq_epi8(x, newline)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 16;
+  }
+  return find_string_end_scalar(p, end, delimiter);
+}
+
+static const ScanKernels sse2_kernels = {"sse2", skip_spaces_sse2,
+                                         skip_alnum_sse2, skip_digits_sse2,
+                                         find_string_end_sse2};
+
+#define PIECK_AVX2 __attribute__((target("avx2")))
+
+PIECK_AVX2 static inline __m256i in_range_avx2(__m256i x, char lo, char hi) {
+  return _mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8(lo - 1)),
+                          _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), x));
+}
+
+PIECK_AVX2 static inline __m256i is_space_avx2(__m256i x) {
+  return _mm256_or_si256(
+      _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+      _mm256_andnot_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')),
+                          in_range_avx2(x, '\t', '\r')));
+}
+
+PIECK_AVX2 static inline __m256i is_digit_avx2(__m256i x) {
+  return in_range_avx2(x, '0', '9');
+}
+
+PIECK_AVX2 static inline __m256i is_alnum_avx2(__m256i x) {
+  __m256i lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+  return _mm256_or_si256(in_range_avx2(lower, 'a', 'z'), is_digit_avx2(x));
+}
+
+// Same as DEFINE_SSE2_SKIP with 32 characters at a time, the remaining 16-31
+// characters are left to the SSE2 kernel.
+#define DEFINE_AVX2_SKIP(NAME, IN_CLASS, SSE2)                                 \
+  PIECK_AVX2 static const char *NAME(const char *p, const char *end) {         \
+    while (end - p >= 32) {                                                    \
+      __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));    \
+      unsigned mask = ~unsigned(_mm256_movemask_epi8(IN_CLASS(x)));            \
+      if (mask)                                                                \
+        return p + __builtin_ctz(mask);                                        \
+      p += 32;                                                                 \
+    }                                                                          \
+    return SSE2(p, end);                                                       \
+  }
+
+DEFINE_AVX2_SKIP(skip_spaces_avx2, is_space_avx2, skip_spaces_sse2)
+DEFINE_AVX2_SKIP(skip_alnum_avx2, is_alnum_avx2, skip_alnum_sse2)
+DEFINE_AVX2_SKIP(skip_digits_avx2, is_digit_avx2, skip_digits_sse2)
+
+PIECK_AVX2 static const char *find_string_end_avx2(const char *p,
+                                                   const char *end,
+                                                   char delimiter) {
+  const __m256i quote = _mm256_set1_epi8(delimiter);
+  const __m256i newline = _mm256_set1_epi8('\n');
+  while (end - p >= 32) {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    unsigned mask = _mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_cmpeq_epi8(x, quote), _mm256_cmpeq_epi8(x, newline)));
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 32;
+  }
+  return find_string_end_sse2(p, end, delimiter);
+}
+
+static const ScanKernels avx2_kernels = {"avx2", skip_spaces_avx2,
+                                         skip_alnum_avx2, skip_digits_avx2,
+                                         find_string_end_avx2};
+
+#endif // PIECK_X86
+
+std::vector<const ScanKernels *> available_scan_kernels() {
+  std::vector<const ScanKernels *> kernels = {&scalar_kernels};
+#ifdef PIECK_X86
+  kernels.push_back(&sse2_kernels);
+  if (__builtin_cpu_supports("avx2"))
+    kernels.push_back(&avx2_kernels);
+#endif
+  return kernels;
+}
+
+const ScanKernels &scan_kernels() {
+  static const ScanKernels *fastest = available_scan_kernels().back();
+  return *fastest;
+}
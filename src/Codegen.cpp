@@ -0,0 +1,1246 @@
+#include "../include/Codegen.h"
+#include "../include/ASTVisitor.h"
+#include "../include/Casting.h"
+#include "../include/ConstantFolding.h"
+#include "../include/Error.h"
+#include "../include/Fusion.h"
+#include "../include/Kernels.h"
+#include "../include/MemoryPlanner.h"
+#include "../include/Parser.h"
+#include "../include/Runtime.h"
+#include "../include/Tensor.h"
+#include "../include/TypeInference.h"
+#include "../include/ViewFinder.h"
+#include <algorithm>
+#include <functional>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/Module.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/MC/SubtargetFeature.h>
+#include <llvm/MC/TargetRegistry.h>
+#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Target/TargetMachine.h>
+#include <llvm/Target/TargetOptions.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+// the name of the global of the constant tensor ${index}
+std::string constant_name(size_t index) {
+  return "tensor." + std::to_string(index);
+}
+
+// The state of the lowering of a module
+struct Lowering {
+  Lowering(TypeInference &types, llvm::Module &module,
+           std::vector<Tensor> &constants)
+      : types(types), module(module), context(module.getContext()),
+        constants(constants) {}
+
+  // a global that points to a buffer of ${n} doubles, allocated once by
+  // pieck_main
+  llvm::GlobalVariable *static_buffer(int64_t n) {
+    llvm::Type *type = llvm::Type::getDoublePtrTy(context);
+    auto *global = new llvm::GlobalVariable(
+        module, type, false, llvm::GlobalValue::InternalLinkage,
+        llvm::Constant::getNullValue(type), "buffer");
+    static_buffers.emplace_back(global, n);
+    return global;
+  }
+
+  TypeInference &types;
+  llvm::Module &module;
+  llvm::LLVMContext &context;
+  // the tensor literals, the globals constant_name(i) hold their elements
+  std::vector<Tensor> &constants;
+  // functions[i] is the function of types.specs[i]
+  std::vector<llvm::Function *> functions;
+  // the buffers allocated once and their sizes
+  std::vector<std::pair<llvm::GlobalVariable *, int64_t>> static_buffers;
+  // the functions that allocate and free the static buffers
+  llvm::Function *allocate_buffers = nullptr, *free_buffers = nullptr;
+};
+
+// A variable of a specialization while it is emitted
+struct Variable {
+  Shape shape;
+  // where the value is: a double for scalars, a pointer to the elements for
+  // tensors
+  llvm::Value *slot = nullptr;
+  // In the loops by reference over the variable, a pointer to the elements
+  // of the tensor of the loop it refers to
+  llvm::Value *pointer = nullptr;
+  // the elements of a tensor variable, none for the variable of a loop that
+  // points into the iterable
+  llvm::Value *buffer = nullptr;
+  // an i8, 1 once the variable is assigned
+  llvm::Value *set = nullptr;
+  // a global read by a function, which cannot assign it
+  bool global = false;
+};
+
+// A strided view of the elements of a tensor: the element at (i0, i1, ...)
+// is data[i0 * strides[0] + i1 * strides[1] + ...]
+struct View {
+  llvm::Value *data;
+  Shape shape;
+  std::vector<int64_t> strides;
+};
+
+// Emit the body of a specialization into its llvm::Function
+class FunctionEmitter : public ASTVisitor<FunctionEmitter> {
+public:
+  FunctionEmitter(Lowering &lowering, Specialization &spec)
+      : lowering(lowering), types(lowering.types), spec(spec),
+        function(lowering.functions[spec.index]), context(lowering.context),
+        builder(context), entry_builder(context) {
+    f64 = llvm::Type::getDoubleTy(context);
+    f64p = llvm::PointerType::getUnqual(f64);
+    i8 = llvm::Type::getInt8Ty(context);
+    i32 = llvm::Type::getInt32Ty(context);
+    i64 = llvm::Type::getInt64Ty(context);
+  }
+
+  void emit() {
+    llvm::BasicBlock *entry =
+        llvm::BasicBlock::Create(context, "entry", function);
+    llvm::BasicBlock *body =
+        llvm::BasicBlock::Create(context, "body", function);
+    exit = llvm::BasicBlock::Create(context, "exit", function);
+    builder.SetInsertPoint(entry);
+    builder.CreateBr(body);
+    entry_builder.SetInsertPoint(entry->getTerminator());
+    where = entry_builder.CreateGlobalStringPtr(types.name_of(spec));
+
+    auto arg = function->arg_begin();
+    ctx = &*arg++;
+    if (!spec.result.is_none() && !spec.result.is_scala())
+      out = &*arg++;
+    if (spec.result.is_scala())
+      result = entry_builder.CreateAlloca(f64, nullptr, "result");
+    if (types.top_level(spec))
+      entry_builder.CreateCall(lowering.allocate_buffers);
+    find_views();
+    declare_locals(arg);
+
+    builder.SetInsertPoint(body);
+    if (!types.top_level(spec)) {
+      llvm::BasicBlock *entered =
+          llvm::BasicBlock::Create(context, "entered", function);
+      llvm::Value *ok = call("pieck_enter", i32, {i8p(), i8p()},
+                             {ctx, where});
+      builder.CreateCondBr(builder.CreateICmpNE(ok, builder.getInt32(0)),
+                           entered, exit);
+      builder.SetInsertPoint(entered);
+    }
+    visit(types.body_of(spec));
+    builder.CreateBr(exit);
+    allocate();
+
+    builder.SetInsertPoint(exit);
+    for (llvm::Value *buffer : buffers)
+      call("pieck_free", builder.getVoidTy(), {f64p}, {buffer});
+    if (types.top_level(spec))
+      builder.CreateCall(lowering.free_buffers);
+    else
+      call("pieck_leave", builder.getVoidTy(), {i8p()}, {ctx});
+    if (result)
+      builder.CreateRet(builder.CreateLoad(f64, result));
+    else
+      builder.CreateRetVoid();
+  }
+
+  // Stmts
+  void visit_CompoundStmt(CompoundStmt *stmt) { visit_chain(stmt->stmts()); }
+  void visit_ReturnStmt(ReturnStmt *stmt) {
+    if (stmt->expr) {
+      StaticShape value = shape_of(stmt->expr);
+      if (types.top_level(spec) || value.is_none())
+        evaluate(stmt->expr);
+      else if (value.is_scala())
+        builder.CreateStore(scala(stmt->expr), result);
+      else
+        copy(out, tensor(stmt->expr, out), value.shape);
+    }
+    builder.CreateBr(exit);
+    // what follows a return is never run
+    builder.SetInsertPoint(llvm::BasicBlock::Create(context, "dead", function));
+  }
+  void visit_LoopStmt(LoopStmt *stmt) {
+    known(shape_of(stmt->iterable), "the loop");
+    Variable &var = variable(stmt->var);
+    // A body that assigns the variable the iterable is a view of would write
+    // over the sub-tensors still to come, so the loop runs over a copy of
+    // its elements, which the variable points to until it is assigned
+    Variable *rebound = nullptr;
+    llvm::Value *iterated = nullptr;
+    VarExpr *root = dyn_cast<VarExpr>(IndexExpr::root_of(stmt->iterable));
+    if (root && !is_reference(root->var_name)) {
+      Summary body;
+      body.visit_chain(stmt->body);
+      if (body.binds.count(root->var_name.id())) {
+        llvm::Value *elements = tensor(root);
+        rebound = &variable(root->var_name);
+        iterated = new_buffer(rebound->shape.num_of_elements());
+        copy(iterated, elements, rebound->shape);
+        builder.CreateStore(iterated, rebound->slot);
+      }
+    }
+    View iterable = view_of(stmt->iterable);
+    if (stmt->by_reference &&
+        isa<ValueExpr>(IndexExpr::root_of(stmt->iterable))) {
+      // the constant of a literal is not written through a reference
+      llvm::Value *copied = new_buffer(iterable.shape.num_of_elements());
+      gather(copied, iterable);
+      iterable = {copied, iterable.shape,
+                  Tensor::row_major_strides(iterable.shape)};
+    }
+    const Shape element = iterable.shape.drop_front();
+    const std::vector<int64_t> strides(iterable.strides.begin() + 1,
+                                       iterable.strides.end());
+    const bool contiguous = Tensor::is_row_major(element, strides);
+    if (stmt->by_reference && !contiguous)
+      ERROR("Cannot loop by reference over strided sub-tensors in " +
+            types.name_of(spec));
+    // the variable points into the iterable, or holds a copy of every
+    // sub-tensor in its buffer
+    const bool view =
+        views.count(stmt) && contiguous && element.dims_dim() > 0;
+    if (!stmt->by_reference && !view && element.dims_dim() > 0 &&
+        !var.buffer)
+      var.buffer = new_buffer(element.num_of_elements());
+    if (stmt->by_reference)
+      references.push_back(stmt->var);
+    planner.enter_loop(iterable.shape[0]);
+    for_each(iterable.shape[0], [&](llvm::Value *i) {
+      llvm::Value *sub = builder.CreateInBoundsGEP(
+          f64, iterable.data,
+          builder.CreateMul(i, builder.getInt64(iterable.strides[0])));
+      if (stmt->by_reference) {
+        builder.CreateStore(sub, var.pointer);
+      } else if (element.dims_dim() == 0) {
+        builder.CreateStore(builder.CreateLoad(f64, sub), var.slot);
+      } else if (view) {
+        builder.CreateStore(sub, var.slot);
+      } else {
+        if (contiguous)
+          copy(var.buffer, sub, element);
+        else
+          gather(var.buffer, View{sub, element, strides});
+        builder.CreateStore(var.buffer, var.slot);
+      }
+      builder.CreateStore(builder.getInt8(1), var.set);
+      visit_chain(stmt->body);
+    });
+    planner.leave_loop();
+    // the elements are read by every iteration
+    planner.tick();
+    use(iterable.data);
+    if (rebound) {
+      use(iterated);
+      // the variable is still the copy if the body never assigned it
+      copy(rebound->buffer, builder.CreateLoad(f64p, rebound->slot),
+           rebound->shape);
+      builder.CreateStore(rebound->buffer, rebound->slot);
+    }
+    if (stmt->by_reference)
+      references.pop_back();
+  }
+  void visit_PrintStmt(PrintStmt *stmt) {
+    StaticShape value = known(shape_of(stmt->expr), "the printed value");
+    if (value.is_none()) {
+      evaluate(stmt->expr);
+      call("pieck_print_none", builder.getVoidTy(), {i8p()}, {ctx});
+    } else if (value.is_scala()) {
+      call("pieck_print_scala", builder.getVoidTy(), {i8p(), f64},
+           {ctx, scala(stmt->expr)});
+    } else {
+      llvm::Value *elements = tensor(stmt->expr);
+      planner.tick();
+      use(elements);
+      call("pieck_print_tensor", builder.getVoidTy(),
+           {i8p(), f64p, i32, llvm::PointerType::getUnqual(i32)},
+           {ctx, elements, builder.getInt32(value.shape.dims_dim()),
+            dims_of(value.shape)});
+    }
+  }
+  void visit_DefVarStmt(DefVarStmt *stmt) {
+    const Symbol name = stmt->identifier_name;
+    Variable &var = variable(name);
+    ASSERT(!var.global, "Lowering: a function assigns the global " +
+                            std::string(name.str()));
+    const StaticShape value = shape_of(stmt->rhs);
+    if (is_reference(name)) {
+      llvm::Value *elements = builder.CreateLoad(f64p, var.pointer);
+      if (value.is_scala())
+        fill(elements, scala(stmt->rhs), var.shape.num_of_elements());
+      else
+        copy(elements, tensor(stmt->rhs), var.shape);
+      return;
+    }
+    if (var.shape.dims_dim() == 0) {
+      builder.CreateStore(scala(stmt->rhs), var.slot);
+    } else {
+      llvm::Value *dest =
+          writes_in_place(stmt->rhs, name) ? var.buffer : nullptr;
+      copy(var.buffer, tensor(stmt->rhs, dest), var.shape);
+      builder.CreateStore(var.buffer, var.slot);
+    }
+    builder.CreateStore(builder.getInt8(1), var.set);
+  }
+
+private:
+  // Whether ${rhs} may write the variable ${name} directly. An element-wise
+  // op reads every element before it writes it (see emit_fused), but a
+  // matmul clears its result first, and a callee writes its result while it
+  // may still read its args and the globals.
+  bool writes_in_place(Expr *rhs, Symbol name) {
+    if (BinaryOpExpr *binary = dyn_cast<BinaryOpExpr>(rhs))
+      return binary->op != BinaryOpExpr::matmul;
+    CallExpr *call = dyn_cast<CallExpr>(rhs);
+    if (!call)
+      return true;
+    if (types.globals.count(name.id()))
+      return false;
+    for (int32_t i = 0; i < call->num_of_args; i++) {
+      VarExpr *root = dyn_cast<VarExpr>(IndexExpr::root_of(call->args[i]));
+      if (root && (root->var_name.id() == name.id() ||
+                   is_reference(root->var_name)))
+        return false;
+    }
+    return true;
+  }
+
+  // Exprs
+  StaticShape shape_of(Expr *expr) { return types.shape_of(spec, expr); }
+  StaticShape known(StaticShape shape, const std::string &what) {
+    if (!shape.known())
+      ERROR("Cannot infer the shape of " + what + " in " +
+            types.name_of(spec));
+    return shape;
+  }
+
+  // evaluate ${expr} for what it does, such as the calls in it
+  void evaluate(Expr *expr) {
+    StaticShape value = known(shape_of(expr), "a value");
+    if (value.is_none())
+      emit_call(cast<CallExpr>(expr), nullptr);
+    else if (value.is_scala())
+      scala(expr);
+    else
+      tensor(expr);
+  }
+
+  // the value of the scalar ${expr}
+  llvm::Value *scala(Expr *expr) {
+    if (ValueExpr *value = dyn_cast<ValueExpr>(expr))
+      return llvm::ConstantFP::get(f64, cast<ScalaValue>(value->val)->val);
+    if (VarExpr *var = dyn_cast<VarExpr>(expr)) {
+      Variable &variable = read(var->var_name);
+      if (is_reference(var->var_name))
+        return builder.CreateLoad(f64,
+                                  builder.CreateLoad(f64p, variable.pointer));
+      return builder.CreateLoad(f64, variable.slot);
+    }
+    if (CallExpr *call = dyn_cast<CallExpr>(expr))
+      return emit_call(call, nullptr);
+    if (IndexExpr *index = dyn_cast<IndexExpr>(expr)) {
+      View view = view_of(index);
+      planner.tick();
+      use(view.data);
+      return builder.CreateLoad(f64, view.data);
+    }
+    // the transpose of a scalar is the scalar
+    if (TransposeExpr *transpose = dyn_cast<TransposeExpr>(expr))
+      return scala(transpose->operand);
+    BinaryOpExpr *binary = cast<BinaryOpExpr>(expr);
+    if (binary->op == BinaryOpExpr::matmul) {
+      // vector @ vector
+      llvm::Value *dot = new_buffer(1);
+      emit_matmul(binary, dot);
+      planner.tick();
+      use(dot);
+      return builder.CreateLoad(f64, dot);
+    }
+    llvm::Value *lhs = scala(binary->lhs);
+    llvm::Value *rhs = scala(binary->rhs);
+    return arithmetic(binary->op, lhs, rhs);
+  }
+
+  // The elements of the tensor ${expr}. An expression that computes new
+  // elements writes them into ${dest} if it is given.
+  llvm::Value *tensor(Expr *expr, llvm::Value *dest = nullptr) {
+    const Shape shape = known(shape_of(expr), "a tensor").shape;
+    if (ValueExpr *value = dyn_cast<ValueExpr>(expr))
+      return constant(value->val);
+    if (VarExpr *var = dyn_cast<VarExpr>(expr)) {
+      Variable &variable = read(var->var_name);
+      if (is_reference(var->var_name))
+        return builder.CreateLoad(f64p, variable.pointer);
+      llvm::Value *elements = builder.CreateLoad(f64p, variable.slot);
+      // the elements are those of the buffer of the variable once it is
+      // assigned
+      if (variable.buffer)
+        owners[elements] = owners.at(variable.buffer);
+      return elements;
+    }
+    if (isa<IndexExpr>(expr) || isa<TransposeExpr>(expr)) {
+      // a view that skips or permutes elements is gathered into a buffer of
+      // its own, as ${dest} may be the tensor it is a view of
+      View view = view_of(expr);
+      if (Tensor::is_row_major(view.shape, view.strides))
+        return view.data;
+      llvm::Value *gathered = new_buffer(shape.num_of_elements());
+      gather(gathered, view);
+      return gathered;
+    }
+    if (!dest)
+      dest = new_buffer(shape.num_of_elements());
+    if (CallExpr *call = dyn_cast<CallExpr>(expr))
+      return emit_call(call, dest);
+    BinaryOpExpr *binary = cast<BinaryOpExpr>(expr);
+    if (binary->op != BinaryOpExpr::matmul)
+      return emit_fused(binary, dest, shape);
+    emit_matmul(binary, dest);
+    return dest;
+  }
+
+  // The view ${expr} is. The subscripts of an IndexExpr move the pointer to
+  // the elements of its base and drop or narrow its dims, a TransposeExpr
+  // reverses the dims and the strides of its operand, so no element is
+  // copied; other tensors are contiguous.
+  View view_of(Expr *expr) {
+    const Shape shape = known(shape_of(expr), "a tensor").shape;
+    if (TransposeExpr *transpose = dyn_cast<TransposeExpr>(expr)) {
+      View view = view_of(transpose->operand);
+      view.shape = shape;
+      std::reverse(view.strides.begin(), view.strides.end());
+      return view;
+    }
+    IndexExpr *index = dyn_cast<IndexExpr>(expr);
+    if (!index)
+      return {tensor(expr), shape, Tensor::row_major_strides(shape)};
+    const View base = view_of(index->base);
+    View view{nullptr, shape, {}};
+    llvm::Value *offset = builder.getInt64(0);
+    for (int32_t dim = 0; dim < base.shape.dims_dim(); dim++) {
+      const int64_t stride = base.strides[dim];
+      if (dim >= index->num_of_subscripts) {
+        view.strides.push_back(stride);
+        continue;
+      }
+      const IndexExpr::Subscript &subscript = index->subscripts[dim];
+      llvm::Value *first = builder.getInt64(0);
+      if (!subscript.is_range)
+        first = index_value(subscript.begin, base.shape[dim]);
+      else if (subscript.begin)
+        first = builder.getInt64(literal(subscript.begin));
+      offset = builder.CreateAdd(
+          offset, builder.CreateMul(first, builder.getInt64(stride)));
+      if (subscript.is_range)
+        view.strides.push_back(stride);
+    }
+    view.data = builder.CreateInBoundsGEP(f64, base.data, offset);
+    // the view is read and written where the elements of the base are
+    auto owner = owners.find(base.data);
+    if (owner != owners.end())
+      owners[view.data] = owner->second;
+    return view;
+  }
+  // the literal integer ${expr}, which TypeInference checked
+  int64_t literal(Expr *expr) {
+    return int64_t(cast<ScalaValue>(cast<ValueExpr>(expr)->val)->val);
+  }
+  // the index ${expr} into a dim of ${n} as an i64, the call fails if it is
+  // out of range
+  llvm::Value *index_value(Expr *expr, int64_t n) {
+    if (isa<ValueExpr>(expr))
+      return builder.getInt64(literal(expr));
+    llvm::Value *index = call("pieck_index", i64, {i8p(), i8p(), f64, i64},
+                              {ctx, where, scala(expr), builder.getInt64(n)});
+    llvm::BasicBlock *ok =
+        llvm::BasicBlock::Create(context, "index.ok", function);
+    builder.CreateCondBr(builder.CreateICmpSLT(index, builder.getInt64(0)),
+                         exit, ok);
+    builder.SetInsertPoint(ok);
+    return index;
+  }
+  // copy the elements of ${view} into ${dest} in row-major order
+  void gather(llvm::Value *dest, const View &view) {
+    planner.tick();
+    use(view.data);
+    def(dest, false);
+    gather_dims(dest, view, 0, builder.getInt64(0), builder.getInt64(0));
+  }
+  void gather_dims(llvm::Value *dest, const View &view, int32_t dim,
+                   llvm::Value *from, llvm::Value *to) {
+    if (dim == view.shape.dims_dim()) {
+      llvm::Value *element = builder.CreateLoad(
+          f64, builder.CreateInBoundsGEP(f64, view.data, from));
+      builder.CreateStore(element, builder.CreateInBoundsGEP(f64, dest, to));
+      return;
+    }
+    const int64_t size = Tensor::row_major_strides(view.shape)[dim];
+    for_each(view.shape[dim], [&](llvm::Value *i) {
+      llvm::Value *step = builder.getInt64(view.strides[dim]);
+      gather_dims(dest, view, dim + 1,
+                  builder.CreateAdd(from, builder.CreateMul(i, step)),
+                  builder.CreateAdd(to, builder.CreateMul(
+                                            i, builder.getInt64(size))));
+    });
+  }
+
+  // One loop over the elements of ${shape} for the whole tree of
+  // element-wise ops at ${expr}: the leaves are evaluated first, left to
+  // right. A leaf that is a view is read in place through its strides, and
+  // one broadcast to ${shape} through a stride of 0 along the dims it is
+  // stretched over, so neither is copied. Return the elements written, which
+  // are those of a new buffer instead of ${dest} if a leaf reads the
+  // elements of ${dest} at other indices.
+  llvm::Value *emit_fused(BinaryOpExpr *expr, llvm::Value *dest,
+                          const Shape &shape) {
+    std::vector<Expr *> leaves;
+    Fusion fusion = Fusion::of(expr, leaves);
+    std::vector<llvm::Value *> inputs;
+    std::vector<bool> scalas;
+    // the strides of the inputs along the dims of ${shape}
+    std::vector<std::vector<int64_t>> strides;
+    const std::vector<int64_t> out_strides = Tensor::row_major_strides(shape);
+    // the inputs are not all read at the index of the element they make
+    bool strided = false;
+    // the inputs read at other indices than the element they make, such as
+    // permuted and broadcast views
+    std::vector<llvm::Value *> stretched;
+    bool aliased = false;
+    for (Expr *leaf : leaves) {
+      const bool is_scala = shape_of(leaf).is_scala();
+      scalas.push_back(is_scala);
+      if (is_scala) {
+        inputs.push_back(scala(leaf));
+        strides.emplace_back();
+        continue;
+      }
+      const View view = view_of(leaf);
+      inputs.push_back(view.data);
+      strides.push_back(
+          Tensor::broadcast_strides(view.shape, view.strides, shape));
+      strided = strided || strides.back() != out_strides;
+      if (strides.back() != out_strides) {
+        stretched.push_back(view.data);
+        aliased = aliased || may_alias(view.data, dest);
+      }
+    }
+    if (aliased)
+      dest = new_buffer(shape.num_of_elements());
+    planner.tick();
+    for (llvm::Value *input : inputs)
+      use(input);
+    def(dest, true);
+    // ${dest} may only reuse the buffer of an input read at the same index,
+    // the others are read until the last element is written
+    planner.tick();
+    for (llvm::Value *input : stretched)
+      use(input);
+    // the element of the result at ${out}, the inputs at ${offsets}
+    auto element = [&](const std::vector<llvm::Value *> &offsets,
+                       llvm::Value *out) {
+      std::vector<llvm::Value *> stack;
+      for (const Fusion::Step &step : fusion.steps) {
+        if (step.kind == Fusion::Step::sk_input) {
+          llvm::Value *input = inputs[step.index];
+          stack.push_back(scalas[step.index]
+                              ? input
+                              : builder.CreateLoad(
+                                    f64, builder.CreateInBoundsGEP(
+                                             f64, input, offsets[step.index])));
+        } else if (step.kind == Fusion::Step::sk_constant) {
+          stack.push_back(llvm::ConstantFP::get(f64, step.constant_value));
+        } else {
+          llvm::Value *rhs = stack.back();
+          stack.pop_back();
+          stack.back() =
+              arithmetic(BinaryOpExpr::OP(step.op), stack.back(), rhs);
+        }
+      }
+      builder.CreateStore(stack.back(),
+                          builder.CreateInBoundsGEP(f64, dest, out));
+    };
+    if (!strided) {
+      for_each(shape.num_of_elements(), [&](llvm::Value *i) {
+        element(std::vector<llvm::Value *>(inputs.size(), i), i);
+      });
+      return dest;
+    }
+    // a loop per dim, the offsets advance by the strides of the dim
+    std::function<void(int32_t, std::vector<llvm::Value *>, llvm::Value *)>
+        loops = [&](int32_t dim, std::vector<llvm::Value *> offsets,
+                    llvm::Value *out) {
+          if (dim == shape.dims_dim()) {
+            element(offsets, out);
+            return;
+          }
+          for_each(shape[dim], [&](llvm::Value *i) {
+            std::vector<llvm::Value *> next(offsets.size());
+            for (size_t input = 0; input < offsets.size(); input++) {
+              if (scalas[input])
+                continue;
+              next[input] = builder.CreateAdd(
+                  offsets[input],
+                  builder.CreateMul(i,
+                                    builder.getInt64(strides[input][dim])));
+            }
+            loops(dim + 1, next,
+                  builder.CreateAdd(
+                      out, builder.CreateMul(
+                               i, builder.getInt64(out_strides[dim]))));
+          });
+        };
+    loops(0, std::vector<llvm::Value *>(inputs.size(), builder.getInt64(0)),
+          builder.getInt64(0));
+    return dest;
+  }
+
+  void emit_matmul(BinaryOpExpr *expr, llvm::Value *dest) {
+    const Shape lhs_shape = shape_of(expr->lhs).shape;
+    const Shape rhs_shape = shape_of(expr->rhs).shape;
+    bool lhs_transposed = false, rhs_transposed = false;
+    llvm::Value *lhs = matrix(expr->lhs, lhs_transposed);
+    llvm::Value *rhs = matrix(expr->rhs, rhs_transposed);
+    planner.tick();
+    use(lhs);
+    use(rhs);
+    def(dest, false);
+    // a vector on the left is a row, on the right a column
+    const int64_t m = lhs_shape.dims_dim() == 2 ? lhs_shape[0] : 1;
+    const int64_t k = lhs_shape[lhs_shape.dims_dim() - 1];
+    const int64_t n = rhs_shape.dims_dim() == 2 ? rhs_shape[1] : 1;
+    call("pieck_matmul", builder.getVoidTy(),
+         {f64p, f64p, f64p, i64, i64, i64, i32, i32},
+         {lhs, rhs, dest, builder.getInt64(m), builder.getInt64(n),
+          builder.getInt64(k), builder.getInt32(lhs_transposed),
+          builder.getInt32(rhs_transposed)});
+  }
+  // The elements of the operand ${expr} of a matmul. A matrix transposed by
+  // .T is read in place and sets ${transposed}, the kernel reads it by
+  // columns; other views that skip elements are gathered as in tensor().
+  llvm::Value *matrix(Expr *expr, bool &transposed) {
+    View view = view_of(expr);
+    if (Tensor::is_row_major(view.shape, view.strides))
+      return view.data;
+    if (view.shape.dims_dim() == 2 &&
+        Tensor::is_transposed(view.shape, view.strides)) {
+      transposed = true;
+      return view.data;
+    }
+    llvm::Value *gathered = new_buffer(view.shape.num_of_elements());
+    gather(gathered, view);
+    return gathered;
+  }
+
+  // Call the specialization of the callee of ${expr}, a tensor it returns is
+  // written into ${dest}. Return what it returns.
+  llvm::Value *emit_call(CallExpr *expr, llvm::Value *dest) {
+    std::vector<Shape> shapes;
+    for (int32_t i = 0; i < expr->num_of_args; i++)
+      shapes.push_back(known(shape_of(expr->args[i]), "an argument").shape);
+    Specialization &callee = types.specs[spec.callees.at(expr)];
+    known(callee.result, "the value of " + types.name_of(callee));
+    std::vector<llvm::Value *> args = {ctx};
+    if (!callee.result.is_none() && !callee.result.is_scala()) {
+      if (!dest)
+        dest = new_buffer(callee.result.shape.num_of_elements());
+      args.push_back(dest);
+    }
+    for (int32_t i = 0; i < expr->num_of_args; i++) {
+      args.push_back(shapes[i].dims_dim() == 0 ? scala(expr->args[i])
+                                               : tensor(expr->args[i]));
+    }
+    planner.tick();
+    for (size_t i = args.size() - expr->num_of_args; i < args.size(); i++)
+      use(args[i]);
+    // the callee may read the globals
+    if (types.top_level(spec)) {
+      for (SymbolID global : types.globals) {
+        llvm::Value *buffer = variables.at(global).buffer;
+        if (buffer)
+          use(buffer);
+      }
+    }
+    if (dest)
+      def(dest, false);
+    llvm::Value *value =
+        builder.CreateCall(lowering.functions[callee.index], args);
+    // the callee failed, so does the caller
+    llvm::BasicBlock *ok =
+        llvm::BasicBlock::Create(context, "call.ok", function);
+    llvm::Value *failed = call("pieck_failed", i32, {i8p()}, {ctx});
+    builder.CreateCondBr(builder.CreateICmpNE(failed, builder.getInt32(0)),
+                         exit, ok);
+    builder.SetInsertPoint(ok);
+    return callee.result.is_scala() ? value : dest;
+  }
+
+  llvm::Value *arithmetic(BinaryOpExpr::OP op, llvm::Value *lhs,
+                          llvm::Value *rhs) {
+    switch (op) {
+    case BinaryOpExpr::add:
+      return builder.CreateFAdd(lhs, rhs);
+    case BinaryOpExpr::sub:
+      return builder.CreateFSub(lhs, rhs);
+    case BinaryOpExpr::mul:
+      return builder.CreateFMul(lhs, rhs);
+    case BinaryOpExpr::div:
+      return builder.CreateFDiv(lhs, rhs);
+    case BinaryOpExpr::matmul:
+      break;
+    }
+    ERROR("arithmetic: @ is not an element-wise operator.");
+  }
+
+  // Variables
+  void declare_locals(llvm::Function::arg_iterator arg) {
+    std::unordered_set<SymbolID> params;
+    if (!types.top_level(spec)) {
+      const FunctionInfo &info = types.functions[spec.function];
+      for (int32_t i = 0; i < info.def->num_of_params; i++) {
+        Variable &var = declare(info.def->params[i]);
+        entry_builder.CreateStore(&*arg++, var.slot);
+        entry_builder.CreateStore(entry_builder.getInt8(1), var.set);
+        params.insert(info.def->params[i].id());
+      }
+    }
+    for (auto &[id, shape] : spec.shapes) {
+      if (!params.count(id))
+        declare(Symbol::from_id(id));
+    }
+  }
+
+  // the variable of the local ${name}, allocated in the entry block
+  Variable &declare(Symbol name) {
+    StaticShape shape = spec.shapes.at(name.id());
+    if (!shape.known())
+      ERROR("Cannot infer the shape of " + std::string(name.str()) + " in " +
+            types.name_of(spec));
+    Variable &var = variables[name.id()];
+    var.shape = shape.shape;
+    const bool pointer = var.shape.dims_dim() > 0;
+    if (spec.references.count(name.id()))
+      var.pointer = entry_builder.CreateAlloca(f64p);
+    if (types.top_level(spec) && types.globals.count(name.id())) {
+      var.slot = global_slot(name, pointer);
+      var.set = global_set(name);
+    } else {
+      var.slot = entry_builder.CreateAlloca(pointer ? f64p : f64, nullptr,
+                                            std::string(name.str()));
+      var.set = entry_builder.CreateAlloca(i8);
+      entry_builder.CreateStore(entry_builder.getInt8(0), var.set);
+    }
+    const bool assigned =
+        types.top_level(spec) ||
+        types.functions[spec.function].assigned.count(name.id());
+    // the buffer of the variable of a loop that may make it a view is made
+    // by the loop if it does not
+    if (var.shape.dims_dim() > 0 && assigned && !viewed.count(name.id()))
+      var.buffer = new_buffer(var.shape.num_of_elements());
+    return var;
+  }
+
+  Variable &variable(Symbol name) {
+    auto it = variables.find(name.id());
+    if (it != variables.end())
+      return it->second;
+    // a global read by a function
+    ASSERT(!types.top_level(spec) && types.globals.count(name.id()),
+           "Lowering: " + std::string(name.str()) + " is not declared.");
+    Variable &var = variables[name.id()];
+    StaticShape shape = types.specs[0].shapes.at(name.id());
+    var.shape = shape.shape;
+    var.slot = global_slot(name, var.shape.dims_dim() > 0);
+    var.set = global_set(name);
+    var.global = true;
+    return var;
+  }
+
+  // the loops whose variable may be a view, see ViewFinder
+  void find_views() {
+    std::unordered_set<SymbolID> pinned;
+    if (types.top_level(spec)) {
+      pinned = types.globals;
+    } else {
+      const FunctionInfo &info = types.functions[spec.function];
+      for (int32_t i = 0; i < info.def->num_of_params; i++)
+        pinned.insert(info.def->params[i].id());
+    }
+    views = ViewFinder(types.body_of(spec), pinned, spec.references).loops;
+    for (LoopStmt *loop : views)
+      viewed.insert(loop->var.id());
+  }
+
+  // the variable ${name}, which fails the call if it is not assigned yet
+  Variable &read(Symbol name) {
+    Variable &var = variable(name);
+    llvm::BasicBlock *unset =
+        llvm::BasicBlock::Create(context, "unset", function);
+    llvm::BasicBlock *set = llvm::BasicBlock::Create(context, "set", function);
+    builder.CreateCondBr(builder.CreateICmpEQ(builder.CreateLoad(i8, var.set),
+                                              builder.getInt8(0)),
+                         unset, set);
+    builder.SetInsertPoint(unset);
+    call("pieck_fail", builder.getVoidTy(), {i8p(), i8p(), i8p()},
+         {ctx, where,
+          builder.CreateGlobalStringPtr(std::string(name.str()) +
+                                  " is read before it is assigned")});
+    builder.CreateBr(exit);
+    builder.SetInsertPoint(set);
+    return var;
+  }
+
+  llvm::GlobalVariable *global_slot(Symbol name, bool pointer) {
+    const std::string symbol = "global." + std::string(name.str());
+    if (llvm::GlobalVariable *global = lowering.module.getNamedGlobal(symbol))
+      return global;
+    llvm::Type *type = pointer ? static_cast<llvm::Type *>(f64p) : f64;
+    return new llvm::GlobalVariable(lowering.module, type, false,
+                                    llvm::GlobalValue::InternalLinkage,
+                                    llvm::Constant::getNullValue(type), symbol);
+  }
+  llvm::GlobalVariable *global_set(Symbol name) {
+    const std::string symbol = "global." + std::string(name.str()) + ".set";
+    if (llvm::GlobalVariable *global = lowering.module.getNamedGlobal(symbol))
+      return global;
+    return new llvm::GlobalVariable(
+        lowering.module, i8, false, llvm::GlobalValue::InternalLinkage,
+        llvm::ConstantInt::get(i8, 0), symbol);
+  }
+
+  // Memory
+  // A buffer of ${n} doubles. Its memory is given once the body is emitted,
+  // see allocate().
+  llvm::Value *new_buffer(int64_t n) {
+    llvm::LoadInst *buffer = entry_builder.CreateLoad(
+        f64p, llvm::UndefValue::get(llvm::PointerType::getUnqual(f64p)));
+    owners[buffer] = planner.add_buffer(n);
+    placeholders.push_back(buffer);
+    return buffer;
+  }
+  // ${elements} is read at the current point of the MemoryPlanner, if it is
+  // a buffer of the call
+  void use(llvm::Value *elements) {
+    auto it = owners.find(elements);
+    if (it != owners.end())
+      planner.use(it->second);
+  }
+  void def(llvm::Value *elements, bool in_place) {
+    auto it = owners.find(elements);
+    if (it != owners.end())
+      planner.def(it->second, in_place);
+  }
+  // ${a} and ${b} may be elements of the same buffer. The elements of no
+  // buffer, such as the params and the result of a call, may be shared by
+  // the caller.
+  bool may_alias(llvm::Value *a, llvm::Value *b) const {
+    auto lhs = owners.find(a), rhs = owners.find(b);
+    if (lhs == owners.end() || rhs == owners.end())
+      return lhs == rhs;
+    return lhs->second == rhs->second;
+  }
+  // Give the buffers the slots the MemoryPlanner plans. The shapes are known
+  // statically, so a specialization that is never active twice at once gets
+  // slots that are allocated once for the whole run. The slots of the others
+  // are allocated when the call starts and freed when it returns.
+  void allocate() {
+    const MemoryPlanner::Plan plan = planner.plan();
+    llvm::BasicBlock &entry = function->getEntryBlock();
+    llvm::IRBuilder<> first(&entry, entry.getFirstInsertionPt());
+    std::vector<llvm::Value *> slots;
+    for (int64_t size : plan.slot_sizes) {
+      if (!spec.recursive) {
+        slots.push_back(lowering.static_buffer(size));
+        continue;
+      }
+      llvm::FunctionType *type = llvm::FunctionType::get(f64p, {i64}, false);
+      slots.push_back(first.CreateCall(
+          lowering.module.getOrInsertFunction("pieck_alloc", type),
+          {first.getInt64(size)}));
+      buffers.push_back(slots.back());
+    }
+    for (size_t i = 0; i < placeholders.size(); i++) {
+      llvm::Value *slot = slots[plan.slot_of[i]];
+      if (!spec.recursive) {
+        placeholders[i]->setOperand(0, slot);
+      } else {
+        placeholders[i]->replaceAllUsesWith(slot);
+        placeholders[i]->eraseFromParent();
+      }
+    }
+  }
+  // copy the elements of a tensor of ${shape} from ${src} to ${dest}, which
+  // may overlap
+  void copy(llvm::Value *dest, llvm::Value *src, const Shape &shape) {
+    if (dest == src)
+      return;
+    planner.tick();
+    use(src);
+    def(dest, true);
+    builder.CreateMemMove(dest, llvm::MaybeAlign(8), src, llvm::MaybeAlign(8),
+                    sizeof(double) * shape.num_of_elements());
+  }
+  void fill(llvm::Value *dest, llvm::Value *value, int64_t n) {
+    for_each(n, [&](llvm::Value *i) {
+      builder.CreateStore(value, builder.CreateInBoundsGEP(f64, dest, i));
+    });
+  }
+  llvm::Value *constant(Value *value) {
+    auto it = constants.find(value);
+    if (it != constants.end())
+      return it->second;
+    if (PackedTensorValue *packed = dyn_cast<PackedTensorValue>(value)) {
+      lowering.constants.push_back(
+          Tensor::copy_of(packed->shape(), packed->data));
+    } else {
+      Arena scratch;
+      PackedTensorValue *tree =
+          PackedTensorValue::pack(scratch, cast<TensorValue>(value));
+      lowering.constants.push_back(Tensor::copy_of(tree->shape(), tree->data));
+    }
+    const Tensor &tensor = lowering.constants.back();
+    llvm::Constant *array = llvm::ConstantDataArray::get(
+        context, llvm::ArrayRef<double>(tensor.data(),
+                                        tensor.num_of_elements()));
+    auto *global = new llvm::GlobalVariable(
+        lowering.module, array->getType(), true,
+        llvm::GlobalValue::PrivateLinkage, array,
+        constant_name(lowering.constants.size() - 1));
+    global->setAlignment(llvm::Align(Tensor::alignment));
+    llvm::Constant *zero = llvm::ConstantInt::get(i64, 0);
+    llvm::Constant *first = llvm::ConstantExpr::getInBoundsGetElementPtr(
+        array->getType(), global, llvm::ArrayRef<llvm::Constant *>{zero, zero});
+    constants.emplace(value, first);
+    return first;
+  }
+  llvm::Value *dims_of(const Shape &shape) {
+    std::vector<int32_t> dims(shape.dims(), shape.dims() + shape.dims_dim());
+    llvm::Constant *array = llvm::ConstantDataArray::get(context, dims);
+    auto *global = new llvm::GlobalVariable(
+        lowering.module, array->getType(), true,
+        llvm::GlobalValue::PrivateLinkage, array, "dims");
+    llvm::Constant *zero = llvm::ConstantInt::get(i64, 0);
+    return llvm::ConstantExpr::getInBoundsGetElementPtr(
+        array->getType(), global, llvm::ArrayRef<llvm::Constant *>{zero, zero});
+  }
+
+  // Control flow
+  // run ${body} for i in [0, ${n}), i is an i64
+  void for_each(int64_t n, const std::function<void(llvm::Value *)> &body) {
+    if (n <= 0)
+      return;
+    llvm::BasicBlock *before = builder.GetInsertBlock();
+    llvm::BasicBlock *loop =
+        llvm::BasicBlock::Create(context, "loop", function);
+    llvm::BasicBlock *after =
+        llvm::BasicBlock::Create(context, "loop.end", function);
+    builder.CreateBr(loop);
+    builder.SetInsertPoint(loop);
+    llvm::PHINode *i = builder.CreatePHI(i64, 2, "i");
+    i->addIncoming(builder.getInt64(0), before);
+    body(i);
+    llvm::Value *next = builder.CreateAdd(i, builder.getInt64(1));
+    i->addIncoming(next, builder.GetInsertBlock());
+    builder.CreateCondBr(builder.CreateICmpSLT(next, builder.getInt64(n)), loop,
+                         after);
+    builder.SetInsertPoint(after);
+  }
+  void visit_chain(StmtChain *chain) {
+    for (StmtChain *link = chain; link; link = link->next) {
+      if (link->stmt)
+        visit(link->stmt);
+    }
+  }
+  // whether ${name} is the variable of an enclosing loop by reference
+  bool is_reference(Symbol name) const {
+    return std::count(references.begin(), references.end(), name);
+  }
+
+  llvm::Value *call(const char *name, llvm::Type *result,
+                    std::vector<llvm::Type *> params,
+                    std::vector<llvm::Value *> args) {
+    llvm::FunctionType *type = llvm::FunctionType::get(result, params, false);
+    return builder.CreateCall(lowering.module.getOrInsertFunction(name, type),
+                              args);
+  }
+  llvm::Type *i8p() { return llvm::PointerType::getUnqual(i8); }
+
+  Lowering &lowering;
+  TypeInference &types;
+  Specialization &spec;
+  llvm::Function *function;
+  llvm::LLVMContext &context;
+  llvm::IRBuilder<> builder;
+  // inserts before the terminator of the entry block
+  llvm::IRBuilder<> entry_builder;
+  llvm::Type *f64, *f64p, *i8, *i32, *i64;
+  llvm::Value *ctx = nullptr;
+  // where a tensor returned goes
+  llvm::Value *out = nullptr;
+  llvm::Value *result = nullptr;
+  // the name of the function, for errors
+  llvm::Value *where = nullptr;
+  llvm::BasicBlock *exit = nullptr;
+  std::unordered_map<SymbolID, Variable> variables;
+  // the variables of the enclosing loops by reference
+  std::vector<Symbol> references;
+  // the loops whose variable may be a view and their variables
+  std::unordered_set<LoopStmt *> views;
+  std::unordered_set<SymbolID> viewed;
+  MemoryPlanner planner;
+  // the buffer of the planner every pointer to a buffer of the call is in
+  std::unordered_map<llvm::Value *, MemoryPlanner::BufferID> owners;
+  // the loads of the buffers, which read their slots once they are planned
+  std::vector<llvm::LoadInst *> placeholders;
+  // the slots freed when the call returns
+  std::vector<llvm::Value *> buffers;
+  std::unordered_map<Value *, llvm::Constant *> constants;
+};
+
+void initialize_llvm() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+  });
+}
+
+std::string host_features() {
+  llvm::SubtargetFeatures features;
+  llvm::StringMap<bool> host;
+  if (llvm::sys::getHostCPUFeatures(host)) {
+    for (auto &feature : host)
+      features.AddFeature(feature.first(), feature.second);
+  }
+  return features.getString();
+}
+
+// a machine that generates the best code for this CPU
+std::unique_ptr<llvm::TargetMachine> host_machine() {
+  initialize_llvm();
+  const std::string triple = llvm::sys::getProcessTriple();
+  std::string error;
+  const llvm::Target *target =
+      llvm::TargetRegistry::lookupTarget(triple, error);
+  if (!target)
+    ERROR("No LLVM target for " + triple + ": " + error);
+  return std::unique_ptr<llvm::TargetMachine>(target->createTargetMachine(
+      triple, llvm::sys::getHostCPUName(), host_features(),
+      llvm::TargetOptions(), llvm::Reloc::PIC_, llvm::None,
+      llvm::CodeGenOpt::Aggressive));
+}
+
+template <typename T> T unwrap(llvm::Expected<T> expected) {
+  if (!expected)
+    ERROR(llvm::toString(expected.takeError()));
+  return std::move(*expected);
+}
+
+void check(llvm::Error error) {
+  if (error)
+    ERROR(llvm::toString(std::move(error)));
+}
+} // namespace
+
+struct Codegen::Impl {
+  llvm::orc::ThreadSafeContext context{std::make_unique<llvm::LLVMContext>()};
+  std::unique_ptr<llvm::Module> module;
+  std::unique_ptr<llvm::TargetMachine> machine;
+  std::vector<Tensor> constants;
+  int64_t buffer_bytes = 0;
+};
+
+Codegen::Codegen(CompoundStmt *root, Arena &arena)
+    : impl(std::make_unique<Impl>()) {
+  impl->machine = host_machine();
+  llvm::LLVMContext &context = *impl->context.getContext();
+  impl->module = std::make_unique<llvm::Module>("pieck", context);
+  impl->module->setTargetTriple(impl->machine->getTargetTriple().str());
+  impl->module->setDataLayout(impl->machine->createDataLayout());
+
+  ConstantFolding::fold(root, arena);
+  TypeInference types(root);
+  Lowering lowering(types, *impl->module, impl->constants);
+
+  // declare every specialization, then emit them
+  llvm::Type *i8p = llvm::Type::getInt8PtrTy(context);
+  llvm::Type *f64 = llvm::Type::getDoubleTy(context);
+  llvm::Type *f64p = llvm::PointerType::getUnqual(f64);
+  llvm::Type *i64 = llvm::Type::getInt64Ty(context);
+  const std::string cpu = llvm::sys::getHostCPUName().str();
+  const std::string features = host_features();
+  for (Specialization &spec : types.specs) {
+    std::vector<llvm::Type *> params = {i8p};
+    llvm::Type *result = llvm::Type::getVoidTy(context);
+    if (spec.result.is_scala())
+      result = f64;
+    else if (spec.result.kind == StaticShape::ss_shape)
+      params.push_back(f64p);
+    for (const Shape &param : spec.params)
+      params.push_back(param.dims_dim() == 0 ? f64 : f64p);
+    const bool top = types.top_level(spec);
+    llvm::Function *function = llvm::Function::Create(
+        llvm::FunctionType::get(result, params, false),
+        top ? llvm::GlobalValue::ExternalLinkage
+            : llvm::GlobalValue::InternalLinkage,
+        top ? "pieck_main" : types.name_of(spec), *impl->module);
+    function->addFnAttr(llvm::Attribute::NoUnwind);
+    function->addFnAttr("target-cpu", cpu);
+    function->addFnAttr("target-features", features);
+    lowering.functions.push_back(function);
+  }
+  llvm::FunctionType *procedure =
+      llvm::FunctionType::get(llvm::Type::getVoidTy(context), false);
+  lowering.allocate_buffers =
+      llvm::Function::Create(procedure, llvm::GlobalValue::InternalLinkage,
+                             "buffers.allocate", *impl->module);
+  lowering.free_buffers =
+      llvm::Function::Create(procedure, llvm::GlobalValue::InternalLinkage,
+                             "buffers.free", *impl->module);
+  for (Specialization &spec : types.specs)
+    FunctionEmitter(lowering, spec).emit();
+
+  // the static buffers are known once every specialization is emitted
+  llvm::IRBuilder<> builder(llvm::BasicBlock::Create(
+      context, "entry", lowering.allocate_buffers));
+  for (auto &[global, n] : lowering.static_buffers) {
+    builder.CreateStore(
+        builder.CreateCall(impl->module->getOrInsertFunction(
+                               "pieck_alloc",
+                               llvm::FunctionType::get(f64p, {i64}, false)),
+                           {builder.getInt64(n)}),
+        global);
+  }
+  builder.CreateRetVoid();
+  builder.SetInsertPoint(
+      llvm::BasicBlock::Create(context, "entry", lowering.free_buffers));
+  for (auto &[global, n] : lowering.static_buffers) {
+    builder.CreateCall(impl->module->getOrInsertFunction(
+                           "pieck_free",
+                           llvm::FunctionType::get(builder.getVoidTy(), {f64p},
+                                                   false)),
+                       {builder.CreateLoad(f64p, global)});
+    impl->buffer_bytes += sizeof(double) * n;
+  }
+  builder.CreateRetVoid();
+
+  std::string error;
+  llvm::raw_string_ostream stream(error);
+  ASSERT(!llvm::verifyModule(*impl->module, &stream),
+         "Codegen: the module is broken: " + stream.str());
+}
+
+Codegen::~Codegen() = default;
+
+void Codegen::optimize(OptLevel level) {
+  llvm::LoopAnalysisManager loops;
+  llvm::FunctionAnalysisManager functions;
+  llvm::CGSCCAnalysisManager cgscc;
+  llvm::ModuleAnalysisManager modules;
+  llvm::PassBuilder builder(impl->machine.get());
+  builder.registerModuleAnalyses(modules);
+  builder.registerCGSCCAnalyses(cgscc);
+  builder.registerFunctionAnalyses(functions);
+  builder.registerLoopAnalyses(loops);
+  builder.crossRegisterProxies(loops, functions, cgscc, modules);
+  llvm::ModulePassManager passes =
+      level == O0 ? builder.buildO0DefaultPipeline(llvm::OptimizationLevel::O0)
+                  : builder.buildPerModuleDefaultPipeline(
+                        level == O2 ? llvm::OptimizationLevel::O2
+                                    : llvm::OptimizationLevel::O3);
+  passes.run(*impl->module, modules);
+}
+
+int64_t Codegen::buffer_bytes() const { return impl->buffer_bytes; }
+
+std::string Codegen::ir() const {
+  std::string text;
+  llvm::raw_string_ostream stream(text);
+  impl->module->print(stream, nullptr);
+  return stream.str();
+}
+
+void Codegen::emit_object(const std::string &path) const {
+  std::error_code error;
+  llvm::raw_fd_ostream file(path, error, llvm::sys::fs::OF_None);
+  if (error)
+    ERROR("Cannot open " + path + ": " + error.message());
+  // code generation changes the module it runs over
+  std::unique_ptr<llvm::Module> module = llvm::CloneModule(*impl->module);
+  llvm::legacy::PassManager passes;
+  if (impl->machine->addPassesToEmitFile(passes, file, nullptr,
+                                         llvm::CGFT_ObjectFile))
+    ERROR("This machine cannot emit object files");
+  passes.run(*module);
+  file.flush();
+}
+
+void Codegen::run(std::ostream &out) const {
+  initialize_llvm();
+  auto machine = unwrap(llvm::orc::JITTargetMachineBuilder::detectHost());
+  machine.setCPU(llvm::sys::getHostCPUName().str());
+  machine.setCodeGenOptLevel(llvm::CodeGenOpt::Aggressive);
+  std::unique_ptr<llvm::orc::LLJIT> jit = unwrap(
+      llvm::orc::LLJITBuilder().setJITTargetMachineBuilder(machine).create());
+
+  // the runtime, and the C library for memmove
+  llvm::orc::JITDylib &library = jit->getMainJITDylib();
+  llvm::orc::SymbolMap runtime;
+  auto define = [&](const std::string &name, auto *address) {
+    runtime[jit->mangleAndIntern(name)] = llvm::JITEvaluatedSymbol(
+        llvm::pointerToJITTargetAddress(address),
+        llvm::JITSymbolFlags::Exported);
+  };
+  define("pieck_alloc", &pieck_alloc);
+  define("pieck_free", &pieck_free);
+  define("pieck_print_scala", &pieck_print_scala);
+  define("pieck_print_tensor", &pieck_print_tensor);
+  define("pieck_print_none", &pieck_print_none);
+  define("pieck_matmul", &pieck_matmul);
+  define("pieck_index", &pieck_index);
+  define("pieck_enter", &pieck_enter);
+  define("pieck_leave", &pieck_leave);
+  define("pieck_fail", &pieck_fail);
+  define("pieck_failed", &pieck_failed);
+
+  // The code reads the elements of the tensor literals from the Codegen, as
+  // emitting large constants into the code takes longer than running it.
+  std::unique_ptr<llvm::Module> module = llvm::CloneModule(*impl->module);
+  for (size_t i = 0; i < impl->constants.size(); i++) {
+    llvm::GlobalVariable *global = module->getNamedGlobal(constant_name(i));
+    if (!global)
+      continue;
+    global->setInitializer(nullptr);
+    global->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    define(constant_name(i), impl->constants[i].data());
+  }
+  check(library.define(llvm::orc::absoluteSymbols(std::move(runtime))));
+  library.addGenerator(
+      unwrap(llvm::orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+          jit->getDataLayout().getGlobalPrefix())));
+
+  check(jit->addIRModule(
+      llvm::orc::ThreadSafeModule(std::move(module), impl->context)));
+  auto *main = reinterpret_cast<void (*)(RuntimeContext *)>(
+      unwrap(jit->lookup("pieck_main")).getAddress());
+  RuntimeContext context(out);
+  main(&context);
+  if (!context.error.empty())
+    ERROR(context.error);
+}
@@ -0,0 +1,653 @@
+#include "../include/Compiler.h"
+#include "../include/ASTVisitor.h"
+#include "../include/Casting.h"
+#include "../include/ConstantFolding.h"
+#include "../include/Error.h"
+#include "../include/NameCollector.h"
+#include "../include/Parser.h"
+#include "../include/ViewFinder.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace {
+// What is known at compile time about the values of an expression: nothing
+// yet, a scalar, a tensor of a rank (> 0), or anything
+using Kind = int32_t;
+constexpr Kind kind_unset = -2;
+constexpr Kind kind_any = -1;
+constexpr Kind kind_scala = 0;
+
+Kind join(Kind a, Kind b) {
+  if (a == kind_unset)
+    return b;
+  if (b == kind_unset)
+    return a;
+  return a == b ? a : kind_any;
+}
+
+Kind binary_kind(BinaryOpExpr::OP op, Kind lhs, Kind rhs) {
+  if (lhs == kind_unset || rhs == kind_unset)
+    return kind_unset;
+  if (lhs == kind_any || rhs == kind_any)
+    return kind_any;
+  if (op != BinaryOpExpr::matmul) {
+    // a scalar is combined with every element of a tensor, and the shapes
+    // of tensors are broadcast to the larger rank
+    return std::max(lhs, rhs);
+  }
+  // the dims of vectors are dropped, see matmul in Kernels.h
+  if (lhs == kind_scala || rhs == kind_scala || lhs > 2 || rhs > 2)
+    return kind_any;
+  return (lhs == 2) + (rhs == 2);
+}
+
+// the kind of ${expr}[...] where the base has ${kind}: every index drops a
+// dim
+Kind index_kind(IndexExpr *expr, Kind kind) {
+  if (kind == kind_unset || kind == kind_any)
+    return kind;
+  kind -= expr->num_of_indices();
+  return kind < 0 ? kind_any : kind;
+}
+
+// the kind of the sub-tensors a loop over a tensor of ${kind} runs over
+Kind element_kind(Kind kind) {
+  if (kind == kind_unset || kind == kind_any)
+    return kind;
+  return kind == kind_scala ? kind_any : kind - 1;
+}
+
+// Infer the kinds of the variables in ${kinds}: every assignment joins the
+// kind of its value into the kind of the variable, until nothing changes.
+// Other names, such as globals read by a function, have kind_any.
+class KindInference : public ASTVisitor<KindInference, Kind> {
+public:
+  KindInference(std::unordered_map<SymbolID, Kind> &kinds) : kinds(kinds) {}
+
+  void run(CompoundStmt *body) {
+    do {
+      changed = false;
+      visit(body);
+    } while (changed);
+  }
+
+  Kind visit_CompoundStmt(CompoundStmt *stmt) {
+    visit_chain(stmt->stmts());
+    return kind_unset;
+  }
+  Kind visit_LoopStmt(LoopStmt *stmt) {
+    Kind iterable = visit(stmt->iterable);
+    // a reference is a view, even a view of a single element
+    assign(stmt->var, stmt->by_reference ? kind_any : element_kind(iterable));
+    visit_chain(stmt->body);
+    return kind_unset;
+  }
+  Kind visit_DefVarStmt(DefVarStmt *stmt) {
+    assign(stmt->identifier_name, visit(stmt->rhs));
+    return kind_unset;
+  }
+  Kind visit_CallExpr(CallExpr *) { return kind_any; }
+  Kind visit_VarExpr(VarExpr *expr) {
+    auto it = kinds.find(expr->var_name.id());
+    return it == kinds.end() ? kind_any : it->second;
+  }
+  Kind visit_BinaryOpExpr(BinaryOpExpr *expr) {
+    Kind lhs = visit(expr->lhs);
+    return binary_kind(expr->op, lhs, visit(expr->rhs));
+  }
+  Kind visit_ValueExpr(ValueExpr *expr) {
+    return expr->val->is_scala() ? kind_scala : expr->val->shape().dims_dim();
+  }
+  Kind visit_IndexExpr(IndexExpr *expr) {
+    return index_kind(expr, visit(expr->base));
+  }
+  Kind visit_TransposeExpr(TransposeExpr *expr) {
+    return visit(expr->operand);
+  }
+
+private:
+  void visit_chain(StmtChain *chain) {
+    for (StmtChain *link = chain; link; link = link->next) {
+      if (link->stmt)
+        visit(link->stmt);
+    }
+  }
+  void assign(Symbol name, Kind kind) {
+    auto it = kinds.find(name.id());
+    if (it == kinds.end())
+      return;
+    Kind joined = join(it->second, kind);
+    if (joined != it->second) {
+      it->second = joined;
+      changed = true;
+    }
+  }
+
+  std::unordered_map<SymbolID, Kind> &kinds;
+  bool changed = false;
+};
+
+// The state shared by the functions of a module
+struct Module {
+  Program program;
+  // the index of every function in Program::functions
+  std::unordered_map<SymbolID, uint16_t> functions;
+  // the index of every global in Program::globals
+  std::unordered_map<SymbolID, uint32_t> globals;
+  // the index of every scalar in Program::scalas, by its bits
+  std::unordered_map<uint64_t, uint32_t> scalas;
+};
+
+// where the value of an expression is
+struct Operand {
+  uint16_t reg;
+  Kind kind;
+};
+
+// Compile the body of a function. An expression is compiled into the
+// register ${target} when the caller asks for one, otherwise into a new
+// temporary; a local variable is used in place.
+class FunctionCompiler : public ASTVisitor<FunctionCompiler, Operand> {
+public:
+  FunctionCompiler(Module &module, Function &function, bool top_level)
+      : module(module), function(function), top_level(top_level) {}
+
+  // compile ${body}, which assigns ${locals}, the params being the first
+  void compile(CompoundStmt *body, const std::vector<Symbol> &locals) {
+    for (Symbol name : locals) {
+      kinds[name.id()] = kind_unset;
+      if (!top_level || !module.globals.count(name.id()))
+        registers[name.id()] = new_temp();
+    }
+    for (uint16_t i = 0; i < function.num_of_params; i++)
+      kinds[locals[i].id()] = kind_any;
+    KindInference(kinds).run(body);
+    // the params and the globals share their elements, see ViewFinder
+    std::unordered_set<SymbolID> pinned;
+    for (uint16_t i = 0; i < function.num_of_params; i++)
+      pinned.insert(locals[i].id());
+    if (top_level) {
+      for (auto &[global, index] : module.globals)
+        pinned.insert(global);
+    }
+    Summary all;
+    all.visit(body);
+    views = ViewFinder(body, pinned, all.references).loops;
+    visit(body);
+    emit(op_ret_none);
+  }
+
+  // Stmts
+  Operand visit_CompoundStmt(CompoundStmt *stmt) {
+    visit_chain(stmt->stmts());
+    return {};
+  }
+  Operand visit_ReturnStmt(ReturnStmt *stmt) {
+    if (stmt->expr)
+      emit(op_ret, compile(stmt->expr).reg);
+    else
+      emit(op_ret_none);
+    return {};
+  }
+  Operand visit_LoopStmt(LoopStmt *stmt) {
+    const uint16_t state = new_temp();
+    new_temp();
+    // a loop by reference writes into the tensor, not into the constant
+    Expr *root = IndexExpr::root_of(stmt->iterable);
+    const bool copy = stmt->by_reference && isa<ValueExpr>(root);
+    VarExpr *owner = dyn_cast<VarExpr>(root);
+    if (owner && !owns_elements(stmt, owner->var_name))
+      owner = nullptr;
+    if (stmt->by_reference || owner)
+      own(root);
+    if (owner)
+      owned.insert(owner->var_name.id());
+    Operand iterable = compile(stmt->iterable, state, copy);
+    if (iterable.reg != state)
+      emit(op_move, state, iterable.reg);
+    emit(op_for_prep, state);
+
+    auto global = module.globals.find(stmt->var.id());
+    const bool is_global = top_level && global != module.globals.end();
+    const uint16_t var = is_global ? new_temp() : registers.at(stmt->var.id());
+    const uint32_t start = function.code.size();
+    emit(op_for_next, state, var, 0,
+         stmt->by_reference ? 1 : views.count(stmt) ? 2 : 0);
+    const uint32_t exit = emit(op_jump);
+    if (is_global)
+      emit_bc(op_set_global, var, global->second);
+
+    if (stmt->by_reference)
+      references.push_back(stmt->var);
+    visit_chain(stmt->body);
+    if (stmt->by_reference)
+      references.pop_back();
+    if (owner)
+      owned.erase(owner->var_name.id());
+    emit_bc(op_jump, 0, start);
+    function.code[exit].set_bc(function.code.size());
+    return {};
+  }
+  Operand visit_PrintStmt(PrintStmt *stmt) {
+    emit(op_print, compile(stmt->expr).reg);
+    return {};
+  }
+  Operand visit_DefVarStmt(DefVarStmt *stmt) {
+    Symbol name = stmt->identifier_name;
+    if (is_reference(name)) {
+      // write through the reference instead of rebinding it
+      Operand ref = read(name);
+      emit(op_store, ref.reg, compile(stmt->rhs).reg);
+      return {};
+    }
+    auto global = module.globals.find(name.id());
+    if (top_level && global != module.globals.end()) {
+      emit_bc(op_set_global, compile(stmt->rhs, -1, true).reg, global->second);
+      return {};
+    }
+    const uint16_t var = registers.at(name.id());
+    Operand value = compile(stmt->rhs, var, true);
+    if (value.reg != var)
+      emit(op_move, var, value.reg);
+    return {};
+  }
+  Operand visit_DefFuncStmt(DefFuncStmt *stmt) {
+    // compiled by Compiler::compile
+    if (!top_level)
+      ERROR("Functions must be defined at the top level: " +
+            std::string(stmt->identifier_name.str()));
+    return {};
+  }
+
+  // Exprs
+  Operand visit_CallExpr(CallExpr *expr) {
+    const int32_t target = take_target();
+    auto callee = module.functions.find(expr->func_name.id());
+    if (callee == module.functions.end())
+      ERROR(std::string(expr->func_name.str()) + " is not defined");
+    const Function &f = module.program.functions[callee->second];
+    if (f.num_of_params != expr->num_of_args)
+      ERROR(std::string(expr->func_name.str()) + " expects " +
+            std::to_string(f.num_of_params) + " arguments but receives " +
+            std::to_string(expr->num_of_args));
+    // the arguments go into consecutive registers
+    const uint16_t mark = next_temp;
+    const uint16_t first = next_temp;
+    for (int32_t i = 0; i < expr->num_of_args; i++)
+      new_temp();
+    for (int32_t i = 0; i < expr->num_of_args; i++) {
+      Operand arg = compile(expr->args[i], first + i);
+      if (arg.reg != first + i)
+        emit(op_move, first + i, arg.reg);
+    }
+    next_temp = mark;
+    const uint16_t dest = target >= 0 ? target : new_temp();
+    emit(op_call, dest, callee->second, first);
+    return {dest, kind_any};
+  }
+  Operand visit_VarExpr(VarExpr *expr) {
+    take_target();
+    return read(expr->var_name);
+  }
+  Operand visit_BinaryOpExpr(BinaryOpExpr *expr) {
+    const int32_t target = take_target();
+    // Scalar trees are left to the _ss ops, which allocate nothing.
+    if (Fusion::num_of_ops(expr) >= 2 &&
+        KindInference(kinds).visit(expr) != kind_scala)
+      return compile_fused(expr, target);
+    const uint16_t mark = next_temp;
+    Operand lhs = compile(expr->lhs);
+    Operand rhs = compile(expr->rhs);
+    next_temp = mark;
+    const uint16_t dest = target >= 0 ? target : new_temp();
+    const bool scalas = lhs.kind == kind_scala && rhs.kind == kind_scala;
+    OpCode op = op_matmul;
+    switch (expr->op) {
+    case BinaryOpExpr::add:
+      op = scalas ? op_add_ss : op_add;
+      break;
+    case BinaryOpExpr::sub:
+      op = scalas ? op_sub_ss : op_sub;
+      break;
+    case BinaryOpExpr::mul:
+      op = scalas ? op_mul_ss : op_mul;
+      break;
+    case BinaryOpExpr::div:
+      op = scalas ? op_div_ss : op_div;
+      break;
+    case BinaryOpExpr::matmul:
+      break;
+    }
+    emit(op, dest, lhs.reg, rhs.reg);
+    Kind kind = binary_kind(expr->op, lhs.kind, rhs.kind);
+    return {dest, kind == kind_unset ? kind_any : kind};
+  }
+  Operand visit_ValueExpr(ValueExpr *expr) {
+    const bool copy = copy_constant;
+    const int32_t target = take_target();
+    const uint16_t dest = target >= 0 ? target : new_temp();
+    if (ScalaValue *scala = dyn_cast<ScalaValue>(expr->val)) {
+      emit_bc(op_load_scala, dest, add_scala(scala->val));
+      return {dest, kind_scala};
+    }
+    emit_bc(op_load_tensor, dest, add_tensor(expr->val), copy);
+    return {dest, expr->val->shape().dims_dim()};
+  }
+  Operand visit_IndexExpr(IndexExpr *expr) {
+    const bool copy = copy_constant;
+    const int32_t target = take_target();
+    const uint16_t mark = next_temp;
+    IndexedExpr indexed;
+    Operand base = compile(expr->base, -1, copy);
+    indexed.base = base.reg;
+    for (int32_t i = 0; i < expr->num_of_subscripts; i++) {
+      const IndexExpr::Subscript &subscript = expr->subscripts[i];
+      IndexedExpr::Subscript &compiled = indexed.subscripts.emplace_back();
+      compiled.is_range = subscript.is_range;
+      compiled.has_begin = subscript.begin;
+      compiled.has_end = subscript.end;
+      if (subscript.begin)
+        compiled.begin = compile(subscript.begin).reg;
+      if (subscript.end)
+        compiled.end = compile(subscript.end).reg;
+    }
+    next_temp = mark;
+    const uint16_t dest = target >= 0 ? target : new_temp();
+    emit_bc(op_index, dest, module.program.indexings.size());
+    module.program.indexings.push_back(std::move(indexed));
+    const Kind kind = index_kind(expr, base.kind);
+    return {dest, kind == kind_unset ? kind_any : kind};
+  }
+  Operand visit_TransposeExpr(TransposeExpr *expr) {
+    const bool copy = copy_constant;
+    const int32_t target = take_target();
+    const uint16_t mark = next_temp;
+    Operand operand = compile(expr->operand, -1, copy);
+    next_temp = mark;
+    const uint16_t dest = target >= 0 ? target : new_temp();
+    emit(op_transpose, dest, operand.reg);
+    // the dims are reversed, not dropped
+    return {dest, operand.kind};
+  }
+
+private:
+  // Compile the tree of element-wise ops at the root of ${expr} into one
+  // fused instruction. The leaves are compiled first, left to right, as the
+  // ops would compile them.
+  Operand compile_fused(BinaryOpExpr *expr, int32_t target) {
+    std::vector<Expr *> leaves;
+    FusedExpr fused{Fusion::of(expr, leaves), {}};
+    std::vector<Kind> input_kinds;
+    const uint16_t mark = next_temp;
+    for (Expr *leaf : leaves) {
+      Operand input = compile(leaf);
+      fused.inputs.push_back(input.reg);
+      input_kinds.push_back(input.kind);
+    }
+    next_temp = mark;
+    std::vector<Kind> stack;
+    for (const Fusion::Step &step : fused.fusion.steps) {
+      if (step.kind == Fusion::Step::sk_input) {
+        stack.push_back(input_kinds[step.index]);
+      } else if (step.kind == Fusion::Step::sk_constant) {
+        stack.push_back(kind_scala);
+      } else {
+        Kind rhs = stack.back();
+        stack.pop_back();
+        stack.back() =
+            binary_kind(BinaryOpExpr::OP(step.op), stack.back(), rhs);
+      }
+    }
+    const uint16_t dest = target >= 0 ? target : new_temp();
+    emit_bc(op_fused, dest, module.program.fusions.size());
+    module.program.fusions.push_back(std::move(fused));
+    return {dest, stack.back() == kind_unset ? kind_any : stack.back()};
+  }
+
+  // Compile ${expr} into ${target} if it computes a new value. With
+  // ${copy}, a tensor constant is copied, as it may be written through a
+  // reference later.
+  Operand compile(Expr *expr, int32_t target = -1, bool copy = false) {
+    this->target = target;
+    copy_constant = copy;
+    return visit(expr);
+  }
+  // the target of the expression being visited, -1 for a new temporary
+  int32_t take_target() {
+    int32_t taken = target;
+    target = -1;
+    copy_constant = false;
+    return taken;
+  }
+
+  Operand read(Symbol name) {
+    auto reg = registers.find(name.id());
+    if (reg != registers.end()) {
+      Kind kind = kinds.at(name.id());
+      return {reg->second, kind == kind_unset ? kind_any : kind};
+    }
+    auto global = module.globals.find(name.id());
+    if (global == module.globals.end())
+      ERROR(std::string(name.str()) + " is not defined" +
+            (top_level ? "" : " in " + where()));
+    const uint16_t dest = new_temp();
+    emit_bc(op_get_global, dest, global->second);
+    auto kind = kinds.find(name.id());
+    return {dest, kind == kinds.end() || kind->second == kind_unset
+                      ? kind_any
+                      : kind->second};
+  }
+  // Before a loop by reference over the variable ${root}, make it the only
+  // owner of its elements, so the loop writes into no other value. A param
+  // or a global shares them with the caller or the top level on purpose, it
+  // is only copied if it is a view. The variables of enclosing loops by
+  // reference are written through.
+  void own(Expr *root) {
+    VarExpr *var = dyn_cast<VarExpr>(root);
+    if (!var || is_reference(var->var_name) ||
+        owned.count(var->var_name.id()))
+      return;
+    auto reg = registers.find(var->var_name.id());
+    if (reg != registers.end()) {
+      emit(op_unique, reg->second, 0, 0, reg->second < function.num_of_params);
+      return;
+    }
+    auto global = module.globals.find(var->var_name.id());
+    if (global == module.globals.end())
+      return;
+    const uint16_t temp = new_temp();
+    emit_bc(op_get_global, temp, global->second);
+    emit(op_unique, temp, 0, 0, 1);
+    emit_bc(op_set_global, temp, global->second);
+  }
+  // Whether the loop ${stmt} over ${name} owns the elements of ${name}, so
+  // the loops by reference over ${name} in its body write the elements it
+  // runs over, as in native code, instead of copies. The body only uses
+  // ${name} to loop over it, so no other value shares them.
+  bool owns_elements(LoopStmt *stmt, Symbol name) {
+    if (owned.count(name.id()) || is_reference(name))
+      return false;
+    Summary body;
+    body.visit_chain(stmt->body);
+    const SymbolID id = name.id();
+    return body.references_into[id] && !body.binds[id] &&
+           body.reads[id] == body.loops_over[id];
+  }
+  std::string where() const {
+    return top_level ? "the top level" : std::string(function.name.str());
+  }
+  bool is_reference(Symbol name) const {
+    for (Symbol reference : references) {
+      if (reference == name)
+        return true;
+    }
+    return false;
+  }
+
+  void visit_chain(StmtChain *chain) {
+    for (StmtChain *link = chain; link; link = link->next) {
+      if (!link->stmt)
+        continue;
+      // the temporaries of a stmt are free after it
+      const uint16_t mark = next_temp;
+      visit(link->stmt);
+      next_temp = mark;
+    }
+  }
+
+  uint16_t new_temp() {
+    ASSERT(next_temp < UINT16_MAX, "Too many registers in " + where());
+    if (next_temp + 1u > function.num_of_registers)
+      function.num_of_registers = next_temp + 1u;
+    return next_temp++;
+  }
+  uint32_t emit(OpCode op, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0,
+                uint8_t flag = 0) {
+    Instruction instruction;
+    instruction.op = op;
+    instruction.flag = flag;
+    instruction.a = a;
+    instruction.b = b;
+    instruction.c = c;
+    function.code.push_back(instruction);
+    return function.code.size() - 1;
+  }
+  uint32_t emit_bc(OpCode op, uint16_t a, uint32_t bc, uint8_t flag = 0) {
+    uint32_t index = emit(op, a, 0, 0, flag);
+    function.code[index].set_bc(bc);
+    return index;
+  }
+
+  uint32_t add_scala(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    auto [it, inserted] =
+        module.scalas.try_emplace(bits, module.program.scalas.size());
+    if (inserted)
+      module.program.scalas.push_back(value);
+    return it->second;
+  }
+  uint32_t add_tensor(Value *value) {
+    if (PackedTensorValue *packed = dyn_cast<PackedTensorValue>(value)) {
+      module.program.tensors.push_back(
+          Tensor::copy_of(packed->shape(), packed->data));
+    } else {
+      Arena scratch;
+      PackedTensorValue *tree =
+          PackedTensorValue::pack(scratch, cast<TensorValue>(value));
+      module.program.tensors.push_back(
+          Tensor::copy_of(tree->shape(), tree->data));
+    }
+    return module.program.tensors.size() - 1;
+  }
+
+  Module &module;
+  Function &function;
+  const bool top_level;
+  std::unordered_map<SymbolID, uint16_t> registers;
+  std::unordered_map<SymbolID, Kind> kinds;
+  // the variables of the enclosing loops by reference
+  std::vector<Symbol> references;
+  // the variables an enclosing loop owns the elements of, see
+  // owns_elements
+  std::unordered_set<SymbolID> owned;
+  // the loops by value whose variable is a view, see ViewFinder
+  std::unordered_set<LoopStmt *> views;
+  uint16_t next_temp = 0;
+  int32_t target = -1;
+  bool copy_constant = false;
+};
+} // namespace
+
+Program Compiler::compile(CompoundStmt *root, Arena &arena) {
+  ConstantFolding::fold(root, arena);
+  Module module;
+  module.program.functions.emplace_back();
+  std::vector<DefFuncStmt *> defs;
+  for (StmtChain *link = root->stmts(); link; link = link->next) {
+    DefFuncStmt *def = dyn_cast_or_null<DefFuncStmt>(link->stmt);
+    if (!def)
+      continue;
+    auto [it, inserted] = module.functions.try_emplace(
+        def->identifier_name.id(), module.program.functions.size());
+    if (!inserted)
+      ERROR(std::string(def->identifier_name.str()) + " is already defined");
+    ASSERT(module.program.functions.size() < UINT16_MAX,
+           "Too many functions in the module");
+    Function function;
+    function.name = def->identifier_name;
+    function.num_of_params = def->num_of_params;
+    module.program.functions.push_back(std::move(function));
+    defs.push_back(def);
+  }
+
+  // the top-level variables read by functions that do not assign them
+  NameCollector top;
+  top.visit(root);
+  std::vector<std::vector<Symbol>> locals(defs.size());
+  for (size_t i = 0; i < defs.size(); i++) {
+    DefFuncStmt *def = defs[i];
+    NameCollector names;
+    names.visit(def->rhs);
+    std::unordered_set<SymbolID> params;
+    for (int32_t p = 0; p < def->num_of_params; p++) {
+      if (!params.insert(def->params[p].id()).second)
+        ERROR(std::string(def->identifier_name.str()) +
+              " has two params named " + std::string(def->params[p].str()));
+      locals[i].push_back(def->params[p]);
+    }
+    for (Symbol name : names.assigned) {
+      if (!params.count(name.id()))
+        locals[i].push_back(name);
+    }
+    for (Symbol name : names.read) {
+      if (params.count(name.id()) || names.assigns(name) ||
+          !top.assigns(name) || module.globals.count(name.id()))
+        continue;
+      module.globals.emplace(name.id(), module.program.globals.size());
+      module.program.globals.push_back(name);
+    }
+  }
+
+  for (size_t i = 0; i < defs.size(); i++) {
+    FunctionCompiler(module, module.program.functions[i + 1], false)
+        .compile(defs[i]->rhs, locals[i]);
+  }
+  FunctionCompiler(module, module.program.functions[0], true)
+      .compile(root, top.assigned);
+  return std::move(module.program);
+}
+
+const char *opcode_name(OpCode op) {
+  static const char *const names[] = {
+#define PIECK_OPCODE_NAME(NAME) #NAME,
+      PIECK_OPCODES(PIECK_OPCODE_NAME)
+#undef PIECK_OPCODE_NAME
+  };
+  ASSERT(op < num_of_opcodes, "opcode_name: unknown opcode.");
+  return names[op];
+}
+
+std::string Program::disassemble() const {
+  std::string text;
+  for (const Function &function : functions) {
+    text += function.name.valid() ? std::string(function.name.str())
+                                  : std::string("<top level>");
+    text += ":\n";
+    for (size_t i = 0; i < function.code.size(); i++) {
+      const Instruction &instruction = function.code[i];
+      text += "  " + std::to_string(i) + "  " + opcode_name(instruction.op) +
+              " " + std::to_string(instruction.a) + " " +
+              std::to_string(instruction.b) + " " +
+              std::to_string(instruction.c);
+      if (instruction.flag)
+        text += " " + std::to_string(instruction.flag);
+      if (instruction.op == op_fused)
+        text += "  " + fusions[instruction.bc()].fusion.str();
+      text += "\n";
+    }
+  }
+  return text;
+}
@@ -0,0 +1,205 @@
+#include "../include/ConstantFolding.h"
+#include "../include/ASTVisitor.h"
+#include "../include/Casting.h"
+#include "../include/Kernels.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace {
+// The value of a constant subtree, a scalar if ${tensor} is empty
+struct Constant {
+  double scala = 0;
+  Tensor tensor;
+};
+
+class Folder : public ASTVisitor<Folder> {
+public:
+  explicit Folder(Arena &arena) : arena(arena) {}
+
+  void visit_CompoundStmt(CompoundStmt *stmt) { visit_chain(stmt->stmts()); }
+  void visit_ReturnStmt(ReturnStmt *stmt) {
+    if (stmt->expr)
+      stmt->expr = fold(stmt->expr);
+  }
+  void visit_LoopStmt(LoopStmt *stmt) {
+    stmt->iterable = fold(stmt->iterable);
+    visit_chain(stmt->body);
+  }
+  void visit_PrintStmt(PrintStmt *stmt) { stmt->expr = fold(stmt->expr); }
+  void visit_DefVarStmt(DefVarStmt *stmt) { stmt->rhs = fold(stmt->rhs); }
+  void visit_DefFuncStmt(DefFuncStmt *stmt) { visit(stmt->rhs); }
+
+  int32_t num_of_folds = 0;
+
+private:
+  void visit_chain(StmtChain *chain) {
+    for (StmtChain *link = chain; link; link = link->next) {
+      if (link->stmt)
+        visit(link->stmt);
+    }
+  }
+
+  // ${expr} with its constant subtrees folded, a new ValueExpr if all of it
+  // is constant
+  Expr *fold(Expr *expr) {
+    if (CallExpr *call = dyn_cast<CallExpr>(expr)) {
+      for (int32_t i = 0; i < call->num_of_args; i++)
+        call->args[i] = fold(call->args[i]);
+      return expr;
+    }
+    if (BinaryOpExpr *binary = dyn_cast<BinaryOpExpr>(expr)) {
+      binary->lhs = fold(binary->lhs);
+      binary->rhs = fold(binary->rhs);
+      if (!isa<ValueExpr>(binary->lhs) || !isa<ValueExpr>(binary->rhs))
+        return expr;
+    } else if (IndexExpr *index = dyn_cast<IndexExpr>(expr)) {
+      index->base = fold(index->base);
+      bool constant = isa<ValueExpr>(index->base);
+      for (int32_t i = 0; i < index->num_of_subscripts; i++) {
+        IndexExpr::Subscript &subscript = index->subscripts[i];
+        if (subscript.begin)
+          subscript.begin = fold(subscript.begin);
+        if (subscript.end)
+          subscript.end = fold(subscript.end);
+        constant = constant && scala_or_none(subscript.begin) &&
+                   scala_or_none(subscript.end);
+      }
+      if (!constant)
+        return expr;
+    } else if (TransposeExpr *transpose = dyn_cast<TransposeExpr>(expr)) {
+      transpose->operand = fold(transpose->operand);
+      if (!isa<ValueExpr>(transpose->operand))
+        return expr;
+    } else {
+      return expr;
+    }
+    Constant value;
+    try {
+      if (!evaluate(expr, value))
+        return expr;
+    } catch (const std::logic_error &) {
+      // reported by the backends if the code is reached
+      return expr;
+    }
+    num_of_folds++;
+    return literal(value);
+  }
+
+  static bool scala_or_none(Expr *expr) {
+    ValueExpr *value = dyn_cast_or_null<ValueExpr>(expr);
+    return !expr || (value && isa<ScalaValue>(value->val));
+  }
+
+  // Evaluate ${expr}, whose operands are literals, into ${out}. Return false
+  // if it is left to the runtime.
+  bool evaluate(Expr *expr, Constant &out) {
+    if (IndexExpr *index = dyn_cast<IndexExpr>(expr))
+      return evaluate_index(index, out);
+    if (TransposeExpr *transpose = dyn_cast<TransposeExpr>(expr)) {
+      out = constant_of(cast<ValueExpr>(transpose->operand)->val);
+      if (!out.tensor.empty())
+        out.tensor = out.tensor.transpose().contiguous();
+      return true;
+    }
+    BinaryOpExpr *binary = cast<BinaryOpExpr>(expr);
+    const Constant lhs = constant_of(cast<ValueExpr>(binary->lhs)->val);
+    const Constant rhs = constant_of(cast<ValueExpr>(binary->rhs)->val);
+    const bool lhs_tensor = !lhs.tensor.empty();
+    const bool rhs_tensor = !rhs.tensor.empty();
+    if (binary->op == BinaryOpExpr::matmul) {
+      if (!lhs_tensor || !rhs_tensor)
+        return false;
+      out = scala_of(matmul(lhs.tensor, rhs.tensor));
+    } else if (lhs_tensor && rhs_tensor) {
+      out.tensor = elementwise(binary->op, lhs.tensor, rhs.tensor);
+    } else if (lhs_tensor) {
+      out.tensor = elementwise(binary->op, lhs.tensor, rhs.scala);
+    } else if (rhs_tensor) {
+      out.tensor = elementwise(binary->op, lhs.scala, rhs.tensor);
+    } else {
+      out.scala = apply(binary->op, lhs.scala, rhs.scala);
+    }
+    return true;
+  }
+
+  // as the op_index of the VM
+  bool evaluate_index(IndexExpr *index, Constant &out) {
+    Tensor view = constant_of(cast<ValueExpr>(index->base)->val).tensor;
+    if (view.empty() || view.rank() < index->num_of_subscripts)
+      return false;
+    // the dim the next subscript applies to, the dims of indices are dropped
+    int32_t dim = 0;
+    for (int32_t i = 0; i < index->num_of_subscripts; i++) {
+      const IndexExpr::Subscript &subscript = index->subscripts[i];
+      const int64_t n = view.shape()[dim];
+      if (!subscript.is_range) {
+        view = view.select(dim, index_of(number(subscript.begin), n));
+        continue;
+      }
+      const int64_t begin =
+          subscript.begin ? bound_of(number(subscript.begin), n) : 0;
+      const int64_t end =
+          subscript.end ? bound_of(number(subscript.end), n) : n;
+      check_range(begin, end);
+      view = view.slice(dim++, begin, end);
+    }
+    out = scala_of(view.contiguous());
+    return true;
+  }
+
+  static double number(Expr *expr) {
+    return cast<ScalaValue>(cast<ValueExpr>(expr)->val)->val;
+  }
+
+  // a tensor of rank 0 as a scalar
+  static Constant scala_of(Tensor tensor) {
+    Constant constant;
+    if (tensor.rank() == 0)
+      constant.scala = *tensor.data();
+    else
+      constant.tensor = std::move(tensor);
+    return constant;
+  }
+
+  static Constant constant_of(Value *value) {
+    Constant constant;
+    if (ScalaValue *scala = dyn_cast<ScalaValue>(value)) {
+      constant.scala = scala->val;
+    } else if (PackedTensorValue *packed = dyn_cast<PackedTensorValue>(value)) {
+      constant.tensor = Tensor::copy_of(packed->shape(), packed->data);
+    } else {
+      Arena scratch;
+      PackedTensorValue *tree =
+          PackedTensorValue::pack(scratch, cast<TensorValue>(value));
+      constant.tensor = Tensor::copy_of(tree->shape(), tree->data);
+    }
+    return constant;
+  }
+
+  Expr *literal(const Constant &value) {
+    Value *folded;
+    if (value.tensor.empty()) {
+      folded = arena.make<ScalaValue>(value.scala);
+    } else {
+      const Shape &shape = value.tensor.shape();
+      PackedTensorValue *packed =
+          PackedTensorValue::create(arena, shape.dims_dim(), shape.dims());
+      std::copy(value.tensor.data(),
+                value.tensor.data() + value.tensor.num_of_elements(),
+                packed->data);
+      folded = packed;
+    }
+    ValueExpr *expr = arena.make<ValueExpr>(folded);
+    expr->set_shape(folded->shape());
+    return expr;
+  }
+
+  Arena &arena;
+};
+} // namespace
+
+int32_t ConstantFolding::fold(CompoundStmt *root, Arena &arena) {
+  Folder folder(arena);
+  folder.visit(root);
+  return folder.num_of_folds;
+}
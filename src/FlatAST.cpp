@@ -0,0 +1,367 @@
+#include "../include/FlatAST.h"
+#include "../include/ASTVisitor.h"
+#include "../include/Casting.h"
+#include "../include/Parser.h"
+#include <cstring>
+#include <limits>
+#include <unordered_map>
+
+namespace {
+// Append the nodes under a Stmt to a FlatAST in pre-order, return the index of
+// the node of the Stmt. The children of a node are reserved before they are
+// visited, so they stay contiguous in FlatAST::children.
+class Flattener : public ASTVisitor<Flattener, uint32_t> {
+public:
+  Flattener(FlatAST &flat) : flat(flat) {}
+
+  uint32_t visit_CompoundStmt(CompoundStmt *stmt) {
+    return add_chain(add_stmt(fk_compound, stmt), stmt->stmts());
+  }
+  uint32_t visit_ReturnStmt(ReturnStmt *stmt) {
+    uint32_t id = add_stmt(fk_return, stmt);
+    reserve_children(id, stmt->expr != nullptr);
+    if (stmt->expr)
+      set_child(id, 0, visit(stmt->expr));
+    return id;
+  }
+  uint32_t visit_LoopStmt(LoopStmt *stmt) {
+    uint32_t id = add_stmt(fk_loop, stmt);
+    flat.nodes[id].a = add_string(stmt->var);
+    flat.nodes[id].op = stmt->by_reference;
+    return add_chain(id, stmt->body, stmt->iterable);
+  }
+  uint32_t visit_PrintStmt(PrintStmt *stmt) {
+    uint32_t id = add_stmt(fk_print, stmt);
+    reserve_children(id, 1);
+    set_child(id, 0, visit(stmt->expr));
+    return id;
+  }
+  uint32_t visit_DefVarStmt(DefVarStmt *stmt) {
+    uint32_t id = add_stmt(fk_def_var, stmt);
+    flat.nodes[id].a = add_string(stmt->identifier_name);
+    reserve_children(id, 1);
+    set_child(id, 0, visit(stmt->rhs));
+    return id;
+  }
+  uint32_t visit_DefFuncStmt(DefFuncStmt *stmt) {
+    uint32_t id = add_stmt(fk_def_func, stmt);
+    flat.nodes[id].a = add_string(stmt->identifier_name);
+    reserve_children(id, stmt->num_of_params + 1);
+    for (int32_t i = 0; i < stmt->num_of_params; i++) {
+      uint32_t param = add_node(fk_var);
+      flat.nodes[param].a = add_string(stmt->params[i]);
+      set_child(id, i, param);
+    }
+    set_child(id, stmt->num_of_params, visit(stmt->rhs));
+    return id;
+  }
+
+  uint32_t visit_CallExpr(CallExpr *expr) {
+    uint32_t id = add_expr(fk_call, expr);
+    flat.nodes[id].a = add_string(expr->func_name);
+    reserve_children(id, expr->num_of_args);
+    for (int32_t i = 0; i < expr->num_of_args; i++)
+      set_child(id, i, visit(expr->args[i]));
+    return id;
+  }
+  uint32_t visit_VarExpr(VarExpr *expr) {
+    uint32_t id = add_expr(fk_var, expr);
+    flat.nodes[id].a = add_string(expr->var_name);
+    return id;
+  }
+  uint32_t visit_BinaryOpExpr(BinaryOpExpr *expr) {
+    uint32_t id = add_expr(fk_binary_op, expr);
+    flat.nodes[id].op = expr->op;
+    reserve_children(id, 2);
+    set_child(id, 0, visit(expr->lhs));
+    set_child(id, 1, visit(expr->rhs));
+    return id;
+  }
+  uint32_t visit_ValueExpr(ValueExpr *expr) {
+    uint32_t id = add_expr(fk_value, expr);
+    reserve_children(id, 1);
+    set_child(id, 0, visit(expr->val));
+    return id;
+  }
+
+  uint32_t visit_IndexExpr(IndexExpr *expr) {
+    ASSERT(expr->num_of_subscripts <= 32, "FlatAST: too many subscripts.");
+    uint32_t id = add_expr(fk_index, expr);
+    reserve_children(id, 1 + 2 * expr->num_of_subscripts);
+    set_child(id, 0, visit(expr->base));
+    for (int32_t i = 0; i < expr->num_of_subscripts; i++) {
+      const IndexExpr::Subscript &subscript = expr->subscripts[i];
+      if (subscript.is_range)
+        flat.nodes[id].a |= uint32_t(1) << i;
+      set_child(id, 1 + 2 * i,
+                subscript.begin ? visit(subscript.begin) : FlatNode::none);
+      set_child(id, 2 + 2 * i,
+                subscript.end ? visit(subscript.end) : FlatNode::none);
+    }
+    return id;
+  }
+  uint32_t visit_TransposeExpr(TransposeExpr *expr) {
+    uint32_t id = add_expr(fk_transpose, expr);
+    reserve_children(id, 1);
+    set_child(id, 0, visit(expr->operand));
+    return id;
+  }
+
+  uint32_t visit_ScalaValue(ScalaValue *value) {
+    uint32_t id = add_node(fk_scala);
+    flat.nodes[id].first = flat.constants.size();
+    flat.constants.push_back(value->val);
+    return id;
+  }
+  uint32_t visit_TensorValue(TensorValue *value) {
+    uint32_t id = add_tensor(value->shape());
+    pack(value);
+    return id;
+  }
+  uint32_t visit_PackedTensorValue(PackedTensorValue *value) {
+    uint32_t id = add_tensor(value->shape());
+    flat.constants.insert(flat.constants.end(), value->data,
+                          value->data + value->num_of_elements());
+    return id;
+  }
+
+private:
+  uint32_t add_node(FlatKind kind) {
+    ASSERT(flat.nodes.size() < std::numeric_limits<uint32_t>::max(),
+           "FlatAST: too many nodes.");
+    FlatNode node;
+    node.kind = kind;
+    flat.nodes.push_back(node);
+    return flat.nodes.size() - 1;
+  }
+  uint32_t add_stmt(FlatKind kind, Stmt *stmt) {
+    uint32_t id = add_node(kind);
+    flat.nodes[id].scope = add_scope(stmt->scope);
+    return id;
+  }
+  uint32_t add_expr(FlatKind kind, Expr *expr) {
+    uint32_t id = add_node(kind);
+    flat.nodes[id].type = expr->type();
+    return id;
+  }
+  uint32_t add_tensor(const Shape &shape) {
+    uint32_t id = add_node(fk_tensor);
+    FlatNode &node = flat.nodes[id];
+    node.first = flat.constants.size();
+    node.a = flat.dims.size();
+    node.count = shape.dims_dim();
+    flat.dims.insert(flat.dims.end(), shape.dims(),
+                     shape.dims() + shape.dims_dim());
+    return id;
+  }
+  // append the scalars of the tree tensor ${value} in row-major order
+  void pack(Value *value) {
+    if (ScalaValue *sv = dyn_cast<ScalaValue>(value)) {
+      flat.constants.push_back(sv->val);
+      return;
+    }
+    TensorValue *tv = cast<TensorValue>(value);
+    for (int i = 0; i < tv->dim; i++)
+      pack(tv->vals[i]);
+  }
+
+  void reserve_children(uint32_t id, uint32_t count) {
+    flat.nodes[id].first = flat.children.size();
+    flat.nodes[id].count = count;
+    flat.children.resize(flat.children.size() + count);
+  }
+  void set_child(uint32_t id, uint32_t i, uint32_t child) {
+    flat.children[flat.nodes[id].first + i] = child;
+  }
+  // the children of ${id} are ${head}, if any, and the stmts of ${chain}
+  uint32_t add_chain(uint32_t id, StmtChain *chain, Expr *head = nullptr) {
+    uint32_t count = head != nullptr;
+    for (StmtChain *link = chain; link; link = link->next)
+      count += link->stmt != nullptr;
+    reserve_children(id, count);
+    uint32_t i = 0;
+    if (head)
+      set_child(id, i++, visit(head));
+    for (StmtChain *link = chain; link; link = link->next) {
+      if (link->stmt)
+        set_child(id, i++, visit(link->stmt));
+    }
+    return id;
+  }
+
+  // names and scopes are stored once
+  uint32_t add_string(Symbol name) {
+    auto [it, inserted] = string_ids.try_emplace(name.id(), flat.names.size());
+    if (inserted) {
+      std::string_view str = name.str();
+      flat.names.push_back(
+          {(uint32_t)flat.strings.size(), (uint32_t)str.size()});
+      flat.strings.insert(flat.strings.end(), str.begin(), str.end());
+    }
+    return it->second;
+  }
+  uint32_t add_scope(Scope scope) {
+    auto [it, inserted] = scope_ids.try_emplace(scope.id(), flat.scopes.size());
+    if (inserted) {
+      std::vector<Symbol> names = scope.names();
+      flat.scopes.push_back(
+          {(uint32_t)flat.scope_names.size(), (uint32_t)names.size()});
+      for (Symbol name : names)
+        flat.scope_names.push_back(add_string(name));
+    }
+    return it->second;
+  }
+
+  FlatAST &flat;
+  std::unordered_map<SymbolID, uint32_t> string_ids;
+  std::unordered_map<ScopeID, uint32_t> scope_ids;
+};
+} // namespace
+
+namespace {
+// Build the AST of the nodes of a FlatView in an arena, the inverse of the
+// Flattener. The elements of tensors are copied, so the AST does not depend
+// on the arrays of the view.
+class Expander {
+public:
+  Expander(const FlatView &ast, Arena &arena) : ast(ast), arena(arena) {}
+
+  Stmt *stmt(uint32_t id) {
+    const FlatNode &node = ast.nodes[id];
+    std::span<const uint32_t> children = ast.children_of(node);
+    Scope scope = scope_of(node.scope);
+    switch (node.kind) {
+    case fk_compound:
+      return arena.make<CompoundStmt>(scope, chain(children));
+    case fk_return:
+      return arena.make<ReturnStmt>(
+          scope, children.empty() ? nullptr : expr(children[0]));
+    case fk_loop:
+      return arena.make<LoopStmt>(scope, name(node.a), expr(children[0]),
+                                  chain(children.subspan(1)), node.op != 0);
+    case fk_print:
+      return arena.make<PrintStmt>(scope, expr(children[0]));
+    case fk_def_var:
+      return arena.make<DefVarStmt>(scope, name(node.a), expr(children[0]));
+    case fk_def_func: {
+      int32_t num_of_params = children.size() - 1;
+      Symbol *params = arena.allocate_array<Symbol>(num_of_params);
+      for (int32_t i = 0; i < num_of_params; i++)
+        params[i] = name(ast.nodes[children[i]].a);
+      return arena.make<DefFuncStmt>(
+          scope, name(node.a), cast<CompoundStmt>(stmt(children.back())),
+          num_of_params, params);
+    }
+    default:
+      ERROR("FlatAST: the node is not a Stmt.");
+    }
+  }
+
+  Expr *expr(uint32_t id) {
+    const FlatNode &node = ast.nodes[id];
+    std::span<const uint32_t> children = ast.children_of(node);
+    Expr *expr;
+    switch (node.kind) {
+    case fk_call: {
+      Expr **args = arena.allocate_array<Expr *>(children.size());
+      for (size_t i = 0; i < children.size(); i++)
+        args[i] = this->expr(children[i]);
+      expr = arena.make<CallExpr>(name(node.a), children.size(), args);
+      break;
+    }
+    case fk_var:
+      expr = arena.make<VarExpr>(name(node.a));
+      break;
+    case fk_binary_op:
+      expr = arena.make<BinaryOpExpr>(this->expr(children[0]),
+                                      BinaryOpExpr::OP(node.op),
+                                      this->expr(children[1]));
+      break;
+    case fk_value: {
+      Value *val = value(children[0]);
+      expr = arena.make<ValueExpr>(val);
+      expr->set_shape(val->shape());
+      break;
+    }
+    case fk_index: {
+      int32_t num_of_subscripts = children.size() / 2;
+      IndexExpr::Subscript *subscripts =
+          arena.allocate_array<IndexExpr::Subscript>(num_of_subscripts);
+      for (int32_t i = 0; i < num_of_subscripts; i++) {
+        uint32_t begin = children[1 + 2 * i], end = children[2 + 2 * i];
+        subscripts[i] = {begin == FlatNode::none ? nullptr : this->expr(begin),
+                         end == FlatNode::none ? nullptr : this->expr(end),
+                         (node.a >> i & 1) != 0};
+      }
+      expr = arena.make<IndexExpr>(this->expr(children[0]), num_of_subscripts,
+                                   subscripts);
+      break;
+    }
+    case fk_transpose:
+      expr = arena.make<TransposeExpr>(this->expr(children[0]));
+      break;
+    default:
+      ERROR("FlatAST: the node is not an Expr.");
+    }
+    expr->set_type(Type(node.type));
+    return expr;
+  }
+
+  Value *value(uint32_t id) {
+    const FlatNode &node = ast.nodes[id];
+    if (node.kind == fk_scala)
+      return arena.make<ScalaValue>(*ast.data_of(node));
+    ASSERT(node.kind == fk_tensor, "FlatAST: the node is not a value.");
+    PackedTensorValue *tensor =
+        PackedTensorValue::create(arena, node.count, ast.dims.data() + node.a);
+    std::memcpy(tensor->data, ast.data_of(node),
+                sizeof(double) * tensor->num_of_elements());
+    return tensor;
+  }
+
+private:
+  StmtChain *chain(std::span<const uint32_t> stmts) {
+    StmtChain *head = arena.make<StmtChain>();
+    StmtChain *tail = head;
+    for (size_t i = 0; i < stmts.size(); i++) {
+      if (i == 0)
+        head->stmt = stmt(stmts[0]);
+      else
+        tail = tail->add(arena, stmt(stmts[i]));
+    }
+    return head;
+  }
+  Symbol name(uint32_t id) { return Symbol(ast.string(id)); }
+  // a scope is entered once per name of its levels
+  Scope scope_of(uint32_t id) {
+    auto [it, inserted] = scopes.try_emplace(id);
+    if (inserted) {
+      const FlatScope &levels = ast.scopes[id];
+      for (uint32_t name : ast.scope_names.subspan(levels.first, levels.count))
+        it->second.push(ast.string(name));
+    }
+    return it->second;
+  }
+
+  const FlatView &ast;
+  Arena &arena;
+  std::unordered_map<uint32_t, Scope> scopes;
+};
+} // namespace
+
+FlatAST FlatAST::flatten(CompoundStmt *root) {
+  FlatAST flat;
+  Flattener(flat).visit(root);
+  return flat;
+}
+
+Shape FlatView::shape_of(const FlatNode &node) const {
+  if (node.kind == fk_scala)
+    return Shape::scala();
+  ASSERT(node.kind == fk_tensor, "FlatAST: the node is not a value.");
+  return Shape(node.count, dims.data() + node.a);
+}
+
+CompoundStmt *FlatAST::expand(const FlatView &ast, Arena &arena) {
+  return cast<CompoundStmt>(Expander(ast, arena).stmt(0));
+}
@@ -0,0 +1,165 @@
+#include "../include/Fusion.h"
+#include "../include/Casting.h"
+#include "../include/Error.h"
+#include "../include/Kernels.h"
+#include <algorithm>
+#include <cstdio>
+
+static bool is_elementwise(Expr *expr) {
+  BinaryOpExpr *binary = dyn_cast<BinaryOpExpr>(expr);
+  return binary && binary->op != BinaryOpExpr::matmul;
+}
+
+int32_t Fusion::num_of_ops(Expr *expr) {
+  if (!is_elementwise(expr))
+    return 0;
+  BinaryOpExpr *binary = cast<BinaryOpExpr>(expr);
+  return 1 + num_of_ops(binary->lhs) + num_of_ops(binary->rhs);
+}
+
+namespace {
+class FusionBuilder {
+public:
+  FusionBuilder(Fusion &fusion, std::vector<Expr *> &inputs)
+      : fusion(fusion), inputs(inputs), first(inputs.size()) {}
+
+  // Emit the steps of ${expr}, ${held} values are held below it
+  void build(Expr *expr, uint16_t held) {
+    fusion.depth = std::max<uint16_t>(fusion.depth, held + 1);
+    if (is_elementwise(expr)) {
+      BinaryOpExpr *binary = cast<BinaryOpExpr>(expr);
+      build(binary->lhs, held);
+      build(binary->rhs, held + 1);
+      Fusion::Step step{Fusion::Step::sk_op};
+      step.op = binary->op;
+      fusion.steps.push_back(step);
+      return;
+    }
+    if (ValueExpr *value = dyn_cast<ValueExpr>(expr))
+      if (ScalaValue *scala = dyn_cast<ScalaValue>(value->val)) {
+        Fusion::Step step{Fusion::Step::sk_constant};
+        step.constant_value = scala->val;
+        fusion.steps.push_back(step);
+        return;
+      }
+    Fusion::Step step{Fusion::Step::sk_input};
+    step.index = input_of(expr);
+    fusion.steps.push_back(step);
+  }
+
+private:
+  // the index of the input ${expr}, the same for every use of a variable
+  uint16_t input_of(Expr *expr) {
+    if (VarExpr *var = dyn_cast<VarExpr>(expr))
+      for (size_t i = first; i < inputs.size(); i++) {
+        VarExpr *other = dyn_cast<VarExpr>(inputs[i]);
+        if (other && other->var_name == var->var_name)
+          return uint16_t(i - first);
+      }
+    ASSERT(inputs.size() - first < UINT16_MAX,
+           "A fused expression has too many inputs.");
+    inputs.push_back(expr);
+    return fusion.num_of_inputs++;
+  }
+
+  Fusion &fusion;
+  std::vector<Expr *> &inputs;
+  const size_t first;
+};
+} // namespace
+
+Fusion Fusion::of(BinaryOpExpr *root, std::vector<Expr *> &inputs) {
+  ASSERT(root->op != BinaryOpExpr::matmul,
+         "Fusion::of: @ is not an element-wise operator.");
+  Fusion fusion;
+  FusionBuilder(fusion, inputs).build(root, 0);
+  return fusion;
+}
+
+namespace {
+// A value of the evaluation: a block of elements, or a scalar if ${data} is
+// nullptr
+struct Slot {
+  const double *data;
+  double scala;
+};
+} // namespace
+
+void Fusion::run(const FusedInput *inputs, double *out, int64_t n,
+                 double *scratch) const {
+  std::vector<Slot> stack(depth);
+  for (int64_t start = 0; start < n; start += block_size) {
+    const int64_t len = std::min(block_size, n - start);
+    size_t top = 0;
+    for (size_t s = 0; s < steps.size(); s++) {
+      const Step &step = steps[s];
+      if (step.kind == Step::sk_input) {
+        const FusedInput &input = inputs[step.index];
+        stack[top++] = {input.data ? input.data + start : nullptr,
+                        input.scala};
+        continue;
+      }
+      if (step.kind == Step::sk_constant) {
+        stack[top++] = {nullptr, step.constant_value};
+        continue;
+      }
+      const BinaryOpExpr::OP op = BinaryOpExpr::OP(step.op);
+      const Slot rhs = stack[--top], lhs = stack[top - 1];
+      if (!lhs.data && !rhs.data) {
+        stack[top - 1] = {nullptr, apply(op, lhs.scala, rhs.scala)};
+        continue;
+      }
+      // The last op writes the result, the others the tile of their depth.
+      // A tile may be an operand too, it is read and written element by
+      // element.
+      double *dest = s + 1 == steps.size()
+                         ? out + start
+                         : scratch + (top - 1) * block_size;
+      if (lhs.data && rhs.data)
+        elementwise(op, lhs.data, rhs.data, dest, len);
+      else if (lhs.data)
+        elementwise(op, lhs.data, rhs.scala, dest, len);
+      else
+        elementwise(op, lhs.scala, rhs.data, dest, len);
+      stack[top - 1] = {dest, 0};
+    }
+    ASSERT(top == 1 && stack[0].data == out + start,
+           "Fusion::run: the result is not a tensor.");
+  }
+}
+
+double Fusion::run(const FusedInput *inputs) const {
+  std::vector<double> stack;
+  stack.reserve(depth);
+  for (const Step &step : steps) {
+    if (step.kind == Step::sk_input) {
+      stack.push_back(inputs[step.index].scala);
+    } else if (step.kind == Step::sk_constant) {
+      stack.push_back(step.constant_value);
+    } else {
+      const double rhs = stack.back();
+      stack.pop_back();
+      stack.back() = apply(BinaryOpExpr::OP(step.op), stack.back(), rhs);
+    }
+  }
+  return stack.back();
+}
+
+std::string Fusion::str() const {
+  std::vector<std::string> stack;
+  for (const Step &step : steps) {
+    if (step.kind == Step::sk_input) {
+      stack.push_back("in" + std::to_string(step.index));
+    } else if (step.kind == Step::sk_constant) {
+      char constant[32];
+      snprintf(constant, sizeof(constant), "%g", step.constant_value);
+      stack.push_back(constant);
+    } else {
+      std::string rhs = stack.back();
+      stack.pop_back();
+      stack.back() = "(" + stack.back() + " " +
+                     op_name(BinaryOpExpr::OP(step.op)) + " " + rhs + ")";
+    }
+  }
+  return stack.empty() ? "" : stack.back();
+}
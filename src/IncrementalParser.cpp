@@ -0,0 +1,147 @@
+#include "../include/IncrementalParser.h"
+#include "../include/Casting.h"
+#include <algorithm>
+
+IncrementalParser::IncrementalParser(std::string file_name, std::string text)
+    : file_name(std::move(file_name)) {
+  // everything is inserted into an empty text
+  apply({TextEdit{0, 0, std::move(text)}});
+}
+
+IncrementalParser::Segment
+IncrementalParser::parse_segment(const std::string &text, SourceRange range) {
+  Segment segment;
+  segment.range = range;
+  segment.parser = std::make_unique<Parser>(
+      file_name, SourceBuffer::borrow(text), range);
+  segment.first = cast<CompoundStmt>(segment.parser->parse())->stmts();
+  segment.last = segment.first->rehead(&head);
+  return segment;
+}
+
+void IncrementalParser::apply(std::vector<TextEdit> edits) {
+  std::sort(edits.begin(), edits.end(),
+            [](const TextEdit &a, const TextEdit &b) {
+              return a.offset < b.offset;
+            });
+  // the new text, and how far the edits up to each one shift the text behind
+  std::string text;
+  std::vector<int64_t> shifted_bytes;
+  std::vector<int32_t> shifted_lines;
+  size_t copied = 0;
+  int64_t bytes = 0;
+  int32_t lines = 0;
+  for (const TextEdit &edit : edits) {
+    ASSERT(edit.offset >= copied && edit.offset + edit.length <= _text.size(),
+           "The edits overlap or are out of " + file_name);
+    text.append(_text, copied, edit.offset - copied);
+    text += edit.text;
+    copied = edit.offset + edit.length;
+    bytes += (int64_t)edit.text.size() - edit.length;
+    lines += std::count(edit.text.begin(), edit.text.end(), '\n') -
+             std::count(_text.begin() + edit.offset,
+                        _text.begin() + edit.offset + edit.length, '\n');
+    shifted_bytes.push_back(bytes);
+    shifted_lines.push_back(lines);
+  }
+  text.append(_text, copied);
+  ASSERT(text.size() <= UINT32_MAX, "Token offsets are 32-bit, " + file_name +
+                                        " must be smaller than 4GB.");
+
+  // the number of edits in front of the old offset ${offset}
+  auto edits_before = [&](uint32_t offset) -> size_t {
+    return std::lower_bound(edits.begin(), edits.end(), offset,
+                            [](const TextEdit &edit, uint32_t offset) {
+                              return edit.offset < offset;
+                            }) -
+           edits.begin();
+  };
+  // Where the old offset ${offset} is in the new text. It must not be inside
+  // an edited range.
+  auto new_offset = [&](uint32_t offset) -> uint32_t {
+    size_t n = edits_before(offset);
+    return n ? offset + shifted_bytes[n - 1] : offset;
+  };
+  auto new_line = [&](uint32_t offset, int32_t line) -> int32_t {
+    size_t n = edits_before(offset);
+    return n ? line + shifted_lines[n - 1] : line;
+  };
+  // the old offset ${offset} is not inside or at an edited range
+  auto untouched = [&](uint32_t offset) {
+    size_t n = edits_before(offset);
+    if (n < edits.size() && edits[n].offset == offset)
+      return false;
+    return n == 0 || edits[n - 1].offset + edits[n - 1].length <= offset;
+  };
+  // an edit overlaps or borders the segment ${i}, whose blank tail is the end
+  // of the text if it is the last segment
+  auto touched = [&](size_t i) {
+    uint32_t begin = segments[i].range.begin;
+    uint32_t end =
+        i + 1 == segments.size() ? _text.size() : segments[i].range.end;
+    size_t n = edits_before(begin);
+    if (n > 0 && edits[n - 1].offset + edits[n - 1].length >= begin)
+      return true;
+    return n < edits.size() && edits[n].offset <= end;
+  };
+
+  // the new segments, either parsed again or taken from the old segment at
+  // the same index of ${reused}
+  std::vector<Segment> parsed;
+  std::vector<size_t> reused;
+  const size_t no_reuse = SIZE_MAX;
+  auto rescan = [&](uint32_t begin, int32_t line, size_t next) {
+    // split until a statement ends at an old boundary behind the edits
+    Segmenter segmenter(text, begin, line);
+    SourceRange range;
+    while (segmenter.next(range)) {
+      parsed.push_back(parse_segment(text, range));
+      reused.push_back(no_reuse);
+      while (next < segments.size() &&
+             (!untouched(segments[next].range.begin) ||
+              new_offset(segments[next].range.begin) < range.end))
+        next++;
+      if (next < segments.size() &&
+          new_offset(segments[next].range.begin) == range.end)
+        return next;
+    }
+    return segments.size();
+  };
+  if (segments.empty() && !edits.empty())
+    rescan(0, 1, 0);
+  for (size_t i = 0; i < segments.size();) {
+    const SourceRange &old = segments[i].range;
+    if (!touched(i)) {
+      Segment segment;
+      segment.range = {new_offset(old.begin), new_offset(old.end),
+                       new_line(old.begin, old.line)};
+      parsed.push_back(std::move(segment));
+      reused.push_back(i);
+      i++;
+      continue;
+    }
+    i = rescan(new_offset(old.begin), new_line(old.begin, old.line), i + 1);
+  }
+
+  // Everything parsed, commit
+  reparsed = 0;
+  for (size_t i = 0; i < parsed.size(); i++) {
+    if (reused[i] == no_reuse) {
+      reparsed++;
+      continue;
+    }
+    Segment &old = segments[reused[i]];
+    parsed[i].parser = std::move(old.parser);
+    parsed[i].first = old.first;
+    parsed[i].last = old.last;
+  }
+  segments = std::move(parsed);
+  _text = std::move(text);
+  StmtChain *tail = &head;
+  for (Segment &segment : segments) {
+    tail->next = segment.first;
+    tail = segment.last;
+  }
+  tail->next = nullptr;
+  root = std::make_unique<CompoundStmt>(Scope(), &head);
+}
@@ -0,0 +1,229 @@
+#include "../include/Kernels.h"
+#include "../include/Error.h"
+#include "../include/MatMul.h"
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+const char *op_name(BinaryOpExpr::OP op) {
+  switch (op) {
+  case BinaryOpExpr::add:
+    return "+";
+  case BinaryOpExpr::sub:
+    return "-";
+  case BinaryOpExpr::mul:
+    return "*";
+  case BinaryOpExpr::div:
+    return "/";
+  case BinaryOpExpr::matmul:
+    return "@";
+  }
+  ERROR("op_name: unknown operator.");
+}
+
+// ${value} as print writes it
+static std::string number_str(double value) {
+  std::ostringstream out;
+  out << value;
+  return out.str();
+}
+
+int64_t index_of(double value, int64_t n) {
+  if (std::trunc(value) != value)
+    ERROR("The index " + number_str(value) + " is not an integer");
+  if (value < 0 || value >= n)
+    ERROR("The index " + number_str(value) + " is out of range for a dim of " +
+          std::to_string(n));
+  return int64_t(value);
+}
+
+int64_t bound_of(double value, int64_t n) {
+  if (std::trunc(value) != value)
+    ERROR("The bound " + number_str(value) + " of a range is not an integer");
+  if (value < 0 || value > n)
+    ERROR("The bound " + number_str(value) +
+          " of a range is out of range for a dim of " + std::to_string(n));
+  return int64_t(value);
+}
+
+void check_range(int64_t begin, int64_t end) {
+  if (begin > end)
+    ERROR("The range " + std::to_string(begin) + "~" + std::to_string(end) +
+          " ends before it begins");
+}
+
+// The switch over the operator is hoisted out of the loops, so every loop is
+// a single arithmetic instruction the compiler can vectorize.
+template <typename Lhs, typename Rhs>
+static void each(BinaryOpExpr::OP op, Lhs lhs, Rhs rhs, double *out,
+                 int64_t n) {
+  switch (op) {
+  case BinaryOpExpr::add:
+    for (int64_t i = 0; i < n; i++)
+      out[i] = lhs(i) + rhs(i);
+    return;
+  case BinaryOpExpr::sub:
+    for (int64_t i = 0; i < n; i++)
+      out[i] = lhs(i) - rhs(i);
+    return;
+  case BinaryOpExpr::mul:
+    for (int64_t i = 0; i < n; i++)
+      out[i] = lhs(i) * rhs(i);
+    return;
+  case BinaryOpExpr::div:
+    for (int64_t i = 0; i < n; i++)
+      out[i] = lhs(i) / rhs(i);
+    return;
+  case BinaryOpExpr::matmul:
+    break;
+  }
+  ERROR("elementwise: @ is not an element-wise operator.");
+}
+
+void elementwise(BinaryOpExpr::OP op, const double *lhs, const double *rhs,
+                 double *out, int64_t n) {
+  each(
+      op, [lhs](int64_t i) { return lhs[i]; },
+      [rhs](int64_t i) { return rhs[i]; }, out, n);
+}
+
+void elementwise(BinaryOpExpr::OP op, const double *lhs, double rhs,
+                 double *out, int64_t n) {
+  each(
+      op, [lhs](int64_t i) { return lhs[i]; }, [rhs](int64_t) { return rhs; },
+      out, n);
+}
+
+void elementwise(BinaryOpExpr::OP op, double lhs, const double *rhs,
+                 double *out, int64_t n) {
+  each(
+      op, [lhs](int64_t) { return lhs; }, [rhs](int64_t i) { return rhs[i]; },
+      out, n);
+}
+
+namespace {
+// an element-wise op whose operands are broadcast to the shape of its result
+struct Broadcast {
+  BinaryOpExpr::OP op;
+  Shape shape;
+  // the strides of the operands along the dims of the result, 0 along the
+  // dims they are stretched over, and those of the result
+  std::vector<int64_t> lhs, rhs, out;
+};
+} // namespace
+
+// the elements of ${out} along the dims [${dim}, rank) of the result, the
+// operands point at the elements of the same index
+static void broadcast_dims(const Broadcast &op, int32_t dim,
+                           const double *lhs, const double *rhs,
+                           double *out) {
+  const int32_t rank = op.shape.dims_dim();
+  if (dim == rank) {
+    *out = apply(op.op, *lhs, *rhs);
+    return;
+  }
+  const int64_t n = op.shape[dim];
+  const int64_t lhs_stride = op.lhs[dim], rhs_stride = op.rhs[dim];
+  if (dim + 1 < rank) {
+    for (int64_t i = 0; i < n; i++)
+      broadcast_dims(op, dim + 1, lhs + i * lhs_stride, rhs + i * rhs_stride,
+                     out + i * op.out[dim]);
+    return;
+  }
+  // along the last dim, a stretched operand is a single element
+  if (lhs_stride == 1 && rhs_stride == 1)
+    elementwise(op.op, lhs, rhs, out, n);
+  else if (lhs_stride == 1 && rhs_stride == 0)
+    elementwise(op.op, lhs, *rhs, out, n);
+  else if (lhs_stride == 0 && rhs_stride == 1)
+    elementwise(op.op, *lhs, rhs, out, n);
+  else
+    each(
+        op.op, [=](int64_t i) { return lhs[i * lhs_stride]; },
+        [=](int64_t i) { return rhs[i * rhs_stride]; }, out, n);
+}
+
+void matmul(const double *a, const double *b, double *c, int64_t m, int64_t n,
+            int64_t k, bool a_transposed, bool b_transposed) {
+  MatMul::run(MatMul::plan(m, n, k),
+              MatMul::variant(a_transposed, b_transposed), a, b, c);
+}
+
+// the strides of ${tensor} along the dims of ${shape}, which it has
+static std::vector<int64_t> strides_of(const Tensor &tensor,
+                                       const Shape &shape) {
+  std::vector<int64_t> strides(shape.dims_dim());
+  for (int32_t i = 0; i < shape.dims_dim(); i++)
+    strides[i] = tensor.stride(i);
+  return strides;
+}
+
+Tensor elementwise(BinaryOpExpr::OP op, const Tensor &lhs, const Tensor &rhs) {
+  const Shape shape = Shape::broadcast(lhs.shape(), rhs.shape());
+  if (shape.unintialized())
+    ERROR(std::string("Cannot apply ") + op_name(op) +
+          " to tensors of shapes " + lhs.shape().str() + " and " +
+          rhs.shape().str());
+  Tensor out(shape);
+  if (lhs.shape() == rhs.shape() && lhs.is_contiguous() &&
+      rhs.is_contiguous()) {
+    elementwise(op, lhs.data(), rhs.data(), out.data(),
+                out.num_of_elements());
+    return out;
+  }
+  // the operands are read in place through their strides, a broadcast one
+  // through a view that repeats its elements
+  const Broadcast broadcast{op, shape,
+                            strides_of(lhs.broadcast_to(shape), shape),
+                            strides_of(rhs.broadcast_to(shape), shape),
+                            strides_of(out, shape)};
+  broadcast_dims(broadcast, 0, lhs.data(), rhs.data(), out.data());
+  return out;
+}
+
+Tensor elementwise(BinaryOpExpr::OP op, const Tensor &lhs, double rhs) {
+  Tensor out(lhs.shape());
+  if (lhs.is_contiguous()) {
+    elementwise(op, lhs.data(), rhs, out.data(), out.num_of_elements());
+    return out;
+  }
+  // a strided operand is read in place, the scalar is stretched to it
+  const Shape &shape = lhs.shape();
+  const Broadcast broadcast{op, shape, strides_of(lhs, shape),
+                            std::vector<int64_t>(shape.dims_dim(), 0),
+                            strides_of(out, shape)};
+  broadcast_dims(broadcast, 0, lhs.data(), &rhs, out.data());
+  return out;
+}
+
+Tensor elementwise(BinaryOpExpr::OP op, double lhs, const Tensor &rhs) {
+  Tensor out(rhs.shape());
+  if (rhs.is_contiguous()) {
+    elementwise(op, lhs, rhs.data(), out.data(), out.num_of_elements());
+    return out;
+  }
+  const Shape &shape = rhs.shape();
+  const Broadcast broadcast{op, shape,
+                            std::vector<int64_t>(shape.dims_dim(), 0),
+                            strides_of(rhs, shape), strides_of(out, shape)};
+  broadcast_dims(broadcast, 0, &lhs, rhs.data(), out.data());
+  return out;
+}
+
+// a matrix transposed by .T is read as it is
+static bool read_transposed(const Tensor &operand) {
+  return operand.rank() == 2 && !operand.is_contiguous() &&
+         operand.is_transposed();
+}
+
+Tensor matmul(const Tensor &lhs, const Tensor &rhs) {
+  MatMul::Plan plan = MatMul::plan(lhs.shape(), rhs.shape());
+  Tensor out(plan.shape);
+  const bool lhs_transposed = read_transposed(lhs);
+  const bool rhs_transposed = read_transposed(rhs);
+  MatMul::run(plan, MatMul::variant(lhs_transposed, rhs_transposed),
+              lhs_transposed ? lhs.data() : lhs.contiguous().data(),
+              rhs_transposed ? rhs.data() : rhs.contiguous().data(),
+              out.data());
+  return out;
+}
@@ -1,282 +1,186 @@
 #include "../include/Lexer.h"
 #include "../include/Error.h"
-#include <cctype>
-#include <cstdio>
-#include <stdlib.h>
+#include <limits>
 #include <string>
 
-void Lexer::eat_chars_in_the_current_line(int number) {
-  while (number--) {
-    file_loc.col++;
+static_assert(is_keyword("def") && is_keyword("print") && is_keyword("for") &&
+              is_keyword("in") && is_keyword("return") && is_keyword("let"));
+static_assert(!is_keyword("define") && !is_keyword("x") && !is_keyword("fo"));
+
+Lexer::Lexer(FileLocation file_loc, SourceBuffer source)
+    : file_loc(file_loc), source(std::move(source)) {
+  ASSERT(this->source.size() <= std::numeric_limits<uint32_t>::max(),
+         "Token offsets are 32-bit, " + file_loc.file_name +
+             " must be smaller than 4GB.");
+  end = this->source.size();
+  new_line(0);
+}
+
+Lexer::Lexer(FileLocation file_loc, SourceBuffer source, SourceRange range)
+    : file_loc(file_loc), source(std::move(source)) {
+  ASSERT(range.begin <= range.end && range.end <= this->source.size(),
+         "The range is out of " + file_loc.file_name);
+  pos = range.begin;
+  end = range.end;
+  // columns count from the start of the line the range starts in
+  size_t begin = range.begin;
+  while (begin > 0 && this->source.data()[begin - 1] != '\n') {
+    begin--;
   }
-  ASSERT(file_loc.col <= code_line_length,
-         "file_loc.col (" + std::to_string(file_loc.col) +
-             ") should not be larger than code_line_length (" +
-             std::to_string(code_line_length) + ").");
+  this->file_loc.line = range.line - 1;
+  new_line(begin);
 }
 
-std::string_view Lexer::get_chars_in_this_line(int number) {
-  ASSERT(number > 0, "get_chars_in_this_line: The number of characeters you "
-                     "want to obtain should be larger than 0.");
-  ASSERT(number + file_loc.col <= code_line_length,
-         "There are only " + std::to_string(code_line_length - file_loc.col) +
-             " unhandled characters in this line (" + code_line +
-             "), but the lexer requires " + std::to_string(number));
-  return std::string_view(code_line.data() + file_loc.col, number);
-}
-
-char Lexer::get_char_in_this_line(int dis) {
-  ASSERT(dis >= 0, "dis should not be less than zero.");
-  ASSERT(dis + file_loc.col < code_line_length,
-         "get_char_in_this_line: There are only " +
-             std::to_string(code_line_length - file_loc.col) +
-             " unhandled characters in this line (" + code_line +
-             "), but the lexer requires the " + std::to_string(dis + 1) +
-             (dis == 1 ? "st" : (dis == 2 ? "nd" : "th")));
-  return code_line[file_loc.col + dis];
-}
-
-void Lexer::nextLine() {
-  std::getline(file, code_line);
-  code_line_length = code_line.size();
+void Lexer::new_line(size_t begin) {
   file_loc.line++;
   file_loc.col = 0;
+  line_begin = begin;
 }
 
-int Lexer::num_of_unhandled_chars_this_line() {
-  return code_line_length - file_loc.col;
+std::string_view Lexer::line_at(size_t offset) {
+  std::string_view text = source.view();
+  size_t begin = offset;
+  while (begin > 0 && text[begin - 1] != '\n') {
+    begin--;
+  }
+  std::string_view line = text.substr(begin);
+  return line.substr(0, line.find('\n'));
 }
 
 void Lexer::report(std::string error_msg) {
   std::string msg = "File: " + file_loc.file_name +
                     ", Line: " + std::to_string(file_loc.line) + "\n" +
-                    code_line + "\n";
+                    std::string(line_at(line_begin)) + "\n";
   msg += std::string(file_loc.col, ' ') + "^ " + error_msg;
   ERROR(msg);
 }
 
-bool Lexer::is_end_of_line(int num) {
-  return file_loc.col + num >= code_line_length;
-}
-
-bool Lexer::is_space(int number) {
-  if (is_end_of_line(number))
-    return false;
-  ASSERT(number + file_loc.col < code_line_length,
-         "The value of the argument number is at most " +
-             std::to_string(code_line_length - file_loc.col - 1) +
-             ". But you offer a " + std::to_string(number));
-  return std::isspace(code_line[file_loc.col + number]);
-}
-
-void TokenHandler::pass() { return this->next->handle(lexer->code_line); }
-
-#define REGISTER_KEYWORD_TOKEN_HANDLER(LEN, NAME)                              \
-  if (lexer->num_of_unhandled_chars_this_line() < LEN) {                       \
-    pass();                                                                    \
-  } else if (lexer->get_chars_in_this_line(LEN) == #NAME &&                    \
-             (lexer->is_end_of_line(LEN) || lexer->is_space(LEN))) {           \
-    this->lexer->kind = tk_keyword;                                            \
-    this->lexer->token_text = #NAME;                                           \
-    this->lexer->eat_chars_in_the_current_line(LEN);                           \
-  } else                                                                       \
-    pass();
-
-void TokenHandler_def::handle(std::string &code_line) {
-  TokenHandler::handle(code_line);
-  REGISTER_KEYWORD_TOKEN_HANDLER(3, def);
-}
-
-void TokenHandler_print::handle(std::string &code_line) {
-  TokenHandler::handle(code_line);
-  REGISTER_KEYWORD_TOKEN_HANDLER(5, print);
-}
-
-void TokenHandler_for::handle(std::string &code_line) {
-  TokenHandler::handle(code_line);
-  REGISTER_KEYWORD_TOKEN_HANDLER(3, for);
+void Lexer::report(const Token &token, std::string error_msg) {
+  std::string msg = "File: " + file_loc.file_name +
+                    ", Line: " + std::to_string(token.line) + "\n" +
+                    std::string(line_at(token.offset)) + "\n";
+  msg += std::string(token.col, ' ') + "^ " + error_msg;
+  ERROR(msg);
 }
 
-void TokenHandler_in::handle(std::string &code_line) {
-  TokenHandler::handle(code_line);
-  REGISTER_KEYWORD_TOKEN_HANDLER(2, in);
-}
+bool Lexer::nextToken() { return lex(current); }
 
-void TokenHandler_return::handle(std::string &code_line) {
-  TokenHandler::handle(code_line);
-  REGISTER_KEYWORD_TOKEN_HANDLER(6, return);
+// Most runs are short, like the single space after a comma or the few digits
+// of a number, so the first characters are checked inline and the SIMD kernel
+// only takes over for long runs.
+template <typename InClass, typename Kernel>
+static inline size_t skip_run(const char *text, size_t pos, size_t size,
+                              InClass in_class, Kernel kernel) {
+  for (size_t stop = pos + 8; pos < stop; pos++) {
+    if (pos == size || !in_class(char_class(text[pos])))
+      return pos;
+  }
+  return kernel(text + pos, text + size) - text;
 }
 
-void TokenHandler_let::handle(std::string &code_line) {
-  TokenHandler::handle(code_line);
-  REGISTER_KEYWORD_TOKEN_HANDLER(3, let);
+static inline bool is_space_class(CharClass cc) { return cc == cc_space; }
+static inline bool is_digit_class(CharClass cc) { return cc == cc_digit; }
+static inline bool is_alnum_class(CharClass cc) {
+  return cc == cc_alpha || cc == cc_digit;
 }
 
-void TokenHandler_identifier::handle(std::string &code_line) {
-  TokenHandler::handle(code_line);
-  if (!std::isalpha(lexer->get_char_in_this_line(0))) {
-    pass();
-    return;
-  }
-  int32_t len = 1;
-  while (!(lexer->is_end_of_line(len) || lexer->is_space(len)) &&
-         std::isalnum(lexer->get_char_in_this_line(len))) {
-    len++;
+bool Lexer::lex(Token &token) {
+  const char *text = source.data();
+  const size_t size = end;
+  // skip whitespaces, lines included
+  while (true) {
+    pos = skip_run(text, pos, size, is_space_class, scan.skip_spaces);
+    if (pos == size || text[pos] != '\n')
+      break;
+    new_line(++pos);
   }
-  this->lexer->kind = tk_identifier;
-  this->lexer->token_text = code_line.substr(lexer->file_loc.col, len);
-  this->lexer->eat_chars_in_the_current_line(len);
-}
-
-void TokenHandler_punctuation::handle(std::string &code_line) {
-  TokenHandler::handle(code_line);
-  if (!std::ispunct(lexer->get_char_in_this_line(0))) {
-    pass();
-    return;
+  file_loc.col = pos - line_begin;
+  token.line = file_loc.line;
+  token.col = file_loc.col;
+  token.offset = pos;
+  if (pos == size) {
+    token.kind = tk_eof;
+    token.length = 0;
+    return false;
   }
-  int32_t len = 1;
-  switch (lexer->get_char_in_this_line(0)) {
-  // basic calculation-related symbols can be followed by a single '='
-  case '+':
-  case '-':
-  case '*':
-  case '/':
-  case '@':
-    if (!lexer->is_end_of_line(1) && lexer->get_char_in_this_line(1) == '=') {
-      len++;
-    }
+  const size_t begin = pos;
+  switch (char_class(text[pos])) {
+  case cc_alpha:
+    pos = skip_run(text, pos + 1, size, is_alnum_class, scan.skip_alnum);
+    token.kind = is_keyword(std::string_view(text + begin, pos - begin))
+                     ? tk_keyword
+                     : tk_identifier;
     break;
-  // .T means transpose
-  case '.':
-    if (!lexer->is_end_of_line(1) && lexer->get_char_in_this_line(1) == 'T') {
-      len++;
+  case cc_period:
+    // .T means transpose, and .5 is a number
+    if (pos + 1 == size || char_class(text[pos + 1]) != cc_digit) {
+      pos += (pos + 1 < size && text[pos + 1] == 'T') ? 2 : 1;
+      token.kind = tk_punctuation;
+      break;
+    }
+    [[fallthrough]];
+  case cc_digit:
+    // a number has at most one period
+    pos = skip_run(text, pos, size, is_digit_class, scan.skip_digits);
+    if (pos < size && text[pos] == '.') {
+      pos = skip_run(text, pos + 1, size, is_digit_class, scan.skip_digits);
     }
+    token.kind = tk_number;
     break;
-  // ; -> statement delimiter ;; -> function delimiter
-  case ';':
-    if (!lexer->is_end_of_line(1) && lexer->get_char_in_this_line(1) == ';') {
-      len++;
+  case cc_quote: {
+    // a string ends at the same delimiter in the same line
+    const char delimiter = text[pos];
+    pos = scan.find_string_end(text + pos + 1, text + size, delimiter) - text;
+    if (pos == size || text[pos] != delimiter) {
+      pos = begin;
+      report("Unexpected character");
     }
+    pos++;
+    token.kind = tk_string;
+    break;
+  }
+  // basic calculation-related symbols can be followed by a single '='
+  case cc_arith:
+    pos += (pos + 1 < size && text[pos + 1] == '=') ? 2 : 1;
+    token.kind = tk_punctuation;
     break;
-  case '&': // reference
-  case '~': // range
-  case ':': // field
-  case '#': // comment
-  case ',': // element delimiter
-  case '[':
-  case ']':
-  case '{':
-  case '}':
-  case '(':
-  case ')':
-  case '=':
+  case cc_semicolon:
+    pos += (pos + 1 < size && text[pos + 1] == ';') ? 2 : 1;
+    token.kind = tk_punctuation;
     break;
-  default:
-    this->lexer->report("Unexpected character");
+  case cc_punct:
+    pos++;
+    token.kind = tk_punctuation;
     break;
+  default:
+    report("Unexpected character");
   }
-  this->lexer->kind = tk_punctuation;
-  this->lexer->token_text = code_line.substr(lexer->file_loc.col, len);
-  this->lexer->eat_chars_in_the_current_line(len);
+  token.length = pos - begin;
+  file_loc.col = pos - line_begin;
+  return true;
 }
 
-void TokenHandler_number::handle(std::string &code_line) {
-  TokenHandler::handle(code_line);
-  if (!(std::isdigit(lexer->get_char_in_this_line(0)) ||
-        lexer->get_char_in_this_line(0) == '.' && !lexer->is_end_of_line(1) &&
-            std::isdigit(lexer->get_char_in_this_line(1)))) {
-    pass();
-    return;
-  }
-  int32_t len = 1;
-  bool period_shown_up = (lexer->get_char_in_this_line(0) == '.');
-  while (!(lexer->is_end_of_line(len) || lexer->is_space(len)) &&
-         (std::isdigit(
-             lexer->get_char_in_this_line(len) ||
-             (!period_shown_up && lexer->get_char_in_this_line(len) == '.')))) {
-    if (!period_shown_up)
-      period_shown_up = lexer->get_char_in_this_line(len) == '.';
-    len++;
+const Token &TokenStream::peek(size_t k) {
+  ASSERT(k < lookahead, "TokenStream can look at most " +
+                            std::to_string(lookahead) + " tokens ahead.");
+  while (count <= k) {
+    lexer.lex(ring[(head + count) & (lookahead - 1)]);
+    count++;
   }
-  this->lexer->kind = tk_number;
-  this->lexer->token_text = code_line.substr(lexer->file_loc.col, len);
-  this->lexer->eat_chars_in_the_current_line(len);
+  return ring[(head + k) & (lookahead - 1)];
 }
 
-void TokenHandler_string::handle(std::string &code_line) {
-  TokenHandler::handle(code_line);
-  if (lexer->get_char_in_this_line(0) != '\"' &&
-      lexer->get_char_in_this_line(0) != '\'') {
-    pass();
-    return;
+Token TokenStream::next() {
+  Token token = peek(0);
+  // the tk_eof token is never consumed
+  if (token.kind != tk_eof) {
+    head = (head + 1) & (lookahead - 1);
+    count--;
   }
-  int32_t len = 1;
-  bool meet_another_delimiter = false;
-  char delimeter = lexer->get_char_in_this_line(0);
-  while (!(lexer->is_end_of_line(len))) {
-    if (lexer->get_char_in_this_line(len) == delimeter) {
-      len++;
-      meet_another_delimiter = true;
-      break;
-    }
-    len++;
-  }
-  if (meet_another_delimiter) {
-    this->lexer->kind = tk_string;
-    this->lexer->token_text = code_line.substr(lexer->file_loc.col, len);
-    this->lexer->eat_chars_in_the_current_line(len);
-  } else {
-    this->lexer->report("Unexpected character");
-  }
-}
-
-void TokenHandler_unknown::handle(std::string &code_line) {
-  TokenHandler::handle(code_line);
-  this->lexer->report("Unexpected character");
+  return token;
 }
 
-TokenHandler *Default_TokenHandler_Factory::create(Lexer *lexer) {
-  return new TokenHandler_def(
-      lexer,
-      new TokenHandler_print(
-          lexer,
-          new TokenHandler_for(
-              lexer,
-              new TokenHandler_in(
-                  lexer,
-                  new TokenHandler_return(
-                      lexer,
-                      new TokenHandler_let(
-                          lexer,
-                          // TokenHandler_identifier must be placed after all
-                          // keyword handlers !!
-                          new TokenHandler_identifier(
-                              lexer,
-                              // TokenHandler_number must be placed before
-                              // TokenHandler_punctuation since '.' is also
-                              // considered in the number handler
-                              new TokenHandler_number(
-                                  lexer,
-                                  // TokenHandler_string must be placed before
-                                  // TokenHandler_punctuation since strings are
-                                  // wrapped by " or ', which are also
-                                  // punctuation characters
-                                  new TokenHandler_string(
-                                      lexer,
-                                      new TokenHandler_punctuation(
-                                          lexer, new TokenHandler_unknown(
-                                                     lexer)))))))))));
+bool TokenStream::next_is(TokenKind kind, std::string_view text) {
+  const Token &token = peek(0);
+  return token.kind == kind && lexer.text(token) == text;
 }
-
-static Default_TokenHandler_Factory *_token_handler_factory =
-    new Default_TokenHandler_Factory();
-
-bool Lexer::nextToken() {
-  std::cout << "is_end_of_line ? " << is_end_of_line(0) << std::endl;
-  std::cout << "file.eof() ? " << file.eof() << std::endl;
-  if (is_end_of_line(0) && file.eof()) {
-    return false;
-  }
-  _token_handler_factory->create(this)->handle(this->code_line);
-  return true;
-}
\ No newline at end of file
@@ -0,0 +1,436 @@
+#include "../include/MatMul.h"
+#include "../include/Error.h"
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PIECK_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+// The blocks of the operands. kc * nr doubles of a right panel stay in L1,
+// an (mc, kc) left block in L2 and a (kc, nc) right block in L3. mc and nc
+// are multiples of every mr and nr.
+constexpr int64_t kc_block = 256;
+constexpr int64_t mc_block = 72;
+constexpr int64_t nc_block = 2048;
+// products of fewer multiply-adds are computed without packing
+constexpr int64_t direct_limit = 32 * 32 * 32;
+
+// C[0, mr) x [0, nr) += the product of a packed left panel and a packed right
+// panel over ${kc}, C has rows ${ldc} doubles apart
+using MicroKernel = void (*)(int64_t kc, const double *a, const double *b,
+                             double *c, int64_t ldc);
+
+struct Kernel {
+  int64_t mr, nr;
+  MicroKernel micro;
+};
+
+void micro_scalar(int64_t kc, const double *a, const double *b, double *c,
+                  int64_t ldc) {
+  constexpr int mr = 4, nr = 4;
+  double acc[mr][nr] = {};
+  for (int64_t p = 0; p < kc; p++, a += mr, b += nr) {
+    for (int r = 0; r < mr; r++) {
+      for (int j = 0; j < nr; j++)
+        acc[r][j] += a[r] * b[j];
+    }
+  }
+  for (int r = 0; r < mr; r++) {
+    for (int j = 0; j < nr; j++)
+      c[r * ldc + j] += acc[r][j];
+  }
+}
+
+#ifdef PIECK_X86
+// 4 x 4 doubles in 8 registers of 2
+__attribute__((target("sse2"))) void micro_sse2(int64_t kc, const double *a,
+                                                const double *b, double *c,
+                                                int64_t ldc) {
+  __m128d c00 = _mm_setzero_pd(), c01 = _mm_setzero_pd();
+  __m128d c10 = _mm_setzero_pd(), c11 = _mm_setzero_pd();
+  __m128d c20 = _mm_setzero_pd(), c21 = _mm_setzero_pd();
+  __m128d c30 = _mm_setzero_pd(), c31 = _mm_setzero_pd();
+  for (int64_t p = 0; p < kc; p++, a += 4, b += 4) {
+    const __m128d b0 = _mm_load_pd(b), b1 = _mm_load_pd(b + 2);
+    __m128d ar = _mm_set1_pd(a[0]);
+    c00 = _mm_add_pd(c00, _mm_mul_pd(ar, b0));
+    c01 = _mm_add_pd(c01, _mm_mul_pd(ar, b1));
+    ar = _mm_set1_pd(a[1]);
+    c10 = _mm_add_pd(c10, _mm_mul_pd(ar, b0));
+    c11 = _mm_add_pd(c11, _mm_mul_pd(ar, b1));
+    ar = _mm_set1_pd(a[2]);
+    c20 = _mm_add_pd(c20, _mm_mul_pd(ar, b0));
+    c21 = _mm_add_pd(c21, _mm_mul_pd(ar, b1));
+    ar = _mm_set1_pd(a[3]);
+    c30 = _mm_add_pd(c30, _mm_mul_pd(ar, b0));
+    c31 = _mm_add_pd(c31, _mm_mul_pd(ar, b1));
+  }
+  const __m128d rows[4][2] = {{c00, c01}, {c10, c11}, {c20, c21}, {c30, c31}};
+  for (int r = 0; r < 4; r++, c += ldc) {
+    _mm_storeu_pd(c, _mm_add_pd(_mm_loadu_pd(c), rows[r][0]));
+    _mm_storeu_pd(c + 2, _mm_add_pd(_mm_loadu_pd(c + 2), rows[r][1]));
+  }
+}
+
+// 6 x 8 doubles in 12 registers of 4, which leaves 2 for the right panel and
+// 1 for the broadcast left element
+__attribute__((target("avx2,fma"))) void micro_avx2(int64_t kc,
+                                                    const double *a,
+                                                    const double *b, double *c,
+                                                    int64_t ldc) {
+  __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+  __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+  __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+  __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+  __m256d c40 = _mm256_setzero_pd(), c41 = _mm256_setzero_pd();
+  __m256d c50 = _mm256_setzero_pd(), c51 = _mm256_setzero_pd();
+#pragma GCC unroll 4
+  for (int64_t p = 0; p < kc; p++, a += 6, b += 8) {
+    const __m256d b0 = _mm256_load_pd(b), b1 = _mm256_load_pd(b + 4);
+    __m256d ar = _mm256_broadcast_sd(a);
+    c00 = _mm256_fmadd_pd(ar, b0, c00);
+    c01 = _mm256_fmadd_pd(ar, b1, c01);
+    ar = _mm256_broadcast_sd(a + 1);
+    c10 = _mm256_fmadd_pd(ar, b0, c10);
+    c11 = _mm256_fmadd_pd(ar, b1, c11);
+    ar = _mm256_broadcast_sd(a + 2);
+    c20 = _mm256_fmadd_pd(ar, b0, c20);
+    c21 = _mm256_fmadd_pd(ar, b1, c21);
+    ar = _mm256_broadcast_sd(a + 3);
+    c30 = _mm256_fmadd_pd(ar, b0, c30);
+    c31 = _mm256_fmadd_pd(ar, b1, c31);
+    ar = _mm256_broadcast_sd(a + 4);
+    c40 = _mm256_fmadd_pd(ar, b0, c40);
+    c41 = _mm256_fmadd_pd(ar, b1, c41);
+    ar = _mm256_broadcast_sd(a + 5);
+    c50 = _mm256_fmadd_pd(ar, b0, c50);
+    c51 = _mm256_fmadd_pd(ar, b1, c51);
+  }
+  const __m256d rows[6][2] = {{c00, c01}, {c10, c11}, {c20, c21},
+                              {c30, c31}, {c40, c41}, {c50, c51}};
+  for (int r = 0; r < 6; r++, c += ldc) {
+    _mm256_storeu_pd(c, _mm256_add_pd(_mm256_loadu_pd(c), rows[r][0]));
+    _mm256_storeu_pd(c + 4,
+                     _mm256_add_pd(_mm256_loadu_pd(c + 4), rows[r][1]));
+  }
+}
+#endif
+
+Kernel kernel_of(MatMul::ISA isa) {
+  switch (isa) {
+#ifdef PIECK_X86
+  case MatMul::isa_avx2:
+    return {6, 8, micro_avx2};
+  case MatMul::isa_sse2:
+    return {4, 4, micro_sse2};
+#endif
+  default:
+    return {4, 4, micro_scalar};
+  }
+}
+
+// Pack the (mc, kc) block at ${a} into panels of ${mr} rows, each stored
+// column by column. Rows past ${mc} are zero, so the micro-kernel never
+// branches on the edges. A row is ${rs} doubles and a column ${cs} doubles
+// apart in ${a}.
+void pack_left(const double *a, int64_t rs, int64_t cs, int64_t mc,
+               int64_t kc, int64_t mr, double *out) {
+  for (int64_t i = 0; i < mc; i += mr) {
+    const int64_t rows = std::min(mr, mc - i);
+    for (int64_t p = 0; p < kc; p++) {
+      int64_t r = 0;
+      for (; r < rows; r++)
+        *out++ = a[(i + r) * rs + p * cs];
+      for (; r < mr; r++)
+        *out++ = 0;
+    }
+  }
+}
+
+// pack the (kc, nc) block at ${b} into panels of ${nr} columns, each stored
+// row by row, columns past ${nc} are zero
+void pack_right(const double *b, int64_t rs, int64_t cs, int64_t kc,
+                int64_t nc, int64_t nr, double *out) {
+  for (int64_t j = 0; j < nc; j += nr) {
+    const int64_t cols = std::min(nr, nc - j);
+    for (int64_t p = 0; p < kc; p++) {
+      int64_t q = 0;
+      for (; q < cols; q++)
+        *out++ = b[p * rs + (j + q) * cs];
+      for (; q < nr; q++)
+        *out++ = 0;
+    }
+  }
+}
+
+// the packing buffers of a thread, allocated by its first blocked product
+struct Panels {
+  static constexpr size_t alignment = 64;
+  std::unique_ptr<double, decltype(&std::free)> left{nullptr, std::free};
+  std::unique_ptr<double, decltype(&std::free)> right{nullptr, std::free};
+
+  static Panels &of_this_thread() {
+    thread_local Panels panels;
+    if (!panels.left) {
+      panels.left.reset(static_cast<double *>(std::aligned_alloc(
+          alignment, sizeof(double) * mc_block * kc_block)));
+      panels.right.reset(static_cast<double *>(std::aligned_alloc(
+          alignment, sizeof(double) * kc_block * nc_block)));
+      ASSERT(panels.left && panels.right, "Out of memory for matmul panels");
+    }
+    return panels;
+  }
+};
+
+// A matrix operand: the element (i, j) is data[i * rs + j * cs]. A row-major
+// (m, k) matrix has rs = k and cs = 1, a transposed one rs = 1 and cs = m.
+struct Matrix {
+  const double *data;
+  int64_t rs, cs;
+
+  double at(int64_t i, int64_t j) const { return data[i * rs + j * cs]; }
+  // the matrix transposed, which reads the same elements
+  Matrix transposed() const { return {data, cs, rs}; }
+};
+
+// the (${rows}, ${cols}) operand at ${data}, stored transposed if
+// ${transposed}
+Matrix matrix(const double *data, int64_t rows, int64_t cols,
+              bool transposed) {
+  return transposed ? Matrix{data, 1, rows} : Matrix{data, cols, 1};
+}
+
+void blocked(const Kernel &kernel, Matrix a, Matrix b, double *c, int64_t m,
+             int64_t n, int64_t k) {
+  std::fill(c, c + m * n, 0.0);
+  Panels &panels = Panels::of_this_thread();
+  double *left = panels.left.get(), *right = panels.right.get();
+  const int64_t mr = kernel.mr, nr = kernel.nr;
+  // the tile of an edge, written back element by element
+  alignas(64) double edge[8 * 8];
+  for (int64_t jc = 0; jc < n; jc += nc_block) {
+    const int64_t nc = std::min(nc_block, n - jc);
+    for (int64_t pc = 0; pc < k; pc += kc_block) {
+      const int64_t kc = std::min(kc_block, k - pc);
+      // the packing reads either layout, so the micro-kernel is the same for
+      // every variant
+      pack_right(b.data + pc * b.rs + jc * b.cs, b.rs, b.cs, kc, nc, nr,
+                 right);
+      for (int64_t ic = 0; ic < m; ic += mc_block) {
+        const int64_t mc = std::min(mc_block, m - ic);
+        pack_left(a.data + ic * a.rs + pc * a.cs, a.rs, a.cs, mc, kc, mr,
+                  left);
+        for (int64_t jr = 0; jr < nc; jr += nr) {
+          const int64_t cols = std::min(nr, nc - jr);
+          for (int64_t ir = 0; ir < mc; ir += mr) {
+            const int64_t rows = std::min(mr, mc - ir);
+            double *tile = c + (ic + ir) * n + jc + jr;
+            if (rows == mr && cols == nr) {
+              kernel.micro(kc, left + ir * kc, right + jr * kc, tile, n);
+              continue;
+            }
+            std::fill(edge, edge + mr * nr, 0.0);
+            kernel.micro(kc, left + ir * kc, right + jr * kc, edge, nr);
+            for (int64_t r = 0; r < rows; r++) {
+              for (int64_t q = 0; q < cols; q++)
+                tile[r * n + q] += edge[r * nr + q];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+// c[i] = the dot product of the row i of the (m, k) matrix a and b, the
+// rows of a are contiguous
+void dots(const double *a, int64_t rs, const double *b, double *c, int64_t m,
+          int64_t k) {
+  for (int64_t i = 0; i < m; i++, a += rs) {
+    // independent sums, so the additions of a row overlap
+    double s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    int64_t p = 0;
+    for (; p + 4 <= k; p += 4) {
+      s0 += a[p] * b[p];
+      s1 += a[p + 1] * b[p + 1];
+      s2 += a[p + 2] * b[p + 2];
+      s3 += a[p + 3] * b[p + 3];
+    }
+    for (; p < k; p++)
+      s0 += a[p] * b[p];
+    c[i] = (s0 + s1) + (s2 + s3);
+  }
+}
+
+// c = a @ b for a vector a, the rows of the (k, n) matrix b scaled by a and
+// summed, the rows of b are contiguous
+void axpys(const double *a, const double *b, int64_t rs, double *c,
+           int64_t n, int64_t k) {
+  std::fill(c, c + n, 0.0);
+  for (int64_t p = 0; p < k; p++, b += rs) {
+    const double a_p = a[p];
+    for (int64_t j = 0; j < n; j++)
+      c[j] += a_p * b[j];
+  }
+}
+
+// (m, k) @ vector: a dot product per row of a, or the columns of a scaled
+// and summed if they are the contiguous ones
+void matvec(Matrix a, const double *b, double *c, int64_t m, int64_t k) {
+  if (a.cs == 1)
+    dots(a.data, a.rs, b, c, m, k);
+  else
+    axpys(b, a.data, a.cs, c, m, k);
+}
+
+// vector @ (k, n): the rows of b scaled and summed, or a dot product per
+// column of b if they are the contiguous ones
+void vecmat(const double *a, Matrix b, double *c, int64_t n, int64_t k) {
+  if (b.cs == 1)
+    axpys(a, b.data, b.rs, c, n, k);
+  else
+    dots(b.data, b.cs, a, c, n, k);
+}
+
+void direct(Matrix a, Matrix b, double *c, int64_t m, int64_t n, int64_t k) {
+  if (b.cs != 1) {
+    // NT and TT: the columns of b are contiguous, a dot product per element
+    for (int64_t i = 0; i < m; i++) {
+      for (int64_t j = 0; j < n; j++) {
+        double sum = 0;
+        for (int64_t p = 0; p < k; p++)
+          sum += a.at(i, p) * b.data[p * b.rs + j * b.cs];
+        c[i * n + j] = sum;
+      }
+    }
+    return;
+  }
+  std::fill(c, c + m * n, 0.0);
+  // NN and TN: i-p-j order, the innermost loop runs along rows of b and c
+  for (int64_t i = 0; i < m; i++) {
+    for (int64_t p = 0; p < k; p++) {
+      const double a_ip = a.at(i, p);
+      const double *b_p = b.data + p * b.rs;
+      for (int64_t j = 0; j < n; j++)
+        c[i * n + j] += a_ip * b_p[j];
+    }
+  }
+}
+} // namespace
+
+MatMul::Plan MatMul::plan(const Shape &lhs, const Shape &rhs) {
+  const int32_t lhs_rank = lhs.dims_dim(), rhs_rank = rhs.dims_dim();
+  if (lhs_rank < 1 || lhs_rank > 2 || rhs_rank < 1 || rhs_rank > 2)
+    ERROR("Cannot apply @ to tensors of shapes " + lhs.str() + " and " +
+          rhs.str() + ", only to vectors and matrices");
+  // a vector is a (1, k) matrix on the left and a (k, 1) matrix on the right
+  const int64_t m = lhs_rank == 2 ? lhs[0] : 1;
+  const int64_t k = lhs[lhs_rank - 1];
+  const int64_t n = rhs_rank == 2 ? rhs[1] : 1;
+  if (rhs[0] != k)
+    ERROR("Cannot apply @ to tensors of shapes " + lhs.str() + " and " +
+          rhs.str());
+  Plan plan = MatMul::plan(m, n, k);
+  int32_t dims[2];
+  int32_t rank = 0;
+  if (lhs_rank == 2)
+    dims[rank++] = m;
+  if (rhs_rank == 2)
+    dims[rank++] = n;
+  plan.shape = Shape(rank, dims);
+  return plan;
+}
+
+MatMul::Plan MatMul::plan(int64_t m, int64_t n, int64_t k) {
+  Plan plan;
+  plan.m = m;
+  plan.n = n;
+  plan.k = k;
+  if (m == 1 && n == 1)
+    plan.method = mm_dot;
+  else if (n == 1)
+    plan.method = mm_matvec;
+  else if (m == 1)
+    plan.method = mm_vecmat;
+  else if (m * n * k <= direct_limit)
+    plan.method = mm_direct;
+  else
+    plan.method = mm_blocked;
+  int32_t dims[2] = {int32_t(m), int32_t(n)};
+  plan.shape = Shape(2, dims);
+  return plan;
+}
+
+void MatMul::run(const Plan &plan, Variant variant, const double *a,
+                 const double *b, double *c) {
+  const Matrix lhs = matrix(a, plan.m, plan.k, transposes_left(variant));
+  const Matrix rhs = matrix(b, plan.k, plan.n, transposes_right(variant));
+  switch (plan.method) {
+  case mm_dot:
+  case mm_matvec:
+    // the right operand is a vector, whatever its variant
+    return matvec(lhs, b, c, plan.m, plan.k);
+  case mm_vecmat:
+    return vecmat(a, rhs, c, plan.n, plan.k);
+  case mm_direct:
+    return direct(lhs, rhs, c, plan.m, plan.n, plan.k);
+  case mm_blocked:
+    return gemm(best(), variant, a, b, c, plan.m, plan.n, plan.k);
+  }
+}
+
+void MatMul::gemm(ISA isa, Variant variant, const double *a, const double *b,
+                  double *c, int64_t m, int64_t n, int64_t k) {
+  ASSERT(supported(isa), std::string("This CPU does not support ") +
+                             name(isa));
+  blocked(kernel_of(isa), matrix(a, m, k, transposes_left(variant)),
+          matrix(b, k, n, transposes_right(variant)), c, m, n, k);
+}
+
+MatMul::Variant MatMul::variant(bool left_transposed, bool right_transposed) {
+  return Variant((left_transposed ? mm_tn : mm_nn) |
+                 (right_transposed ? mm_nt : mm_nn));
+}
+
+const char *MatMul::name(Variant variant) {
+  static const char *const names[] = {"NN", "NT", "TN", "TT"};
+  return names[variant];
+}
+
+MatMul::ISA MatMul::best() {
+  static const ISA isa = supported(isa_avx2)   ? isa_avx2
+                         : supported(isa_sse2) ? isa_sse2
+                                               : isa_scalar;
+  return isa;
+}
+
+bool MatMul::supported(ISA isa) {
+  switch (isa) {
+  case isa_scalar:
+    return true;
+#ifdef PIECK_X86
+  case isa_sse2:
+    return __builtin_cpu_supports("sse2");
+  case isa_avx2:
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+  default:
+    return false;
+  }
+}
+
+const char *MatMul::name(ISA isa) {
+  switch (isa) {
+  case isa_scalar:
+    return "scalar";
+  case isa_sse2:
+    return "sse2";
+  case isa_avx2:
+    return "avx2";
+  }
+  return "";
+}
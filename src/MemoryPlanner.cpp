@@ -0,0 +1,109 @@
+#include "../include/MemoryPlanner.h"
+#include "../include/Error.h"
+#include <algorithm>
+#include <unordered_map>
+
+int64_t MemoryPlanner::Plan::num_of_elements() const {
+  int64_t n = 0;
+  for (int64_t size : slot_sizes)
+    n += size;
+  return n;
+}
+
+MemoryPlanner::BufferID MemoryPlanner::add_buffer(int64_t n) {
+  sizes.push_back(n);
+  return BufferID(sizes.size() - 1);
+}
+
+void MemoryPlanner::enter_loop(int64_t trip_count) {
+  tick();
+  Loop loop;
+  loop.start = 2 * point;
+  loop.trip_count = trip_count;
+  loop.parent = open_loops.empty() ? -1 : open_loops.back();
+  loops.push_back(loop);
+  open_loops.push_back(int32_t(loops.size() - 1));
+}
+
+void MemoryPlanner::leave_loop() {
+  ASSERT(!open_loops.empty(), "MemoryPlanner: no loop to leave.");
+  tick();
+  loops[open_loops.back()].end = 2 * point + 1;
+  open_loops.pop_back();
+}
+
+void MemoryPlanner::add_event(BufferID buffer, bool def, bool in_place) {
+  ASSERT(buffer >= 0 && size_t(buffer) < sizes.size(),
+         "MemoryPlanner: unknown buffer.");
+  events.push_back({buffer, 2 * point + (def && in_place), def,
+                    open_loops.empty() ? -1 : open_loops.back()});
+}
+
+namespace {
+// The first event of a buffer in a loop
+struct FirstEvent {
+  int64_t time;
+  // a write in the body of the loop itself, not in a loop inside it, and not
+  // at the same time as a read
+  bool defines;
+};
+} // namespace
+
+MemoryPlanner::Plan MemoryPlanner::plan() const {
+  ASSERT(open_loops.empty(), "MemoryPlanner: a loop is not left.");
+  const size_t n = sizes.size();
+  std::vector<int64_t> start(n, INT64_MAX), end(n, INT64_MIN);
+  std::vector<std::unordered_map<int32_t, FirstEvent>> first(n);
+  for (const Event &event : events) {
+    start[event.buffer] = std::min(start[event.buffer], event.time);
+    end[event.buffer] = std::max(end[event.buffer], event.time);
+    for (int32_t loop = event.loop; loop >= 0; loop = loops[loop].parent) {
+      auto [it, inserted] = first[event.buffer].try_emplace(
+          loop, FirstEvent{event.time, event.def && event.loop == loop});
+      if (!inserted && !event.def && event.time == it->second.time)
+        it->second.defines = false;
+    }
+  }
+  // a buffer whose value may be read in the next iteration lives as long as
+  // the loop
+  for (size_t buffer = 0; buffer < n; buffer++) {
+    for (auto &[loop, event] : first[buffer]) {
+      if (event.defines && loops[loop].trip_count > 0)
+        continue;
+      start[buffer] = std::min(start[buffer], loops[loop].start);
+      end[buffer] = std::max(end[buffer], loops[loop].end);
+    }
+    if (start[buffer] > end[buffer])
+      start[buffer] = end[buffer] = 0;
+  }
+
+  // Give every buffer, by order of start, a free slot of its size. The slot
+  // freed last is taken first, so an op written in place takes the slot of
+  // the operand that dies there.
+  std::vector<BufferID> order(n);
+  for (size_t i = 0; i < n; i++)
+    order[i] = BufferID(i);
+  std::stable_sort(order.begin(), order.end(),
+                   [&](BufferID a, BufferID b) { return start[a] < start[b]; });
+  Plan plan;
+  plan.slot_of.assign(n, -1);
+  // the end of the last buffer of every slot
+  std::vector<int64_t> slot_ends;
+  for (BufferID buffer : order) {
+    int32_t slot = -1;
+    for (size_t i = 0; i < slot_ends.size(); i++) {
+      if (plan.slot_sizes[i] == sizes[buffer] &&
+          slot_ends[i] < start[buffer] &&
+          (slot < 0 || slot_ends[i] > slot_ends[slot]))
+        slot = int32_t(i);
+    }
+    if (slot < 0) {
+      slot = int32_t(slot_ends.size());
+      plan.slot_sizes.push_back(sizes[buffer]);
+      slot_ends.push_back(end[buffer]);
+    }
+    slot_ends[slot] = std::max(slot_ends[slot], end[buffer]);
+    plan.slot_of[buffer] = slot;
+  }
+  return plan;
+}
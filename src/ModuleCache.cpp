@@ -0,0 +1,265 @@
+#include "../include/ModuleCache.h"
+#include "../include/Parser.h"
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+constexpr char magic[8] = {'P', 'I', 'E', 'C', 'K', 'C', '\0', '\0'};
+// written as is, so a cache of the other byte order does not match it
+constexpr uint32_t byte_order = 0x01020304;
+constexpr size_t section_alignment = 64;
+
+// the arrays of a FlatAST, in the order they are stored
+enum Section {
+  s_nodes,
+  s_children,
+  s_names,
+  s_strings,
+  s_scopes,
+  s_scope_names,
+  s_constants,
+  s_dims,
+  num_of_sections
+};
+
+struct Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t source_size;
+  uint64_t source_hash;
+  // the array of a section is the ${count} records at ${offset} of the file
+  struct {
+    uint64_t offset, count;
+  } sections[num_of_sections];
+};
+
+// the records are stored as is
+static_assert(sizeof(FlatNode) == 20 && alignof(FlatNode) == 4);
+static_assert(sizeof(FlatString) == 8 && sizeof(FlatScope) == 8);
+
+template <typename T>
+void add_section(std::vector<char> &bytes, Header &header, Section section,
+                 std::span<const T> records) {
+  size_t offset = (bytes.size() + section_alignment - 1) &
+                  ~(section_alignment - 1);
+  bytes.resize(offset + records.size_bytes());
+  if (!records.empty())
+    std::memcpy(bytes.data() + offset, records.data(), records.size_bytes());
+  header.sections[section] = {offset, records.size()};
+}
+
+// Point ${records} at a section of ${file}, false if it does not fit in the
+// file or is misaligned
+template <typename T>
+bool map_section(const SourceBuffer &file, const Header &header,
+                 Section section, std::span<const T> &records) {
+  uint64_t offset = header.sections[section].offset;
+  uint64_t count = header.sections[section].count;
+  if (offset > file.size() || offset % alignof(T) != 0 ||
+      count > (file.size() - offset) / sizeof(T))
+    return false;
+  records = std::span<const T>(
+      reinterpret_cast<const T *>(file.data() + offset), count);
+  return true;
+}
+
+// whether [${first}, ${first} + ${count}) is a range of ${array}
+template <typename T>
+bool in(std::span<const T> array, uint64_t first, uint64_t count) {
+  return first <= array.size() && count <= array.size() - first;
+}
+
+// whether ${node} has as many children as its kind takes
+bool has_arity(const FlatNode &node) {
+  switch (node.kind) {
+  case fk_print:
+  case fk_def_var:
+  case fk_value:
+  case fk_transpose:
+    return node.count == 1;
+  case fk_binary_op:
+    return node.count == 2;
+  case fk_var:
+    return node.count == 0;
+  case fk_return:
+    return node.count <= 1;
+  case fk_loop:
+  case fk_def_func:
+    return node.count >= 1;
+  case fk_index:
+    return node.count % 2 == 1;
+  default:
+    return true;
+  }
+}
+
+// Whether every index in ${ast} stays inside the arrays it refers to and the
+// children of each node come after it, so the tree is walked without reading
+// out of bounds or looping. A cache that passes the header checks can still
+// be corrupted on disk.
+bool valid(const FlatView &ast) {
+  for (const FlatString &name : ast.names)
+    if (!in(ast.strings, name.offset, name.length))
+      return false;
+  for (const FlatScope &scope : ast.scopes)
+    if (!in(ast.scope_names, scope.first, scope.count))
+      return false;
+  for (uint32_t name : ast.scope_names)
+    if (name >= ast.names.size())
+      return false;
+  if (ast.nodes.empty() || ast.root().kind != fk_compound)
+    return false;
+  for (uint32_t id = 0; id < ast.nodes.size(); id++) {
+    const FlatNode &node = ast.nodes[id];
+    if (node.kind > fk_tensor ||
+        (node.kind <= fk_def_func && node.scope >= ast.scopes.size()))
+      return false;
+    switch (node.kind) {
+    case fk_loop:
+    case fk_def_var:
+    case fk_def_func:
+    case fk_call:
+    case fk_var:
+      if (node.a >= ast.names.size())
+        return false;
+      break;
+    case fk_binary_op:
+      if (node.op > BinaryOpExpr::matmul)
+        return false;
+      break;
+    case fk_scala:
+      if (node.first >= ast.constants.size())
+        return false;
+      continue;
+    case fk_tensor: {
+      if (!in(ast.dims, node.a, node.count))
+        return false;
+      uint64_t size = 1;
+      for (int32_t dim : ast.dims.subspan(node.a, node.count)) {
+        if (dim < 0 || (dim > 0 && size > ast.constants.size() / dim))
+          return false;
+        size *= dim;
+      }
+      if (!in(ast.constants, node.first, size))
+        return false;
+      continue;
+    }
+    default:
+      break;
+    }
+    if (!has_arity(node) || !in(ast.children, node.first, node.count))
+      return false;
+    std::span<const uint32_t> children = ast.children_of(node);
+    for (uint32_t i = 0; i < children.size(); i++) {
+      // only the bounds of subscripts are left out
+      if (children[i] == FlatNode::none && node.kind == fk_index && i > 0)
+        continue;
+      if (children[i] <= id || children[i] >= ast.nodes.size())
+        return false;
+    }
+  }
+  return true;
+}
+
+bool write_all(int fd, const char *data, size_t size) {
+  while (size > 0) {
+    ssize_t n = ::write(fd, data, size);
+    if (n <= 0)
+      return false;
+    data += n;
+    size -= n;
+  }
+  return true;
+}
+} // namespace
+
+uint64_t ModuleCache::hash(std::string_view source) {
+  // a word at a time, with the mixing of the MurmurHash3 finalizer
+  auto mix = [](uint64_t word) {
+    word ^= word >> 33;
+    word *= 0xff51afd7ed558ccdull;
+    word ^= word >> 33;
+    word *= 0xc4ceb9fe1a85ec53ull;
+    return word ^ (word >> 33);
+  };
+  uint64_t hash = 14695981039346656037ull ^ source.size();
+  size_t i = 0;
+  for (; i + 8 <= source.size(); i += 8) {
+    uint64_t word;
+    std::memcpy(&word, source.data() + i, 8);
+    hash = (hash ^ mix(word)) * 1099511628211ull;
+  }
+  uint64_t tail = 0;
+  std::memcpy(&tail, source.data() + i, source.size() - i);
+  return mix(hash ^ mix(tail));
+}
+
+bool ModuleCache::write(const std::string &cache_file, const FlatView &ast,
+                        std::string_view source) {
+  Header header = {};
+  std::memcpy(header.magic, magic, sizeof(magic));
+  header.version = version;
+  header.byte_order = byte_order;
+  header.source_size = source.size();
+  header.source_hash = hash(source);
+  std::vector<char> bytes(sizeof(Header));
+  add_section(bytes, header, s_nodes, ast.nodes);
+  add_section(bytes, header, s_children, ast.children);
+  add_section(bytes, header, s_names, ast.names);
+  add_section(bytes, header, s_strings, ast.strings);
+  add_section(bytes, header, s_scopes, ast.scopes);
+  add_section(bytes, header, s_scope_names, ast.scope_names);
+  add_section(bytes, header, s_constants, ast.constants);
+  add_section(bytes, header, s_dims, ast.dims);
+  std::memcpy(bytes.data(), &header, sizeof(Header));
+
+  // write a temporary file of a unique name and rename it over the cache,
+  // so writers in other threads and processes never share a file
+  std::string temp_file = cache_file + ".XXXXXX";
+  int fd = ::mkstemp(temp_file.data());
+  if (fd < 0)
+    return false;
+  bool written = ::fchmod(fd, 0644) == 0 &&
+                 write_all(fd, bytes.data(), bytes.size());
+  written = ::close(fd) == 0 && written;
+  if (!written || ::rename(temp_file.c_str(), cache_file.c_str()) != 0) {
+    ::unlink(temp_file.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool ModuleCache::load(const std::string &cache_file,
+                       std::string_view source) {
+  file = SourceBuffer();
+  if (::access(cache_file.c_str(), R_OK) != 0)
+    return false;
+  SourceBuffer mapped(cache_file);
+  // the records are read in place, so the file must be mapped
+  if (!mapped.is_mapped() || mapped.size() < sizeof(Header))
+    return false;
+  Header header;
+  std::memcpy(&header, mapped.data(), sizeof(Header));
+  if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 ||
+      header.version != version || header.byte_order != byte_order ||
+      header.source_size != source.size() ||
+      header.source_hash != hash(source))
+    return false;
+  FlatView cached;
+  if (!map_section(mapped, header, s_nodes, cached.nodes) ||
+      !map_section(mapped, header, s_children, cached.children) ||
+      !map_section(mapped, header, s_names, cached.names) ||
+      !map_section(mapped, header, s_strings, cached.strings) ||
+      !map_section(mapped, header, s_scopes, cached.scopes) ||
+      !map_section(mapped, header, s_scope_names, cached.scope_names) ||
+      !map_section(mapped, header, s_constants, cached.constants) ||
+      !map_section(mapped, header, s_dims, cached.dims) || !valid(cached))
+    return false;
+  file = std::move(mapped);
+  view = cached;
+  return true;
+}
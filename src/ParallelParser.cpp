@@ -0,0 +1,37 @@
+#include "../include/ParallelParser.h"
+#include "../include/Casting.h"
+#include <algorithm>
+
+CompoundStmt *ParallelParser::parse(size_t min_chunk_size) {
+  // a few chunks per thread, so that the threads finish at about the same time
+  const size_t chunk_size =
+      std::max(min_chunk_size, source.size() / (4 * (pool.size() + 1)) + 1);
+  chunks.clear();
+  Segmenter segmenter(source.view());
+  SourceRange range;
+  while (segmenter.next(range)) {
+    if (!chunks.empty() &&
+        chunks.back().range.end - chunks.back().range.begin < chunk_size) {
+      chunks.back().range.end = range.end;
+      continue;
+    }
+    chunks.push_back(Chunk{range, nullptr, nullptr, nullptr});
+  }
+
+  pool.parallel_for(chunks.size(), [this](size_t i) {
+    Chunk &chunk = chunks[i];
+    chunk.parser = std::make_unique<Parser>(
+        file_name, SourceBuffer::borrow(source.view()), chunk.range);
+    chunk.first = cast<CompoundStmt>(chunk.parser->parse())->stmts();
+    chunk.last = chunk.first->rehead(&head);
+  });
+
+  StmtChain *tail = &head;
+  for (Chunk &chunk : chunks) {
+    tail->next = chunk.first;
+    tail = chunk.last;
+  }
+  tail->next = nullptr;
+  root = std::make_unique<CompoundStmt>(Scope(), &head);
+  return root.get();
+}
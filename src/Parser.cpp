@@ -1,14 +1,27 @@
 #include "../include/Parser.h"
+#include "../include/Casting.h"
+#include "../include/ConstantFolding.h"
 #include "../include/Error.h"
-#include <cctype>
-#include <string.h>
+#include "../include/FlatAST.h"
+#include <charconv>
+#include <cstring>
 
-StmtChain *StmtChain::add(Stmt *stmt) {
-  this->next = new StmtChain(stmt);
+StmtChain *StmtChain::add(Arena &arena, Stmt *stmt) {
+  this->next = arena.make<StmtChain>(stmt);
   this->next->header = this->header;
   return this->next;
 }
 
+StmtChain *StmtChain::rehead(StmtChain *head) {
+  StmtChain *link = this;
+  while (true) {
+    link->header = head;
+    if (!link->next)
+      return link;
+    link = link->next;
+  }
+}
+
 Stmt *CompoundStmt::header() { return this->chain->header->stmt; }
 
 Stmt *CompoundStmt::next() {
@@ -22,26 +35,6 @@ bool CompoundStmt::isTail() { return this->chain->next == nullptr; }
 
 bool CompoundStmt::isHeader() { return this->chain->header == this->chain; }
 
-bool Shape::operator==(const Shape &other) {
-  if (unintialized() || other.unintialized())
-    return false;
-  if (dims_dim != other.dims_dim)
-    return false;
-  if (dims_dim == 0 && other.dims_dim == 0) {
-    return true;
-  }
-  for (int i = 0; i < dims_dim; i++) {
-    if (dims[i] != other.dims[i])
-      return false;
-  }
-  return true;
-}
-
-Shape ScalaValue::shape() {
-  ASSERT(!_shape.unintialized(), "");
-  return _shape = Shape(0); // the default _shape, with dims_dim = 0
-}
-
 // Shape checking, and calculate the shapes by the way
 // The shape requriement is similar to Numpy's.
 //
@@ -54,86 +47,182 @@ Shape ScalaValue::shape() {
 // "The requested array has an inhomogeneous shape" will be thrown.
 // Pieck follows Numpy's taste on tensors and fails the shape checking if
 // sub-tensors are of different shapes.
-bool shape_checking(TensorValue *tv) {
-  ASSERT(tv->dim > 0, "Tensor's dim must be larger than 0.");
-  auto f_next_dim = [](TensorValue *tv, int i) {
-    ASSERT(i < tv->dim, "");
-    if (tv->vals[i]->is_scala())
-      return 0;
-    return dynamic_cast<TensorValue *>(tv->vals[i])->dim;
+//
+// The inference is iterative and runs a single post-order pass over the tree:
+// a tensor is finished once the shapes of all its sub-tensors are known, and
+// its shape is the common sub-shape with its own length prepended. Shapes are
+// interned, so comparing sub-shapes is an integer comparison, and scalars have
+// the shape (), which differs from every tensor shape. The shapes are stored
+// in the tensors, so a sub-tensor shared by several parents is only visited
+// once and the pass runs in O(elements). It stops at the first sub-tensor
+// whose shape differs from its siblings'.
+bool shape_checking(TensorValue *root) {
+  struct Frame {
+    TensorValue *tv;
+    // the next sub-tensor whose shape is compared
+    int32_t next;
   };
-  // if sub-tensors are not of the same shape,
-  // then shape checking fails
-  int nextdim = f_next_dim(tv, 0);
-  for (int i = 1; i < tv->dim; i++) {
-    if (nextdim != f_next_dim(tv, i))
-      return false;
-  }
-  // if all sub-tensors are actually scalars, then no need for
-  // further shape checkings on sub-tensors
-  if (nextdim == 0) {
-    int32_t *dims = new int[1];
-    dims[0] = tv->dim;
-    tv->set_shape(Shape(1, dims));
-    return true;
-  }
-  // if all sub-tensors are tensors, then check each sub-tensor separately
-  // to make sure all of them are of good shape
-  bool subchecking = true;
-  for (int i = 0; i < tv->dim; i++) {
-    subchecking &= shape_checking(dynamic_cast<TensorValue *>(tv->vals[i]));
-  }
-  if (!subchecking)
-    return false;
-  // Until now, all sub-shape-checking on sub-tensors succeeds, but remains
-  // a single problem: what if sub-shapes are not the same?
-  Shape shape_0 = tv->vals[0]->shape();
-  for (int i = 1; i < tv->dim; i++) {
-    if (shape_0 != tv->vals[i]->shape())
-      return false;
+  std::vector<Frame> stack = {{root, 0}};
+  while (!stack.empty()) {
+    Frame &frame = stack.back();
+    TensorValue *tv = frame.tv;
+    ASSERT(tv->dim > 0, "Tensor's dim must be larger than 0.");
+    for (; frame.next < tv->dim; frame.next++) {
+      Value *sub = tv->vals[frame.next];
+      if (sub->is_tensor() && !sub->has_shape())
+        break;
+      // if sub-tensors are not of the same shape,
+      // then shape checking fails
+      if (frame.next > 0 && sub->shape() != tv->vals[0]->shape())
+        return false;
+    }
+    if (frame.next < tv->dim) {
+      // infer the shape of the sub-tensor first, and come back later
+      stack.push_back({cast<TensorValue>(tv->vals[frame.next]), 0});
+      continue;
+    }
+    tv->set_shape(tv->vals[0]->shape().prepend(tv->dim));
+    stack.pop_back();
   }
-  int32_t *sub_dims = shape_0.dims;
-  int32_t *dims = (int32_t *)malloc(sizeof(int) * (shape_0.dims_dim + 1));
-  memcpy(dims + 1, sub_dims, sizeof(int32_t) * (shape_0.dims_dim));
-  dims[0] = tv->dim;
-  tv->set_shape(Shape(shape_0.dims_dim + 1, dims));
   return true;
 }
 
-Shape TensorValue::shape() {
-  if (_shape.unintialized()) {
-    shape_checking(this);
+const Shape &Value::shape() {
+  if (_shape.unintialized() && !shape_checking(cast<TensorValue>(this))) {
+    ERROR("The tensor has an inhomogeneous shape.");
   }
-  ASSERT(!_shape.unintialized(), "Shape must be initialized here.");
   return _shape;
 }
 
-DefFuncStmt *Parser::build_DefFuncStmt(std::string identifier_name) {
+PackedTensorValue *PackedTensorValue::create(Arena &arena, int32_t dims_dim,
+                                             const int32_t *dims) {
+  ASSERT(dims_dim > 0, "Tensor's dim must be larger than 0.");
+  int64_t *strides = arena.allocate_array<int64_t>(dims_dim);
+  // row-major: the last dim is contiguous
+  int64_t n = 1;
+  for (int i = dims_dim - 1; i >= 0; i--) {
+    strides[i] = n;
+    n *= dims[i];
+  }
+  double *data =
+      static_cast<double *>(arena.allocate(sizeof(double) * n, alignment));
+  return arena.make<PackedTensorValue>(Shape(dims_dim, dims), data, strides);
+}
+
+// Append the scalars of ${value} to ${out} in row-major order
+static double *pack_elements(Value *value, double *out) {
+  if (ScalaValue *sv = dyn_cast<ScalaValue>(value))
+    *out++ = sv->val;
+  else {
+    TensorValue *tv = cast<TensorValue>(value);
+    for (int i = 0; i < tv->dim; i++)
+      out = pack_elements(tv->vals[i], out);
+  }
+  return out;
+}
+
+PackedTensorValue *PackedTensorValue::pack(Arena &arena, TensorValue *tree) {
+  const Shape &shape = tree->shape();
+  PackedTensorValue *packed = create(arena, shape.dims_dim(), shape.dims());
+  pack_elements(tree, packed->data);
+  return packed;
+}
+
+DefFuncStmt *Parser::build_DefFuncStmt(Symbol identifier_name) {
   // TODO: impl
   return nullptr;
 }
 
-DefVarStmt *Parser::build_DefVarStmt(std::string identifier_name) {
-  bool res = lexer.nextToken();
+// The elements of a tensor literal are read into a flat buffer and its shape
+// is inferred on the fly: the rank is the depth of the first number, and the
+// length of every list at a depth must be the length of the first list closed
+// at that depth. Like Numpy, literals of inhomogeneous shapes are rejected.
+PackedTensorValue *Parser::build_TensorLiteral() {
+  literal_elements.clear();
+  int32_t rank = -1;
+  // dims[d - 1] is the length of the lists at depth d, -1 if unknown yet
+  std::vector<int32_t> dims;
+  // counts[d] is the number of elements read in the open list at depth d
+  std::vector<int32_t> counts = {0, 0};
+  int32_t depth = 1;
+  bool expect_element = true;
+  while (depth > 0) {
+    Token token = tokens.next();
+    std::string_view text = tokens.text(token);
+    if (expect_element) {
+      if (text == "[") {
+        if (rank != -1 && depth + 1 > rank)
+          tokens.report(token, "The tensor literal has an inhomogeneous shape");
+        depth++;
+        counts.push_back(0);
+        continue;
+      }
+      bool negative = token.kind == tk_punctuation && text == "-";
+      if (negative) {
+        token = tokens.next();
+        text = tokens.text(token);
+      }
+      if (token.kind != tk_number)
+        tokens.report(token, "Expected a number or [ in the tensor literal");
+      if (rank == -1) {
+        rank = depth;
+        dims.assign(rank, -1);
+      } else if (depth != rank) {
+        tokens.report(token, "The tensor literal has an inhomogeneous shape");
+      }
+      double val;
+      auto [end, ec] = std::from_chars(text.data(), text.data() + text.size(),
+                                       val);
+      if (ec != std::errc() || end != text.data() + text.size())
+        tokens.report(token, std::string(text) +
+                                 " cannot be converted into a double value.");
+      literal_elements.push_back(negative ? -val : val);
+      counts[depth]++;
+      expect_element = false;
+    } else if (text == ",") {
+      expect_element = true;
+    } else if (text == "]") {
+      if (dims[depth - 1] == -1)
+        dims[depth - 1] = counts[depth];
+      else if (dims[depth - 1] != counts[depth])
+        tokens.report(token, "The tensor literal has an inhomogeneous shape");
+      counts.pop_back();
+      depth--;
+      counts[depth]++;
+    } else {
+      tokens.report(token, "Expected , or ] in the tensor literal");
+    }
+  }
+  PackedTensorValue *tensor =
+      PackedTensorValue::create(arena, rank, dims.data());
+  std::memcpy(tensor->data, literal_elements.data(),
+              sizeof(double) * literal_elements.size());
+  return tensor;
+}
+
+DefVarStmt *Parser::build_DefVarStmt(Symbol identifier_name) {
+  Token token = tokens.next();
   // TODO: if tk_string is supported, this checking should be expanded
   // TODO: support 'a = func(x, y)'
-  if (!res ||
-      lexer.get_kind() != tk_number && lexer.get_kind() != tk_identifier) {
-    lexer.report("Expected a number or an identifier");
+  bool is_tensor = token.kind == tk_punctuation && tokens.text(token) == "[";
+  if (token.kind != tk_number && token.kind != tk_identifier && !is_tensor) {
+    tokens.report(token, "Expected a number, a tensor or an identifier");
   }
-  if (std::isdigit(lexer.get_token()[0])) {
-    std::string digit_token_1 = lexer.get_token();
-    Value *ve_1 = new ScalaValue(digit_token_1);
-    res = lexer.nextToken();
-    if (!res) {
-      lexer.report("Should not end up here.");
+  if (token.kind == tk_number || is_tensor) {
+    Value *ve_1 =
+        is_tensor
+            ? static_cast<Value *>(build_TensorLiteral())
+            : arena.make<ScalaValue>(std::string(tokens.text(token)));
+    Token delimiter = tokens.next();
+    if (delimiter.kind == tk_eof) {
+      tokens.report(delimiter, "Should not end up here.");
     }
 
-    if (lexer.get_token() == ";") {
-      // x = 1;
-      Expr *expr = new ValueExpr(ve_1);
+    if (tokens.text(delimiter) == ";") {
+      // x = 1; or x = [1, 2];
+      Expr *expr = arena.make<ValueExpr>(ve_1);
       expr->set_type(tyFloat64);
-      return new DefVarStmt(scope, std::move(identifier_name), expr);
+      return arena.make<DefVarStmt>(scope, identifier_name, expr);
     }
     // TODO other situations
     return nullptr;
@@ -142,44 +231,70 @@ DefVarStmt *Parser::build_DefVarStmt(std::string identifier_name) {
 }
 
 DefStmt *Parser::build_DefStmt() {
-  bool res = lexer.nextToken();
-  if (!res || lexer.get_kind() != tk_identifier) {
-    lexer.report("Expected an indentifier");
+  Token identifier = tokens.next();
+  if (identifier.kind != tk_identifier) {
+    tokens.report(identifier, "Expected an indentifier");
   }
-  std::string identifier_name = lexer.get_token();
-  res = lexer.nextToken();
-  if (!res || lexer.get_kind() != tk_punctuation) {
-    lexer.report("Expected a punctuation");
+  Symbol identifier_name(tokens.text(identifier));
+  Token punctuation = tokens.next();
+  if (punctuation.kind != tk_punctuation) {
+    tokens.report(punctuation, "Expected a punctuation");
   }
-  if (lexer.get_token() == "(") {
+  if (tokens.text(punctuation) == "(") {
     return build_DefFuncStmt(identifier_name);
-  } else if (lexer.get_token() == "=") {
+  } else if (tokens.text(punctuation) == "=") {
     return build_DefVarStmt(identifier_name);
-  } else {
-    lexer.report("Expected ( or =, but receives a " + lexer.get_token());
   }
+  tokens.report(punctuation, "Expected ( or =, but receives a " +
+                                 std::string(tokens.text(punctuation)));
+  return nullptr;
 }
 
-Stmt *Parser::meet_keyword() {
-  if (lexer.get_token() == "def") {
+Stmt *Parser::meet_keyword(const Token &keyword) {
+  if (tokens.text(keyword) == "def") {
     return build_DefStmt();
   }
   // TODO: add other keywords here
+  return nullptr;
 }
 
 Stmt *Parser::parse() {
-  bool head_init = false;
-  StmtChain *chain = new StmtChain();
-  while (lexer.nextToken()) {
-    TokenKind tk = lexer.get_kind();
-    std::string token = lexer.get_token();
-    if (tk == tk_keyword) {
-      if (!head_init) {
-        head_init = true;
-        chain->stmt = meet_keyword();
+  std::string_view source = lexer.source_text();
+  if (!cache_file.empty() && cache.load(cache_file, source))
+    return FlatAST::expand(cache.ast(), arena);
+  CompoundStmt *root = parse_source();
+  if (!cache_file.empty()) {
+    flat = FlatAST::flatten(root);
+    ModuleCache::write(cache_file, flat.view(), source);
+  }
+  return root;
+}
+
+CompoundStmt *Parser::parse_source() {
+  StmtChain *chain = arena.make<StmtChain>();
+  StmtChain *tail = nullptr;
+  while (tokens.peek().kind != tk_eof) {
+    Token token = tokens.next();
+    if (token.kind == tk_keyword) {
+      if (!tail) {
+        tail = chain;
+        chain->stmt = meet_keyword(token);
       } else
-        chain->add(meet_keyword());
+        tail = tail->add(arena, meet_keyword(token));
     }
   }
-  return new CompoundStmt(scope, chain);
-}
\ No newline at end of file
+  CompoundStmt *root = arena.make<CompoundStmt>(scope, chain);
+  ConstantFolding::fold(root, arena);
+  return root;
+}
+
+FlatView Parser::parse_module() {
+  std::string_view source = lexer.source_text();
+  if (!cache_file.empty() && cache.load(cache_file, source))
+    return cache.ast();
+  flat = FlatAST::flatten(parse_source());
+  // a cache that cannot be written only costs the next run a parse
+  if (!cache_file.empty())
+    ModuleCache::write(cache_file, flat.view(), source);
+  return flat.view();
+}
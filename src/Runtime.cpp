@@ -0,0 +1,62 @@
+#include "../include/Runtime.h"
+#include "../include/Kernels.h"
+#include "../include/Tensor.h"
+#include <algorithm>
+#include <cstdlib>
+
+double *pieck_alloc(int64_t n) {
+  // aligned_alloc needs a multiple of the alignment
+  size_t bytes = sizeof(double) * std::max<int64_t>(n, 1);
+  bytes = (bytes + Tensor::alignment - 1) / Tensor::alignment *
+          Tensor::alignment;
+  double *data =
+      static_cast<double *>(std::aligned_alloc(Tensor::alignment, bytes));
+  ASSERT(data, "pieck_alloc: out of memory.");
+  return data;
+}
+
+void pieck_free(double *data) { std::free(data); }
+
+void pieck_print_scala(RuntimeContext *ctx, double value) {
+  *ctx->out << value << "\n";
+}
+
+void pieck_print_tensor(RuntimeContext *ctx, const double *data, int32_t rank,
+                        const int32_t *dims) {
+  Tensor::copy_of(Shape(rank, dims), data).print(*ctx->out);
+  *ctx->out << "\n";
+}
+
+void pieck_print_none(RuntimeContext *ctx) { *ctx->out << "none\n"; }
+
+void pieck_matmul(const double *a, const double *b, double *c, int64_t m,
+                  int64_t n, int64_t k, int32_t a_transposed,
+                  int32_t b_transposed) {
+  matmul(a, b, c, m, n, k, a_transposed, b_transposed);
+}
+
+int64_t pieck_index(RuntimeContext *ctx, const char *where, double value,
+                    int64_t n) {
+  try {
+    return index_of(value, n);
+  } catch (std::logic_error &e) {
+    pieck_fail(ctx, where, e.what());
+    return -1;
+  }
+}
+
+int32_t pieck_enter(RuntimeContext *ctx, const char *where) {
+  if (++ctx->depth <= RuntimeContext::max_call_depth)
+    return 1;
+  pieck_fail(ctx, where, "The calls are nested too deeply");
+  return 0;
+}
+
+void pieck_leave(RuntimeContext *ctx) { ctx->depth--; }
+
+void pieck_fail(RuntimeContext *ctx, const char *where, const char *message) {
+  if (ctx->error.empty())
+    ctx->error = std::string("In ") + where + ": " + message;
+}
+
+int32_t pieck_failed(RuntimeContext *ctx) { return !ctx->error.empty(); }
@@ -0,0 +1,69 @@
+#include "../include/Scope.h"
+#include "../include/Error.h"
+#include <algorithm>
+
+ScopeTree &ScopeTree::global() {
+  static ScopeTree tree;
+  return tree;
+}
+
+ScopeTree::ScopeTree() {
+  nodes.push_back({invalid_id, Symbol(), 0, invalid_id, invalid_id});
+}
+
+ScopeID ScopeTree::child(ScopeID parent, Symbol name) {
+  const uint64_t key = (uint64_t)parent << 32 | name.id();
+  std::lock_guard<std::mutex> lock(mutex);
+  auto [it, inserted] = children.try_emplace(key, nodes.size());
+  if (inserted) {
+    ASSERT(nodes.size() < invalid_id, "Too many scopes.");
+    Node &parent_node = nodes[parent];
+    nodes.push_back({parent, name, parent_node.depth + 1, invalid_id,
+                     parent_node.first_child});
+    parent_node.first_child = it->second;
+  }
+  return it->second;
+}
+
+std::shared_ptr<const ScopeIntervals> ScopeTree::intervals() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (numbered && numbered->size() == nodes.size())
+    return numbered;
+  // number the tree depth-first without recursion
+  auto intervals = std::make_shared<ScopeIntervals>();
+  std::vector<ScopeIntervals::Interval> &numbers = intervals->intervals;
+  numbers.resize(nodes.size());
+  uint32_t counter = 0;
+  // the scopes being visited, with the next child of each to visit
+  std::vector<std::pair<ScopeID, ScopeID>> stack;
+  numbers[root].pre = counter++;
+  stack.push_back({root, nodes[root].first_child});
+  while (!stack.empty()) {
+    auto &[scope, next_child] = stack.back();
+    if (next_child == invalid_id) {
+      numbers[scope].post = counter++;
+      stack.pop_back();
+      continue;
+    }
+    ScopeID child = next_child;
+    next_child = nodes[child].next_sibling;
+    numbers[child].pre = counter++;
+    stack.push_back({child, nodes[child].first_child});
+  }
+  numbered = intervals;
+  return numbered;
+}
+
+void Scope::pop() {
+  ASSERT(_id != ScopeTree::root, "The outermost scope cannot be left.");
+  _id = ScopeTree::global().parent(_id);
+}
+
+std::vector<Symbol> Scope::names() const {
+  std::vector<Symbol> names;
+  ScopeTree &tree = ScopeTree::global();
+  for (ScopeID id = _id; id != ScopeTree::root; id = tree.parent(id))
+    names.push_back(tree.name(id));
+  std::reverse(names.begin(), names.end());
+  return names;
+}
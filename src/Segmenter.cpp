@@ -0,0 +1,69 @@
+#include "../include/Segmenter.h"
+
+bool Segmenter::starts_function(size_t begin) const {
+  const char *text = source.data();
+  const size_t size = source.size();
+  auto skip = [&](size_t pos, CharClass cc) {
+    while (pos < size && char_class(text[pos]) == cc)
+      pos++;
+    return pos;
+  };
+  if (source.compare(begin, 3, "def") != 0)
+    return false;
+  size_t pos = begin + 3;
+  size_t name = skip(pos, cc_space);
+  if (name == pos || name == size || char_class(text[name]) != cc_alpha)
+    return false;
+  pos = name + 1;
+  while (pos < size && (char_class(text[pos]) == cc_alpha ||
+                        char_class(text[pos]) == cc_digit))
+    pos++;
+  pos = skip(pos, cc_space);
+  return pos < size && text[pos] == '(';
+}
+
+bool Segmenter::next(SourceRange &range) {
+  const char *text = source.data();
+  const size_t size = source.size();
+  range.begin = pos;
+  range.line = line;
+  // skip the blank lines in front of the statement
+  while (pos < size &&
+         (char_class(text[pos]) == cc_space || text[pos] == '\n')) {
+    line += text[pos] == '\n';
+    pos++;
+  }
+  if (pos == size) {
+    // trailing whitespaces are no statement
+    range.line = line;
+    return false;
+  }
+  const bool in_function = starts_function(pos);
+  while (pos < size) {
+    const char c = text[pos++];
+    if (c == '\n') {
+      line++;
+    } else if (char_class(c) == cc_quote) {
+      // a string ends at the same delimiter in the same line
+      while (pos < size && text[pos] != c && text[pos] != '\n')
+        pos++;
+      pos += pos < size && text[pos] == c;
+    } else if (c == ';') {
+      const bool double_semicolon = pos < size && text[pos] == ';';
+      pos += double_semicolon;
+      if (double_semicolon || !in_function)
+        break;
+    }
+  }
+  range.end = pos;
+  return true;
+}
+
+std::vector<SourceRange> Segmenter::split(std::string_view source) {
+  std::vector<SourceRange> ranges;
+  Segmenter segmenter(source);
+  SourceRange range;
+  while (segmenter.next(range))
+    ranges.push_back(range);
+  return ranges;
+}
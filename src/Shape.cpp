@@ -0,0 +1,170 @@
+#include "../include/Shape.h"
+#include <algorithm>
+
+Shape::Shape(int32_t dims_dim, const int32_t dims[]) : _dims_dim(dims_dim) {
+  ASSERT(dims_dim >= 0, "The length of the dims vector must not be negative.");
+  const int32_t *stored_dims;
+  _id = ShapeTable::global().intern(dims_dim, dims, &stored_dims);
+  if (dims_dim <= max_inline_rank)
+    std::copy(dims, dims + dims_dim, inline_dims);
+  else
+    table_dims = stored_dims;
+}
+
+Shape Shape::scala() {
+  // the ShapeTable interns the shape () first
+  Shape shape;
+  shape._dims_dim = 0;
+  shape._id = 0;
+  return shape;
+}
+
+int64_t Shape::num_of_elements() const {
+  ASSERT(!unintialized(), "Shape must be initialized here.");
+  int64_t n = 1;
+  for (int i = 0; i < _dims_dim; i++)
+    n *= dims()[i];
+  return n;
+}
+
+Shape Shape::prepend(int32_t dim) const {
+  ASSERT(!unintialized(), "Shape must be initialized here.");
+  int32_t buffer[max_inline_rank + 1];
+  std::vector<int32_t> large;
+  int32_t *new_dims = buffer;
+  if (_dims_dim + 1 > max_inline_rank + 1) {
+    large.resize(_dims_dim + 1);
+    new_dims = large.data();
+  }
+  new_dims[0] = dim;
+  std::copy(dims(), dims() + _dims_dim, new_dims + 1);
+  return Shape(_dims_dim + 1, new_dims);
+}
+
+Shape Shape::drop_front() const {
+  ASSERT(_dims_dim > 0, "Shape must have a dim to drop.");
+  return Shape(_dims_dim - 1, dims() + 1);
+}
+
+Shape Shape::broadcast(const Shape &lhs, const Shape &rhs) {
+  ASSERT(!lhs.unintialized() && !rhs.unintialized(),
+         "Shape must be initialized here.");
+  if (lhs == rhs)
+    return lhs;
+  const int32_t rank = std::max(lhs._dims_dim, rhs._dims_dim);
+  std::vector<int32_t> dims(rank);
+  for (int32_t i = 1; i <= rank; i++) {
+    const int32_t a = i <= lhs._dims_dim ? lhs[lhs._dims_dim - i] : 1;
+    const int32_t b = i <= rhs._dims_dim ? rhs[rhs._dims_dim - i] : 1;
+    if (a != b && a != 1 && b != 1)
+      return Shape();
+    dims[rank - i] = a == 1 ? b : a;
+  }
+  return Shape(rank, dims.data());
+}
+
+std::string Shape::str() const {
+  ASSERT(!unintialized(), "Shape must be initialized here.");
+  std::string str = "(";
+  for (int i = 0; i < _dims_dim; i++) {
+    if (i > 0)
+      str += ", ";
+    str += std::to_string(dims()[i]);
+  }
+  return str + ")";
+}
+
+ShapeTable &ShapeTable::global() {
+  static ShapeTable table;
+  return table;
+}
+
+ShapeTable::ShapeTable() {
+  tables.push_back(std::make_unique<Slots>(64));
+  slots.store(tables.back().get(), std::memory_order_release);
+  // the shape () of scalars is always the ID 0
+  const int32_t *stored_dims;
+  intern(0, nullptr, &stored_dims);
+}
+
+ShapeTable::Slots::Slots(size_t size)
+    : ids(new std::atomic<ShapeID>[size]), mask(size - 1) {
+  for (size_t i = 0; i < size; i++)
+    ids[i].store(Shape::invalid_id, std::memory_order_relaxed);
+}
+
+// FNV-1a over the rank and the dims
+static uint64_t hash_dims(int32_t dims_dim, const int32_t dims[]) {
+  uint64_t hash = 14695981039346656037ull;
+  auto mix = [&hash](uint32_t word) {
+    for (int i = 0; i < 4; i++, word >>= 8) {
+      hash ^= word & 0xFF;
+      hash *= 1099511628211ull;
+    }
+  };
+  mix(dims_dim);
+  for (int i = 0; i < dims_dim; i++)
+    mix(dims[i]);
+  return hash;
+}
+
+ShapeID ShapeTable::find(const Slots &slots, uint64_t hash,
+                         int32_t dims_dim, const int32_t dims[],
+                         size_t &slot) const {
+  for (size_t i = hash & slots.mask;; i = (i + 1) & slots.mask) {
+    // the entry of an ID is complete before the ID is published
+    ShapeID id = slots.ids[i].load(std::memory_order_acquire);
+    if (id == Shape::invalid_id) {
+      slot = i;
+      return id;
+    }
+    const Entry &entry = entries[id];
+    if (entry.hash == hash && entry.dims_dim == dims_dim &&
+        std::equal(dims, dims + dims_dim, entry.dims))
+      return id;
+  }
+}
+
+ShapeID ShapeTable::intern(int32_t dims_dim, const int32_t dims[],
+                           const int32_t **stored_dims) {
+  const uint64_t hash = hash_dims(dims_dim, dims);
+  size_t slot;
+  ShapeID id = find(*slots.load(std::memory_order_acquire), hash, dims_dim,
+                    dims, slot);
+  if (id == Shape::invalid_id) {
+    // probe again under the lock, another thread may have added the shape
+    std::lock_guard<std::mutex> lock(mutex);
+    const Slots &current = *slots.load(std::memory_order_relaxed);
+    id = find(current, hash, dims_dim, dims, slot);
+    if (id == Shape::invalid_id) {
+      // a shape never seen before
+      int32_t *copy = dims_storage.allocate_array<int32_t>(dims_dim);
+      std::copy(dims, dims + dims_dim, copy);
+      id = entries.push_back({hash, dims_dim, copy});
+      current.ids[slot].store(id, std::memory_order_release);
+      if (entries.size() * 2 > current.mask + 1)
+        grow();
+    }
+  }
+  *stored_dims = entries[id].dims;
+  return id;
+}
+
+void ShapeTable::grow() {
+  const Slots &old_slots = *slots.load(std::memory_order_relaxed);
+  auto new_slots = std::make_unique<Slots>((old_slots.mask + 1) * 2);
+  for (ShapeID id = 0; id < entries.size(); id++) {
+    size_t i = entries[id].hash & new_slots->mask;
+    while (new_slots->ids[i].load(std::memory_order_relaxed) !=
+           Shape::invalid_id)
+      i = (i + 1) & new_slots->mask;
+    new_slots->ids[i].store(id, std::memory_order_relaxed);
+  }
+  slots.store(new_slots.get(), std::memory_order_release);
+  tables.push_back(std::move(new_slots));
+}
+
+ArenaStats ShapeTable::stats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return dims_storage.stats();
+}
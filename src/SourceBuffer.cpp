@@ -0,0 +1,91 @@
+#include "../include/SourceBuffer.h"
+#include "../include/Error.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+SourceBuffer::SourceBuffer(const std::string &file_name) {
+  int fd = ::open(file_name.c_str(), O_RDONLY);
+  ASSERT(fd >= 0, "Cannot open the source file " + file_name);
+  struct stat st;
+  if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *addr =
+        ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, /*offset*/ 0);
+    if (addr != MAP_FAILED) {
+      // the lexer walks the file front to back exactly once
+      ::madvise(addr, st.st_size, MADV_SEQUENTIAL);
+      _data = static_cast<const char *>(addr);
+      _size = st.st_size;
+      mapped = true;
+      ::close(fd);
+      return;
+    }
+  }
+  // Not mappable, read the file into memory instead.
+  char chunk[4096];
+  ssize_t n;
+  while ((n = ::read(fd, chunk, sizeof(chunk))) > 0) {
+    owned.append(chunk, n);
+  }
+  ::close(fd);
+  ASSERT(n == 0, "Failed to read the source file " + file_name);
+  _data = owned.data();
+  _size = owned.size();
+}
+
+SourceBuffer SourceBuffer::from_string(std::string text) {
+  SourceBuffer buffer;
+  buffer.owned = std::move(text);
+  buffer._data = buffer.owned.data();
+  buffer._size = buffer.owned.size();
+  return buffer;
+}
+
+SourceBuffer SourceBuffer::borrow(std::string_view text) {
+  SourceBuffer buffer;
+  buffer.borrowed = true;
+  buffer._data = text.data();
+  buffer._size = text.size();
+  return buffer;
+}
+
+SourceBuffer::SourceBuffer(SourceBuffer &&other) noexcept {
+  *this = std::move(other);
+}
+
+SourceBuffer &SourceBuffer::operator=(SourceBuffer &&other) noexcept {
+  if (this == &other)
+    return *this;
+  release();
+  mapped = other.mapped;
+  borrowed = other.borrowed;
+  _size = other._size;
+  if (mapped || borrowed) {
+    _data = other._data;
+  } else {
+    // the characters of a short string live inside the string object itself,
+    // so the pointer must be recomputed after the move
+    owned = std::move(other.owned);
+    _data = owned.data();
+  }
+  other.mapped = false;
+  other.borrowed = false;
+  other._data = "";
+  other._size = 0;
+  return *this;
+}
+
+SourceBuffer::~SourceBuffer() { release(); }
+
+void SourceBuffer::release() {
+  if (mapped) {
+    ::munmap(const_cast<char *>(_data), _size);
+    mapped = false;
+  }
+  borrowed = false;
+  owned.clear();
+  _data = "";
+  _size = 0;
+}
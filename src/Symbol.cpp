@@ -0,0 +1,63 @@
+#include "../include/Symbol.h"
+#include "../include/Error.h"
+#include <cstring>
+
+Symbol::Symbol(std::string_view name)
+    : _id(SymbolInterner::global().intern(name)) {}
+
+SymbolInterner &SymbolInterner::global() {
+  static SymbolInterner interner;
+  return interner;
+}
+
+// FNV-1a over the characters
+static uint64_t hash_name(std::string_view name) {
+  uint64_t hash = 14695981039346656037ull;
+  for (unsigned char c : name) {
+    hash ^= c;
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+SymbolID SymbolInterner::intern(std::string_view name) {
+  ASSERT(name.size() <= UINT32_MAX, "The name is too long.");
+  const uint64_t hash = hash_name(name);
+  std::lock_guard<std::mutex> lock(mutex);
+  const size_t mask = slots.size() - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    SymbolID id = slots[i];
+    if (id == Symbol::invalid_id) {
+      // a name never seen before
+      ASSERT(entries.size() < Symbol::invalid_id, "Too many names.");
+      char *copy = name_storage.allocate_array<char>(name.size());
+      std::memcpy(copy, name.data(), name.size());
+      id = entries.push_back({hash, copy, (uint32_t)name.size()});
+      slots[i] = id;
+      if (entries.size() * 2 > slots.size())
+        grow();
+      return id;
+    }
+    const Entry &entry = entries[id];
+    if (entry.hash == hash &&
+        std::string_view(entry.data, entry.length) == name)
+      return id;
+  }
+}
+
+void SymbolInterner::grow() {
+  std::vector<SymbolID> new_slots(slots.size() * 2, Symbol::invalid_id);
+  const size_t mask = new_slots.size() - 1;
+  for (SymbolID id = 0; id < entries.size(); id++) {
+    size_t i = entries[id].hash & mask;
+    while (new_slots[i] != Symbol::invalid_id)
+      i = (i + 1) & mask;
+    new_slots[i] = id;
+  }
+  slots.swap(new_slots);
+}
+
+ArenaStats SymbolInterner::stats() {
+  std::lock_guard<std::mutex> lock(mutex);
+  return name_storage.stats();
+}
@@ -0,0 +1,47 @@
+#include "../include/SymbolTable.h"
+#include <mutex>
+
+uint32_t SymbolTable::add_modules(const std::vector<std::string> &file_names) {
+  std::lock_guard<std::mutex> lock(modules_mutex);
+  uint32_t first = module_files.size();
+  module_files.insert(module_files.end(), file_names.begin(),
+                      file_names.end());
+  return first;
+}
+
+const std::string &SymbolTable::file_of(uint32_t module) const {
+  std::lock_guard<std::mutex> lock(modules_mutex);
+  return module_files.at(module);
+}
+
+SymbolTable::Definition SymbolTable::define(Symbol name,
+                                            Definition definition) {
+  Shard &shard = shard_of(name);
+  std::unique_lock<std::shared_mutex> lock(shard.mutex);
+  auto [it, inserted] = shard.definitions.try_emplace(name.id(), definition);
+  Definition &winner = it->second;
+  if (!inserted &&
+      (definition.module < winner.module ||
+       (definition.module == winner.module && definition.node < winner.node)))
+    winner = definition;
+  return winner;
+}
+
+std::optional<SymbolTable::Definition>
+SymbolTable::lookup(Symbol name) const {
+  Shard &shard = shard_of(name);
+  std::shared_lock<std::shared_mutex> lock(shard.mutex);
+  auto it = shard.definitions.find(name.id());
+  if (it == shard.definitions.end())
+    return std::nullopt;
+  return it->second;
+}
+
+size_t SymbolTable::size() const {
+  size_t size = 0;
+  for (Shard &shard : shards) {
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    size += shard.definitions.size();
+  }
+  return size;
+}
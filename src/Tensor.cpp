@@ -0,0 +1,239 @@
+#include "../include/Tensor.h"
+#include "../include/Error.h"
+#include <cstdlib>
+#include <algorithm>
+#include <cstring>
+
+Tensor::Tensor(Shape shape) : _shape(shape) {
+  ASSERT(!shape.unintialized(), "Shape must be initialized here.");
+  // aligned_alloc wants a multiple of the alignment
+  size_t bytes = sizeof(double) * shape.num_of_elements();
+  bytes = (bytes + alignment - 1) / alignment * alignment;
+  if (bytes == 0)
+    bytes = alignment;
+  _data = static_cast<double *>(std::aligned_alloc(alignment, bytes));
+  ASSERT(_data, "Out of memory for a tensor of shape " + shape.str());
+  buffer = std::shared_ptr<double>(_data, std::free);
+}
+
+Tensor Tensor::copy_of(Shape shape, const double *data) {
+  Tensor tensor(shape);
+  std::memcpy(tensor._data, data, sizeof(double) * shape.num_of_elements());
+  return tensor;
+}
+
+int64_t Tensor::stride(int32_t dim) const {
+  if (_strides)
+    return _strides[dim];
+  int64_t stride = 1;
+  for (int32_t i = dim + 1; i < rank(); i++)
+    stride *= _shape[i];
+  return stride;
+}
+
+namespace {
+// the strides of every dim of ${tensor}
+std::vector<int64_t> strides_of(const Tensor &tensor) {
+  std::vector<int64_t> strides(tensor.rank());
+  for (int32_t i = 0; i < tensor.rank(); i++)
+    strides[i] = tensor.stride(i);
+  return strides;
+}
+
+// Copy the ${dim}th and later dims of ${shape} from ${src} to ${dest}, whose
+// dims are ${src_strides} and ${dest_strides} elements apart
+void copy_dims(const Shape &shape, int32_t dim, double *dest,
+               const int64_t *dest_strides, const double *src,
+               const int64_t *src_strides) {
+  if (dim == shape.dims_dim()) {
+    *dest = *src;
+    return;
+  }
+  const int64_t n = shape[dim];
+  if (dim + 1 == shape.dims_dim()) {
+    for (int64_t i = 0; i < n; i++)
+      dest[i * dest_strides[dim]] = src[i * src_strides[dim]];
+    return;
+  }
+  for (int64_t i = 0; i < n; i++)
+    copy_dims(shape, dim + 1, dest + i * dest_strides[dim], dest_strides,
+              src + i * src_strides[dim], src_strides);
+}
+
+void fill_dims(const Shape &shape, int32_t dim, double *dest,
+               const int64_t *strides, double value) {
+  if (dim == shape.dims_dim()) {
+    *dest = value;
+    return;
+  }
+  for (int64_t i = 0; i < shape[dim]; i++)
+    fill_dims(shape, dim + 1, dest + i * strides[dim], strides, value);
+}
+} // namespace
+
+std::vector<int64_t> Tensor::row_major_strides(const Shape &shape) {
+  std::vector<int64_t> strides(shape.dims_dim());
+  int64_t stride = 1;
+  for (int32_t i = shape.dims_dim() - 1; i >= 0; i--) {
+    strides[i] = stride;
+    stride *= shape[i];
+  }
+  return strides;
+}
+
+std::vector<int64_t>
+Tensor::broadcast_strides(const Shape &shape,
+                          const std::vector<int64_t> &strides,
+                          const Shape &to) {
+  ASSERT(Shape::broadcast(shape, to) == to,
+         "Tensor: the shape cannot be broadcast.");
+  std::vector<int64_t> broadcast(to.dims_dim(), 0);
+  const int32_t prepended = to.dims_dim() - shape.dims_dim();
+  for (int32_t i = 0; i < shape.dims_dim(); i++) {
+    if (shape[i] == to[prepended + i])
+      broadcast[prepended + i] = strides[i];
+  }
+  return broadcast;
+}
+
+bool Tensor::is_row_major(const Shape &shape,
+                          const std::vector<int64_t> &strides) {
+  int64_t expected = 1;
+  for (int32_t i = shape.dims_dim() - 1; i >= 0; i--) {
+    if (shape[i] != 1 && strides[i] != expected)
+      return false;
+    expected *= shape[i];
+  }
+  return true;
+}
+
+bool Tensor::is_transposed(const Shape &shape,
+                           const std::vector<int64_t> &strides) {
+  int64_t expected = 1;
+  for (int32_t i = 0; i < shape.dims_dim(); i++) {
+    if (shape[i] != 1 && strides[i] != expected)
+      return false;
+    expected *= shape[i];
+  }
+  return true;
+}
+
+Tensor Tensor::with_strides(double *data, Shape shape,
+                            const std::vector<int64_t> &strides) const {
+  Tensor tensor;
+  tensor.buffer = buffer;
+  tensor._data = data;
+  tensor._shape = shape;
+  tensor._view = true;
+  if (!is_row_major(shape, strides)) {
+    std::shared_ptr<int64_t[]> copy(new int64_t[strides.size()]);
+    std::copy(strides.begin(), strides.end(), copy.get());
+    tensor._strides = std::move(copy);
+  }
+  return tensor;
+}
+
+Tensor Tensor::select(int32_t dim, int64_t index) const {
+  ASSERT(dim < rank() && index >= 0 && index < _shape[dim],
+         "Tensor: the index is out of range.");
+  if (dim == 0 && is_contiguous())
+    return view(_shape.drop_front(), index * stride(0));
+  std::vector<int32_t> dims;
+  std::vector<int64_t> strides;
+  for (int32_t i = 0; i < rank(); i++) {
+    if (i == dim)
+      continue;
+    dims.push_back(_shape[i]);
+    strides.push_back(stride(i));
+  }
+  return with_strides(_data + index * stride(dim),
+                      Shape(dims.size(), dims.data()), strides);
+}
+
+Tensor Tensor::slice(int32_t dim, int64_t begin, int64_t end) const {
+  ASSERT(dim < rank() && 0 <= begin && begin <= end && end <= _shape[dim],
+         "Tensor: the range is out of range.");
+  std::vector<int32_t> dims(_shape.dims(), _shape.dims() + rank());
+  dims[dim] = end - begin;
+  return with_strides(_data + begin * stride(dim), Shape(rank(), dims.data()),
+                      strides_of(*this));
+}
+
+Tensor Tensor::transpose() const {
+  if (rank() < 2)
+    return *this;
+  std::vector<int32_t> dims(_shape.dims(), _shape.dims() + rank());
+  std::vector<int64_t> strides = strides_of(*this);
+  std::reverse(dims.begin(), dims.end());
+  std::reverse(strides.begin(), strides.end());
+  return with_strides(_data, Shape(rank(), dims.data()), strides);
+}
+
+bool Tensor::is_transposed() const {
+  return is_transposed(_shape, strides_of(*this));
+}
+
+Tensor Tensor::broadcast_to(const Shape &shape) const {
+  if (shape == _shape)
+    return *this;
+  return with_strides(_data, shape,
+                      broadcast_strides(_shape, strides_of(*this), shape));
+}
+
+Tensor Tensor::clone() const {
+  if (is_contiguous())
+    return copy_of(_shape, _data);
+  Tensor tensor(_shape);
+  std::vector<int64_t> strides = strides_of(*this);
+  std::vector<int64_t> packed = row_major_strides(_shape);
+  copy_dims(_shape, 0, tensor._data, packed.data(), _data, strides.data());
+  return tensor;
+}
+
+void Tensor::assign(const Tensor &value) const {
+  ASSERT(value.shape() == _shape, "Tensor: the shapes must be equal.");
+  if (is_contiguous() && value.is_contiguous()) {
+    std::memmove(_data, value._data, sizeof(double) * num_of_elements());
+    return;
+  }
+  // a strided copy is only right if the elements do not overlap
+  if (value.buffer == buffer) {
+    assign(value.clone());
+    return;
+  }
+  std::vector<int64_t> dest_strides = strides_of(*this);
+  std::vector<int64_t> src_strides = strides_of(value);
+  copy_dims(_shape, 0, _data, dest_strides.data(), value._data,
+            src_strides.data());
+}
+
+void Tensor::fill(double value) const {
+  if (is_contiguous()) {
+    std::fill(_data, _data + num_of_elements(), value);
+    return;
+  }
+  std::vector<int64_t> strides = strides_of(*this);
+  fill_dims(_shape, 0, _data, strides.data(), value);
+}
+
+// print the ${dim}th and later dims of the tensor at ${data}
+static void print_dims(std::ostream &out, const Shape &shape, int32_t dim,
+                       const double *data, const int64_t *strides) {
+  if (dim == shape.dims_dim()) {
+    out << *data;
+    return;
+  }
+  out << "[";
+  for (int32_t i = 0; i < shape[dim]; i++) {
+    if (i > 0)
+      out << ", ";
+    print_dims(out, shape, dim + 1, data + i * strides[dim], strides);
+  }
+  out << "]";
+}
+
+void Tensor::print(std::ostream &out) const {
+  ASSERT(!empty(), "Tensor must hold elements before being printed.");
+  std::vector<int64_t> strides = strides_of(*this);
+  print_dims(out, _shape, 0, _data, strides.data());
+}
@@ -0,0 +1,132 @@
+#include "../include/ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+size_t ThreadPool::default_num_of_threads() {
+  return std::max(1u, std::thread::hardware_concurrency());
+}
+
+namespace {
+// the pool and the index of the worker running on this thread
+thread_local const ThreadPool *current_pool = nullptr;
+thread_local size_t current_worker = 0;
+} // namespace
+
+ThreadPool::ThreadPool(size_t num_of_threads) {
+  for (size_t i = 0; i < num_of_threads; i++)
+    queues.push_back(std::make_unique<Queue>());
+  for (size_t i = 0; i < num_of_threads; i++)
+    workers.emplace_back(&ThreadPool::work, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+  for (std::thread &worker : workers)
+    worker.join();
+}
+
+void ThreadPool::push(std::function<void()> task) {
+  size_t index = current_pool == this ? current_worker
+                                      : next_queue++ % queues.size();
+  {
+    std::lock_guard<std::mutex> lock(queues[index]->mutex);
+    queues[index]->tasks.push_back(std::move(task));
+  }
+  {
+    // counted under the lock, so no worker misses the wake-up
+    std::lock_guard<std::mutex> lock(sleep_mutex);
+    pending++;
+  }
+  wake.notify_one();
+}
+
+bool ThreadPool::take(size_t index, std::function<void()> &task) {
+  {
+    Queue &own = *queues[index];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      pending--;
+      return true;
+    }
+  }
+  for (size_t i = 1; i < queues.size(); i++) {
+    Queue &victim = *queues[(index + i) % queues.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      pending--;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::work(size_t index) {
+  current_pool = this;
+  current_worker = index;
+  std::function<void()> task;
+  while (true) {
+    if (take(index, task)) {
+      task();
+      task = nullptr;
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    wake.wait(lock, [this] { return stopping || pending > 0; });
+    if (stopping && pending <= 0)
+      return;
+  }
+}
+
+void ThreadPool::parallel_for(size_t n,
+                              const std::function<void(size_t)> &task) {
+  // The indices are claimed one by one from a shared counter by the calling
+  // thread and by up to size() helpers pushed to the pool. A helper may only
+  // start after all indices are done, e.g. when the pool is busy with the task
+  // that called parallel_for, so the loop state is shared with the helpers
+  // and the call only waits for the indices.
+  struct Loop {
+    std::atomic<size_t> next{0};
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t completed = 0;
+    size_t failed = SIZE_MAX;
+    std::exception_ptr error;
+  };
+  auto loop = std::make_shared<Loop>();
+  auto run = [n, &task](Loop &loop) {
+    for (size_t i; (i = loop.next++) < n;) {
+      std::exception_ptr error;
+      try {
+        task(i);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      std::lock_guard<std::mutex> lock(loop.mutex);
+      if (error && i < loop.failed) {
+        loop.failed = i;
+        loop.error = error;
+      }
+      if (++loop.completed == n)
+        loop.done.notify_one();
+    }
+  };
+  const size_t num_of_helpers = std::min(size(), n > 0 ? n - 1 : 0);
+  for (size_t i = 0; i < num_of_helpers; i++)
+    push([loop, run] { run(*loop); });
+  run(*loop);
+  std::unique_lock<std::mutex> lock(loop->mutex);
+  loop->done.wait(lock, [&] { return loop->completed == n; });
+  // take the error, a late helper may release ${loop} any time
+  if (std::exception_ptr error = std::move(loop->error))
+    std::rethrow_exception(error);
+}
@@ -0,0 +1,393 @@
+#include "../include/TypeInference.h"
+#include "../include/ASTVisitor.h"
+#include "../include/Casting.h"
+#include "../include/Error.h"
+#include "../include/Kernels.h"
+#include "../include/MatMul.h"
+#include "../include/NameCollector.h"
+#include <algorithm>
+
+std::string StaticShape::describe() const {
+  if (kind == ss_unknown)
+    return "an unknown value";
+  if (kind == ss_none)
+    return "none";
+  return is_scala() ? "a scalar" : "a tensor of shape " + shape.str();
+}
+
+namespace {
+// Whether a function returns a value somewhere. Functions that do not return
+// none.
+class ReturnFinder : public ASTVisitor<ReturnFinder, bool> {
+public:
+  bool visit_CompoundStmt(CompoundStmt *stmt) {
+    return visit_chain(stmt->stmts());
+  }
+  bool visit_ReturnStmt(ReturnStmt *stmt) { return stmt->expr; }
+  bool visit_LoopStmt(LoopStmt *stmt) { return visit_chain(stmt->body); }
+
+private:
+  bool visit_chain(StmtChain *chain) {
+    for (StmtChain *link = chain; link; link = link->next) {
+      if (link->stmt && visit(link->stmt))
+        return true;
+    }
+    return false;
+  }
+};
+} // namespace
+
+// Infer the shapes of the variables of a specialization, of what it returns
+// and of its Exprs from its assignments. Calls create the specializations of
+// their callees. TypeInference::changed is set if anything new is learned.
+class ShapeInference : public ASTVisitor<ShapeInference, StaticShape> {
+public:
+  ShapeInference(TypeInference &types, Specialization &spec)
+      : types(types), spec(spec) {}
+
+  using ASTVisitor::visit;
+  // the shape of ${expr}, which is recorded in the specialization
+  StaticShape visit(Expr *expr) {
+    StaticShape shape = ASTVisitor::visit(expr);
+    spec.exprs[expr] = shape;
+    return shape;
+  }
+
+  StaticShape visit_CompoundStmt(CompoundStmt *stmt) {
+    visit_chain(stmt->stmts());
+    return {};
+  }
+  StaticShape visit_ReturnStmt(ReturnStmt *stmt) {
+    StaticShape value = stmt->expr ? visit(stmt->expr) : StaticShape::none();
+    if (types.top_level(spec) || !value.known())
+      return {};
+    if (!spec.result.known()) {
+      spec.result = value;
+      types.changed = true;
+    } else if (spec.result != value) {
+      ERROR(types.name_of(spec) + " returns both " + spec.result.describe() +
+            " and " + value.describe());
+    }
+    return {};
+  }
+  StaticShape visit_LoopStmt(LoopStmt *stmt) {
+    StaticShape iterable = visit(stmt->iterable);
+    if (iterable.known()) {
+      if (iterable.kind != StaticShape::ss_shape || iterable.is_scala())
+        ERROR("Cannot loop over " + iterable.describe());
+      assign(stmt->var, StaticShape::of(iterable.shape.drop_front()));
+    }
+    if (stmt->by_reference) {
+      spec.references.insert(stmt->var.id());
+      references.push_back(stmt->var);
+    }
+    visit_chain(stmt->body);
+    if (stmt->by_reference)
+      references.pop_back();
+    return {};
+  }
+  StaticShape visit_PrintStmt(PrintStmt *stmt) {
+    visit(stmt->expr);
+    return {};
+  }
+  StaticShape visit_DefVarStmt(DefVarStmt *stmt) {
+    StaticShape value = visit(stmt->rhs);
+    if (!value.known())
+      return {};
+    const Symbol name = stmt->identifier_name;
+    if (value.is_none())
+      ERROR("Cannot assign none to " + std::string(name.str()));
+    // a reference is written through, a scalar fills it
+    if (std::count(references.begin(), references.end(), name) &&
+        spec.shapes[name.id()].known()) {
+      const StaticShape &reference = spec.shapes[name.id()];
+      if (!value.is_scala() && value != reference)
+        ERROR("Cannot write " + value.describe() + " into " +
+              reference.describe());
+      return {};
+    }
+    assign(name, value);
+    return {};
+  }
+  StaticShape visit_DefFuncStmt(DefFuncStmt *stmt) {
+    if (!types.top_level(spec))
+      ERROR("Functions must be defined at the top level: " +
+            std::string(stmt->identifier_name.str()));
+    return {};
+  }
+
+  StaticShape visit_CallExpr(CallExpr *expr) {
+    auto it = types.function_index.find(expr->func_name.id());
+    if (it == types.function_index.end())
+      ERROR(std::string(expr->func_name.str()) + " is not defined");
+    const FunctionInfo &callee = types.functions[it->second];
+    if (callee.def->num_of_params != expr->num_of_args)
+      ERROR(std::string(expr->func_name.str()) + " expects " +
+            std::to_string(callee.def->num_of_params) +
+            " arguments but receives " + std::to_string(expr->num_of_args));
+    std::vector<Shape> args;
+    bool known = true;
+    for (int32_t i = 0; i < expr->num_of_args; i++) {
+      StaticShape arg = visit(expr->args[i]);
+      if (arg.is_none())
+        ERROR("Cannot pass none to " + std::string(expr->func_name.str()));
+      known = known && arg.known();
+      args.push_back(arg.shape);
+    }
+    if (!known)
+      return {};
+    Specialization &specialization = types.specialize(it->second, args);
+    spec.callees[expr] = specialization.index;
+    return specialization.result;
+  }
+  StaticShape visit_VarExpr(VarExpr *expr) {
+    const Symbol name = expr->var_name;
+    auto local = spec.shapes.find(name.id());
+    if (local != spec.shapes.end())
+      return local->second;
+    if (!types.top_level(spec) && types.top_assigned.count(name.id()))
+      return types.specs[0].shapes.at(name.id());
+    ERROR(std::string(name.str()) + " is not defined" +
+          (types.top_level(spec) ? "" : " in " + types.name_of(spec)));
+  }
+  StaticShape visit_BinaryOpExpr(BinaryOpExpr *expr) {
+    StaticShape lhs = visit(expr->lhs);
+    StaticShape rhs = visit(expr->rhs);
+    if (!lhs.known() || !rhs.known())
+      return {};
+    const std::string name = op_name(expr->op);
+    if (lhs.is_none() || rhs.is_none() ||
+        (expr->op == BinaryOpExpr::matmul &&
+         (lhs.is_scala() || rhs.is_scala())))
+      ERROR("Cannot apply " + name + " to " + lhs.describe() + " and " +
+            rhs.describe());
+    if (expr->op == BinaryOpExpr::matmul)
+      return StaticShape::of(MatMul::plan(lhs.shape, rhs.shape).shape);
+    const Shape shape = Shape::broadcast(lhs.shape, rhs.shape);
+    if (shape.unintialized())
+      ERROR("Cannot apply " + name + " to tensors of shapes " +
+            lhs.shape.str() + " and " + rhs.shape.str());
+    return StaticShape::of(shape);
+  }
+  StaticShape visit_ValueExpr(ValueExpr *expr) {
+    return StaticShape::of(expr->val->is_scala() ? Shape::scala()
+                                                 : expr->val->shape());
+  }
+  StaticShape visit_IndexExpr(IndexExpr *expr) {
+    StaticShape base = visit(expr->base);
+    for (int32_t i = 0; i < expr->num_of_subscripts; i++) {
+      for (Expr *bound : {expr->subscripts[i].begin, expr->subscripts[i].end}) {
+        if (!bound)
+          continue;
+        StaticShape value = visit(bound);
+        if (value.known() && !value.is_scala())
+          ERROR("Cannot index with " + value.describe());
+      }
+    }
+    if (!base.known())
+      return {};
+    if (base.kind != StaticShape::ss_shape ||
+        base.shape.dims_dim() < expr->num_of_subscripts)
+      ERROR("Cannot index " + base.describe() + " with " +
+            std::to_string(expr->num_of_subscripts) + " subscripts");
+    // the dims of ranges are kept, the ones of indices dropped
+    std::vector<int32_t> dims;
+    for (int32_t i = 0; i < base.shape.dims_dim(); i++) {
+      const int64_t n = base.shape[i];
+      if (i >= expr->num_of_subscripts) {
+        dims.push_back(n);
+        continue;
+      }
+      const IndexExpr::Subscript &subscript = expr->subscripts[i];
+      if (!subscript.is_range) {
+        // the index is checked here if it is a literal, when it runs if not
+        if (ValueExpr *value = dyn_cast<ValueExpr>(subscript.begin))
+          index_of(cast<ScalaValue>(value->val)->val, n);
+        continue;
+      }
+      const int64_t begin =
+          subscript.begin ? bound(subscript.begin, n) : 0;
+      const int64_t end = subscript.end ? bound(subscript.end, n) : n;
+      check_range(begin, end);
+      dims.push_back(end - begin);
+    }
+    return StaticShape::of(Shape(dims.size(), dims.data()));
+  }
+  StaticShape visit_TransposeExpr(TransposeExpr *expr) {
+    StaticShape operand = visit(expr->operand);
+    if (!operand.known() || operand.is_scala())
+      return operand;
+    if (operand.kind != StaticShape::ss_shape)
+      ERROR("Cannot transpose " + operand.describe());
+    std::vector<int32_t> dims(operand.shape.dims(),
+                              operand.shape.dims() + operand.shape.dims_dim());
+    std::reverse(dims.begin(), dims.end());
+    return StaticShape::of(Shape(dims.size(), dims.data()));
+  }
+
+private:
+  void visit_chain(StmtChain *chain) {
+    for (StmtChain *link = chain; link; link = link->next) {
+      if (link->stmt)
+        visit(link->stmt);
+    }
+  }
+  // the bound ${expr} of a range along a dim of ${n}, which must be a
+  // literal, as the shape of the range depends on it
+  int64_t bound(Expr *expr, int64_t n) {
+    ValueExpr *value = dyn_cast<ValueExpr>(expr);
+    if (!value || !value->val->is_scala())
+      ERROR("The bounds of a range must be literal numbers in " +
+            types.name_of(spec));
+    return bound_of(cast<ScalaValue>(value->val)->val, n);
+  }
+  // Join ${shape} into the shape of ${name}: a variable has one shape
+  void assign(Symbol name, StaticShape shape) {
+    StaticShape &current = spec.shapes.at(name.id());
+    if (!current.known()) {
+      current = shape;
+      types.changed = true;
+    } else if (current != shape) {
+      ERROR(std::string(name.str()) + " is assigned both " +
+            current.describe() + " and " + shape.describe() +
+            ", the shape of a variable must not change");
+    }
+  }
+
+  TypeInference &types;
+  Specialization &spec;
+  // the variables of the enclosing loops by reference
+  std::vector<Symbol> references;
+};
+
+TypeInference::TypeInference(CompoundStmt *root) : root(root) {
+  NameCollector top;
+  top.visit(root);
+  for (Symbol name : top.assigned)
+    top_assigned.insert(name.id());
+  for (StmtChain *link = root->stmts(); link; link = link->next) {
+    DefFuncStmt *def = dyn_cast_or_null<DefFuncStmt>(link->stmt);
+    if (!def)
+      continue;
+    if (!function_index.try_emplace(def->identifier_name.id(), functions.size())
+             .second)
+      ERROR(std::string(def->identifier_name.str()) + " is already defined");
+    FunctionInfo info;
+    info.def = def;
+    NameCollector names;
+    names.visit(def->rhs);
+    for (int32_t i = 0; i < def->num_of_params; i++) {
+      if (!info.locals.insert(def->params[i].id()).second)
+        ERROR(std::string(def->identifier_name.str()) +
+              " has two params named " + std::string(def->params[i].str()));
+    }
+    for (Symbol name : names.assigned) {
+      info.locals.insert(name.id());
+      info.assigned.insert(name.id());
+    }
+    for (Symbol name : names.read) {
+      if (!info.locals.count(name.id()) && top_assigned.count(name.id()))
+        globals.insert(name.id());
+    }
+    info.returns_value = ReturnFinder().visit(def->rhs);
+    functions.push_back(std::move(info));
+  }
+
+  // infer all specializations until nothing changes
+  Specialization &top_level = specs.emplace_back();
+  top_level.function = -1;
+  top_level.index = 0;
+  for (SymbolID name : top_assigned)
+    top_level.shapes.emplace(name, StaticShape());
+  do {
+    changed = false;
+    for (size_t i = 0; i < specs.size(); i++)
+      ShapeInference(*this, specs[i]).visit(body_of(specs[i]));
+  } while (changed);
+  find_recursion();
+  annotate();
+}
+
+std::string TypeInference::name_of(const Specialization &spec) const {
+  if (top_level(spec))
+    return "the top level";
+  return std::string(functions[spec.function].def->identifier_name.str());
+}
+
+StaticShape TypeInference::shape_of(const Specialization &spec,
+                                    Expr *expr) const {
+  auto it = spec.exprs.find(expr);
+  return it == spec.exprs.end() ? StaticShape() : it->second;
+}
+
+Specialization &TypeInference::specialize(int32_t function,
+                                          const std::vector<Shape> &params) {
+  std::vector<ShapeID> key;
+  for (const Shape &param : params)
+    key.push_back(param.id());
+  auto [it, inserted] = spec_index.try_emplace({function, key}, specs.size());
+  if (!inserted)
+    return specs[it->second];
+  FunctionInfo &info = functions[function];
+  if (++info.num_of_specializations > max_specializations)
+    ERROR(std::string(info.def->identifier_name.str()) +
+          " is called with too many shapes of arguments");
+  Specialization &spec = specs.emplace_back();
+  spec.function = function;
+  spec.index = specs.size() - 1;
+  spec.params = params;
+  for (SymbolID local : info.locals)
+    spec.shapes.emplace(local, StaticShape());
+  for (int32_t i = 0; i < info.def->num_of_params; i++)
+    spec.shapes[info.def->params[i].id()] = StaticShape::of(params[i]);
+  if (!info.returns_value)
+    spec.result = StaticShape::none();
+  changed = true;
+  return spec;
+}
+
+// A specialization is recursive if it is reachable from its callees
+void TypeInference::find_recursion() {
+  for (Specialization &spec : specs) {
+    std::vector<bool> seen(specs.size());
+    std::vector<size_t> stack;
+    for (auto &[call, callee] : spec.callees)
+      stack.push_back(callee);
+    while (!stack.empty() && !spec.recursive) {
+      const size_t next = stack.back();
+      stack.pop_back();
+      if (seen[next])
+        continue;
+      seen[next] = true;
+      spec.recursive = next == spec.index;
+      for (auto &[call, callee] : specs[next].callees)
+        stack.push_back(callee);
+    }
+  }
+}
+
+// An Expr has a shape if it has the same one in every specialization
+void TypeInference::annotate() {
+  std::unordered_map<Expr *, StaticShape> joined;
+  std::unordered_set<Expr *> polymorphic;
+  for (const Specialization &spec : specs) {
+    for (auto &[expr, shape] : spec.exprs) {
+      auto [it, inserted] = joined.try_emplace(expr, shape);
+      if (inserted || it->second == shape)
+        continue;
+      polymorphic.insert(expr);
+      if (!it->second.known())
+        it->second = shape;
+    }
+  }
+  for (auto &[expr, shape] : joined) {
+    if (!shape.known()) {
+      expr->set_type(tyUnknown);
+      expr->set_shape(Shape());
+      continue;
+    }
+    expr->set_type(shape.is_none() ? tyNone : tyFloat64);
+    expr->set_shape(shape.is_none() || polymorphic.count(expr) ? Shape()
+                                                               : shape.shape);
+  }
+}
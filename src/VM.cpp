@@ -0,0 +1,423 @@
+#include "../include/VM.h"
+#include "../include/Error.h"
+#include "../include/Kernels.h"
+#include <algorithm>
+#include <cstring>
+
+std::string Register::describe() const {
+  switch (kind) {
+  case rk_none:
+    return "none";
+  case rk_scala:
+    return "a scalar";
+  case rk_tensor:
+    return "a tensor of shape " + tensor.shape().str();
+  }
+  return "";
+}
+
+void Register::print(std::ostream &out) const {
+  switch (kind) {
+  case rk_none:
+    out << "none";
+    return;
+  case rk_scala:
+    out << scala;
+    return;
+  case rk_tensor:
+    tensor.print(out);
+    return;
+  }
+}
+
+// ${out} = ${lhs} ${op} ${rhs} for registers of any kind. ${out} may be one
+// of the operands, so the result is computed before it is written.
+static void binary(BinaryOpExpr::OP op, Register &out, const Register &lhs,
+                   const Register &rhs) {
+  if (op == BinaryOpExpr::matmul) {
+    if (lhs.kind != Register::rk_tensor || rhs.kind != Register::rk_tensor)
+      ERROR("Cannot apply @ to " + lhs.describe() + " and " + rhs.describe());
+    Tensor product = matmul(lhs.tensor, rhs.tensor);
+    if (product.rank() == 0)
+      out.set_scala(*product.data());
+    else
+      out.set_tensor(std::move(product));
+    return;
+  }
+  const bool lhs_number = lhs.is_number(), rhs_number = rhs.is_number();
+  if (lhs_number && rhs_number)
+    out.set_scala(apply(op, lhs.number(), rhs.number()));
+  else if (lhs_number && rhs.kind == Register::rk_tensor)
+    out.set_tensor(elementwise(op, lhs.number(), rhs.tensor));
+  else if (lhs.kind == Register::rk_tensor && rhs_number)
+    out.set_tensor(elementwise(op, lhs.tensor, rhs.number()));
+  else if (lhs.kind == Register::rk_tensor && rhs.kind == Register::rk_tensor)
+    out.set_tensor(elementwise(op, lhs.tensor, rhs.tensor));
+  else
+    ERROR(std::string("Cannot apply ") + op_name(op) + " to " +
+          lhs.describe() + " and " + rhs.describe());
+}
+
+// ${out} = ${fused} over the registers ${R}. If a tensor input does not have
+// the shape of the others, the ops are applied one by one instead, so the
+// error is the one of the op that fails.
+static void run_fused(const FusedExpr &fused, Register &out,
+                      const Register *R, std::vector<double> &scratch) {
+  const Fusion &fusion = fused.fusion;
+  std::vector<FusedInput> inputs(fused.inputs.size());
+  // the contiguous copies of the inputs that are strided views
+  std::vector<Tensor> packed;
+  packed.reserve(inputs.size());
+  const Tensor *shaped = nullptr;
+  bool compatible = true;
+  for (size_t i = 0; i < inputs.size(); i++) {
+    const Register &input = R[fused.inputs[i]];
+    if (input.is_number()) {
+      inputs[i].scala = input.number();
+    } else if (input.kind == Register::rk_tensor) {
+      if (input.tensor.is_contiguous()) {
+        inputs[i].data = input.tensor.data();
+      } else {
+        packed.push_back(input.tensor.clone());
+        inputs[i].data = packed.back().data();
+      }
+      if (!shaped)
+        shaped = &input.tensor;
+      else if (input.tensor.shape() != shaped->shape())
+        compatible = false;
+    } else {
+      compatible = false;
+    }
+  }
+  if (!shaped && compatible) {
+    out.set_scala(fusion.run(inputs.data()));
+    return;
+  }
+  if (compatible) {
+    Tensor result(shaped->shape());
+    if (scratch.size() < fusion.scratch_size())
+      scratch.resize(fusion.scratch_size());
+    fusion.run(inputs.data(), result.data(), result.num_of_elements(),
+               scratch.data());
+    out.set_tensor(std::move(result));
+    return;
+  }
+  std::vector<Register> stack;
+  for (const Fusion::Step &step : fusion.steps) {
+    if (step.kind == Fusion::Step::sk_input) {
+      stack.push_back(R[fused.inputs[step.index]]);
+    } else if (step.kind == Fusion::Step::sk_constant) {
+      stack.emplace_back().set_scala(step.constant_value);
+    } else {
+      Register rhs = std::move(stack.back());
+      stack.pop_back();
+      binary(BinaryOpExpr::OP(step.op), stack.back(), stack.back(), rhs);
+    }
+  }
+  out = std::move(stack.back());
+}
+
+// write ${value} into the elements ${ref} is a view of
+static void store(const Register &ref, const Register &value) {
+  ASSERT(ref.kind == Register::rk_tensor,
+         "Cannot write through " + ref.describe());
+  const Tensor &dest = ref.tensor;
+  if (value.is_number())
+    dest.fill(value.number());
+  else if (value.kind == Register::rk_tensor &&
+           value.tensor.shape() == dest.shape())
+    dest.assign(value.tensor);
+  else
+    ERROR("Cannot write " + value.describe() + " into " + ref.describe());
+}
+
+// ${out} = the view ${indexed} of its base over the registers ${R}
+static void run_index(const IndexedExpr &indexed, Register &out,
+                      const Register *R) {
+  const Register &base = R[indexed.base];
+  if (base.kind != Register::rk_tensor ||
+      base.tensor.rank() < int32_t(indexed.subscripts.size()))
+    ERROR("Cannot index " + base.describe() + " with " +
+          std::to_string(indexed.subscripts.size()) + " subscripts");
+  auto number = [&](uint16_t reg) {
+    if (!R[reg].is_number())
+      ERROR("Cannot index with " + R[reg].describe());
+    return R[reg].number();
+  };
+  Tensor view = base.tensor;
+  // the dim the next subscript applies to, the dims of indices are dropped
+  int32_t dim = 0;
+  for (const IndexedExpr::Subscript &subscript : indexed.subscripts) {
+    const int64_t n = view.shape()[dim];
+    if (!subscript.is_range) {
+      view = view.select(dim, index_of(number(subscript.begin), n));
+      continue;
+    }
+    const int64_t begin =
+        subscript.has_begin ? bound_of(number(subscript.begin), n) : 0;
+    const int64_t end =
+        subscript.has_end ? bound_of(number(subscript.end), n) : n;
+    check_range(begin, end);
+    view = view.slice(dim++, begin, end);
+  }
+  if (view.rank() == 0)
+    out.set_scala(*view.data());
+  else
+    out.set_tensor(std::move(view));
+}
+
+#if defined(__GNUC__)
+#define PIECK_COMPUTED_GOTO
+#endif
+
+#ifdef PIECK_COMPUTED_GOTO
+#define CASE(NAME) L_##NAME:
+#define DISPATCH() goto *labels[ip->op]
+#else
+#define CASE(NAME) case op_##NAME:
+#define DISPATCH() goto dispatch
+#endif
+
+Register VM::run(const Program &program) {
+  const Function *function = &program.functions[0];
+  stack.clear();
+  stack.resize(function->num_of_registers);
+  globals.clear();
+  globals.resize(program.globals.size());
+  frames.clear();
+  size_t base = 0;
+  Register *R = stack.data();
+  const Instruction *ip = function->code.data();
+
+  try {
+#ifdef PIECK_COMPUTED_GOTO
+    static const void *const labels[] = {
+#define PIECK_OPCODE_LABEL(NAME) &&L_##NAME,
+        PIECK_OPCODES(PIECK_OPCODE_LABEL)
+#undef PIECK_OPCODE_LABEL
+    };
+    DISPATCH();
+#else
+  dispatch:
+    switch (ip->op) {
+#endif
+
+    CASE(load_scala) {
+      R[ip->a].set_scala(program.scalas[ip->bc()]);
+      ip++;
+      DISPATCH();
+    }
+    CASE(load_tensor) {
+      const Tensor &constant = program.tensors[ip->bc()];
+      R[ip->a].set_tensor(ip->flag ? constant.clone() : constant);
+      ip++;
+      DISPATCH();
+    }
+    CASE(move) {
+      R[ip->a] = R[ip->b];
+      ip++;
+      DISPATCH();
+    }
+    CASE(get_global) {
+      R[ip->a] = globals[ip->bc()];
+      ip++;
+      DISPATCH();
+    }
+    CASE(set_global) {
+      globals[ip->bc()] = R[ip->a];
+      ip++;
+      DISPATCH();
+    }
+    CASE(add) {
+      binary(BinaryOpExpr::add, R[ip->a], R[ip->b], R[ip->c]);
+      ip++;
+      DISPATCH();
+    }
+    CASE(sub) {
+      binary(BinaryOpExpr::sub, R[ip->a], R[ip->b], R[ip->c]);
+      ip++;
+      DISPATCH();
+    }
+    CASE(mul) {
+      binary(BinaryOpExpr::mul, R[ip->a], R[ip->b], R[ip->c]);
+      ip++;
+      DISPATCH();
+    }
+    CASE(div) {
+      binary(BinaryOpExpr::div, R[ip->a], R[ip->b], R[ip->c]);
+      ip++;
+      DISPATCH();
+    }
+    CASE(add_ss) {
+      R[ip->a].set_scala(R[ip->b].scala + R[ip->c].scala);
+      ip++;
+      DISPATCH();
+    }
+    CASE(sub_ss) {
+      R[ip->a].set_scala(R[ip->b].scala - R[ip->c].scala);
+      ip++;
+      DISPATCH();
+    }
+    CASE(mul_ss) {
+      R[ip->a].set_scala(R[ip->b].scala * R[ip->c].scala);
+      ip++;
+      DISPATCH();
+    }
+    CASE(div_ss) {
+      R[ip->a].set_scala(R[ip->b].scala / R[ip->c].scala);
+      ip++;
+      DISPATCH();
+    }
+    CASE(matmul) {
+      binary(BinaryOpExpr::matmul, R[ip->a], R[ip->b], R[ip->c]);
+      ip++;
+      DISPATCH();
+    }
+    CASE(fused) {
+      run_fused(program.fusions[ip->bc()], R[ip->a], R, scratch);
+      ip++;
+      DISPATCH();
+    }
+    CASE(index) {
+      const IndexedExpr &indexed = program.indexings[ip->bc()];
+      run_index(indexed, R[ip->a], R);
+      ip++;
+      DISPATCH();
+    }
+    CASE(transpose) {
+      const Register &operand = R[ip->b];
+      if (operand.kind == Register::rk_tensor)
+        R[ip->a].set_tensor(operand.tensor.transpose());
+      else if (operand.kind == Register::rk_scala)
+        R[ip->a].set_scala(operand.scala);
+      else
+        ERROR("Cannot transpose " + operand.describe());
+      ip++;
+      DISPATCH();
+    }
+    CASE(store) {
+      store(R[ip->a], R[ip->b]);
+      ip++;
+      DISPATCH();
+    }
+    CASE(unique) {
+      Register &reg = R[ip->a];
+      if (reg.kind == Register::rk_tensor &&
+          (reg.tensor.is_view() || (!ip->flag && !reg.tensor.unique())))
+        reg.tensor = reg.tensor.clone();
+      ip++;
+      DISPATCH();
+    }
+    CASE(for_prep) {
+      // The state of the loop holds a view of the first sub-tensor in its
+      // tensor and the index of the next one in its scala, so the shape and
+      // the strides of the sub-tensors are made once per loop.
+      const Register &iterable = R[ip->a];
+      if (iterable.kind != Register::rk_tensor || iterable.tensor.rank() < 1)
+        ERROR("Cannot loop over " + iterable.describe());
+      Register &state = R[ip->a + 1];
+      state.kind = Register::rk_tensor;
+      state.tensor = iterable.tensor.shape()[0] > 0
+                         ? iterable.tensor.select(0, 0)
+                         : Tensor();
+      state.scala = 0;
+      ip++;
+      DISPATCH();
+    }
+    CASE(for_next) {
+      Register &iterable = R[ip->a];
+      Register &state = R[ip->a + 1];
+      const int64_t i = state.scala;
+      if (i == iterable.tensor.shape()[0]) {
+        // let go of the elements, then on to the jump out of the loop
+        iterable.clear();
+        state.clear();
+        ip++;
+        DISPATCH();
+      }
+      state.scala = i + 1;
+      // a view sees the writes through references to the iterable, so the
+      // Compiler only asks for one when the body makes none (see ViewFinder)
+      const Tensor &first = state.tensor;
+      const int64_t offset = i * iterable.tensor.stride(0);
+      Register &var = R[ip->b];
+      if (ip->flag != 1 && first.rank() == 0)
+        var.set_scala(first.data()[offset]);
+      else if (ip->flag)
+        var.set_tensor(first.shifted(offset));
+      else
+        var.set_tensor(first.shifted(offset).clone());
+      ip += 2;
+      DISPATCH();
+    }
+    CASE(jump) {
+      ip = function->code.data() + ip->bc();
+      DISPATCH();
+    }
+    CASE(call) {
+      const Function &callee = program.functions[ip->b];
+      if (frames.size() >= max_call_depth)
+        ERROR("The calls are nested too deeply");
+      const size_t callee_base = base + function->num_of_registers;
+      if (stack.size() < callee_base + callee.num_of_registers) {
+        stack.resize(std::max(callee_base + callee.num_of_registers,
+                              stack.size() * 2));
+        R = stack.data() + base;
+      }
+      Register *args = R + ip->c;
+      for (uint16_t i = 0; i < callee.num_of_params; i++)
+        stack[callee_base + i] = args[i];
+      frames.push_back({function, ip + 1, base, ip->a});
+      function = &callee;
+      base = callee_base;
+      R = stack.data() + base;
+      ip = function->code.data();
+      DISPATCH();
+    }
+    CASE(ret) {
+      Register value = std::move(R[ip->a]);
+      for (uint32_t i = 0; i < function->num_of_registers; i++)
+        R[i].clear();
+      if (frames.empty())
+        return value;
+      const Frame &caller = frames.back();
+      function = caller.function;
+      base = caller.base;
+      R = stack.data() + base;
+      R[caller.dest] = std::move(value);
+      ip = caller.ip;
+      frames.pop_back();
+      DISPATCH();
+    }
+    CASE(ret_none) {
+      for (uint32_t i = 0; i < function->num_of_registers; i++)
+        R[i].clear();
+      if (frames.empty())
+        return Register();
+      const Frame &caller = frames.back();
+      function = caller.function;
+      base = caller.base;
+      R = stack.data() + base;
+      R[caller.dest].clear();
+      ip = caller.ip;
+      frames.pop_back();
+      DISPATCH();
+    }
+    CASE(print) {
+      R[ip->a].print(out);
+      out << "\n";
+      ip++;
+      DISPATCH();
+    }
+
+#ifndef PIECK_COMPUTED_GOTO
+    }
+    ERROR("VM: unknown opcode.");
+#endif
+  } catch (std::logic_error &e) {
+    ERROR("In " +
+          (function->name.valid() ? std::string(function->name.str())
+                                  : std::string("the top level")) +
+          ": " + e.what());
+  }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "../include/Parser.h"
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// builds ASTs by hand, the parser does not read these stmts yet
+struct Builder {
+  Arena arena;
+  Scope scope;
+
+  Expr *num(const char *value) {
+    return arena.make<ValueExpr>(arena.make<ScalaValue>(value));
+  }
+  Expr *tensor(const char *literal) {
+    Parser parser("in_memory", SourceBuffer::from_string(
+                                   "def t = " + std::string(literal) + ";"));
+    DefVarStmt *def = static_cast<DefVarStmt *>(
+        static_cast<CompoundStmt *>(parser.parse())->cur());
+    Value *value = static_cast<ValueExpr *>(def->rhs)->val;
+    PackedTensorValue *packed = static_cast<PackedTensorValue *>(value);
+    PackedTensorValue *copy = PackedTensorValue::create(
+        arena, packed->shape().dims_dim(), packed->shape().dims());
+    std::copy(packed->data, packed->data + packed->num_of_elements(),
+              copy->data);
+    return arena.make<ValueExpr>(copy);
+  }
+  Expr *var(const char *name) { return arena.make<VarExpr>(name); }
+  Expr *op(Expr *lhs, BinaryOpExpr::OP op, Expr *rhs) {
+    return arena.make<BinaryOpExpr>(lhs, op, rhs);
+  }
+  Expr *call(const char *name, std::vector<Expr *> args) {
+    Expr **array = arena.allocate_array<Expr *>(args.size());
+    std::copy(args.begin(), args.end(), array);
+    return arena.make<CallExpr>(name, args.size(), array);
+  }
+  // ${base}[${subscripts}], see IndexExpr::Subscript for the subscripts
+  Expr *index(Expr *base, std::vector<IndexExpr::Subscript> subscripts) {
+    IndexExpr::Subscript *array =
+        arena.allocate_array<IndexExpr::Subscript>(subscripts.size());
+    std::copy(subscripts.begin(), subscripts.end(), array);
+    return arena.make<IndexExpr>(base, subscripts.size(), array);
+  }
+  // ${operand}.T
+  Expr *transpose(Expr *operand) {
+    return arena.make<TransposeExpr>(operand);
+  }
+  Stmt *def(const char *name, Expr *rhs) {
+    return arena.make<DefVarStmt>(scope, name, rhs);
+  }
+  Stmt *print(Expr *expr) { return arena.make<PrintStmt>(scope, expr); }
+  Stmt *ret(Expr *expr) { return arena.make<ReturnStmt>(scope, expr); }
+  Stmt *loop(const char *var, Expr *iterable, std::vector<Stmt *> body,
+             bool by_reference = false) {
+    return arena.make<LoopStmt>(scope, var, iterable, chain(body),
+                                by_reference);
+  }
+  Stmt *func(const char *name, std::vector<const char *> params,
+             std::vector<Stmt *> body) {
+    Symbol *array = arena.allocate_array<Symbol>(params.size());
+    for (size_t i = 0; i < params.size(); i++)
+      array[i] = Symbol(params[i]);
+    return arena.make<DefFuncStmt>(scope, name, block(body), params.size(),
+                                   array);
+  }
+  CompoundStmt *block(std::vector<Stmt *> stmts) {
+    return arena.make<CompoundStmt>(scope, chain(stmts));
+  }
+  StmtChain *chain(std::vector<Stmt *> stmts) {
+    StmtChain *head = arena.make<StmtChain>();
+    StmtChain *tail = head;
+    for (size_t i = 0; i < stmts.size(); i++) {
+      if (i == 0)
+        head->stmt = stmts[0];
+      else
+        tail = tail->add(arena, stmts[i]);
+    }
+    return head;
+  }
+};
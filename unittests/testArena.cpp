@@ -0,0 +1,56 @@
+#include "../include/Arena.h"
+#include "../include/Parser.h"
+#include <gtest/gtest.h>
+
+namespace {
+struct Counted {
+  Counted(int *destroyed) : destroyed(destroyed) {}
+  ~Counted() { (*destroyed)++; }
+  int *destroyed;
+};
+} // namespace
+
+TEST(TestArena, Allocate) {
+  Arena arena(1024);
+  char *c = static_cast<char *>(arena.allocate(1, 1));
+  double *d = arena.allocate_array<double>(3);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(d) % alignof(double), 0);
+  void *aligned = arena.allocate(8, 64);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(aligned) % 64, 0);
+  EXPECT_NE(static_cast<void *>(c), static_cast<void *>(d));
+  EXPECT_EQ(arena.stats().num_of_blocks, 1);
+  // an oversized request gets its own block and the current one is kept
+  char *big = static_cast<char *>(arena.allocate(4096, 8));
+  char *small = static_cast<char *>(arena.allocate(1, 1));
+  EXPECT_EQ(arena.stats().num_of_blocks, 2);
+  EXPECT_TRUE(small < big || small > big + 4096);
+  // small allocations that do not fit start a new block
+  for (int i = 0; i < 64; i++)
+    arena.allocate(64, 8);
+  EXPECT_GT(arena.stats().num_of_blocks, 2);
+  EXPECT_GE(arena.stats().bytes_reserved, arena.stats().bytes_allocated);
+  EXPECT_THROW(arena.allocate(8, 3), std::logic_error);
+}
+
+TEST(TestArena, Finalizers) {
+  int destroyed = 0;
+  {
+    Arena arena;
+    for (int i = 0; i < 10; i++)
+      arena.make<Counted>(&destroyed);
+    arena.make<int>(1);
+    EXPECT_EQ(arena.stats().num_of_objects, 11);
+    EXPECT_EQ(arena.stats().num_of_finalizers, 10);
+    EXPECT_EQ(destroyed, 0);
+  }
+  EXPECT_EQ(destroyed, 10);
+}
+
+TEST(TestArena, ParserOwnsTheAST) {
+  Parser parser("./codes/code_2.pieck");
+  EXPECT_EQ(parser.arena_stats().num_of_objects, 0);
+  parser.parse();
+  // the chain, the statement, its expression, value and the compound
+  EXPECT_EQ(parser.arena_stats().num_of_objects, 5);
+  EXPECT_NE(parser.arena_stats().str().find("objects: 5"), std::string::npos);
+}
@@ -0,0 +1,69 @@
+#include "../include/BatchDriver.h"
+#include <cstdio>
+#include <fstream>
+#include <gtest/gtest.h>
+
+static std::string write_module(const std::string &name,
+                                const std::string &text) {
+  std::string file_name = ::testing::TempDir() + name;
+  std::ofstream(file_name, std::ios::binary) << text;
+  std::remove(ModuleCache::path_of(file_name).c_str());
+  return file_name;
+}
+
+TEST(TestBatchDriver, SymbolTable) {
+  SymbolTable symbols;
+  EXPECT_EQ(symbols.add_modules({"a", "b"}), 0);
+  EXPECT_EQ(symbols.add_modules({"c"}), 2);
+  EXPECT_EQ(symbols.file_of(2), "c");
+  // the smallest module wins, whatever order the threads run in
+  ThreadPool pool(4);
+  pool.parallel_for(3000, [&](size_t i) {
+    symbols.define(Symbol("x" + std::to_string(i % 1000)),
+                   {uint32_t(2 - i / 1000), uint32_t(i), fk_def_var});
+  });
+  EXPECT_EQ(symbols.size(), 1000);
+  SymbolTable::Definition x5 = *symbols.lookup(Symbol("x5"));
+  EXPECT_EQ(x5.module, 0);
+  EXPECT_EQ(x5.node, 2005);
+  EXPECT_FALSE(symbols.lookup(Symbol("y")).has_value());
+}
+
+TEST(TestBatchDriver, Compile) {
+  std::vector<std::string> file_names;
+  for (int i = 0; i < 64; i++) {
+    std::string n = std::to_string(i);
+    file_names.push_back(write_module(
+        "batch_" + n + ".pieck",
+        "def a" + n + " = [" + n + ", 1];\ndef b" + n + " = " + n + ";\n"));
+  }
+  file_names.push_back(write_module("batch_broken.pieck", "def x = ,;\n"));
+  file_names.push_back(write_module("batch_twice.pieck", "def b3 = 1;\n"));
+
+  ThreadPool pool(4);
+  SymbolTable symbols;
+  BatchDriver driver(pool, symbols);
+  std::vector<ModuleResult> results = driver.compile(file_names);
+  ASSERT_EQ(results.size(), 66);
+  for (int i = 0; i < 64; i++) {
+    ASSERT_TRUE(results[i].ok()) << results[i].error;
+    EXPECT_EQ(results[i].file_name, file_names[i]);
+    EXPECT_EQ(results[i].ast.nodes.size(), 7);
+  }
+  EXPECT_NE(results[64].error.find("Line: 1"), std::string::npos);
+  EXPECT_EQ(results[65].error, "File: " + file_names[65] +
+                                   "\nb3 is already defined in " +
+                                   file_names[3]);
+  EXPECT_EQ(symbols.size(), 128);
+  SymbolTable::Definition a7 = *symbols.lookup(Symbol("a7"));
+  EXPECT_EQ(symbols.file_of(a7.module), file_names[7]);
+  EXPECT_EQ(results[7].ast.name_of(results[7].ast.nodes[a7.node]), "a7");
+
+  // the modules of an earlier batch come first
+  std::vector<ModuleResult> more = driver.compile(
+      {write_module("batch_more.pieck", "def a1 = 2;\ndef c = 3;\n")});
+  EXPECT_EQ(more[0].error, "File: " + ::testing::TempDir() +
+                               "batch_more.pieck\na1 is already defined in " +
+                               file_names[1]);
+  EXPECT_TRUE(symbols.lookup(Symbol("c")).has_value());
+}
@@ -0,0 +1,414 @@
+#include "../include/Codegen.h"
+#include "../include/Compiler.h"
+#include "../include/VM.h"
+#include "ASTBuilder.h"
+#include <cstdio>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <sstream>
+
+namespace {
+std::string jit(Arena &arena, CompoundStmt *module,
+                Codegen::OptLevel level = Codegen::O2) {
+  Codegen codegen(module, arena);
+  codegen.optimize(level);
+  std::ostringstream out;
+  codegen.run(out);
+  return out.str();
+}
+
+std::string interpret(Arena &arena, CompoundStmt *module) {
+  std::ostringstream out;
+  VM(out).run(Compiler::compile(module, arena));
+  return out.str();
+}
+
+std::string message(Arena &arena, CompoundStmt *module) {
+  try {
+    jit(arena, module);
+  } catch (std::logic_error &e) {
+    return e.what();
+  }
+  return "";
+}
+} // namespace
+
+TEST(TestCodegen, SameAsVM) {
+  Builder b;
+  CompoundStmt *module = b.block({
+      b.def("m", b.tensor("[[1, 2], [3, 4]]")),
+      b.print(b.op(b.var("m"), BinaryOpExpr::matmul, b.var("m"))),
+      b.print(b.op(b.op(b.var("m"), BinaryOpExpr::mul, b.num("2")),
+                   BinaryOpExpr::sub,
+                   b.op(b.var("m"), BinaryOpExpr::div, b.var("m")))),
+      b.print(b.op(b.tensor("[1, 2]"), BinaryOpExpr::matmul,
+                   b.tensor("[3, 4]"))),
+      b.print(b.op(b.tensor("[1, 1]"), BinaryOpExpr::matmul, b.var("m"))),
+      b.def("s", b.num("0")),
+      b.loop("row", b.var("m"),
+             {b.loop("e", b.var("row"),
+                     {b.def("s", b.op(b.var("s"), BinaryOpExpr::add,
+                                      b.var("e")))})}),
+      b.print(b.var("s")),
+      b.loop("row", b.var("m"),
+             {b.def("row", b.op(b.var("row"), BinaryOpExpr::mul,
+                                b.num("10")))},
+             true),
+      b.print(b.var("m")),
+      // called before its definition, reads the global scale
+      b.func("axpy", {"x", "y"},
+             {b.ret(b.op(b.op(b.var("x"), BinaryOpExpr::mul, b.var("scale")),
+                         BinaryOpExpr::add, b.var("y")))}),
+      b.def("scale", b.num("3")),
+      b.print(b.call("axpy", {b.tensor("[1, 2]"), b.num("1")})),
+      b.print(b.call("axpy", {b.var("scale"), b.num("1")})),
+      b.func("nothing", {}, {}),
+      b.print(b.call("nothing", {})),
+  });
+  const std::string expected = "[[7, 10], [15, 22]]\n"
+                               "[[1, 3], [5, 7]]\n"
+                               "11\n"
+                               "[4, 6]\n"
+                               "10\n"
+                               "[[10, 20], [30, 40]]\n"
+                               "[4, 7]\n"
+                               "10\n"
+                               "none\n";
+  EXPECT_EQ(interpret(b.arena, module), expected);
+  for (Codegen::OptLevel level : {Codegen::O0, Codegen::O2, Codegen::O3})
+    EXPECT_EQ(jit(b.arena, module, level), expected);
+
+  // the loops run over the elements the iterables had when they started
+  CompoundStmt *reassigned = b.block({
+      b.def("v", b.tensor("[1, 2, 3]")),
+      b.loop("e", b.var("v"),
+             {b.def("v", b.op(b.var("v"), BinaryOpExpr::mul, b.num("0"))),
+              b.print(b.var("e"))}),
+      b.def("m", b.tensor("[[1, 2], [3, 4]]")),
+      b.loop("r", b.var("m"),
+             {b.def("m", b.op(b.var("m"), BinaryOpExpr::mul, b.num("0"))),
+              b.print(b.var("r"))}),
+      b.def("m", b.tensor("[[1, 2], [3, 4]]")),
+      b.loop("r", b.var("m"),
+             {b.def("m", b.op(b.var("m"), BinaryOpExpr::mul, b.num("0"))),
+              b.def("r", b.op(b.var("r"), BinaryOpExpr::add, b.num("1"))),
+              b.print(b.var("r"))},
+             true),
+      b.print(b.var("m")),
+      // m is the tensor of the references until it is assigned
+      b.def("m", b.tensor("[[1, 2], [3, 4]]")),
+      b.loop("r", b.var("m"),
+             {b.def("r", b.op(b.var("r"), BinaryOpExpr::add, b.num("1"))),
+              b.def("m", b.op(b.var("m"), BinaryOpExpr::mul, b.num("2")))},
+             true),
+      b.print(b.var("m")),
+  });
+  const std::string snapshots = "1\n2\n3\n"
+                                "[1, 2]\n[3, 4]\n"
+                                "[2, 3]\n[4, 5]\n[[0, 0], [0, 0]]\n"
+                                "[[8, 12], [12, 16]]\n";
+  EXPECT_EQ(interpret(b.arena, reassigned), snapshots);
+  for (Codegen::OptLevel level : {Codegen::O0, Codegen::O2, Codegen::O3})
+    EXPECT_EQ(jit(b.arena, reassigned, level), snapshots);
+}
+
+TEST(TestCodegen, CallsIntoTheirArgs) {
+  Builder b;
+  BinaryOpExpr::OP matmul = BinaryOpExpr::matmul;
+  CompoundStmt *module = b.block({
+      // the result of sq must not be written over x, which sq reads
+      b.func("sq", {"p"}, {b.ret(b.op(b.var("p"), matmul, b.var("p")))}),
+      b.def("x", b.tensor("[[1, 2], [3, 4]]")),
+      b.def("x", b.call("sq", {b.var("x")})),
+      b.print(b.var("x")),
+      // nor the one of f over the global f reads
+      b.func("f", {}, {b.ret(b.op(b.var("g"), matmul, b.var("g")))}),
+      b.def("g", b.tensor("[[1, 2], [3, 4]]")),
+      b.def("g", b.call("f", {})),
+      b.print(b.var("g")),
+  });
+  const std::string expected = "[[7, 10], [15, 22]]\n"
+                               "[[7, 10], [15, 22]]\n";
+  EXPECT_EQ(interpret(b.arena, module), expected);
+  EXPECT_EQ(jit(b.arena, module), expected);
+}
+
+TEST(TestCodegen, LoopsAndReferences) {
+  Builder b;
+  BinaryOpExpr::OP mul = BinaryOpExpr::mul;
+  // r is bound before p is written, so it keeps the elements it had
+  CompoundStmt *cleared = b.block({
+      b.def("t", b.tensor("[[[1, 2], [3, 4]]]")),
+      b.loop("p", b.var("t"),
+             {b.loop("r", b.var("p"),
+                     {b.def("p", b.num("0")), b.print(b.var("r"))})},
+             true),
+  });
+  CompoundStmt *scaled = b.block({
+      b.def("t", b.tensor("[[[1, 2], [3, 4]]]")),
+      b.loop("p", b.var("t"),
+             {b.loop("r", b.var("p"),
+                     {b.def("p", b.op(b.var("p"), mul, b.num("10"))),
+                      b.print(b.var("r"))})},
+             true),
+  });
+  // the rows of m are read after the inner loop writes them
+  CompoundStmt *rewritten = b.block({
+      b.def("m", b.tensor("[[1, 2], [3, 4]]")),
+      b.loop("r", b.var("m"),
+             {b.loop("e", b.var("m"), {b.def("e", b.num("0"))}, true),
+              b.print(b.var("r"))}),
+  });
+  EXPECT_EQ(interpret(b.arena, cleared), "[1, 2]\n[0, 0]\n");
+  EXPECT_EQ(jit(b.arena, cleared), "[1, 2]\n[0, 0]\n");
+  EXPECT_EQ(interpret(b.arena, scaled), "[1, 2]\n[30, 40]\n");
+  EXPECT_EQ(jit(b.arena, scaled), "[1, 2]\n[30, 40]\n");
+  EXPECT_EQ(interpret(b.arena, rewritten), "[1, 2]\n[0, 0]\n");
+  EXPECT_EQ(jit(b.arena, rewritten), "[1, 2]\n[0, 0]\n");
+}
+
+TEST(TestCodegen, Vectorize) {
+  std::string ones = "[1";
+  for (int i = 1; i < 1024; i++)
+    ones += ", 1";
+  ones += "]";
+  Builder b;
+  CompoundStmt *module = b.block({
+      b.def("x", b.tensor(ones.c_str())),
+      b.def("y", b.op(b.op(b.var("x"), BinaryOpExpr::mul, b.var("x")),
+                      BinaryOpExpr::add, b.num("1"))),
+      b.print(b.op(b.var("y"), BinaryOpExpr::matmul, b.var("x"))),
+  });
+  Codegen codegen(module, b.arena);
+  codegen.optimize(Codegen::O3);
+  // the loop over the elements runs on vectors of doubles
+  EXPECT_NE(codegen.ir().find(" x double>"), std::string::npos);
+  std::ostringstream out;
+  codegen.run(out);
+  EXPECT_EQ(out.str(), "2048\n");
+
+  const std::string path = testing::TempDir() + "pieck_codegen.o";
+  codegen.emit_object(path);
+  std::ifstream object(path, std::ios::binary);
+  char magic[4] = {};
+  object.read(magic, 4);
+  EXPECT_EQ(std::string(magic, 4), "\x7f"
+                                   "ELF");
+  std::remove(path.c_str());
+}
+
+TEST(TestCodegen, MemoryPlan) {
+  Builder b;
+  CompoundStmt *module = b.block({
+      b.def("m", b.tensor("[[1, 2], [3, 4]]")),
+      b.def("a", b.op(b.var("m"), BinaryOpExpr::matmul, b.var("m"))),
+      b.def("b", b.op(b.var("a"), BinaryOpExpr::matmul, b.var("m"))),
+      b.def("c", b.op(b.var("b"), BinaryOpExpr::matmul, b.var("m"))),
+      b.print(b.var("c")),
+      b.def("acc", b.tensor("[0, 0]")),
+      b.loop("r", b.var("m"),
+             {b.def("t", b.op(b.var("r"), BinaryOpExpr::mul, b.num("2"))),
+              b.def("acc", b.op(b.var("acc"), BinaryOpExpr::add,
+                                b.var("t")))}),
+      b.print(b.var("acc")),
+  });
+  const std::string expected = "[[199, 290], [435, 634]]\n"
+                               "[8, 12]\n";
+  EXPECT_EQ(interpret(b.arena, module), expected);
+  EXPECT_EQ(jit(b.arena, module), expected);
+  // Seven buffers of 4 doubles (m, a, b, c and the products) fit in three:
+  // m lives until the loop, the others are dead two matmuls later. acc is
+  // read by the next iteration, t only lives in one, and r points into m.
+  EXPECT_EQ(Codegen(module, b.arena).buffer_bytes(), (3 * 4 + 2 * 2) * 8);
+}
+
+TEST(TestCodegen, Views) {
+  Builder b;
+  using S = IndexExpr::Subscript;
+  CompoundStmt *module = b.block({
+      b.def("x", b.tensor("[[1, 2, 3], [4, 5, 6]]")),
+      b.print(b.index(b.index(b.var("x"), {S::index(b.num("0"))}),
+                      {S::range(b.num("1"), nullptr)})),
+      b.print(b.index(b.var("x"), {S::range(nullptr, nullptr),
+                                   S::index(b.num("2"))})),
+      b.print(b.index(b.var("x"), {S::range(nullptr, nullptr),
+                                   S::range(b.num("1"), nullptr)})),
+      b.def("i", b.num("1")),
+      b.print(b.index(b.var("x"), {S::index(b.var("i")),
+                                   S::index(b.num("0"))})),
+      b.loop("e", b.index(b.var("x"), {S::range(nullptr, nullptr),
+                                       S::index(b.num("1"))}),
+             {b.def("e", b.op(b.var("e"), BinaryOpExpr::mul, b.num("10")))},
+             true),
+      b.print(b.var("x")),
+      // r points into x, as nothing writes x in the loop
+      b.def("acc", b.tensor("[0, 0, 0]")),
+      b.loop("r", b.var("x"),
+             {b.def("acc", b.op(b.var("acc"), BinaryOpExpr::add,
+                                b.var("r")))}),
+      b.print(b.var("acc")),
+  });
+  const std::string expected = "[2, 3]\n"
+                               "[3, 6]\n"
+                               "[[2, 3], [5, 6]]\n"
+                               "4\n"
+                               "[[1, 20, 3], [4, 50, 6]]\n"
+                               "[5, 70, 9]\n";
+  EXPECT_EQ(interpret(b.arena, module), expected);
+  EXPECT_EQ(jit(b.arena, module), expected);
+  // x, acc and the views x[~, 2] and x[~, 1~] gathered to print them, r has
+  // no buffer
+  EXPECT_EQ(Codegen(module, b.arena).buffer_bytes(), (6 + 3 + 2 + 4) * 8);
+
+  EXPECT_EQ(message(b.arena,
+                    b.block({b.def("i", b.num("2")),
+                             b.print(b.index(b.tensor("[1, 2]"),
+                                             {S::index(b.var("i"))}))})),
+            "In the top level: The index 2 is out of range for a dim of 2");
+  EXPECT_EQ(message(b.arena,
+                    b.block({b.def("n", b.num("1")),
+                             b.print(b.index(b.tensor("[1, 2]"),
+                                             {S::range(b.var("n"),
+                                                       nullptr)}))})),
+            "The bounds of a range must be literal numbers in the top level");
+}
+
+TEST(TestCodegen, Broadcast) {
+  Builder b;
+  using S = IndexExpr::Subscript;
+  CompoundStmt *module = b.block({
+      b.def("m", b.tensor("[[1, 2, 3], [4, 5, 6]]")),
+      b.def("bias", b.tensor("[10, 20, 30]")),
+      b.print(b.op(b.var("m"), BinaryOpExpr::add, b.var("bias"))),
+      b.print(b.op(b.tensor("[[1], [2]]"), BinaryOpExpr::mul,
+                   b.var("bias"))),
+      b.print(b.op(b.op(b.var("bias"), BinaryOpExpr::sub,
+                        b.op(b.var("m"), BinaryOpExpr::mul, b.num("2"))),
+                   BinaryOpExpr::add, b.num("1"))),
+      b.loop("row", b.var("m"),
+             {b.def("row", b.op(b.var("row"), BinaryOpExpr::add,
+                                b.var("bias")))},
+             true),
+      b.print(b.var("m")),
+      b.print(b.op(b.index(b.var("m"), {S::range(nullptr, nullptr),
+                                        S::range(nullptr, b.num("2"))}),
+                   BinaryOpExpr::add, b.tensor("[[1], [2]]"))),
+  });
+  const std::string expected = "[[11, 22, 33], [14, 25, 36]]\n"
+                               "[[10, 20, 30], [20, 40, 60]]\n"
+                               "[[9, 17, 25], [3, 11, 19]]\n"
+                               "[[11, 22, 33], [14, 25, 36]]\n"
+                               "[[12, 23], [16, 27]]\n";
+  EXPECT_EQ(interpret(b.arena, module), expected);
+  EXPECT_EQ(jit(b.arena, module), expected);
+
+  CompoundStmt *biased = b.block({
+      b.def("m", b.tensor("[[1, 2, 3], [4, 5, 6]]")),
+      b.def("bias", b.tensor("[10, 20, 30]")),
+      b.def("y", b.op(b.var("m"), BinaryOpExpr::add, b.var("bias"))),
+      b.print(b.var("y")),
+  });
+  // y is written over m, which dies there, and the bias row is read in
+  // place instead of being stretched into a copy of the size of m first
+  EXPECT_EQ(Codegen(biased, b.arena).buffer_bytes(), (6 + 3) * 8);
+
+  // m dies at y too, but its first row is read for every row of y
+  CompoundStmt *shifted = b.block({
+      b.def("m", b.tensor("[[1, 2], [3, 4]]")),
+      b.def("y", b.op(b.var("m"), BinaryOpExpr::add,
+                      b.index(b.var("m"), {S::index(b.num("0"))}))),
+      b.print(b.var("y")),
+  });
+  EXPECT_EQ(interpret(b.arena, shifted), "[[2, 4], [4, 6]]\n");
+  EXPECT_EQ(jit(b.arena, shifted), "[[2, 4], [4, 6]]\n");
+}
+
+TEST(TestCodegen, Transpose) {
+  Builder b;
+  using S = IndexExpr::Subscript;
+  BinaryOpExpr::OP matmul = BinaryOpExpr::matmul, add = BinaryOpExpr::add;
+  CompoundStmt *module = b.block({
+      b.def("x", b.tensor("[[1, 2, 3], [4, 5, 6]]")),
+      b.def("a", b.tensor("[[1, 1], [0, 1]]")),
+      b.def("y", b.tensor("[[10, 20], [30, 40], [50, 60]]")),
+      b.print(b.transpose(b.var("x"))),
+      b.print(b.op(b.transpose(b.var("x")), matmul, b.var("a"))),
+      b.print(b.op(b.var("x"), matmul, b.transpose(b.var("x")))),
+      b.print(b.op(b.transpose(b.var("x")), matmul,
+                   b.transpose(b.var("y")))),
+      b.print(b.op(b.transpose(b.var("x")), matmul, b.tensor("[1, 1]"))),
+      b.print(b.op(b.tensor("[1, 1, 1]"), matmul, b.transpose(b.var("x")))),
+      b.print(b.op(b.transpose(b.var("x")), add, b.var("y"))),
+      b.print(b.index(b.transpose(b.var("x")), {S::index(b.num("0"))})),
+      b.def("acc", b.tensor("[0, 0]")),
+      b.loop("r", b.transpose(b.var("x")),
+             {b.def("acc", b.op(b.var("acc"), add, b.var("r")))}),
+      b.print(b.var("acc")),
+      b.def("s", b.num("2")),
+      b.print(b.transpose(b.var("s"))),
+      b.print(b.transpose(b.tensor("[1, 2]"))),
+      // every element of sq is read before it is written
+      b.def("sq", b.tensor("[[1, 2], [3, 4]]")),
+      b.def("sq", b.op(b.transpose(b.var("sq")), add, b.var("sq"))),
+      b.print(b.var("sq")),
+      b.func("f", {"m"}, {b.ret(b.op(b.transpose(b.var("m")), add,
+                                     b.num("1")))}),
+      b.def("t", b.tensor("[[1, 2], [3, 4]]")),
+      b.def("t", b.call("f", {b.var("t")})),
+      b.print(b.var("t")),
+  });
+  const std::string expected = "[[1, 4], [2, 5], [3, 6]]\n"
+                               "[[1, 5], [2, 7], [3, 9]]\n"
+                               "[[14, 32], [32, 77]]\n"
+                               "[[90, 190, 290], [120, 260, 400], "
+                               "[150, 330, 510]]\n"
+                               "[5, 7, 9]\n"
+                               "[6, 15]\n"
+                               "[[11, 24], [32, 45], [53, 66]]\n"
+                               "[1, 4]\n"
+                               "[6, 15]\n"
+                               "2\n"
+                               "[1, 2]\n"
+                               "[[2, 5], [5, 8]]\n"
+                               "[[2, 4], [3, 5]]\n";
+  EXPECT_EQ(interpret(b.arena, module), expected);
+  EXPECT_EQ(jit(b.arena, module), expected);
+
+  CompoundStmt *transposed = b.block({
+      b.def("x", b.tensor("[[1, 2, 3], [4, 5, 6]]")),
+      b.def("a", b.tensor("[[1, 1], [0, 1]]")),
+      b.def("y", b.tensor("[[10, 20], [30, 40], [50, 60]]")),
+      b.print(b.op(b.transpose(b.var("x")), matmul, b.var("a"))),
+      b.print(b.op(b.transpose(b.var("x")), add, b.var("y"))),
+      b.print(b.var("x")),
+  });
+  // x, a, y and one buffer for both results: x.T is read in place by the
+  // matmul and by the sum, it is never copied
+  EXPECT_EQ(Codegen(transposed, b.arena).buffer_bytes(), (6 + 4 + 6 + 6) * 8);
+}
+
+TEST(TestCodegen, Errors) {
+  Builder b;
+  EXPECT_EQ(message(b.arena, b.block({b.print(b.var("x"))})),
+            "x is not defined");
+  EXPECT_EQ(message(b.arena, b.block({b.print(b.op(b.tensor("[1, 2]"),
+                                                   BinaryOpExpr::add,
+                                                   b.tensor("[1, 2, 3]")))})),
+            "Cannot apply + to tensors of shapes (2) and (3)");
+  EXPECT_EQ(message(b.arena, b.block({b.def("x", b.num("1")),
+                                      b.def("x", b.tensor("[1, 2]"))})),
+            "x is assigned both a scalar and a tensor of shape (2), the "
+            "shape of a variable must not change");
+  EXPECT_EQ(message(b.arena, b.block({b.loop("i", b.num("1"), {})})),
+            "Cannot loop over a scalar");
+  // f returns none, and calls itself forever
+  EXPECT_EQ(message(b.arena,
+                    b.block({b.func("f", {}, {b.print(b.call("f", {}))}),
+                             b.print(b.call("f", {}))})),
+            "In f: The calls are nested too deeply");
+  // the global is read before it is assigned
+  EXPECT_EQ(message(b.arena, b.block({b.func("f", {}, {b.ret(b.var("g"))}),
+                                      b.print(b.call("f", {})),
+                                      b.def("g", b.num("1"))})),
+            "In f: g is read before it is assigned");
+}
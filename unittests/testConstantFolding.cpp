@@ -0,0 +1,100 @@
+#include "../include/Casting.h"
+#include "../include/Codegen.h"
+#include "../include/Compiler.h"
+#include "../include/ConstantFolding.h"
+#include "../include/VM.h"
+#include "ASTBuilder.h"
+#include <gtest/gtest.h>
+#include <sstream>
+
+namespace {
+std::string run(Arena &arena, CompoundStmt *module) {
+  std::ostringstream out;
+  VM(out).run(Compiler::compile(module, arena));
+  return out.str();
+}
+
+// the rhs of the ${i}th stmt of ${module}, which is a DefVarStmt
+Expr *rhs_of(CompoundStmt *module, int32_t i) {
+  StmtChain *link = module->stmts();
+  while (i--)
+    link = link->next;
+  return cast<DefVarStmt>(link->stmt)->rhs;
+}
+} // namespace
+
+TEST(TestConstantFolding, Fold) {
+  Builder b;
+  using S = IndexExpr::Subscript;
+  Expr *partial =
+      b.op(b.var("x"), BinaryOpExpr::add,
+           b.op(b.num("2"), BinaryOpExpr::mul, b.num("3")));
+  Expr *mismatch = b.op(b.tensor("[1, 2]"), BinaryOpExpr::add,
+                        b.tensor("[1, 2, 3]"));
+  Stmt *ret = b.ret(mismatch);
+  CompoundStmt *module = b.block({
+      b.def("a", b.op(b.op(b.tensor("[1, 2]"), BinaryOpExpr::mul,
+                           b.num("2")),
+                      BinaryOpExpr::add, b.tensor("[3, 4]"))),
+      b.def("m", b.op(b.tensor("[[1, 2], [3, 4]]"), BinaryOpExpr::matmul,
+                      b.tensor("[[0, 1], [1, 0]]"))),
+      b.def("v", b.op(b.tensor("[1, 2]"), BinaryOpExpr::matmul,
+                      b.tensor("[3, 4]"))),
+      b.def("r", b.index(b.tensor("[[1, 2, 3], [4, 5, 6]]"),
+                         {S::index(b.num("1")),
+                          S::range(b.num("1"), nullptr)})),
+      b.def("x", b.num("1")),
+      b.def("y", partial),
+      b.def("t", b.transpose(b.tensor("[[1, 2], [3, 4]]"))),
+      b.func("f", {}, {ret}),
+      b.print(b.var("a")),
+      b.print(b.var("m")),
+      b.print(b.var("v")),
+      b.print(b.var("r")),
+      b.print(b.var("y")),
+      b.print(b.var("t")),
+  });
+  EXPECT_EQ(ConstantFolding::fold(module, b.arena), 7);
+
+  ValueExpr *a = dyn_cast<ValueExpr>(rhs_of(module, 0));
+  ASSERT_TRUE(a);
+  ASSERT_TRUE(isa<PackedTensorValue>(a->val));
+  EXPECT_EQ(a->shape().str(), "(2)");
+  EXPECT_EQ(cast<PackedTensorValue>(a->val)->data[1], 8);
+  ValueExpr *v = dyn_cast<ValueExpr>(rhs_of(module, 2));
+  ASSERT_TRUE(v);
+  ASSERT_TRUE(isa<ScalaValue>(v->val));
+  EXPECT_EQ(cast<ScalaValue>(v->val)->val, 11);
+  // only the constant operand of y is folded
+  EXPECT_EQ(rhs_of(module, 5), partial);
+  EXPECT_TRUE(isa<ValueExpr>(cast<BinaryOpExpr>(partial)->rhs));
+  // the shapes disagree, the error is left to the code that runs it
+  EXPECT_EQ(cast<ReturnStmt>(ret)->expr, mismatch);
+
+  EXPECT_EQ(run(b.arena, module), "[5, 8]\n"
+                         "[[2, 1], [4, 3]]\n"
+                         "11\n"
+                         "[5, 6]\n"
+                         "7\n"
+                         "[[1, 3], [2, 4]]\n");
+  // nothing is left to fold
+  EXPECT_EQ(ConstantFolding::fold(module, b.arena), 0);
+}
+
+TEST(TestConstantFolding, Backends) {
+  // ASTs that did not come from the Parser are folded by the backends
+  Builder b;
+  CompoundStmt *module = b.block({
+      b.print(b.op(b.op(b.num("2"), BinaryOpExpr::mul, b.num("3")),
+                   BinaryOpExpr::add, b.num("1"))),
+  });
+  Program program = Compiler::compile(module, b.arena);
+  EXPECT_EQ(program.disassemble().find("_ss"), std::string::npos);
+  EXPECT_EQ(program.scalas, std::vector<double>{7});
+
+  Expr *product = b.op(b.tensor("[1, 2]"), BinaryOpExpr::mul, b.num("2"));
+  Stmt *print = b.print(product);
+  // the product would need a buffer, its value is a constant
+  EXPECT_EQ(Codegen(b.block({print}), b.arena).buffer_bytes(), 0);
+  EXPECT_TRUE(isa<ValueExpr>(cast<PrintStmt>(print)->expr));
+}
@@ -0,0 +1,168 @@
+#include "../include/Casting.h"
+#include "../include/Compiler.h"
+#include "../include/FlatAST.h"
+#include "../include/Parser.h"
+#include "../include/VM.h"
+#include "ASTBuilder.h"
+#include <gtest/gtest.h>
+#include <sstream>
+
+TEST(TestFlatAST, Flatten) {
+  Parser parser("in_memory",
+                SourceBuffer::from_string("def x = [[1, 2], [3, 4]];\n"
+                                          "def y = 5;\n"
+                                          "def x = 6;\n"));
+  FlatAST flat = FlatAST::flatten(cast<CompoundStmt>(parser.parse()));
+  // compound, then def, value expr and value for each stmt
+  ASSERT_EQ(flat.nodes.size(), 10);
+  const FlatNode &root = flat.root();
+  EXPECT_EQ(root.kind, fk_compound);
+  std::span<const uint32_t> stmts = flat.children_of(root);
+  ASSERT_EQ(stmts.size(), 3);
+  // pre-order
+  EXPECT_EQ(stmts[0], 1);
+  EXPECT_EQ(stmts[1], 4);
+  EXPECT_EQ(stmts[2], 7);
+
+  const FlatNode &def_x = flat.nodes[stmts[0]];
+  EXPECT_EQ(def_x.kind, fk_def_var);
+  EXPECT_EQ(flat.name_of(def_x), "x");
+  const FlatNode &value_expr = flat.nodes[flat.children_of(def_x)[0]];
+  EXPECT_EQ(value_expr.kind, fk_value);
+  const FlatNode &tensor = flat.nodes[flat.children_of(value_expr)[0]];
+  EXPECT_EQ(tensor.kind, fk_tensor);
+  int32_t dims[2] = {2, 2};
+  EXPECT_EQ(flat.shape_of(tensor), Shape(2, dims));
+  const double *data = flat.data_of(tensor);
+  EXPECT_EQ(data[0], 1);
+  EXPECT_EQ(data[3], 4);
+
+  const FlatNode &y = flat.nodes[flat.children_of(flat.nodes[stmts[1]])[0]];
+  const FlatNode &five = flat.nodes[flat.children_of(y)[0]];
+  EXPECT_EQ(five.kind, fk_scala);
+  EXPECT_EQ(flat.shape_of(five), Shape::scala());
+  EXPECT_EQ(*flat.data_of(five), 5);
+
+  // names and scopes are stored once
+  EXPECT_EQ(flat.names.size(), 2);
+  EXPECT_EQ(flat.name_of(flat.nodes[stmts[2]]), "x");
+  EXPECT_EQ(flat.scopes.size(), 1);
+}
+
+TEST(TestFlatAST, TreeNodes) {
+  Arena arena;
+  Scope scope;
+  scope.push("f");
+  Value *one = arena.make<ScalaValue>("1");
+  Value *row[3] = {one, one, one};
+  Value *rows[2] = {arena.make<TensorValue>(3, row),
+                    arena.make<TensorValue>(3, row)};
+  Expr *tensor = arena.make<ValueExpr>(arena.make<TensorValue>(2, rows));
+  Expr *sum = arena.make<BinaryOpExpr>(arena.make<VarExpr>("y"),
+                                       BinaryOpExpr::matmul, tensor);
+  StmtChain *chain = arena.make<StmtChain>(arena.make<PrintStmt>(scope, sum));
+  chain->add(arena, arena.make<ReturnStmt>(scope, arena.make<CallExpr>("g")));
+  FlatAST flat = FlatAST::flatten(arena.make<CompoundStmt>(scope, chain));
+
+  // compound, print, +, var, value expr, tensor, return, call
+  ASSERT_EQ(flat.nodes.size(), 8);
+  const FlatNode &op = flat.nodes[2];
+  EXPECT_EQ(op.kind, fk_binary_op);
+  EXPECT_EQ(op.op, BinaryOpExpr::matmul);
+  EXPECT_EQ(flat.name_of(flat.nodes[flat.children_of(op)[0]]), "y");
+  const FlatNode &packed = flat.nodes[5];
+  EXPECT_EQ(packed.kind, fk_tensor);
+  int32_t dims[2] = {2, 3};
+  EXPECT_EQ(flat.shape_of(packed), Shape(2, dims));
+  EXPECT_EQ(flat.constants.size(), 6);
+  EXPECT_EQ(flat.nodes[6].kind, fk_return);
+  EXPECT_EQ(flat.name_of(flat.nodes[7]), "g");
+  const FlatScope &f = flat.scopes[flat.nodes[6].scope];
+  ASSERT_EQ(f.count, 1);
+  EXPECT_EQ(flat.string(flat.scope_names[f.first]), "f");
+
+  // the encoding holds no pointers, a copy is as good as the original
+  FlatAST copy = flat;
+  EXPECT_EQ(copy.name_of(copy.nodes[7]), "g");
+  EXPECT_EQ(copy.data_of(copy.nodes[5])[5], 1);
+}
+
+TEST(TestFlatAST, LoopsAndCalls) {
+  Arena arena;
+  Scope scope;
+  Expr *args[2] = {arena.make<VarExpr>("i"), arena.make<VarExpr>("i")};
+  StmtChain *body =
+      arena.make<StmtChain>(arena.make<PrintStmt>(scope, arena.make<CallExpr>(
+                                                             "f", 2, args)));
+  StmtChain *chain = arena.make<StmtChain>(
+      arena.make<LoopStmt>(scope, "i", arena.make<VarExpr>("x"), body, true));
+  Symbol params[1] = {Symbol("a")};
+  CompoundStmt *empty =
+      arena.make<CompoundStmt>(scope, arena.make<StmtChain>());
+  chain->add(arena, arena.make<DefFuncStmt>(scope, "f", empty, 1, params));
+  FlatAST flat = FlatAST::flatten(arena.make<CompoundStmt>(scope, chain));
+
+  // compound, loop, var x, print, call, var i, var i, def, var a, compound
+  ASSERT_EQ(flat.nodes.size(), 10);
+  const FlatNode &loop = flat.nodes[1];
+  EXPECT_EQ(loop.kind, fk_loop);
+  EXPECT_EQ(flat.name_of(loop), "i");
+  EXPECT_EQ(loop.op, 1);
+  ASSERT_EQ(flat.children_of(loop).size(), 2);
+  EXPECT_EQ(flat.name_of(flat.nodes[flat.children_of(loop)[0]]), "x");
+  EXPECT_EQ(flat.children_of(flat.nodes[4]).size(), 2);
+  const FlatNode &def = flat.nodes[7];
+  ASSERT_EQ(flat.children_of(def).size(), 2);
+  EXPECT_EQ(flat.name_of(flat.nodes[flat.children_of(def)[0]]), "a");
+  EXPECT_EQ(flat.nodes[flat.children_of(def)[1]].kind, fk_compound);
+}
+
+TEST(TestFlatAST, Expand) {
+  Builder b;
+  using S = IndexExpr::Subscript;
+  CompoundStmt *module = b.block({
+      b.func("f", {"a", "b"},
+             {b.loop("r", b.var("a"),
+                     {b.def("r", b.op(b.var("r"), BinaryOpExpr::mul,
+                                      b.var("b")))},
+                     true),
+              b.ret(b.index(b.var("a"), {S::range(nullptr, b.num("2")),
+                                         S::index(b.num("1"))}))}),
+      b.func("nothing", {}, {b.ret(nullptr)}),
+      b.def("m", b.tensor("[[1, 2, 3], [4, 5, 6], [7, 8, 9]]")),
+      b.print(b.call("f", {b.var("m"), b.num("10")})),
+      b.print(b.op(b.transpose(b.var("m")), BinaryOpExpr::matmul,
+                   b.var("m"))),
+      b.print(b.call("nothing", {})),
+  });
+  FlatAST flat = FlatAST::flatten(module);
+  Arena arena;
+  CompoundStmt *expanded = FlatAST::expand(flat.view(), arena);
+
+  // the expanded AST flattens to the same arrays
+  FlatAST again = FlatAST::flatten(expanded);
+  ASSERT_EQ(again.nodes.size(), flat.nodes.size());
+  for (size_t i = 0; i < flat.nodes.size(); i++) {
+    const FlatNode &lhs = flat.nodes[i], &rhs = again.nodes[i];
+    EXPECT_EQ(lhs.kind, rhs.kind);
+    EXPECT_EQ(lhs.op, rhs.op);
+    EXPECT_EQ(lhs.type, rhs.type);
+    EXPECT_EQ(lhs.scope, rhs.scope);
+    EXPECT_EQ(lhs.a, rhs.a);
+    EXPECT_EQ(lhs.first, rhs.first);
+    EXPECT_EQ(lhs.count, rhs.count);
+  }
+  EXPECT_EQ(again.children, flat.children);
+  EXPECT_EQ(again.strings, flat.strings);
+  EXPECT_EQ(again.scope_names, flat.scope_names);
+  EXPECT_EQ(again.constants, flat.constants);
+  EXPECT_EQ(again.dims, flat.dims);
+
+  // and runs the same
+  auto run = [](CompoundStmt *module, Arena &arena) {
+    std::ostringstream out;
+    VM(out).run(Compiler::compile(module, arena));
+    return out.str();
+  };
+  EXPECT_EQ(run(expanded, arena), run(module, b.arena));
+}
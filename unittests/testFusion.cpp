@@ -0,0 +1,69 @@
+#include "../include/Fusion.h"
+#include <gtest/gtest.h>
+#include <vector>
+
+TEST(TestFusion, Build) {
+  Arena arena;
+  auto var = [&](const char *name) -> Expr * {
+    return arena.make<VarExpr>(name);
+  };
+  auto op = [&](Expr *lhs, BinaryOpExpr::OP op, Expr *rhs) {
+    return arena.make<BinaryOpExpr>(lhs, op, rhs);
+  };
+  Expr *product = op(var("a"), BinaryOpExpr::matmul, var("b"));
+  // (a * b + a) - (a @ b) / 2
+  BinaryOpExpr *root =
+      op(op(op(var("a"), BinaryOpExpr::mul, var("b")), BinaryOpExpr::add,
+            var("a")),
+         BinaryOpExpr::sub,
+         op(product, BinaryOpExpr::div,
+            arena.make<ValueExpr>(arena.make<ScalaValue>("2"))));
+  EXPECT_EQ(Fusion::num_of_ops(root), 4);
+  EXPECT_EQ(Fusion::num_of_ops(product), 0);
+
+  std::vector<Expr *> inputs;
+  Fusion fusion = Fusion::of(root, inputs);
+  // a is read once, @ is a leaf
+  ASSERT_EQ(inputs.size(), 3u);
+  EXPECT_EQ(inputs[2], product);
+  EXPECT_EQ(fusion.num_of_inputs, 3);
+  EXPECT_EQ(fusion.str(), "(((in0 * in1) + in0) - (in2 / 2))");
+  EXPECT_EQ(fusion.depth, 3);
+}
+
+TEST(TestFusion, Run) {
+  Arena arena;
+  auto var = [&](const char *name) -> Expr * {
+    return arena.make<VarExpr>(name);
+  };
+  // x * y + z * x - s
+  BinaryOpExpr *root = arena.make<BinaryOpExpr>(
+      arena.make<BinaryOpExpr>(
+          arena.make<BinaryOpExpr>(var("x"), BinaryOpExpr::mul, var("y")),
+          BinaryOpExpr::add,
+          arena.make<BinaryOpExpr>(var("z"), BinaryOpExpr::mul, var("x"))),
+      BinaryOpExpr::sub, var("s"));
+  std::vector<Expr *> leaves;
+  Fusion fusion = Fusion::of(root, leaves);
+  ASSERT_EQ(fusion.num_of_inputs, 4);
+
+  // partial blocks on both sides of block_size
+  for (int64_t n : {int64_t(1), Fusion::block_size - 1, Fusion::block_size,
+                    3 * Fusion::block_size + 7}) {
+    std::vector<double> x(n), y(n), z(n), out(n);
+    for (int64_t i = 0; i < n; i++) {
+      x[i] = i;
+      y[i] = 0.5 * i;
+      z[i] = 3 - i;
+    }
+    FusedInput inputs[4] = {{x.data()}, {y.data()}, {z.data()}, {nullptr, 2}};
+    std::vector<double> scratch(fusion.scratch_size());
+    fusion.run(inputs, out.data(), n, scratch.data());
+    for (int64_t i = 0; i < n; i++)
+      ASSERT_DOUBLE_EQ(out[i], x[i] * y[i] + z[i] * x[i] - 2) << i;
+  }
+
+  FusedInput scalas[4] = {{nullptr, 2}, {nullptr, 3}, {nullptr, 4},
+                          {nullptr, 1}};
+  EXPECT_DOUBLE_EQ(fusion.run(scalas), 13);
+}
@@ -0,0 +1,128 @@
+#include "../include/Casting.h"
+#include "../include/FlatAST.h"
+#include "../include/IncrementalParser.h"
+#include <gtest/gtest.h>
+#include <random>
+
+TEST(TestIncrementalParser, Segmenter) {
+  std::string code = "def x = 1;\n"
+                     "def f (x):\n"
+                     "  x += 1;\n"
+                     "  return x;;\n"
+                     "print \"a;b\"; def y = 2;;\n"
+                     "\n";
+  std::vector<SourceRange> ranges = Segmenter::split(code);
+  ASSERT_EQ(ranges.size(), 4);
+  EXPECT_EQ(code.substr(ranges[0].begin, ranges[0].end - ranges[0].begin),
+            "def x = 1;");
+  EXPECT_EQ(ranges[1].line, 1);
+  EXPECT_EQ(code.substr(ranges[1].end - 10, 10), "return x;;");
+  EXPECT_EQ(ranges[2].line, 4);
+  EXPECT_EQ(code.substr(ranges[2].end - 12, 12), "print \"a;b\";");
+  EXPECT_EQ(ranges[3].line, 5);
+  EXPECT_EQ(ranges[3].end, code.size() - 2);
+}
+
+TEST(TestIncrementalParser, RangeErrorLocation) {
+  std::string code = "def x = 1;\n\ndef y = 2; def z = ,;";
+  std::vector<SourceRange> ranges = Segmenter::split(code);
+  ASSERT_EQ(ranges.size(), 3);
+  Parser parser("in_memory", SourceBuffer::borrow(code), ranges[2]);
+  try {
+    parser.parse();
+    FAIL();
+  } catch (const std::logic_error &e) {
+    EXPECT_EQ(std::string(e.what()),
+              "File: in_memory, Line: 3\n"
+              "def y = 2; def z = ,;\n"
+              "                   ^ Expected a number, a tensor or an "
+              "identifier");
+  }
+}
+
+// the values of the variables defined in ${ast}, in order
+static std::vector<std::pair<std::string, double>> values_of(Stmt *ast) {
+  FlatAST flat = FlatAST::flatten(cast<CompoundStmt>(ast));
+  std::vector<std::pair<std::string, double>> values;
+  for (uint32_t stmt : flat.children_of(flat.root())) {
+    const FlatNode &def = flat.nodes[stmt];
+    const FlatNode &expr = flat.nodes[flat.children_of(def)[0]];
+    const FlatNode &value = flat.nodes[flat.children_of(expr)[0]];
+    values.push_back({std::string(flat.name_of(def)), *flat.data_of(value)});
+  }
+  return values;
+}
+
+TEST(TestIncrementalParser, Edits) {
+  std::string code;
+  for (int i = 0; i < 1000; i++)
+    code += "def v" + std::to_string(i) + " = [" + std::to_string(i) + "];\n";
+  IncrementalParser incremental("in_memory", code);
+  EXPECT_EQ(incremental.num_of_stmts(), 1000);
+  Stmt *kept = incremental.ast()->stmts()->next->stmt;
+
+  // change the value of v500 only
+  uint32_t offset = incremental.text().find("[500]") + 1;
+  incremental.apply({{offset, 3, "-7.5"}});
+  EXPECT_EQ(incremental.num_of_reparsed(), 1);
+  EXPECT_EQ(incremental.num_of_stmts(), 1000);
+  EXPECT_EQ(incremental.ast()->stmts()->next->stmt, kept);
+  auto values = values_of(incremental.ast());
+  EXPECT_EQ(values[500], std::make_pair(std::string("v500"), -7.5));
+  EXPECT_EQ(values[501], std::make_pair(std::string("v501"), 501.0));
+
+  // split a statement, append one and remove the first one
+  offset = incremental.text().find("def v10 ");
+  incremental.apply({{offset, 0, "def a = 1; "},
+                     {(uint32_t)incremental.text().size(), 0, "def b = 2;"},
+                     {0, (uint32_t)incremental.text().find("def v1 "), ""}});
+  EXPECT_EQ(incremental.num_of_stmts(), 1001);
+  values = values_of(incremental.ast());
+  EXPECT_EQ(values.front().first, "v1");
+  EXPECT_EQ(values[9].first, "a");
+  EXPECT_EQ(values[10].first, "v10");
+  EXPECT_EQ(values.back(), std::make_pair(std::string("b"), 2.0));
+
+  // a broken edit changes nothing, and is located in the whole text
+  std::string text = incremental.text();
+  offset = text.find("[3]");
+  try {
+    incremental.apply({{offset, 3, ","}});
+    FAIL();
+  } catch (const std::logic_error &e) {
+    EXPECT_EQ(std::string(e.what()).substr(0, 26),
+              "File: in_memory, Line: 3\nd");
+  }
+  EXPECT_EQ(incremental.text(), text);
+  EXPECT_EQ(values_of(incremental.ast()), values);
+}
+
+TEST(TestIncrementalParser, SameAsFullParse) {
+  std::mt19937 random(42);
+  std::string code;
+  for (int i = 0; i < 50; i++)
+    code += "def v" + std::to_string(i) + " = " + std::to_string(i) + ";\n";
+  IncrementalParser incremental("in_memory", code);
+  const std::vector<std::string> pieces = {
+      "def w = 1;", ";", "\n", " ", "def u = [2, 3];\n", "",
+      "def f (x):\n", "return x;;", "print \"a;\";"};
+  for (int round = 0; round < 200; round++) {
+    // replace a whole statement, or insert a piece between two statements
+    std::string text = incremental.text();
+    std::vector<SourceRange> ranges = Segmenter::split(text);
+    TextEdit edit;
+    if (ranges.empty() || random() % 2) {
+      edit.offset = ranges.empty() ? 0 : ranges[random() % ranges.size()].end;
+      edit.length = 0;
+      edit.text = pieces[random() % pieces.size()];
+    } else {
+      SourceRange range = ranges[random() % ranges.size()];
+      edit.offset = range.begin;
+      edit.length = range.end - range.begin;
+      edit.text = pieces[random() % pieces.size()];
+    }
+    incremental.apply({edit});
+    Parser parser("in_memory", SourceBuffer::from_string(incremental.text()));
+    ASSERT_EQ(values_of(incremental.ast()), values_of(parser.parse()));
+  }
+}
@@ -0,0 +1,151 @@
+#include "../include/Lexer.h"
+#include <gtest/gtest.h>
+
+TEST(TestLexer, SourceBuffer) {
+  SourceBuffer mapped("./codes/code_2.pieck");
+  EXPECT_TRUE(mapped.is_mapped());
+  EXPECT_EQ(mapped.view(), "def x = 1;");
+  SourceBuffer moved = std::move(mapped);
+  EXPECT_EQ(moved.view(), "def x = 1;");
+  EXPECT_EQ(mapped.size(), 0);
+
+  SourceBuffer in_memory = SourceBuffer::from_string("x");
+  EXPECT_FALSE(in_memory.is_mapped());
+  SourceBuffer moved_in_memory = std::move(in_memory);
+  EXPECT_EQ(moved_in_memory.view(), "x");
+  EXPECT_THROW(SourceBuffer("./codes/no_such_file.pieck"), std::logic_error);
+}
+
+TEST(TestLexer, TokensAreViews) {
+  Lexer lexer(FileLocation("./codes/code_2.pieck", 0, 0));
+  std::vector<std::string_view> tokens;
+  std::vector<TokenKind> kinds;
+  while (lexer.nextToken()) {
+    tokens.push_back(lexer.get_token());
+    kinds.push_back(lexer.get_kind());
+  }
+  std::vector<std::string_view> expected = {"def", "x", "=", "1", ";"};
+  EXPECT_EQ(tokens, expected);
+  EXPECT_EQ(kinds, std::vector<TokenKind>({tk_keyword, tk_identifier,
+                                           tk_punctuation, tk_number,
+                                           tk_punctuation}));
+  // "x" and "1" point into the same mapped line
+  EXPECT_EQ(tokens[3].data() - tokens[1].data(), 4);
+}
+
+TEST(TestLexer, Keywords) {
+  for (std::string_view keyword : keywords) {
+    EXPECT_TRUE(is_keyword(keyword));
+  }
+  EXPECT_FALSE(is_keyword("define"));
+  EXPECT_FALSE(is_keyword("prints"));
+  EXPECT_FALSE(is_keyword("le"));
+  EXPECT_FALSE(is_keyword("x"));
+}
+
+TEST(TestLexer, Code1) {
+  Lexer lexer(FileLocation("./codes/code_1.pieck", 0, 0));
+  std::vector<std::string_view> tokens;
+  while (lexer.nextToken()) {
+    tokens.push_back(lexer.get_token());
+  }
+  std::vector<std::string_view> expected = {
+      "def", "f", "(",   "x", ")", ":",     "x", "+=", "1", ";",
+      "return", "x", "for", "i", "in", "[", "1", "~", "2", "]",
+      ":",   "print", "f", "(", "1", ")", ";"};
+  EXPECT_EQ(tokens, expected);
+  EXPECT_EQ(lexer.file_loc.line, 6);
+}
+
+TEST(TestLexer, NumbersAndPunctuations) {
+  Lexer lexer(FileLocation("./codes/code_3.pieck", 0, 0));
+  std::vector<std::string_view> tokens;
+  std::vector<TokenKind> kinds;
+  while (lexer.nextToken()) {
+    tokens.push_back(lexer.get_token());
+    kinds.push_back(lexer.get_kind());
+  }
+  std::vector<std::string_view> expected = {
+      "def", "y",  "=",  "[",  "[",  "12", ",",  "3.5", "]", ",",
+      "[",   ".25", ",", "4",  "]",  "]",  ";",  "y",   ".T", "@=",
+      "y",   ";;", "s",  "=",  "\"a b\"", ";"};
+  EXPECT_EQ(tokens, expected);
+  EXPECT_EQ(kinds[5], tk_number);
+  EXPECT_EQ(kinds[11], tk_number);
+  EXPECT_EQ(kinds[18], tk_punctuation);
+  EXPECT_EQ(kinds[24], tk_string);
+}
+
+TEST(TestLexer, TokenStream) {
+  Lexer lexer(FileLocation("./codes/code_1.pieck", 0, 0));
+  TokenStream tokens(lexer);
+  EXPECT_EQ(tokens.text(tokens.peek(3)), "x");
+  EXPECT_EQ(tokens.text(tokens.peek(7)), "+=");
+  EXPECT_THROW(tokens.peek(TokenStream::lookahead), std::logic_error);
+  EXPECT_TRUE(tokens.next_is(tk_keyword, "def"));
+  Token def = tokens.next();
+  EXPECT_EQ(def.kind, tk_keyword);
+  EXPECT_EQ(def.line, 1);
+  EXPECT_EQ(def.col, 0);
+  // the ring buffer wraps around many times
+  size_t n = 1;
+  Token last = def;
+  while (tokens.peek().kind != tk_eof) {
+    last = tokens.next();
+    n++;
+  }
+  EXPECT_EQ(n, 27);
+  EXPECT_EQ(tokens.text(last), ";");
+  EXPECT_EQ(last.line, 6);
+  EXPECT_EQ(last.col, 12);
+  // tk_eof is sticky
+  EXPECT_EQ(tokens.next().kind, tk_eof);
+  EXPECT_EQ(tokens.peek(5).kind, tk_eof);
+}
+
+TEST(TestLexer, ReportAtToken) {
+  Lexer lexer(FileLocation("./codes/code_1.pieck", 0, 0));
+  TokenStream tokens(lexer);
+  // return x
+  for (int i = 0; i < 10; i++)
+    tokens.next();
+  Token ret = tokens.next();
+  tokens.peek(4);
+  try {
+    tokens.report(ret, "here");
+    FAIL();
+  } catch (std::logic_error &e) {
+    EXPECT_EQ(std::string(e.what()),
+              "File: ./codes/code_1.pieck, Line: 3\n  return x\n  ^ here");
+  }
+}
+
+TEST(TestLexer, ScanKernels) {
+  // random characters drawn mostly from the classes the kernels care about
+  const std::string alphabet = "  \t\r\n09az AZ_,.;\"'\x80\xff";
+  std::string text;
+  unsigned seed = 42;
+  for (int i = 0; i < 4096; i++) {
+    seed = seed * 1103515245 + 12345;
+    // long runs of the same character
+    text.append((seed >> 8) % 40, alphabet[(seed >> 16) % alphabet.size()]);
+  }
+  const char *begin = text.data(), *end = text.data() + text.size();
+  std::vector<const ScanKernels *> kernels = available_scan_kernels();
+  ASSERT_EQ(std::string(kernels[0]->name), "scalar");
+  EXPECT_EQ(&scan_kernels(), kernels.back());
+  const ScanKernels &scalar = *kernels[0];
+  for (const ScanKernels *kernel : kernels) {
+    for (const char *p = begin; p < end; p++) {
+      ASSERT_EQ(kernel->skip_spaces(p, end), scalar.skip_spaces(p, end))
+          << kernel->name;
+      ASSERT_EQ(kernel->skip_alnum(p, end), scalar.skip_alnum(p, end))
+          << kernel->name;
+      ASSERT_EQ(kernel->skip_digits(p, end), scalar.skip_digits(p, end))
+          << kernel->name;
+      ASSERT_EQ(kernel->find_string_end(p, end, '"'),
+                scalar.find_string_end(p, end, '"'))
+          << kernel->name;
+    }
+  }
+}
@@ -0,0 +1,117 @@
+#include "../include/Kernels.h"
+#include "../include/MatMul.h"
+#include <gtest/gtest.h>
+#include <random>
+#include <vector>
+
+// c = a @ b by definition
+static std::vector<double> reference(const std::vector<double> &a,
+                                     const std::vector<double> &b, int64_t m,
+                                     int64_t n, int64_t k) {
+  std::vector<double> c(m * n);
+  for (int64_t i = 0; i < m; i++) {
+    for (int64_t j = 0; j < n; j++) {
+      double sum = 0;
+      for (int64_t p = 0; p < k; p++)
+        sum += a[i * k + p] * b[p * n + j];
+      c[i * n + j] = sum;
+    }
+  }
+  return c;
+}
+
+// the (${rows}, ${cols}) row-major matrix ${x} as the variant of a product
+// stores it, the rows of its transpose if ${transposed}
+static std::vector<double> stored(const std::vector<double> &x, int64_t rows,
+                                  int64_t cols, bool transposed) {
+  if (!transposed)
+    return x;
+  std::vector<double> t(x.size());
+  for (int64_t i = 0; i < rows; i++) {
+    for (int64_t j = 0; j < cols; j++)
+      t[j * rows + i] = x[i * cols + j];
+  }
+  return t;
+}
+
+static const MatMul::Variant variants[] = {MatMul::mm_nn, MatMul::mm_nt,
+                                           MatMul::mm_tn, MatMul::mm_tt};
+
+TEST(TestMatMul, Kernels) {
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<double> dist(-1, 1);
+  // edges of every tile size, and blocks larger than kc and mc
+  const int64_t shapes[][3] = {{1, 1, 1},    {5, 7, 3},     {6, 8, 256},
+                               {13, 17, 300}, {75, 9, 257}, {150, 33, 520}};
+  for (MatMul::ISA isa :
+       {MatMul::isa_scalar, MatMul::isa_sse2, MatMul::isa_avx2}) {
+    if (!MatMul::supported(isa))
+      continue;
+    for (const auto &shape : shapes) {
+      const int64_t m = shape[0], n = shape[1], k = shape[2];
+      std::vector<double> a(m * k), b(k * n), c(m * n, -1);
+      for (double &x : a)
+        x = dist(gen);
+      for (double &x : b)
+        x = dist(gen);
+      std::vector<double> expected = reference(a, b, m, n, k);
+      for (MatMul::Variant variant : variants) {
+        std::vector<double> left =
+            stored(a, m, k, MatMul::transposes_left(variant));
+        std::vector<double> right =
+            stored(b, k, n, MatMul::transposes_right(variant));
+        MatMul::gemm(isa, variant, left.data(), right.data(), c.data(), m, n,
+                     k);
+        for (int64_t i = 0; i < m * n; i++)
+          ASSERT_NEAR(c[i], expected[i], 1e-10)
+              << MatMul::name(isa) << " " << MatMul::name(variant) << " "
+              << m << "x" << n << "x" << k;
+      }
+    }
+  }
+  EXPECT_TRUE(MatMul::supported(MatMul::best()));
+}
+
+TEST(TestMatMul, Plans) {
+  int32_t matrix[2] = {300, 200}, square[2] = {200, 200}, small[2] = {4, 4};
+  int32_t vector[1] = {200};
+  EXPECT_EQ(MatMul::plan(Shape(1, vector), Shape(1, vector)).method,
+            MatMul::mm_dot);
+  EXPECT_EQ(MatMul::plan(Shape(2, matrix), Shape(1, vector)).method,
+            MatMul::mm_matvec);
+  EXPECT_EQ(MatMul::plan(Shape(1, vector), Shape(2, square)).method,
+            MatMul::mm_vecmat);
+  EXPECT_EQ(MatMul::plan(Shape(2, small), Shape(2, small)).method,
+            MatMul::mm_direct);
+  MatMul::Plan plan = MatMul::plan(Shape(2, matrix), Shape(2, square));
+  EXPECT_EQ(plan.method, MatMul::mm_blocked);
+  EXPECT_EQ(plan.shape, Shape(2, matrix));
+  EXPECT_EQ(MatMul::plan(Shape(1, vector), Shape(1, vector)).shape,
+            Shape::scala());
+  EXPECT_THROW(MatMul::plan(Shape(2, matrix), Shape(2, matrix)),
+               std::logic_error);
+
+  // every plan agrees with the definition
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<double> dist(-1, 1);
+  for (auto [m, n, k] : std::vector<std::tuple<int64_t, int64_t, int64_t>>{
+           {1, 1, 50}, {40, 1, 50}, {1, 40, 50}, {3, 5, 7}, {64, 64, 64}}) {
+    std::vector<double> a(m * k), b(k * n), c(m * n);
+    for (double &x : a)
+      x = dist(gen);
+    for (double &x : b)
+      x = dist(gen);
+    std::vector<double> expected = reference(a, b, m, n, k);
+    for (MatMul::Variant variant : variants) {
+      const bool left_transposed = MatMul::transposes_left(variant);
+      const bool right_transposed = MatMul::transposes_right(variant);
+      std::vector<double> left = stored(a, m, k, left_transposed);
+      std::vector<double> right = stored(b, k, n, right_transposed);
+      matmul(left.data(), right.data(), c.data(), m, n, k, left_transposed,
+             right_transposed);
+      for (int64_t i = 0; i < m * n; i++)
+        ASSERT_NEAR(c[i], expected[i], 1e-10)
+            << MatMul::name(variant) << " " << m << "x" << n << "x" << k;
+    }
+  }
+}
@@ -0,0 +1,65 @@
+#include "../include/MemoryPlanner.h"
+#include <gtest/gtest.h>
+
+TEST(TestMemoryPlanner, Share) {
+  MemoryPlanner planner;
+  auto a = planner.add_buffer(8), b = planner.add_buffer(8),
+       c = planner.add_buffer(8), d = planner.add_buffer(4);
+  // b = a @ a: b is written while a is read
+  planner.tick();
+  planner.def(a, true);
+  planner.tick();
+  planner.use(a);
+  planner.def(b, false);
+  // c = b * 2: c may be written over b
+  planner.tick();
+  planner.use(b);
+  planner.def(c, true);
+  // d is smaller, so it never takes the slot of a
+  planner.tick();
+  planner.def(d, true);
+  planner.use(c);
+  MemoryPlanner::Plan plan = planner.plan();
+  EXPECT_NE(plan.slot_of[a], plan.slot_of[b]);
+  EXPECT_EQ(plan.slot_of[b], plan.slot_of[c]);
+  EXPECT_EQ(plan.slot_sizes[plan.slot_of[d]], 4);
+  EXPECT_EQ(plan.num_of_elements(), 8 + 8 + 4);
+}
+
+TEST(TestMemoryPlanner, Loops) {
+  MemoryPlanner planner;
+  auto before = planner.add_buffer(2), carried = planner.add_buffer(2),
+       local = planner.add_buffer(2), after = planner.add_buffer(2);
+  planner.tick();
+  planner.def(before, false);
+  planner.tick();
+  planner.use(before);
+  planner.enter_loop(3);
+  // carried is read before it is written, local only lives in an iteration
+  planner.tick();
+  planner.use(carried);
+  planner.def(local, false);
+  planner.tick();
+  planner.use(local);
+  planner.def(carried, true);
+  planner.leave_loop();
+  planner.tick();
+  planner.def(after, false);
+  MemoryPlanner::Plan plan = planner.plan();
+  EXPECT_NE(plan.slot_of[carried], plan.slot_of[local]);
+  EXPECT_EQ(plan.num_of_elements(), 4);
+
+  // a loop that never runs leaves the value of before it
+  MemoryPlanner empty;
+  auto value = empty.add_buffer(2), other = empty.add_buffer(2);
+  empty.tick();
+  empty.def(value, false);
+  empty.enter_loop(0);
+  empty.tick();
+  empty.def(value, false);
+  empty.leave_loop();
+  empty.tick();
+  empty.use(value);
+  empty.def(other, false);
+  EXPECT_EQ(empty.plan().num_of_elements(), 4);
+}
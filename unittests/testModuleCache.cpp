@@ -0,0 +1,193 @@
+#include "../include/Casting.h"
+#include "../include/ModuleCache.h"
+#include "../include/Parser.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <thread>
+
+static std::string write_source(const std::string &name,
+                                const std::string &text) {
+  std::string file_name = ::testing::TempDir() + name;
+  std::ofstream(file_name, std::ios::binary) << text;
+  std::remove(ModuleCache::path_of(file_name).c_str());
+  return file_name;
+}
+
+TEST(TestModuleCache, RoundTrip) {
+  std::string code = "def x = [[1, 2, 3], [4, 5, 6]];\ndef y = 7;\n";
+  std::string file_name = write_source("round_trip.pieck", code);
+  std::string cache_file = ModuleCache::path_of(file_name);
+  {
+    Parser parser(file_name);
+    FlatView ast = parser.parse_module();
+    EXPECT_EQ(ast.nodes.size(), 7);
+  }
+  ModuleCache cache;
+  ASSERT_TRUE(cache.load(cache_file, code));
+  const FlatView &ast = cache.ast();
+  ASSERT_EQ(ast.nodes.size(), 7);
+  EXPECT_EQ(ast.root().kind, fk_compound);
+  const FlatNode &def_x = ast.nodes[ast.children_of(ast.root())[0]];
+  EXPECT_EQ(ast.name_of(def_x), "x");
+  const FlatNode &tensor = ast.nodes[3];
+  int32_t dims[2] = {2, 3};
+  EXPECT_EQ(ast.shape_of(tensor), Shape(2, dims));
+  EXPECT_EQ(ast.data_of(tensor)[5], 6);
+  EXPECT_EQ(*ast.data_of(ast.nodes[6]), 7);
+  // the elements are read in place from the mapping
+  EXPECT_EQ((uintptr_t)ast.constants.data() % 64, 0);
+
+  // a valid cache is mapped without building an AST
+  Parser parser(file_name);
+  EXPECT_EQ(parser.parse_module().nodes.size(), 7);
+  EXPECT_EQ(parser.arena_stats().num_of_objects, 0);
+}
+
+TEST(TestModuleCache, StaleCache) {
+  std::string file_name = write_source("stale.pieck", "def x = 1;\n");
+  std::string cache_file = ModuleCache::path_of(file_name);
+  Parser(file_name).parse_module();
+  ModuleCache cache;
+  EXPECT_FALSE(cache.load(cache_file, "def x = 2;\n"));
+  EXPECT_FALSE(cache.load(cache_file, "def x = 1;;\n"));
+  EXPECT_FALSE(cache.loaded());
+
+  // the source changed, it is parsed again and the cache rewritten
+  std::ofstream(file_name, std::ios::binary) << "def x = 2;\n";
+  Parser parser(file_name);
+  FlatView ast = parser.parse_module();
+  EXPECT_GT(parser.arena_stats().num_of_objects, 0);
+  EXPECT_EQ(*ast.data_of(ast.nodes[3]), 2);
+  EXPECT_TRUE(cache.load(cache_file, "def x = 2;\n"));
+}
+
+TEST(TestModuleCache, CorruptCache) {
+  std::string code = "def x = [1, 2];\n";
+  std::string file_name = write_source("corrupt.pieck", code);
+  std::string cache_file = ModuleCache::path_of(file_name);
+  ModuleCache cache;
+  EXPECT_FALSE(cache.load(cache_file, code));
+  Parser(file_name).parse_module();
+  ASSERT_TRUE(cache.load(cache_file, code));
+
+  // a truncated cache is rejected, not read past its end
+  std::string bytes;
+  {
+    std::ifstream in(cache_file, std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(in), {});
+  }
+  std::ofstream(cache_file, std::ios::binary) << bytes.substr(0, 200);
+  EXPECT_FALSE(cache.load(cache_file, code));
+  std::ofstream(cache_file, std::ios::binary) << "not a cache";
+  EXPECT_FALSE(cache.load(cache_file, code));
+}
+
+TEST(TestModuleCache, CorruptRecords) {
+  std::string code = "def x = [1, 2];\ndef y = 7;\n";
+  std::string file_name = write_source("records.pieck", code);
+  std::string cache_file = ModuleCache::path_of(file_name);
+  Parser(file_name).parse_module();
+  std::string bytes;
+  {
+    std::ifstream in(cache_file, std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(in), {});
+  }
+  // the offsets of the sections of nodes and children in the header
+  uint64_t nodes, children;
+  std::memcpy(&nodes, bytes.data() + 32, 8);
+  std::memcpy(&children, bytes.data() + 48, 8);
+
+  // the header is intact, the records are not
+  auto corrupt = [&](uint64_t offset, uint32_t value) {
+    std::string corrupted = bytes;
+    std::memcpy(corrupted.data() + offset, &value, sizeof(value));
+    std::ofstream(cache_file, std::ios::binary) << corrupted;
+    ModuleCache cache;
+    EXPECT_FALSE(cache.load(cache_file, code));
+
+    // the module is parsed again and the cache rewritten
+    Parser parser(file_name);
+    FlatView ast = parser.parse_module();
+    EXPECT_GT(parser.arena_stats().num_of_objects, 0);
+    ASSERT_EQ(ast.nodes.size(), 7);
+    const FlatNode &def_y = ast.nodes[ast.children_of(ast.root())[1]];
+    EXPECT_EQ(ast.name_of(def_y), "y");
+    EXPECT_TRUE(cache.load(cache_file, code));
+  };
+  // the root is its own child
+  corrupt(children, 0);
+  // a child past the last node
+  corrupt(children, 1000);
+  // a node of no kind
+  corrupt(nodes + sizeof(FlatNode), 0xff);
+  // a name past the names
+  corrupt(nodes + sizeof(FlatNode) + offsetof(FlatNode, a), 1000);
+  // elements past the constants
+  corrupt(nodes + 3 * sizeof(FlatNode) + offsetof(FlatNode, first), 1000);
+}
+
+TEST(TestModuleCache, ParseFromCache) {
+  std::string code = "def x = [[1, 2], [3, 4]];\ndef y = 7;\n";
+  std::string file_name = write_source("parse.pieck", code);
+  auto check = [](Stmt *root) {
+    CompoundStmt *module = cast<CompoundStmt>(root);
+    DefVarStmt *x = cast<DefVarStmt>(module->stmts()->stmt);
+    EXPECT_EQ(x->identifier_name, "x");
+    PackedTensorValue *tensor =
+        cast<PackedTensorValue>(cast<ValueExpr>(x->rhs)->val);
+    int32_t dims[2] = {2, 2};
+    EXPECT_EQ(tensor->shape(), Shape(2, dims));
+    EXPECT_EQ(tensor->data[3], 4);
+    DefVarStmt *y = cast<DefVarStmt>(module->stmts()->next->stmt);
+    EXPECT_EQ(cast<ScalaValue>(cast<ValueExpr>(y->rhs)->val)->val, 7);
+  };
+  // the first parse writes the cache, the second builds the AST from it
+  check(Parser(file_name).parse());
+  ModuleCache cache;
+  EXPECT_TRUE(cache.load(ModuleCache::path_of(file_name), code));
+  check(Parser(file_name).parse());
+
+  // the source is not even lexed: a cache written for a source that does
+  // not parse is used as it is
+  std::string broken = "def x = ;\n";
+  std::string broken_file = write_source("broken.pieck", broken);
+  Parser parser(file_name);
+  FlatAST flat = FlatAST::flatten(cast<CompoundStmt>(parser.parse()));
+  ASSERT_TRUE(ModuleCache::write(ModuleCache::path_of(broken_file),
+                                 flat.view(), broken));
+  check(Parser(broken_file).parse());
+  std::remove(ModuleCache::path_of(broken_file).c_str());
+  EXPECT_THROW(Parser(broken_file).parse(), std::logic_error);
+}
+
+TEST(TestModuleCache, ConcurrentWriters) {
+  std::string code = "def x = [1, 2];\n";
+  std::string file_name = write_source("concurrent.pieck", code);
+  std::string cache_file = ModuleCache::path_of(file_name);
+  FlatAST flat = FlatAST::flatten(
+      cast<CompoundStmt>(Parser("in_memory", SourceBuffer::from_string(code))
+                             .parse()));
+  // every thread writes a temporary file of its own
+  std::vector<std::thread> writers;
+  std::atomic<int32_t> failures = 0;
+  for (int32_t i = 0; i < 8; i++)
+    writers.emplace_back([&] {
+      for (int32_t j = 0; j < 20; j++)
+        failures += !ModuleCache::write(cache_file, flat.view(), code);
+    });
+  for (std::thread &writer : writers)
+    writer.join();
+  EXPECT_EQ(failures, 0);
+  ModuleCache cache;
+  EXPECT_TRUE(cache.load(cache_file, code));
+  // and no temporary file is left behind
+  for (const auto &entry :
+       std::filesystem::directory_iterator(::testing::TempDir()))
+    EXPECT_EQ(entry.path().string().find(cache_file + "."), std::string::npos);
+}
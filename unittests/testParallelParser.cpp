@@ -0,0 +1,71 @@
+#include "../include/Casting.h"
+#include "../include/FlatAST.h"
+#include "../include/ParallelParser.h"
+#include <gtest/gtest.h>
+
+// the kinds, names and constants of ${ast} in pre-order
+static std::string dump(CompoundStmt *ast) {
+  FlatAST flat = FlatAST::flatten(ast);
+  std::string text;
+  for (const FlatNode &node : flat.nodes) {
+    text += std::to_string(node.kind);
+    if (node.kind == fk_def_var || node.kind == fk_var)
+      text += std::string(flat.name_of(node));
+    text += " ";
+  }
+  for (double constant : flat.constants)
+    text += std::to_string(constant) + " ";
+  return text;
+}
+
+static std::string make_source(int num_of_stmts) {
+  std::string code;
+  for (int i = 0; i < num_of_stmts; i++) {
+    std::string n = std::to_string(i);
+    switch (i % 4) {
+    case 0:
+      code += "def v" + n + " = " + n + ";\n";
+      break;
+    case 1:
+      code += "def t" + n + " = [[" + n + ", 1], [2, " + n + "]]; ";
+      break;
+    case 2:
+      code += "def f" + n + " (x):\n  x += 1;\n  def w = " + n + ";\n;;\n";
+      break;
+    default:
+      code += "print \"a;b\";\n";
+    }
+  }
+  return code;
+}
+
+TEST(TestParallelParser, SameAsSequential) {
+  std::string code = make_source(1000);
+  ThreadPool pool(4);
+  ParallelParser parallel("in_memory", SourceBuffer::from_string(code), pool);
+  CompoundStmt *ast = parallel.parse(/*min_chunk_size*/ 256);
+  EXPECT_GT(parallel.num_of_chunks(), 4);
+  Parser sequential("in_memory", SourceBuffer::from_string(code));
+  EXPECT_EQ(dump(ast), dump(cast<CompoundStmt>(sequential.parse())));
+}
+
+TEST(TestParallelParser, ErrorLocation) {
+  // two broken statements far apart, the first one is reported
+  std::string code = make_source(500) + "def x = ,;\n" + make_source(500) +
+                     "def y = [1, 2;\n";
+  std::string expected;
+  try {
+    Parser("in_memory", SourceBuffer::from_string(code)).parse();
+  } catch (const std::logic_error &e) {
+    expected = e.what();
+  }
+  ASSERT_NE(expected.find("Line: "), std::string::npos);
+  ThreadPool pool(4);
+  ParallelParser parallel("in_memory", SourceBuffer::from_string(code), pool);
+  try {
+    parallel.parse(/*min_chunk_size*/ 256);
+    FAIL();
+  } catch (const std::logic_error &e) {
+    EXPECT_EQ(std::string(e.what()), expected);
+  }
+}
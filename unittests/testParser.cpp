@@ -1,3 +1,5 @@
+#include "../include/ASTVisitor.h"
+#include "../include/Casting.h"
 #include "../include/Parser.h"
 #include <gtest/gtest.h>
 
@@ -36,4 +38,177 @@ TEST(TestParser, build_DefVarStmt_1) {
       dynamic_cast<ValueExpr *>(dynamic_cast<DefVarStmt *>(c_stmt->cur())->rhs);
   EXPECT_EQ(dynamic_cast<ScalaValue *>(ve->val)->val, 1.0);
   EXPECT_EQ(ve->type(), tyFloat64);
-}
\ No newline at end of file
+}
+TEST(TestParser, ErrorLocation) {
+  Parser parser("in_memory", SourceBuffer::from_string("\ndef x = ,;"));
+  try {
+    parser.parse();
+    FAIL();
+  } catch (std::logic_error &e) {
+    EXPECT_NE(std::string(e.what()).find("Line: 2\n"), std::string::npos);
+    EXPECT_NE(std::string(e.what()).find("\n        ^ Expected a number"),
+              std::string::npos);
+  }
+}
+
+static Value *parse_rhs(Parser &parser) {
+  CompoundStmt *c_stmt = dynamic_cast<CompoundStmt *>(parser.parse());
+  DefVarStmt *def = dynamic_cast<DefVarStmt *>(c_stmt->cur());
+  return dynamic_cast<ValueExpr *>(def->rhs)->val;
+}
+
+TEST(TestParser, TensorLiteral) {
+  Parser parser("./codes/code_3.pieck");
+  PackedTensorValue *tensor =
+      dynamic_cast<PackedTensorValue *>(parse_rhs(parser));
+  ASSERT_NE(tensor, nullptr);
+  int dims[2] = {2, 2};
+  EXPECT_TRUE(tensor->shape() == Shape(2, dims));
+  EXPECT_EQ(tensor->strides[0], 2);
+  EXPECT_EQ(tensor->strides[1], 1);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(tensor->data) %
+                PackedTensorValue::alignment,
+            0);
+  EXPECT_EQ(std::vector<double>(tensor->data, tensor->data + 4),
+            std::vector<double>({12, 3.5, .25, 4}));
+
+  Parser parser3d("in_memory", SourceBuffer::from_string(
+                                   "def x = [[[1], [-2]], [[3], [4]]];"));
+  tensor = dynamic_cast<PackedTensorValue *>(parse_rhs(parser3d));
+  int dims3d[3] = {2, 2, 1};
+  EXPECT_TRUE(tensor->shape() == Shape(3, dims3d));
+  EXPECT_EQ(tensor->num_of_elements(), 4);
+  EXPECT_EQ(tensor->data[1], -2);
+}
+
+TEST(TestParser, InhomogeneousTensorLiteral) {
+  for (const char *code :
+       {"def x = [[1, 2], [3]];", "def x = [[1, 2], 3];", "def x = [1, [2]];",
+        "def x = [[1], [[2]]];", "def x = [];", "def x = [1 2];"}) {
+    Parser parser("in_memory", SourceBuffer::from_string(code));
+    EXPECT_THROW(parser.parse(), std::logic_error) << code;
+  }
+}
+
+TEST(TestParser, PackTree) {
+  Arena arena;
+  ScalaValue *sv1 = arena.make<ScalaValue>("1.5");
+  ScalaValue *sv2 = arena.make<ScalaValue>("2");
+  Value *row[3] = {sv1, sv2, sv1};
+  TensorValue *tv1 = arena.make<TensorValue>(3, row);
+  Value *rows[2] = {tv1, tv1};
+  TensorValue *tv2 = arena.make<TensorValue>(2, rows);
+  PackedTensorValue *packed = PackedTensorValue::pack(arena, tv2);
+  EXPECT_TRUE(packed->shape() == tv2->shape());
+  EXPECT_EQ(std::vector<double>(packed->data, packed->data + 6),
+            std::vector<double>({1.5, 2, 1.5, 1.5, 2, 1.5}));
+}
+
+TEST(TestParser, TensorLiteralMemory) {
+  // 1000 x 100 elements take one buffer instead of 100000 objects
+  std::string code = "def x = [";
+  for (int i = 0; i < 1000; i++) {
+    code += i ? ", [" : "[";
+    for (int j = 0; j < 100; j++)
+      code += (j ? ", " : "") + std::to_string(i * 100 + j);
+    code += "]";
+  }
+  code += "];";
+  Parser parser("in_memory", SourceBuffer::from_string(code));
+  PackedTensorValue *tensor =
+      dynamic_cast<PackedTensorValue *>(parse_rhs(parser));
+  EXPECT_EQ(tensor->data[99999], 99999);
+  EXPECT_LT(parser.arena_stats().bytes_allocated, 100000 * 8 + 4096);
+  EXPECT_LT(parser.arena_stats().num_of_objects, 10);
+}
+
+TEST(TestParser, DeepShapeInference) {
+  // deep nesting is inferred without recursion
+  Arena arena;
+  const int depth = 3000;
+  Value *sub = arena.make<ScalaValue>("1");
+  for (int i = 0; i < depth; i++) {
+    Value **vals = arena.allocate_array<Value *>(1);
+    vals[0] = sub;
+    sub = arena.make<TensorValue>(1, vals);
+  }
+  EXPECT_EQ(sub->shape().dims_dim(), depth);
+  EXPECT_EQ(sub->shape()[depth - 1], 1);
+}
+
+TEST(TestParser, SharedShapeInference) {
+  // a sub-tensor shared 2^20 times is inferred once
+  Arena arena;
+  Value *sub = arena.make<ScalaValue>("1");
+  for (int i = 0; i < 20; i++) {
+    Value **vals = arena.allocate_array<Value *>(2);
+    vals[0] = vals[1] = sub;
+    sub = arena.make<TensorValue>(2, vals);
+  }
+  EXPECT_EQ(sub->shape().num_of_elements(), 1 << 20);
+
+  // an inhomogeneous last row, the rows before it are already inferred
+  Value *scala = arena.make<ScalaValue>("2");
+  Value *short_row[1] = {scala};
+  Value *rows[3] = {sub, sub, arena.make<TensorValue>(1, short_row)};
+  TensorValue *bad = arena.make<TensorValue>(3, rows);
+  EXPECT_THROW(bad->shape(), std::logic_error);
+  EXPECT_FALSE(bad->has_shape());
+}
+
+TEST(TestParser, Casting) {
+  Arena arena;
+  Scope scope;
+  Expr *one = arena.make<ValueExpr>(arena.make<ScalaValue>("1"));
+  Stmt *def = arena.make<DefVarStmt>(scope, "x", one);
+  EXPECT_TRUE(isa<DefVarStmt>(def));
+  EXPECT_TRUE(isa<DefStmt>(def));
+  EXPECT_TRUE(isa<Stmt>(def));
+  EXPECT_FALSE(isa<DefFuncStmt>(def));
+  EXPECT_EQ(dyn_cast<PrintStmt>(def), nullptr);
+  EXPECT_EQ(cast<DefStmt>(def)->identifier_name, "x");
+  EXPECT_THROW(cast<ReturnStmt>(def), std::logic_error);
+  const Expr *const_one = one;
+  const ValueExpr *value_expr = dyn_cast<ValueExpr>(const_one);
+  ASSERT_NE(value_expr, nullptr);
+  EXPECT_TRUE(isa<ScalaValue>(value_expr->val));
+  EXPECT_FALSE(isa<PackedTensorValue>(value_expr->val));
+  EXPECT_EQ(dyn_cast_or_null<VarExpr>(static_cast<Expr *>(nullptr)), nullptr);
+}
+
+namespace {
+// counts the nodes below a statement
+class NodeCounter : public ASTVisitor<NodeCounter, int> {
+public:
+  int visit_Stmt(Stmt *) { return 1; }
+  int visit_DefVarStmt(DefVarStmt *stmt) { return 1 + visit(stmt->rhs); }
+  int visit_PrintStmt(PrintStmt *stmt) { return 1 + visit(stmt->expr); }
+  int visit_BinaryOpExpr(BinaryOpExpr *expr) {
+    return 1 + visit(expr->lhs) + visit(expr->rhs);
+  }
+  int visit_ValueExpr(ValueExpr *expr) { return 1 + visit(expr->val); }
+  int visit_Expr(Expr *) { return 1; }
+  int visit_TensorValue(TensorValue *value) {
+    int n = 1;
+    for (int i = 0; i < value->dim; i++)
+      n += visit(value->vals[i]);
+    return n;
+  }
+  int visit_Value(Value *) { return 1; }
+};
+} // namespace
+
+TEST(TestParser, ASTVisitor) {
+  Arena arena;
+  Scope scope;
+  Value *one = arena.make<ScalaValue>("1");
+  Value *vals[2] = {one, one};
+  Expr *tensor = arena.make<ValueExpr>(arena.make<TensorValue>(2, vals));
+  Expr *sum = arena.make<BinaryOpExpr>(tensor, BinaryOpExpr::add,
+                                       arena.make<VarExpr>("y"));
+  NodeCounter counter;
+  // print: 1, +: 1, value expr: 1, tensor: 3, var: 1
+  EXPECT_EQ(counter.visit(arena.make<PrintStmt>(scope, sum)), 7);
+  EXPECT_EQ(counter.visit(arena.make<DefVarStmt>(scope, "x", tensor)), 5);
+  EXPECT_EQ(counter.visit(arena.make<ReturnStmt>(scope, sum)), 1);
+}
@@ -0,0 +1,75 @@
+#include "../include/Shape.h"
+#include <gtest/gtest.h>
+#include <thread>
+
+TEST(TestShape, Interning) {
+  int32_t dims_a[3] = {2, 3, 4};
+  int32_t dims_b[3] = {2, 3, 4};
+  int32_t dims_c[3] = {2, 4, 3};
+  Shape a(3, dims_a), b(3, dims_b), c(3, dims_c);
+  EXPECT_EQ(a.id(), b.id());
+  EXPECT_TRUE(a == b);
+  EXPECT_TRUE(a != c);
+  EXPECT_EQ(a[2], 4);
+  EXPECT_EQ(a.num_of_elements(), 24);
+  // uninitialized shapes are equal to nothing
+  EXPECT_FALSE(Shape() == Shape());
+  EXPECT_TRUE(Shape::scala() == Shape(0, nullptr));
+  EXPECT_EQ(Shape::scala().num_of_elements(), 1);
+  // the scala shape is not the shape (1)
+  int32_t one[1] = {1};
+  EXPECT_TRUE(Shape::scala() != Shape(1, one));
+}
+
+TEST(TestShape, LargeRanks) {
+  std::vector<int32_t> dims = {1, 2, 3, 4, 5, 6, 7, 8};
+  Shape large(8, dims.data());
+  std::vector<int32_t> copy = dims;
+  EXPECT_TRUE(large == Shape(8, copy.data()));
+  dims[7] = 9;
+  EXPECT_EQ(large[7], 8);
+  EXPECT_TRUE(large != Shape(8, dims.data()));
+  Shape prepended = Shape(7, copy.data() + 1).prepend(1);
+  EXPECT_TRUE(prepended == large);
+  EXPECT_EQ(std::vector<int32_t>(prepended.dims(), prepended.dims() + 8),
+            copy);
+}
+
+TEST(TestShape, Broadcast) {
+  int32_t matrix[2] = {2, 3}, row[1] = {3}, column[2] = {2, 1},
+          other[1] = {2};
+  EXPECT_EQ(Shape::broadcast(Shape(2, matrix), Shape(1, row)).str(),
+            "(2, 3)");
+  EXPECT_EQ(Shape::broadcast(Shape(1, row), Shape(2, column)).str(),
+            "(2, 3)");
+  EXPECT_EQ(Shape::broadcast(Shape::scala(), Shape(1, row)).str(), "(3)");
+  // the last dims are matched, 3 and 2 cannot be
+  EXPECT_TRUE(
+      Shape::broadcast(Shape(2, matrix), Shape(1, other)).unintialized());
+}
+
+TEST(TestShape, BoundedTable) {
+  int32_t dims[2] = {123, 456};
+  Shape(2, dims);
+  size_t size = ShapeTable::global().size();
+  for (int i = 0; i < 1000; i++)
+    Shape(2, dims);
+  EXPECT_EQ(ShapeTable::global().size(), size);
+}
+
+TEST(TestShape, ConcurrentInterning) {
+  std::vector<std::thread> threads;
+  std::vector<std::vector<ShapeID>> ids(4);
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([t, &ids]() {
+      for (int32_t i = 0; i < 500; i++) {
+        int32_t dims[2] = {7777, i};
+        ids[t].push_back(Shape(2, dims).id());
+      }
+    });
+  }
+  for (std::thread &thread : threads)
+    thread.join();
+  for (int t = 1; t < 4; t++)
+    EXPECT_EQ(ids[t], ids[0]);
+}
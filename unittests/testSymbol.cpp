@@ -0,0 +1,88 @@
+#include "../include/Parser.h"
+#include "../include/Scope.h"
+#include "../include/Symbol.h"
+#include "../include/ThreadPool.h"
+#include <gtest/gtest.h>
+
+TEST(TestSymbol, Interning) {
+  static_assert(sizeof(Symbol) == 4 && sizeof(Scope) == 4);
+  Symbol x("x"), y("y");
+  EXPECT_EQ(x, Symbol("x"));
+  EXPECT_NE(x, y);
+  EXPECT_EQ(x.str(), "x");
+  EXPECT_TRUE(x == "x");
+  EXPECT_FALSE(Symbol() == "x");
+  EXPECT_EQ(Symbol::from_id(y.id()), y);
+
+  // names are interned once, whichever thread comes first
+  ThreadPool pool(4);
+  std::vector<SymbolID> ids(4000);
+  pool.parallel_for(ids.size(), [&](size_t i) {
+    ids[i] = Symbol("name_" + std::to_string(i % 1000)).id();
+  });
+  for (size_t i = 0; i < ids.size(); i++) {
+    EXPECT_EQ(ids[i], ids[i % 1000]);
+    EXPECT_EQ(Symbol::from_id(ids[i]), "name_" + std::to_string(i % 1000));
+  }
+}
+
+TEST(TestSymbol, ScopeTree) {
+  Scope f, g, loop;
+  f.push("f");
+  g.push("g");
+  loop = f;
+  loop.push("for_1");
+  EXPECT_EQ(loop.names(), (std::vector<Symbol>{Symbol("f"), Symbol("for_1")}));
+  EXPECT_TRUE(loop <= f);
+  EXPECT_TRUE(loop <= Scope());
+  EXPECT_TRUE(f <= f);
+  EXPECT_FALSE(f <= loop);
+  EXPECT_FALSE(loop <= g);
+  // the same path of names is the same scope
+  Scope again;
+  again.push("f");
+  again.push("for_1");
+  EXPECT_EQ(again, loop);
+  again.pop();
+  EXPECT_EQ(again, f);
+
+  // a numbered tree is numbered again only once it grows
+  ScopeTree &tree = ScopeTree::global();
+  std::shared_ptr<const ScopeIntervals> intervals = tree.intervals();
+  EXPECT_EQ(tree.intervals(), intervals);
+  EXPECT_TRUE(intervals->contains(f.id(), loop.id()));
+  g.push("deeper");
+  // the intervals this thread took do not number the new scope yet
+  EXPECT_FALSE(g <= loop);
+  EXPECT_TRUE(g <= Scope());
+  EXPECT_NE(tree.intervals(), intervals);
+  EXPECT_EQ(tree.depth(g.id()), 2);
+  EXPECT_EQ(tree.name(g.id()), "deeper");
+}
+
+TEST(TestSymbol, DeepScopes) {
+  Scope scope;
+  std::vector<Scope> path;
+  for (int i = 0; i < 10000; i++) {
+    scope.push("level");
+    path.push_back(scope);
+  }
+  std::shared_ptr<const ScopeIntervals> intervals =
+      ScopeTree::global().intervals();
+  EXPECT_TRUE(intervals->contains(path[10].id(), path[9999].id()));
+  EXPECT_FALSE(intervals->contains(path[9999].id(), path[10].id()));
+  Scope sibling = path[10];
+  sibling.push("other");
+  EXPECT_FALSE(sibling <= path[11]);
+  EXPECT_TRUE(sibling <= path[10]);
+}
+
+TEST(TestSymbol, StmtsKeepIDs) {
+  Arena arena;
+  Scope scope;
+  scope.push("f");
+  DefVarStmt *def = arena.make<DefVarStmt>(scope, "x", nullptr);
+  EXPECT_EQ(def->identifier_name, Symbol("x"));
+  EXPECT_EQ(def->scope, scope);
+  EXPECT_EQ(arena.make<VarExpr>("x")->var_name, def->identifier_name);
+}
@@ -0,0 +1,40 @@
+#include "../include/ThreadPool.h"
+#include <atomic>
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+
+TEST(TestThreadPool, ParallelFor) {
+  ThreadPool pool(4);
+  std::vector<int> squares(1000);
+  pool.parallel_for(squares.size(), [&](size_t i) { squares[i] = i * i; });
+  for (size_t i = 0; i < squares.size(); i++)
+    EXPECT_EQ(squares[i], i * i);
+  pool.parallel_for(0, [](size_t) { FAIL(); });
+}
+
+TEST(TestThreadPool, FirstErrorIsThrown) {
+  ThreadPool pool(4);
+  std::atomic<size_t> done = 0;
+  try {
+    pool.parallel_for(100, [&](size_t i) {
+      done++;
+      if (i % 10 == 7)
+        throw std::logic_error(std::to_string(i));
+    });
+    FAIL();
+  } catch (const std::logic_error &e) {
+    EXPECT_EQ(std::string(e.what()), "7");
+  }
+  EXPECT_EQ(done, 100);
+}
+
+TEST(TestThreadPool, Nested) {
+  // the outer tasks keep every worker busy, the inner loops still finish
+  ThreadPool pool(2);
+  std::atomic<size_t> sum = 0;
+  pool.parallel_for(8, [&](size_t) {
+    pool.parallel_for(8, [&](size_t j) { sum += j; });
+  });
+  EXPECT_EQ(sum, 8 * 28);
+}
@@ -0,0 +1,110 @@
+#include "../include/TypeInference.h"
+#include "ASTBuilder.h"
+#include <gtest/gtest.h>
+
+namespace {
+std::string message(CompoundStmt *module) {
+  try {
+    TypeInference types(module);
+  } catch (std::logic_error &e) {
+    return e.what();
+  }
+  return "";
+}
+} // namespace
+
+TEST(TestTypeInference, Annotate) {
+  Builder b;
+  Expr *product = b.op(b.var("m"), BinaryOpExpr::matmul, b.tensor("[1, 1]"));
+  Expr *scaled = b.op(b.var("m"), BinaryOpExpr::mul, b.num("2"));
+  // the row is broadcast over the rows of m
+  Expr *shifted = b.op(b.var("m"), BinaryOpExpr::add, b.tensor("[1, 2]"));
+  Expr *log = b.call("log", {b.var("m")});
+  // id is called with a scalar and a tensor
+  Expr *arg = b.var("x");
+  Expr *by_scalar = b.call("id", {b.num("1")});
+  Expr *by_tensor = b.call("id", {product});
+  CompoundStmt *module = b.block({
+      b.func("log", {"t"}, {b.print(b.var("t"))}),
+      b.func("id", {"x"}, {b.ret(arg)}),
+      b.def("m", b.tensor("[[1, 2], [3, 4], [5, 6]]")),
+      b.print(scaled),
+      b.print(shifted),
+      b.print(log),
+      b.print(by_scalar),
+      b.print(by_tensor),
+  });
+  TypeInference types(module);
+
+  EXPECT_EQ(product->type(), tyFloat64);
+  EXPECT_EQ(product->shape().str(), "(3)");
+  EXPECT_EQ(scaled->shape().str(), "(3, 2)");
+  EXPECT_EQ(shifted->shape().str(), "(3, 2)");
+  EXPECT_EQ(log->type(), tyNone);
+  EXPECT_TRUE(log->shape().unintialized());
+  EXPECT_EQ(by_scalar->shape().str(), "()");
+  EXPECT_EQ(by_tensor->shape().str(), "(3)");
+  // x has a shape per specialization of id
+  EXPECT_EQ(arg->type(), tyFloat64);
+  EXPECT_TRUE(arg->shape().unintialized());
+  ASSERT_EQ(types.specs.size(), 4u);
+  std::vector<std::string> shapes;
+  for (const Specialization &spec : types.specs) {
+    if (types.name_of(spec) == "id")
+      shapes.push_back(types.shape_of(spec, arg).shape.str());
+  }
+  EXPECT_EQ(shapes, std::vector<std::string>({"()", "(3)"}));
+}
+
+TEST(TestTypeInference, Recursion) {
+  Builder b;
+  CompoundStmt *module = b.block({
+      b.func("even", {"n"}, {b.ret(b.call("odd", {b.var("n")}))}),
+      b.func("odd", {"n"}, {b.ret(b.call("even", {b.var("n")}))}),
+      b.func("twice", {"n"}, {b.ret(b.op(b.var("n"), BinaryOpExpr::mul,
+                                         b.num("2")))}),
+      b.def("a", b.call("twice", {b.num("1")})),
+      b.def("b", b.call("twice", {b.tensor("[1, 2]")})),
+      b.def("c", b.call("even", {b.num("1")})),
+  });
+  TypeInference types(module);
+  std::vector<std::string> recursive;
+  for (const Specialization &spec : types.specs) {
+    if (spec.recursive)
+      recursive.push_back(types.name_of(spec));
+  }
+  EXPECT_EQ(recursive, std::vector<std::string>({"even", "odd"}));
+  // even never returns, so the shape of c is not known
+  EXPECT_FALSE(types.specs[0].shapes.at(Symbol("c").id()).known());
+  EXPECT_EQ(types.specs[0].shapes.at(Symbol("b").id()).shape.str(), "(2)");
+}
+
+TEST(TestTypeInference, Errors) {
+  Builder b;
+  // the error is in a function that is only called with these shapes
+  EXPECT_EQ(message(b.block({
+                b.func("add", {"x", "y"},
+                       {b.ret(b.op(b.var("x"), BinaryOpExpr::add,
+                                   b.var("y")))}),
+                b.print(b.call("add", {b.num("1"), b.tensor("[1, 2]")})),
+                b.print(b.call("add",
+                               {b.tensor("[1, 2, 3]"), b.tensor("[1, 2]")})),
+            })),
+            "Cannot apply + to tensors of shapes (3) and (2)");
+  EXPECT_EQ(message(b.block({
+                b.def("m", b.tensor("[[1, 2], [3, 4]]")),
+                b.print(b.op(b.var("m"), BinaryOpExpr::matmul,
+                             b.tensor("[1, 2, 3]"))),
+            })),
+            "Cannot apply @ to tensors of shapes (2, 2) and (3)");
+  EXPECT_EQ(message(b.block({
+                b.func("f", {}, {b.ret(b.num("1")), b.ret(b.tensor("[1]"))}),
+                b.print(b.call("f", {})),
+            })),
+            "f returns both a scalar and a tensor of shape (1)");
+  // a function that is never called is not checked
+  EXPECT_EQ(message(b.block({
+                b.func("f", {}, {b.print(b.var("undefined"))}),
+            })),
+            "");
+}
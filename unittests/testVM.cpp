@@ -0,0 +1,328 @@
+#include "../include/Compiler.h"
+#include "../include/VM.h"
+#include "ASTBuilder.h"
+#include <gtest/gtest.h>
+#include <sstream>
+
+namespace {
+std::string run(Arena &arena, CompoundStmt *module) {
+  std::ostringstream out;
+  VM(out).run(Compiler::compile(module, arena));
+  return out.str();
+}
+} // namespace
+
+TEST(TestVM, Arithmetic) {
+  Builder b;
+  CompoundStmt *module = b.block({
+      b.def("x", b.num("1")),
+      b.def("y", b.op(b.var("x"), BinaryOpExpr::add,
+                      b.op(b.num("2"), BinaryOpExpr::mul, b.num("3")))),
+      b.print(b.var("y")),
+      b.def("m", b.tensor("[[1, 2], [3, 4]]")),
+      b.print(b.op(b.var("m"), BinaryOpExpr::matmul, b.var("m"))),
+      b.print(b.op(b.var("m"), BinaryOpExpr::div, b.num("2"))),
+      b.print(b.op(b.tensor("[1, 2]"), BinaryOpExpr::matmul,
+                   b.tensor("[3, 4]"))),
+      b.print(b.op(b.tensor("[1, 1]"), BinaryOpExpr::matmul, b.var("m"))),
+  });
+  EXPECT_EQ(run(b.arena, module), "7\n"
+                         "[[7, 10], [15, 22]]\n"
+                         "[[0.5, 1], [1.5, 2]]\n"
+                         "11\n"
+                         "[4, 6]\n");
+}
+
+TEST(TestVM, Loops) {
+  Builder b;
+  CompoundStmt *module = b.block({
+      b.def("s", b.num("0")),
+      b.loop("i", b.tensor("[1, 2, 3, 4]"),
+             {b.def("s", b.op(b.var("s"), BinaryOpExpr::add, b.var("i")))}),
+      b.print(b.var("s")),
+      b.def("x", b.tensor("[[1, 2], [3, 4]]")),
+      b.def("t", b.tensor("[0, 0]")),
+      b.loop("row", b.var("x"),
+             {b.def("t", b.op(b.var("t"), BinaryOpExpr::add, b.var("row")))}),
+      b.print(b.var("t")),
+  });
+  Program program = Compiler::compile(module, b.arena);
+  // s and i are known to be scalars
+  EXPECT_NE(program.disassemble().find("add_ss"), std::string::npos);
+  std::ostringstream out;
+  VM(out).run(program);
+  EXPECT_EQ(out.str(), "10\n[4, 6]\n");
+}
+
+TEST(TestVM, References) {
+  Builder b;
+  CompoundStmt *module = b.block({
+      b.def("x", b.tensor("[[1, 2], [3, 4]]")),
+      // by value, x is left alone
+      b.loop("row", b.var("x"),
+             {b.def("row", b.op(b.var("row"), BinaryOpExpr::mul,
+                                b.num("0")))}),
+      b.print(b.var("x")),
+      b.loop("row", b.var("x"),
+             {b.def("row",
+                    b.op(b.var("row"), BinaryOpExpr::mul, b.num("10")))},
+             true),
+      b.print(b.var("x")),
+  });
+  EXPECT_EQ(run(b.arena, module), "[[1, 2], [3, 4]]\n[[10, 20], [30, 40]]\n");
+
+  // the constant of a literal is not written through a reference
+  Builder c;
+  module = c.block({
+      c.func("g", {},
+             {c.def("v", c.tensor("[1, 2]")),
+              c.loop("e", c.var("v"),
+                     {c.def("e", c.op(c.var("e"), BinaryOpExpr::add,
+                                      c.num("1")))},
+                     true),
+              c.ret(c.var("v"))}),
+      c.print(c.call("g", {})),
+      c.print(c.call("g", {})),
+  });
+  EXPECT_EQ(run(c.arena, module), "[2, 3]\n[2, 3]\n");
+}
+
+TEST(TestVM, Views) {
+  Builder b;
+  using S = IndexExpr::Subscript;
+  CompoundStmt *module = b.block({
+      b.def("x", b.tensor("[[1, 2, 3], [4, 5, 6]]")),
+      b.print(b.index(b.index(b.var("x"), {S::index(b.num("0"))}),
+                      {S::range(nullptr, b.num("2"))})),
+      // a column, and an element read with an index computed at runtime
+      b.print(b.index(b.var("x"), {S::range(nullptr, nullptr),
+                                   S::index(b.num("1"))})),
+      b.def("i", b.num("1")),
+      b.print(b.index(b.var("x"), {S::index(b.var("i")),
+                                   S::index(b.num("2"))})),
+      b.def("s", b.num("0")),
+      b.loop("e", b.index(b.var("x"), {S::range(b.num("1"), b.num("2"))}),
+             {b.def("s", b.op(b.var("s"), BinaryOpExpr::add,
+                              b.op(b.var("e"), BinaryOpExpr::matmul,
+                                   b.tensor("[1, 1, 1]"))))}),
+      b.print(b.var("s")),
+      // loops by reference write into x through the views
+      b.loop("e", b.index(b.var("x"), {S::index(b.num("1"))}),
+             {b.def("e", b.op(b.var("e"), BinaryOpExpr::add, b.num("1")))},
+             true),
+      b.loop("e", b.index(b.var("x"), {S::range(nullptr, nullptr),
+                                       S::index(b.num("0"))}),
+             {b.def("e", b.num("0"))}, true),
+      b.print(b.var("x")),
+      // but not into the values that share its elements
+      b.def("y", b.index(b.var("x"), {S::index(b.num("0"))})),
+      b.loop("e", b.var("y"), {b.def("e", b.num("9"))}, true),
+      b.loop("row", b.var("x"),
+             {b.loop("e", b.var("row"), {b.def("e", b.num("7"))}, true)}),
+      b.print(b.var("y")),
+      b.print(b.var("x")),
+  });
+  EXPECT_EQ(run(b.arena, module), "[1, 2]\n"
+                         "[2, 5]\n"
+                         "6\n"
+                         "15\n"
+                         "[[0, 2, 3], [0, 6, 7]]\n"
+                         "[9, 9, 9]\n"
+                         "[[0, 2, 3], [0, 6, 7]]\n");
+}
+
+TEST(TestVM, Broadcast) {
+  Builder b;
+  using S = IndexExpr::Subscript;
+  CompoundStmt *module = b.block({
+      b.def("m", b.tensor("[[1, 2, 3], [4, 5, 6]]")),
+      b.def("bias", b.tensor("[10, 20, 30]")),
+      b.print(b.op(b.var("m"), BinaryOpExpr::add, b.var("bias"))),
+      b.print(b.op(b.tensor("[[1], [2]]"), BinaryOpExpr::mul,
+                   b.var("bias"))),
+      b.print(b.op(b.op(b.var("bias"), BinaryOpExpr::sub,
+                        b.op(b.var("m"), BinaryOpExpr::mul, b.num("2"))),
+                   BinaryOpExpr::add, b.num("1"))),
+      b.loop("row", b.var("m"),
+             {b.def("row", b.op(b.var("row"), BinaryOpExpr::add,
+                                b.var("bias")))},
+             true),
+      b.print(b.var("m")),
+      b.print(b.op(b.index(b.var("m"), {S::range(nullptr, nullptr),
+                                        S::range(nullptr, b.num("2"))}),
+                   BinaryOpExpr::add, b.tensor("[[1], [2]]"))),
+  });
+  const std::string expected = "[[11, 22, 33], [14, 25, 36]]\n"
+                               "[[10, 20, 30], [20, 40, 60]]\n"
+                               "[[9, 17, 25], [3, 11, 19]]\n"
+                               "[[11, 22, 33], [14, 25, 36]]\n"
+                               "[[12, 23], [16, 27]]\n";
+  EXPECT_EQ(run(b.arena, module), expected);
+}
+
+TEST(TestVM, Transpose) {
+  Builder b;
+  using S = IndexExpr::Subscript;
+  BinaryOpExpr::OP matmul = BinaryOpExpr::matmul, add = BinaryOpExpr::add;
+  CompoundStmt *module = b.block({
+      b.def("x", b.tensor("[[1, 2, 3], [4, 5, 6]]")),
+      b.def("a", b.tensor("[[1, 1], [0, 1]]")),
+      b.def("y", b.tensor("[[10, 20], [30, 40], [50, 60]]")),
+      b.print(b.transpose(b.var("x"))),
+      b.print(b.op(b.transpose(b.var("x")), matmul, b.var("a"))),
+      b.print(b.op(b.var("x"), matmul, b.transpose(b.var("x")))),
+      b.print(b.op(b.transpose(b.var("x")), matmul,
+                   b.transpose(b.var("y")))),
+      b.print(b.op(b.transpose(b.var("x")), matmul, b.tensor("[1, 1]"))),
+      b.print(b.op(b.tensor("[1, 1, 1]"), matmul, b.transpose(b.var("x")))),
+      b.print(b.op(b.transpose(b.var("x")), add, b.var("y"))),
+      b.print(b.index(b.transpose(b.var("x")), {S::index(b.num("0"))})),
+      b.def("acc", b.tensor("[0, 0]")),
+      b.loop("r", b.transpose(b.var("x")),
+             {b.def("acc", b.op(b.var("acc"), add, b.var("r")))}),
+      b.print(b.var("acc")),
+      b.def("s", b.num("2")),
+      b.print(b.transpose(b.var("s"))),
+      b.print(b.transpose(b.tensor("[1, 2]"))),
+      // every element of sq is read before it is written
+      b.def("sq", b.tensor("[[1, 2], [3, 4]]")),
+      b.def("sq", b.op(b.transpose(b.var("sq")), add, b.var("sq"))),
+      b.print(b.var("sq")),
+      b.func("f", {"m"}, {b.ret(b.op(b.transpose(b.var("m")), add,
+                                     b.num("1")))}),
+      b.def("t", b.tensor("[[1, 2], [3, 4]]")),
+      b.def("t", b.call("f", {b.var("t")})),
+      b.print(b.var("t")),
+      // strided operands of scalar ops are read in place too
+      b.print(b.op(b.num("7"), BinaryOpExpr::sub, b.transpose(b.var("x")))),
+      b.print(b.op(b.index(b.var("x"), {S::range(nullptr, nullptr),
+                                        S::index(b.num("1"))}),
+                   BinaryOpExpr::mul, b.num("10"))),
+  });
+  const std::string expected = "[[1, 4], [2, 5], [3, 6]]\n"
+                               "[[1, 5], [2, 7], [3, 9]]\n"
+                               "[[14, 32], [32, 77]]\n"
+                               "[[90, 190, 290], [120, 260, 400], "
+                               "[150, 330, 510]]\n"
+                               "[5, 7, 9]\n"
+                               "[6, 15]\n"
+                               "[[11, 24], [32, 45], [53, 66]]\n"
+                               "[1, 4]\n"
+                               "[6, 15]\n"
+                               "2\n"
+                               "[1, 2]\n"
+                               "[[2, 5], [5, 8]]\n"
+                               "[[2, 4], [3, 5]]\n"
+                               "[[6, 3], [5, 2], [4, 1]]\n"
+                               "[20, 50]\n";
+  EXPECT_EQ(run(b.arena, module), expected);
+}
+
+TEST(TestVM, Calls) {
+  Builder b;
+  CompoundStmt *module = b.block({
+      // called before its definition, reads the global scale
+      b.print(b.call("axpy", {b.tensor("[1, 2]"), b.num("1")})),
+      b.func("axpy", {"x", "y"},
+             {b.def("z", b.op(b.var("x"), BinaryOpExpr::mul, b.var("scale"))),
+              b.ret(b.op(b.var("z"), BinaryOpExpr::add, b.var("y")))}),
+      b.def("scale", b.num("3")),
+      b.print(b.call("axpy", {b.var("scale"), b.num("1")})),
+      b.func("nothing", {}, {}),
+      b.print(b.call("nothing", {})),
+  });
+  // the first call runs before scale is assigned
+  EXPECT_THROW(run(b.arena, module), std::logic_error);
+
+  Builder c;
+  module = c.block({
+      c.func("axpy", {"x", "y"},
+             {c.ret(c.op(c.op(c.var("x"), BinaryOpExpr::mul, c.var("scale")),
+                         BinaryOpExpr::add, c.var("y")))}),
+      c.def("scale", c.num("3")),
+      c.print(c.call("axpy", {c.tensor("[1, 2]"), c.num("1")})),
+      c.print(c.call("axpy", {c.var("scale"), c.num("1")})),
+      c.func("nothing", {}, {}),
+      c.print(c.call("nothing", {})),
+  });
+  EXPECT_EQ(run(c.arena, module), "[4, 7]\n10\nnone\n");
+}
+
+TEST(TestVM, Fusion) {
+  Builder b;
+  CompoundStmt *module = b.block({
+      b.def("x", b.tensor("[[1, 2], [3, 4]]")),
+      b.def("y", b.tensor("[[1, 0], [0, 1]]")),
+      b.def("s", b.num("2")),
+      b.print(b.op(b.op(b.var("x"), BinaryOpExpr::mul, b.var("x")),
+                   BinaryOpExpr::sub,
+                   b.op(b.op(b.var("x"), BinaryOpExpr::matmul, b.var("y")),
+                        BinaryOpExpr::div, b.var("s")))),
+      b.print(b.op(b.op(b.var("s"), BinaryOpExpr::mul, b.var("s")),
+                   BinaryOpExpr::add, b.num("1"))),
+  });
+  Program program = Compiler::compile(module, b.arena);
+  std::string code = program.disassemble();
+  EXPECT_NE(code.find("fused"), std::string::npos);
+  EXPECT_NE(code.find("((in0 * in0) - (in1 / in2))"), std::string::npos);
+  // s * s + 1 is known to be a scalar
+  EXPECT_EQ(program.fusions.size(), 1u);
+  std::ostringstream out;
+  VM(out).run(program);
+  EXPECT_EQ(out.str(), "[[0.5, 3], [7.5, 14]]\n5\n");
+
+  // the kinds of parameters are only known when the function runs
+  Builder c;
+  module = c.block({
+      c.func("f", {"a", "b"},
+             {c.ret(c.op(c.op(c.var("a"), BinaryOpExpr::add, c.var("b")),
+                         BinaryOpExpr::mul, c.var("a")))}),
+      c.print(c.call("f", {c.num("2"), c.num("3")})),
+      c.print(c.call("f", {c.tensor("[1, 2]"), c.num("1")})),
+      c.print(c.call("f", {c.tensor("[1, 2]"), c.tensor("[1, 2, 3]")})),
+  });
+  std::ostringstream log;
+  EXPECT_THROW(VM(log).run(Compiler::compile(module, c.arena)),
+               std::logic_error);
+  EXPECT_EQ(log.str(), "10\n[2, 6]\n");
+}
+
+TEST(TestVM, Errors) {
+  Builder b;
+  auto message = [&](CompoundStmt *module) {
+    try {
+      run(b.arena, module);
+    } catch (std::logic_error &e) {
+      return std::string(e.what());
+    }
+    return std::string();
+  };
+  EXPECT_EQ(message(b.block({b.print(b.var("x"))})), "x is not defined");
+  EXPECT_EQ(message(b.block({b.print(b.call("f", {}))})), "f is not defined");
+  EXPECT_EQ(message(b.block({b.func("f", {"a"}, {}),
+                             b.print(b.call("f", {}))})),
+            "f expects 1 arguments but receives 0");
+  EXPECT_EQ(message(b.block({b.print(b.op(b.tensor("[1, 2]"),
+                                          BinaryOpExpr::add,
+                                          b.tensor("[1, 2, 3]")))})),
+            "In the top level: Cannot apply + to tensors of shapes (2) and "
+            "(3)");
+  // a fused tree fails as its first op would
+  EXPECT_EQ(message(b.block({b.print(b.op(
+                b.op(b.tensor("[1, 2]"), BinaryOpExpr::mul, b.num("2")),
+                BinaryOpExpr::sub, b.tensor("[[1, 2, 3]]")))})),
+            "In the top level: Cannot apply - to tensors of shapes (2) and "
+            "(1, 3)");
+  EXPECT_EQ(message(b.block({b.func("f", {}, {b.ret(b.call("f", {}))}),
+                             b.print(b.call("f", {}))})),
+            "In f: The calls are nested too deeply");
+  EXPECT_EQ(message(b.block({b.loop("i", b.num("1"), {})})),
+            "In the top level: Cannot loop over a scalar");
+  using S = IndexExpr::Subscript;
+  EXPECT_EQ(message(b.block({b.print(
+                b.index(b.tensor("[1, 2]"), {S::index(b.num("2"))}))})),
+            "In the top level: The index 2 is out of range for a dim of 2");
+  EXPECT_EQ(message(b.block({b.print(b.index(
+                b.tensor("[1, 2]"), {S::range(b.num("2"), b.num("1"))}))})),
+            "In the top level: The range 2~1 ends before it begins");
+}